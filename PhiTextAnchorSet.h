@@ -0,0 +1,94 @@
+//
+//  PhiTextAnchorSet.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class PhiTextAnchorSet;
+
+typedef enum {
+	/*! Stays before text inserted at the anchor, and moves to the start of a replacement that covers it. */
+	PhiTextAnchorStickyBackward,
+	/*! Moves after text inserted at the anchor, and to the end of a replacement that covers it. */
+	PhiTextAnchorStickyForward,
+} PhiTextAnchorStickiness;
+
+typedef struct {
+	/*! Number of edits applied to the anchors (see textDidReplaceCharactersInRange:withLength:). */
+	NSUInteger edits;
+	/*! Number of anchors that were inside a replaced range, and so were collapsed to one of its ends. */
+	NSUInteger anchorsCollapsed;
+	/*! Number of anchors added (or moved by setLocation:). */
+	NSUInteger insertions;
+	/*! Number of anchors removed (or moved by setLocation:). */
+	NSUInteger removals;
+	/*! Total time spent applying edits (in seconds). */
+	double updateTime;
+	/*! Longest time spent applying a single edit (in seconds). */
+	double maxUpdateTime;
+} PhiTextAnchorStatistics;
+
+typedef struct PhiTextAnchorNode PhiTextAnchorNode;
+
+/*!
+ A location in a text that follows the edits of the text. An anchor belongs to the set that made it
+ and is removed from the set when it is deallocated; if the set is deallocated first, its location
+ becomes NSNotFound.
+ */
+@interface PhiTextAnchor : NSObject {
+@private
+	PhiTextAnchorSet *anchorSet;
+	PhiTextAnchorNode *node;
+	PhiTextAnchorStickiness stickiness;
+}
+
+/*! The set that keeps the receiver up to date, or nil if the set was deallocated. */
+@property (nonatomic, readonly) PhiTextAnchorSet *anchorSet;
+/*! The offset of the receiver in the text; found in logarithmic time, by summing the relative offsets from its node to the root. */
+@property (nonatomic) NSUInteger location;
+@property (nonatomic, readonly) PhiTextAnchorStickiness stickiness;
+
+@end
+
+/*!
+ The anchors of a text, kept in a treap (a randomly balanced binary search tree) in which each node
+ holds its offset relative to its parent. An edit splits the tree around the replaced range, collapses
+ the anchors inside it to its ends and shifts every anchor after it by changing a single offset, then
+ joins the pieces; so that it takes O(log n + k) time for n anchors, k of which were inside the range.
+ The set is thread safe, but is meant to be edited on the main thread, by the owner of the text.
+ */
+@interface PhiTextAnchorSet : NSObject {
+@private
+	PhiTextAnchorNode *root;
+	NSUInteger count;
+	PhiTextAnchorStatistics statistics;
+}
+
+/*! Number of anchors in the receiver. */
+@property (readonly) NSUInteger count;
+
+/*! Returns a new anchor (with a retain count of one, that the caller must release) at location. */
+- (PhiTextAnchor *)newAnchorAtLocation:(NSUInteger)location stickiness:(PhiTextAnchorStickiness)stickiness;
+
+/*! Moves the anchors for the replacement of the characters in range (in the coordinates before the edit) with length characters. */
+- (void)textDidReplaceCharactersInRange:(NSRange)range withLength:(NSUInteger)length;
+
+- (PhiTextAnchorStatistics)statistics;
+- (void)resetStatistics;
+
+@end
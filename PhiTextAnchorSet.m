@@ -0,0 +1,340 @@
+//
+//  PhiTextAnchorSet.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextAnchorSet.h"
+
+struct PhiTextAnchorNode {
+	PhiTextAnchorNode *left;
+	PhiTextAnchorNode *right;
+	PhiTextAnchorNode *parent;
+	/*! The location of the anchor, relative to the location of the parent (or absolute, at a root). */
+	NSInteger offset;
+	/*! Every node has a higher priority than its children. */
+	uint32_t priority;
+	PhiTextAnchorStickiness stickiness;
+	/*! Not retained; the anchor frees its node when it is deallocated. */
+	PhiTextAnchor *anchor;
+};
+
+/*! Joins two trees, whose roots' offsets are relative to the same location, and every anchor of a precedes every anchor of b. */
+static PhiTextAnchorNode *PhiAnchorMerge(PhiTextAnchorNode *a, PhiTextAnchorNode *b) {
+	PhiTextAnchorNode *child;
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (a->priority > b->priority) {
+		b->offset -= a->offset;
+		child = PhiAnchorMerge(a->right, b);
+		child->parent = a;
+		a->right = child;
+		return a;
+	} else {
+		a->offset -= b->offset;
+		child = PhiAnchorMerge(a, b->left);
+		child->parent = b;
+		b->left = child;
+		return b;
+	}
+}
+
+/*! Divides a tree (whose root's offset is relative to the same location as key) into the anchors before key (or at key, if inclusive) and the rest. */
+static void PhiAnchorSplit(PhiTextAnchorNode *node, NSInteger key, BOOL inclusive, PhiTextAnchorNode **before, PhiTextAnchorNode **after) {
+	PhiTextAnchorNode *low, *high;
+	if (!node) {
+		*before = *after = NULL;
+		return;
+	}
+	node->parent = NULL;
+	if (node->offset < key || (inclusive && node->offset == key)) {
+		PhiAnchorSplit(node->right, key - node->offset, inclusive, &low, &high);
+		if (high)
+			high->offset += node->offset;
+		node->right = low;
+		if (low)
+			low->parent = node;
+		*before = node;
+		*after = high;
+	} else {
+		PhiAnchorSplit(node->left, key - node->offset, inclusive, &low, &high);
+		if (low)
+			low->offset += node->offset;
+		node->left = high;
+		if (high)
+			high->parent = node;
+		*before = low;
+		*after = node;
+	}
+}
+
+static NSInteger PhiAnchorLocation(PhiTextAnchorNode *node) {
+	NSInteger location = 0;
+	while (node) {
+		location += node->offset;
+		node = node->parent;
+	}
+	return location;
+}
+
+/*! The anchors of a replaced range, regrouped by the end of the replacement they were collapsed to. */
+typedef struct {
+	NSInteger location;
+	NSInteger oldEnd;
+	NSInteger newEnd;
+	PhiTextAnchorNode *atLocation;
+	PhiTextAnchorNode *atNewEnd;
+	NSUInteger count;
+} PhiTextAnchorCollapse;
+
+/*! Visits every node of a tree in order, reading its children before they are cleared; the order within each group must not depend on the priorities (e.g. a post-order visit would append the nodes in ascending priority and degenerate each group into a list). */
+static void PhiAnchorCollapse(PhiTextAnchorNode *node, NSInteger base, PhiTextAnchorCollapse *collapse) {
+	PhiTextAnchorNode *left, *right;
+	NSInteger location, destination;
+	if (!node)
+		return;
+	location = base + node->offset;
+	left = node->left;
+	right = node->right;
+	PhiAnchorCollapse(left, location, collapse);
+	node->left = node->right = node->parent = NULL;
+	collapse->count++;
+	// An anchor at either end of a replaced range stays at that end; one inside it moves by its stickiness
+	if (collapse->oldEnd > collapse->location && location == collapse->location)
+		destination = collapse->location;
+	else if (collapse->oldEnd > collapse->location && location == collapse->oldEnd)
+		destination = collapse->newEnd;
+	else
+		destination = node->stickiness == PhiTextAnchorStickyForward ? collapse->newEnd : collapse->location;
+	node->offset = destination;
+	if (destination == collapse->location)
+		collapse->atLocation = PhiAnchorMerge(collapse->atLocation, node);
+	else
+		collapse->atNewEnd = PhiAnchorMerge(collapse->atNewEnd, node);
+	PhiAnchorCollapse(right, location, collapse);
+}
+
+static void PhiAnchorFree(PhiTextAnchorNode *node);
+
+@interface PhiTextAnchor (PhiTextAnchorSet)
+
+- (id)initWithAnchorSet:(PhiTextAnchorSet *)set node:(PhiTextAnchorNode *)node;
+- (void)detachFromAnchorSet;
+
+@end
+
+@interface PhiTextAnchorSet ()
+
+- (NSUInteger)locationOfNode:(PhiTextAnchorNode *)node;
+- (void)insertNode:(PhiTextAnchorNode *)node atLocation:(NSUInteger)location;
+- (void)removeNode:(PhiTextAnchorNode *)node;
+
+@end
+
+@implementation PhiTextAnchor
+
+@synthesize anchorSet, stickiness;
+
+- (id)initWithAnchorSet:(PhiTextAnchorSet *)set node:(PhiTextAnchorNode *)aNode {
+	if (self = [super init]) {
+		anchorSet = set;
+		node = aNode;
+		node->anchor = self;
+		stickiness = node->stickiness;
+	}
+	return self;
+}
+
+- (void)detachFromAnchorSet {
+	anchorSet = nil;
+	node = NULL;
+}
+
+- (NSUInteger)location {
+	PhiTextAnchorSet *set = anchorSet;
+	if (!set)
+		return NSNotFound;
+	return [set locationOfNode:node];
+}
+
+- (void)setLocation:(NSUInteger)location {
+	PhiTextAnchorSet *set = anchorSet;
+	if (set) {
+		@synchronized(set) {
+			[set removeNode:node];
+			[set insertNode:node atLocation:location];
+		}
+	}
+}
+
+- (NSString *)description {
+	return [NSString stringWithFormat:@"<%@: 0x%x; location = %u; %s>",
+			NSStringFromClass([self class]), self, [self location],
+			stickiness == PhiTextAnchorStickyForward ? "forward" : "backward"];
+}
+
+- (void)dealloc {
+	PhiTextAnchorSet *set = anchorSet;
+	if (set) {
+		@synchronized(set) {
+			[set removeNode:node];
+		}
+		free(node);
+	}
+	[super dealloc];
+}
+
+@end
+
+@implementation PhiTextAnchorSet
+
+- (id)init {
+	if (self = [super init]) {
+		root = NULL;
+		count = 0;
+		memset(&statistics, 0, sizeof(statistics));
+	}
+	return self;
+}
+
+- (NSUInteger)count {
+	NSUInteger rv;
+	@synchronized(self) {
+		rv = count;
+	}
+	return rv;
+}
+
+- (PhiTextAnchor *)newAnchorAtLocation:(NSUInteger)location stickiness:(PhiTextAnchorStickiness)stickiness {
+	PhiTextAnchorNode *node = calloc(1, sizeof(PhiTextAnchorNode));
+	node->stickiness = stickiness;
+	node->priority = arc4random();
+	@synchronized(self) {
+		[self insertNode:node atLocation:location];
+	}
+	return [[PhiTextAnchor alloc] initWithAnchorSet:self node:node];
+}
+
+- (NSUInteger)locationOfNode:(PhiTextAnchorNode *)node {
+	NSUInteger rv;
+	@synchronized(self) {
+		rv = PhiAnchorLocation(node);
+	}
+	return rv;
+}
+
+- (void)insertNode:(PhiTextAnchorNode *)node atLocation:(NSUInteger)location {
+	PhiTextAnchorNode *before, *after;
+	PhiAnchorSplit(root, location, NO, &before, &after);
+	node->left = node->right = NULL;
+	node->offset = location;
+	root = PhiAnchorMerge(PhiAnchorMerge(before, node), after);
+	root->parent = NULL;
+	count++;
+	statistics.insertions++;
+}
+
+- (void)removeNode:(PhiTextAnchorNode *)node {
+	PhiTextAnchorNode *parent = node->parent;
+	// The children's offsets are both relative to node, so they may be joined as they are
+	PhiTextAnchorNode *child = PhiAnchorMerge(node->left, node->right);
+	if (child) {
+		child->offset += node->offset;
+		child->parent = parent;
+	}
+	if (!parent)
+		root = child;
+	else if (parent->left == node)
+		parent->left = child;
+	else
+		parent->right = child;
+	node->left = node->right = node->parent = NULL;
+	count--;
+	statistics.removals++;
+}
+
+- (void)textDidReplaceCharactersInRange:(NSRange)range withLength:(NSUInteger)length {
+	PhiTextAnchorNode *before, *inside, *after;
+	PhiTextAnchorCollapse collapse;
+	CFAbsoluteTime start, time;
+	@synchronized(self) {
+		if (!root)
+			return;
+		start = CFAbsoluteTimeGetCurrent();
+		PhiAnchorSplit(root, range.location, NO, &before, &after);
+		PhiAnchorSplit(after, NSMaxRange(range), YES, &inside, &after);
+		// Every anchor after the range moves with the root of its subtree
+		if (after)
+			after->offset += (NSInteger)length - (NSInteger)range.length;
+		memset(&collapse, 0, sizeof(collapse));
+		collapse.location = range.location;
+		collapse.oldEnd = NSMaxRange(range);
+		collapse.newEnd = range.location + length;
+		PhiAnchorCollapse(inside, 0, &collapse);
+		root = PhiAnchorMerge(PhiAnchorMerge(before, collapse.atLocation), PhiAnchorMerge(collapse.atNewEnd, after));
+		if (root)
+			root->parent = NULL;
+		time = CFAbsoluteTimeGetCurrent() - start;
+		statistics.edits++;
+		statistics.anchorsCollapsed += collapse.count;
+		statistics.updateTime += time;
+		if (time > statistics.maxUpdateTime)
+			statistics.maxUpdateTime = time;
+	}
+}
+
+- (PhiTextAnchorStatistics)statistics {
+	PhiTextAnchorStatistics rv;
+	@synchronized(self) {
+		rv = statistics;
+	}
+	return rv;
+}
+
+- (void)resetStatistics {
+	@synchronized(self) {
+		memset(&statistics, 0, sizeof(statistics));
+	}
+}
+
+- (NSString *)description {
+	PhiTextAnchorStatistics stats = [self statistics];
+	return [NSString stringWithFormat:@"<%@: 0x%x; %u anchors; %u edits (%.3fs, max %.3fs); %u collapsed>",
+			NSStringFromClass([self class]), self, [self count],
+			stats.edits, stats.updateTime, stats.maxUpdateTime, stats.anchorsCollapsed];
+}
+
+- (void)dealloc {
+	@synchronized(self) {
+		PhiAnchorFree(root);
+		root = NULL;
+	}
+	[super dealloc];
+}
+
+@end
+
+/*! Detaches the anchors of a tree from their set; the nodes themselves are freed. */
+static void PhiAnchorFree(PhiTextAnchorNode *node) {
+	if (node) {
+		PhiAnchorFree(node->left);
+		PhiAnchorFree(node->right);
+		[node->anchor detachFromAnchorSet];
+		free(node);
+	}
+}
@@ -0,0 +1,104 @@
+//
+//  PhiTextBoundaryCache.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/*! Number of characters whose boundaries are found (and cached) as a unit. */
+#ifndef PHI_BOUNDARY_CHUNK_LENGTH
+#define PHI_BOUNDARY_CHUNK_LENGTH 1024
+#endif
+/*! Maximum number of chunks cached; the chunk farthest from the latest query is evicted first. */
+#ifndef PHI_BOUNDARY_CHUNK_LIMIT
+#define PHI_BOUNDARY_CHUNK_LIMIT 32
+#endif
+/*! Number of characters either side of a position that may decide whether it is a boundary (and so are invalidated around an edit). */
+#ifndef PHI_BOUNDARY_CONTEXT_LENGTH
+#define PHI_BOUNDARY_CONTEXT_LENGTH 32
+#endif
+
+enum {
+	PhiTextWordStartBoundary = 1 << 0,
+	PhiTextWordEndBoundary = 1 << 1,
+	PhiTextSentenceStartBoundary = 1 << 2,
+	PhiTextSentenceEndBoundary = 1 << 3,
+	PhiTextParagraphStartBoundary = 1 << 4,
+	PhiTextParagraphEndBoundary = 1 << 5,
+};
+typedef uint8_t PhiTextBoundary;
+
+typedef struct {
+	/*! Number of boundary queries. */
+	NSUInteger queries;
+	/*! Number of chunks found (i.e. whose boundaries were derived from the text). */
+	NSUInteger chunksFound;
+	/*! Number of cached chunks dropped because of an edit (or because the text was replaced). */
+	NSUInteger chunksInvalidated;
+	NSUInteger evictions;
+	/*! Total time spent answering queries (in seconds). */
+	double queryTime;
+	/*! Number of touch moves snapped to a boundary by the owner (see addSnapTime:). */
+	NSUInteger snaps;
+	/*! Total time spent snapping touch moves to boundaries (in seconds). */
+	double snapTime;
+} PhiTextBoundaryStatistics;
+
+typedef struct PhiTextBoundaryChunk PhiTextBoundaryChunk;
+
+/*!
+ Finds the word, sentence and paragraph boundaries of a text, a chunk at a time, and caches them
+ until an edit touches the chunk; chunks after an edit are kept (and shifted). Words are found by
+ CFStringTokenizer (in the current locale), so they follow the Unicode rules, CJK text is split by
+ dictionary, and surrogate pairs are kept whole; a word is a token with a letter, digit or underscore in
+ it. A sentence ends after terminal punctuation (and any closing quotes or brackets) that is followed by
+ white space, or at the end of a paragraph; a paragraph ends at a line break (\n, \r, \r\n or U+2029).
+ The cache uses only Foundation and CFStringTokenizer, not UIKit, but like the rest of the library it is
+ built and tested (by PhiTextBoundaryCacheTests) only for iOS; there is no GNUstep build of it.
+ */
+@interface PhiTextBoundaryCache : NSObject {
+@private
+	id source;
+	NSUInteger sourceLength;
+	PhiTextBoundaryChunk *chunks;
+	NSUInteger chunkCount;
+	PhiTextBoundaryStatistics statistics;
+}
+
+/*! The text, any object that responds to -length and -substringWithRange: (such as an NSString or a PhiTextStorage); setting it invalidates the receiver. */
+@property (assign) id source;
+
+- (id)initWithSource:(id)source;
+
+/*! Returns the boundaries at index (between the characters index - 1 and index). */
+- (PhiTextBoundary)boundariesAtIndex:(NSUInteger)index;
+/*! Returns the first index after the specified index that is any of the specified boundaries, or NSNotFound. */
+- (NSUInteger)indexOfBoundary:(PhiTextBoundary)boundary afterIndex:(NSUInteger)index;
+/*! Returns the last index before the specified index that is any of the specified boundaries, or NSNotFound. */
+- (NSUInteger)indexOfBoundary:(PhiTextBoundary)boundary beforeIndex:(NSUInteger)index;
+
+/*! Drops the chunks near range (which was replaced, in the coordinates after the edit) and shifts those after it by diff. */
+- (void)textDidChangeInRange:(NSRange)range changeInLength:(NSInteger)diff;
+/*! Drops every chunk. */
+- (void)invalidate;
+
+- (PhiTextBoundaryStatistics)statistics;
+- (void)resetStatistics;
+/*! Accumulates the time taken by the owner to snap a touch move to a boundary. */
+- (void)addSnapTime:(NSTimeInterval)time;
+
+@end
@@ -0,0 +1,381 @@
+//
+//  PhiTextBoundaryCache.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextBoundaryCache.h"
+
+struct PhiTextBoundaryChunk {
+	NSUInteger location;
+	NSUInteger length;
+	/*! The boundaries at each index from location to location + length (inclusive). */
+	PhiTextBoundary *boundaries;
+};
+
+/*! The characters of the text around a chunk; beyond either end of the text is treated as a line break. */
+typedef struct {
+	unichar *characters;
+	NSInteger location;
+	NSInteger length;
+	NSInteger textLength;
+} PhiTextBoundaryBuffer;
+
+static NSCharacterSet *PhiWordCharacters = nil;
+static NSCharacterSet *PhiSpaceCharacters = nil;
+
+static unichar PhiBufferCharacterAtIndex(PhiTextBoundaryBuffer *buffer, NSInteger index) {
+	if (index < 0 || index >= buffer->textLength)
+		return '\n';
+	if (index < buffer->location || index >= buffer->location + buffer->length)
+		return ' ';
+	return buffer->characters[index - buffer->location];
+}
+static BOOL PhiIsLineBreak(unichar c) {
+	return c == '\n' || c == '\r' || c == 0x2029;
+}
+/*! Returns whether a paragraph ends at index, i.e. before a line break (but not between the \r and \n of a \r\n). */
+static BOOL PhiIsParagraphEndAtIndex(PhiTextBoundaryBuffer *buffer, NSInteger index) {
+	unichar c = PhiBufferCharacterAtIndex(buffer, index);
+	return PhiIsLineBreak(c) && !(c == '\n' && PhiBufferCharacterAtIndex(buffer, index - 1) == '\r');
+}
+static BOOL PhiIsSpace(unichar c) {
+	return !PhiIsLineBreak(c) && [PhiSpaceCharacters characterIsMember:c];
+}
+static BOOL PhiIsTerminator(unichar c) {
+	return c == '.' || c == '!' || c == '?' || c == 0x2026 || c == 0x3002 || c == 0xFF01 || c == 0xFF1F;
+}
+static BOOL PhiIsCloser(unichar c) {
+	return c == '"' || c == '\'' || c == ')' || c == ']' || c == '}' || c == 0x2019 || c == 0x201D || c == 0x00BB;
+}
+/*! Returns whether any (whole) character of the token is a letter, digit or underscore, rather than punctuation or white space. */
+static BOOL PhiIsWordToken(PhiTextBoundaryBuffer *buffer, CFRange token) {
+	CFIndex i, end = token.location + token.length;
+	UTF32Char c;
+	for (i = token.location; i < end; i++) {
+		c = buffer->characters[i];
+		if (CFStringIsSurrogateHighCharacter(c) && i + 1 < end && CFStringIsSurrogateLowCharacter(buffer->characters[i + 1])) {
+			c = CFStringGetLongCharacterForSurrogatePair(buffer->characters[i], buffer->characters[i + 1]);
+			i++;
+		}
+		if (c == '_' || CFCharacterSetIsLongCharacterMember((CFCharacterSetRef)PhiWordCharacters, c))
+			return YES;
+	}
+	return NO;
+}
+/*!
+ Marks the starts and ends of the words between start and end (inclusive), as found by a CFStringTokenizer
+ over the buffer; so words are split by the Unicode rules (e.g. "don't" and "3.14" are words), CJK text is
+ split by dictionary, and a surrogate pair is never split.
+ */
+static void PhiAddWordBoundaries(PhiTextBoundaryBuffer *buffer, PhiTextBoundary *boundaries, NSInteger start, NSInteger end) {
+	CFStringRef string;
+	CFLocaleRef locale;
+	CFStringTokenizerRef tokenizer;
+	CFRange token;
+	NSInteger tokenStart, tokenEnd;
+	if (buffer->length <= 0)
+		return;
+	string = CFStringCreateWithCharactersNoCopy(NULL, buffer->characters, buffer->length, kCFAllocatorNull);
+	locale = CFLocaleCopyCurrent();
+	tokenizer = CFStringTokenizerCreate(NULL, string, CFRangeMake(0, buffer->length), kCFStringTokenizerUnitWordBoundary, locale);
+	while (CFStringTokenizerAdvanceToNextToken(tokenizer) != kCFStringTokenizerTokenNone) {
+		token = CFStringTokenizerGetCurrentTokenRange(tokenizer);
+		tokenStart = buffer->location + token.location;
+		tokenEnd = tokenStart + token.length;
+		if (tokenStart > end)
+			break;
+		if (tokenEnd < start || !PhiIsWordToken(buffer, token))
+			continue;
+		if (tokenStart >= start)
+			boundaries[tokenStart - start] |= PhiTextWordStartBoundary;
+		if (tokenEnd <= end)
+			boundaries[tokenEnd - start] |= PhiTextWordEndBoundary;
+	}
+	CFRelease(tokenizer);
+	CFRelease(locale);
+	CFRelease(string);
+}
+static BOOL PhiIsSentenceEndAtIndex(PhiTextBoundaryBuffer *buffer, NSInteger index) {
+	unichar c = PhiBufferCharacterAtIndex(buffer, index);
+	NSInteger i, closers = 0;
+	if (index <= 0 || !(PhiIsSpace(c) || PhiIsLineBreak(c)))
+		return NO;
+	if (PhiIsLineBreak(c) && !PhiIsLineBreak(PhiBufferCharacterAtIndex(buffer, index - 1)))
+		return YES;
+	for (i = index - 1; closers < 4 && PhiIsCloser(PhiBufferCharacterAtIndex(buffer, i)); i--)
+		closers++;
+	return i >= 0 && PhiIsTerminator(PhiBufferCharacterAtIndex(buffer, i));
+}
+static BOOL PhiIsSentenceStartAtIndex(PhiTextBoundaryBuffer *buffer, NSInteger index) {
+	unichar c = PhiBufferCharacterAtIndex(buffer, index);
+	NSInteger i = index, spaces = 0;
+	if (index >= buffer->textLength || PhiIsSpace(c) || PhiIsLineBreak(c))
+		return NO;
+	while (spaces < PHI_BOUNDARY_CONTEXT_LENGTH - 8 && PhiIsSpace(PhiBufferCharacterAtIndex(buffer, i - 1))) {
+		i--;
+		spaces++;
+	}
+	if (PhiIsLineBreak(PhiBufferCharacterAtIndex(buffer, i - 1)))
+		return YES;
+	return spaces > 0 && PhiIsSentenceEndAtIndex(buffer, i);
+}
+/*! Returns the sentence and paragraph boundaries at index; word boundaries are added by PhiAddWordBoundaries. */
+static PhiTextBoundary PhiBoundariesAtIndex(PhiTextBoundaryBuffer *buffer, NSInteger index) {
+	PhiTextBoundary rv = 0;
+	if (PhiIsSentenceStartAtIndex(buffer, index))
+		rv |= PhiTextSentenceStartBoundary;
+	if (PhiIsSentenceEndAtIndex(buffer, index))
+		rv |= PhiTextSentenceEndBoundary;
+	if (PhiIsParagraphEndAtIndex(buffer, index - 1))
+		rv |= PhiTextParagraphStartBoundary;
+	if (PhiIsParagraphEndAtIndex(buffer, index))
+		rv |= PhiTextParagraphEndBoundary;
+	return rv;
+}
+
+@interface PhiTextBoundaryCache ()
+
+- (void)removeChunkAtIndex:(NSUInteger)i;
+- (NSUInteger)chunkContainingIndex:(NSUInteger)index;
+
+@end
+
+@implementation PhiTextBoundaryCache
+
++ (void)initialize {
+	if (!PhiWordCharacters) {
+		PhiWordCharacters = [[NSCharacterSet alphanumericCharacterSet] retain];
+		PhiSpaceCharacters = [[NSCharacterSet whitespaceCharacterSet] retain];
+	}
+}
+
+@synthesize source;
+
+- (id)init {
+	return [self initWithSource:nil];
+}
+
+- (id)initWithSource:(id)aSource {
+	if (self = [super init]) {
+		chunks = calloc(PHI_BOUNDARY_CHUNK_LIMIT, sizeof(PhiTextBoundaryChunk));
+		chunkCount = 0;
+		memset(&statistics, 0, sizeof(statistics));
+		[self setSource:aSource];
+	}
+	return self;
+}
+
+- (void)setSource:(id)aSource {
+	@synchronized(self) {
+		source = aSource;
+		[self invalidate];
+	}
+}
+
+- (void)removeChunkAtIndex:(NSUInteger)i {
+	free(chunks[i].boundaries);
+	memmove(chunks + i, chunks + i + 1, (chunkCount - i - 1) * sizeof(PhiTextBoundaryChunk));
+	chunkCount--;
+}
+
+- (void)invalidate {
+	@synchronized(self) {
+		statistics.chunksInvalidated += chunkCount;
+		while (chunkCount)
+			[self removeChunkAtIndex:chunkCount - 1];
+		sourceLength = [source length];
+	}
+}
+
+- (void)textDidChangeInRange:(NSRange)range changeInLength:(NSInteger)diff {
+	@synchronized(self) {
+		// The edit may be reported in either coordinates, so the larger extent is dropped
+		NSInteger low = (NSInteger)range.location - PHI_BOUNDARY_CONTEXT_LENGTH;
+		NSInteger high = (NSInteger)(range.location + range.length) + MAX(0, -diff) + PHI_BOUNDARY_CONTEXT_LENGTH;
+		NSUInteger i = 0;
+		while (i < chunkCount) {
+			if ((NSInteger)(chunks[i].location + chunks[i].length) < low) {
+				i++;
+			} else if ((NSInteger)chunks[i].location > high) {
+				chunks[i].location += diff;
+				i++;
+			} else {
+				[self removeChunkAtIndex:i];
+				statistics.chunksInvalidated++;
+			}
+		}
+		sourceLength += diff;
+		if (sourceLength != [source length])
+			[self invalidate];
+	}
+}
+
+/*! Returns the index (into chunks) of the chunk that contains index, finding the chunk if necessary. */
+- (NSUInteger)chunkContainingIndex:(NSUInteger)index {
+	NSUInteger low = 0, high = chunkCount, mid, i;
+	NSUInteger start, end;
+	PhiTextBoundaryBuffer buffer;
+	NSRange textRange;
+
+	// Binary search for the last chunk that begins at or before index
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (chunks[mid].location <= index)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low > 0 && index <= chunks[low - 1].location + chunks[low - 1].length)
+		return low - 1;
+
+	start = index - index % PHI_BOUNDARY_CHUNK_LENGTH;
+	end = MIN(start + PHI_BOUNDARY_CHUNK_LENGTH, sourceLength);
+	if (low > 0)
+		start = MAX(start, chunks[low - 1].location + chunks[low - 1].length + 1);
+	if (low < chunkCount)
+		end = MIN(end, chunks[low].location - 1);
+	end = MAX(end, index);
+
+	if (chunkCount == PHI_BOUNDARY_CHUNK_LIMIT) {
+		NSUInteger farthest = (ABS((NSInteger)index - (NSInteger)chunks[0].location)
+							   > ABS((NSInteger)chunks[chunkCount - 1].location - (NSInteger)index)) ? 0 : chunkCount - 1;
+		[self removeChunkAtIndex:farthest];
+		statistics.evictions++;
+		if (farthest < low)
+			low--;
+	}
+
+	textRange.location = start > PHI_BOUNDARY_CONTEXT_LENGTH ? start - PHI_BOUNDARY_CONTEXT_LENGTH : 0;
+	textRange.length = MIN(end + PHI_BOUNDARY_CONTEXT_LENGTH, sourceLength) - textRange.location;
+	buffer.location = textRange.location;
+	buffer.length = textRange.length;
+	buffer.textLength = sourceLength;
+	buffer.characters = malloc(MAX(1, textRange.length) * sizeof(unichar));
+	if (textRange.length)
+		[[source substringWithRange:textRange] getCharacters:buffer.characters];
+
+	memmove(chunks + low + 1, chunks + low, (chunkCount - low) * sizeof(PhiTextBoundaryChunk));
+	chunkCount++;
+	chunks[low].location = start;
+	chunks[low].length = end - start;
+	chunks[low].boundaries = malloc((end - start + 1) * sizeof(PhiTextBoundary));
+	for (i = start; i <= end; i++)
+		chunks[low].boundaries[i - start] = PhiBoundariesAtIndex(&buffer, i);
+	PhiAddWordBoundaries(&buffer, chunks[low].boundaries, start, end);
+	free(buffer.characters);
+	statistics.chunksFound++;
+	return low;
+}
+
+- (PhiTextBoundary)boundariesAtIndex:(NSUInteger)index {
+	PhiTextBoundary rv = 0;
+	@synchronized(self) {
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		NSUInteger i;
+		if (sourceLength != [source length])
+			[self invalidate];
+		if (index <= sourceLength) {
+			i = [self chunkContainingIndex:index];
+			rv = chunks[i].boundaries[index - chunks[i].location];
+		}
+		statistics.queries++;
+		statistics.queryTime += CFAbsoluteTimeGetCurrent() - start;
+	}
+	return rv;
+}
+
+- (NSUInteger)indexOfBoundary:(PhiTextBoundary)boundary afterIndex:(NSUInteger)index {
+	NSUInteger rv = NSNotFound;
+	@synchronized(self) {
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		NSUInteger i, p, end;
+		if (sourceLength != [source length])
+			[self invalidate];
+		for (p = index + 1; rv == NSNotFound && p <= sourceLength; ) {
+			i = [self chunkContainingIndex:p];
+			for (end = chunks[i].location + chunks[i].length; p <= end; p++) {
+				if (chunks[i].boundaries[p - chunks[i].location] & boundary) {
+					rv = p;
+					break;
+				}
+			}
+		}
+		statistics.queries++;
+		statistics.queryTime += CFAbsoluteTimeGetCurrent() - start;
+	}
+	return rv;
+}
+
+- (NSUInteger)indexOfBoundary:(PhiTextBoundary)boundary beforeIndex:(NSUInteger)index {
+	NSUInteger rv = NSNotFound;
+	@synchronized(self) {
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		NSUInteger i;
+		NSInteger p, begin;
+		if (sourceLength != [source length])
+			[self invalidate];
+		for (p = (NSInteger)MIN(index, sourceLength + 1) - 1; rv == NSNotFound && p >= 0; ) {
+			i = [self chunkContainingIndex:p];
+			for (begin = chunks[i].location; p >= begin; p--) {
+				if (chunks[i].boundaries[p - begin] & boundary) {
+					rv = p;
+					break;
+				}
+			}
+		}
+		statistics.queries++;
+		statistics.queryTime += CFAbsoluteTimeGetCurrent() - start;
+	}
+	return rv;
+}
+
+- (PhiTextBoundaryStatistics)statistics {
+	PhiTextBoundaryStatistics rv;
+	@synchronized(self) {
+		rv = statistics;
+	}
+	return rv;
+}
+
+- (void)resetStatistics {
+	@synchronized(self) {
+		memset(&statistics, 0, sizeof(statistics));
+	}
+}
+
+- (void)addSnapTime:(NSTimeInterval)time {
+	@synchronized(self) {
+		statistics.snaps++;
+		statistics.snapTime += time;
+	}
+}
+
+- (NSString *)description {
+	PhiTextBoundaryStatistics stats = [self statistics];
+	return [NSString stringWithFormat:@"<%@: 0x%x; %u chunks; %u queries (%.3fs); %u found; %u invalidated; %u evicted>",
+			NSStringFromClass([self class]), self, chunkCount,
+			stats.queries, stats.queryTime, stats.chunksFound, stats.chunksInvalidated, stats.evictions];
+}
+
+- (void)dealloc {
+	while (chunkCount)
+		[self removeChunkAtIndex:chunkCount - 1];
+	free(chunks);
+	[super dealloc];
+}
+
+@end
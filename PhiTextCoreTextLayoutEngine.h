@@ -0,0 +1,35 @@
+//
+//  PhiTextCoreTextLayoutEngine.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreText/CoreText.h>
+#import "PhiTextLayoutEngine.h"
+
+/*!
+ The default layout engine; frames are CTFrames and lines are CTLines.
+ The framesetter of the last string is kept, so that a frame that is grown (i.e. created again,
+ from the same string, in a larger path) doesn't pay for a new framesetter each time.
+ */
+@interface PhiTextCoreTextLayoutEngine : NSObject <PhiTextLayoutEngine> {
+@private
+	NSAttributedString *framesetterString;
+	CTFramesetterRef framesetter;
+}
+
+@end
@@ -0,0 +1,293 @@
+//
+//  PhiTextCoreTextLayoutEngine.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <CoreText/CoreText.h>
+#import <UIKit/UIColor.h>
+#import "PhiTextCoreTextLayoutEngine.h"
+#import "PhiTextStyle.h"
+
+static BOOL PhiRunPaintEqual(CFDictionaryRef runAttributes, NSDictionary *paint) {
+	id value, otherValue;
+	for (NSString *name in [PhiTextStyle paintOnlyAttributeNames]) {
+		value = (id)CFDictionaryGetValue(runAttributes, name);
+		otherValue = [paint objectForKey:name];
+		if (value != otherValue && !(value && otherValue && CFEqual(value, otherValue)))
+			return NO;
+	}
+	return YES;
+}
+
+/*! Shows glyphs (positioned in text space, i.e. relative to the text position) in the paint of the specified attributes, as CTRunDraw would. */
+static void PhiShowGlyphsWithPaint(CGContextRef context, CTFontRef font, CFDictionaryRef runAttributes, NSDictionary *paint,
+								   const CGGlyph *glyphs, const CGPoint *positions, CFIndex count) {
+	CGColorRef fillColor = (CGColorRef)[paint objectForKey:(id)kCTForegroundColorAttributeName];
+	CGColorRef strokeColor = (CGColorRef)[paint objectForKey:(id)kCTStrokeColorAttributeName];
+	CGColorRef underlineColor = (CGColorRef)[paint objectForKey:(id)kCTUnderlineColorAttributeName];
+	BOOL colorFromContext = [[paint objectForKey:(id)kCTForegroundColorFromContextAttributeName] boolValue];
+	CTUnderlineStyle underlineStyle = kCTUnderlineStyleNone;
+	CGFloat strokeWidth = 0.0;
+	CFNumberRef value;
+
+	if ((value = CFDictionaryGetValue(runAttributes, kCTStrokeWidthAttributeName)))
+		CFNumberGetValue(value, kCFNumberCGFloatType, &strokeWidth);
+	if ((value = CFDictionaryGetValue(runAttributes, kCTUnderlineStyleAttributeName)))
+		CFNumberGetValue(value, kCFNumberSInt32Type, &underlineStyle);
+	// Paint that doesn't say otherwise keeps the colours the run was typeset with
+	if (!fillColor && !colorFromContext) {
+		fillColor = (CGColorRef)CFDictionaryGetValue(runAttributes, kCTForegroundColorAttributeName);
+		if (!fillColor && !(colorFromContext = [(id)CFDictionaryGetValue(runAttributes, kCTForegroundColorFromContextAttributeName) boolValue]))
+			fillColor = [[UIColor blackColor] CGColor];
+	}
+	if (!underlineColor)
+		underlineColor = (CGColorRef)CFDictionaryGetValue(runAttributes, kCTUnderlineColorAttributeName);
+
+	CGContextSaveGState(context); {
+		if (fillColor)
+			CGContextSetFillColorWithColor(context, fillColor);
+		if (strokeWidth != 0.0) {
+			if (strokeColor || fillColor)
+				CGContextSetStrokeColorWithColor(context, strokeColor ? strokeColor : fillColor);
+			CGContextSetLineWidth(context, ABS(strokeWidth) * CTFontGetSize(font) / 100.0);
+			CGContextSetTextDrawingMode(context, strokeWidth > 0.0 ? kCGTextStroke : kCGTextFillStroke);
+		} else {
+			CGContextSetTextDrawingMode(context, kCGTextFill);
+		}
+		CGContextShowGlyphsAtPositions(context, glyphs, positions, count);
+
+		if (underlineStyle & 0xFF) {
+			CGSize advance;
+			CGFloat thickness = MAX(CTFontGetUnderlineThickness(font), 0.5);
+			CGAffineTransform textMatrix = CGContextGetTextMatrix(context);
+			CGRect underlines[2];
+			size_t i, underlineCount = 1;
+			CTFontGetAdvancesForGlyphs(font, kCTFontDefaultOrientation, &glyphs[count - 1], &advance, 1);
+			if ((underlineStyle & 0xFF) == kCTUnderlineStyleThick)
+				thickness *= 2.0;
+			// The font's underline position is the centre of the line, in text space (as are the glyph positions)
+			underlines[0] = CGRectMake(positions[0].x,
+									   CTFontGetUnderlinePosition(font) - thickness / 2.0,
+									   positions[count - 1].x + advance.width - positions[0].x,
+									   thickness);
+			if ((underlineStyle & 0xFF) == kCTUnderlineStyleDouble)
+				underlines[underlineCount++] = CGRectOffset(underlines[0], 0.0, -2.0 * thickness);
+			for (i = 0; i < underlineCount; i++)
+				underlines[i] = CGRectApplyAffineTransform(underlines[i], textMatrix);
+			if (underlineColor || fillColor)
+				CGContextSetFillColorWithColor(context, underlineColor ? underlineColor : fillColor);
+			CGContextFillRects(context, underlines, underlineCount);
+		}
+	} CGContextRestoreGState(context);
+}
+
+/*! Draws the run at the text position; runs whose paint is unchanged are left to Core Text. */
+static void PhiDrawRunWithPaint(CTRunRef run, NSAttributedString *string, CGContextRef context) {
+	CFDictionaryRef runAttributes = CTRunGetAttributes(run);
+	CFRange runRange = CTRunGetStringRange(run);
+	CTFontRef font = (CTFontRef)CFDictionaryGetValue(runAttributes, kCTFontAttributeName);
+	NSUInteger length = [string length];
+	CFIndex start, end, count = CTRunGetGlyphCount(run);
+	NSDictionary *paint;
+	NSRange paintRange;
+
+	if (!count)
+		return;
+	if (!font || runRange.location + runRange.length > length) {
+		CTRunDraw(run, context, CFRangeMake(0, 0));
+		return;
+	}
+	paint = [string attributesAtIndex:runRange.location effectiveRange:&paintRange];
+	if (NSMaxRange(paintRange) >= runRange.location + runRange.length && PhiRunPaintEqual(runAttributes, paint)) {
+		CTRunDraw(run, context, CFRangeMake(0, 0));
+		return;
+	}
+
+	const CGGlyph *glyphs = CTRunGetGlyphsPtr(run);
+	const CGPoint *positions = CTRunGetPositionsPtr(run);
+	const CFIndex *indices = CTRunGetStringIndicesPtr(run);
+	CGGlyph *glyphBuffer = NULL;
+	CGPoint *positionBuffer = NULL;
+	CFIndex *indexBuffer = NULL;
+	if (!glyphs) {
+		glyphBuffer = malloc(count * sizeof(CGGlyph));
+		CTRunGetGlyphs(run, CFRangeMake(0, 0), glyphBuffer);
+		glyphs = glyphBuffer;
+	}
+	if (!positions) {
+		positionBuffer = malloc(count * sizeof(CGPoint));
+		CTRunGetPositions(run, CFRangeMake(0, 0), positionBuffer);
+		positions = positionBuffer;
+	}
+	if (!indices) {
+		indexBuffer = malloc(count * sizeof(CFIndex));
+		CTRunGetStringIndices(run, CFRangeMake(0, 0), indexBuffer);
+		indices = indexBuffer;
+	}
+
+	// The text matrix is not part of the graphics state
+	CGPoint textPosition = CGContextGetTextPosition(context);
+	CGAffineTransform textMatrix = CGContextGetTextMatrix(context);
+	CGFontRef graphicsFont = CTFontCopyGraphicsFont(font, NULL);
+	CGContextSaveGState(context); {
+		CGContextSetFont(context, graphicsFont);
+		CGContextSetFontSize(context, CTFontGetSize(font));
+		CGContextSetTextMatrix(context, CGAffineTransformTranslate(textMatrix, textPosition.x, textPosition.y));
+		CGContextSetTextPosition(context, 0.0, 0.0);
+		for (start = 0; start < count; start = end) {
+			if (indices[start] < length) {
+				paint = [string attributesAtIndex:indices[start] effectiveRange:&paintRange];
+			} else {
+				paint = (NSDictionary *)runAttributes;
+				paintRange = NSMakeRange(indices[start], NSUIntegerMax - indices[start]);
+			}
+			for (end = start + 1; end < count && NSLocationInRange(indices[end], paintRange); end++);
+			PhiShowGlyphsWithPaint(context, font, runAttributes, paint, glyphs + start, positions + start, end - start);
+		}
+	} CGContextRestoreGState(context);
+	CGContextSetTextMatrix(context, textMatrix);
+	CGContextSetTextPosition(context, textPosition.x, textPosition.y);
+	CGFontRelease(graphicsFont);
+
+	if (glyphBuffer)
+		free(glyphBuffer);
+	if (positionBuffer)
+		free(positionBuffer);
+	if (indexBuffer)
+		free(indexBuffer);
+}
+
+@implementation PhiTextCoreTextLayoutEngine
+
+/*! Returns the kept framesetter if it was made for string (the very same object), otherwise a new one; the caller owns it until it is handed back with keepFramesetter:forAttributedString:, so that threads never share one. */
+- (CTFramesetterRef)copyFramesetterForAttributedString:(NSAttributedString *)string {
+	CTFramesetterRef rv = NULL;
+	@synchronized(self) {
+		if (framesetter && framesetterString == string) {
+			rv = framesetter;
+			framesetter = NULL;
+			[framesetterString release];
+			framesetterString = nil;
+		}
+	}
+	if (!rv)
+		rv = CTFramesetterCreateWithAttributedString((CFAttributedStringRef)string);
+	return rv;
+}
+
+- (void)keepFramesetter:(CTFramesetterRef)aFramesetter forAttributedString:(NSAttributedString *)string {
+	@synchronized(self) {
+		if (framesetter)
+			CFRelease(framesetter);
+		[framesetterString release];
+		framesetter = aFramesetter;
+		framesetterString = [string retain];
+	}
+}
+
+- (CFTypeRef)createFrameWithAttributedString:(NSAttributedString *)string range:(CFRange)range path:(CGPathRef)path attributes:(NSDictionary *)attributes {
+	CTFrameRef frame = NULL;
+	CTFramesetterRef aFramesetter = [self copyFramesetterForAttributedString:string];
+	if (aFramesetter) {
+		frame = CTFramesetterCreateFrame(aFramesetter, range, path, (CFDictionaryRef)attributes);
+		[self keepFramesetter:aFramesetter forAttributedString:string];
+	}
+	return frame;
+}
+
+- (CGSize)suggestFrameSizeWithAttributedString:(NSAttributedString *)string range:(CFRange)range attributes:(NSDictionary *)attributes constraints:(CGSize)constraints {
+	CGSize size = CGSizeZero;
+	CTFramesetterRef aFramesetter = [self copyFramesetterForAttributedString:string];
+	if (aFramesetter) {
+		size = CTFramesetterSuggestFrameSizeWithConstraints(aFramesetter, range, (CFDictionaryRef)attributes, constraints, NULL);
+		[self keepFramesetter:aFramesetter forAttributedString:string];
+	}
+	return size;
+}
+
+- (CFRange)visibleStringRangeOfFrame:(CFTypeRef)frame {
+	return CTFrameGetVisibleStringRange((CTFrameRef)frame);
+}
+
+- (CFArrayRef)linesOfFrame:(CFTypeRef)frame {
+	return CTFrameGetLines((CTFrameRef)frame);
+}
+
+- (void)getLineOrigins:(CGPoint *)origins inRange:(CFRange)range ofFrame:(CFTypeRef)frame {
+	CTFrameGetLineOrigins((CTFrameRef)frame, range, origins);
+}
+
+- (void)drawFrame:(CFTypeRef)frame inContext:(CGContextRef)context {
+	CTFrameDraw((CTFrameRef)frame, context);
+}
+
+/*! Draws the glyph runs of the frame as typeset, i.e. without a framesetter pass. */
+- (void)drawFrame:(CFTypeRef)frame withPaintFromAttributedString:(NSAttributedString *)string inContext:(CGContextRef)context {
+	CGRect bounds = CGPathGetBoundingBox(CTFrameGetPath((CTFrameRef)frame));
+	CFArrayRef lines = CTFrameGetLines((CTFrameRef)frame);
+	CFIndex i, j, count = CFArrayGetCount(lines), runCount;
+	CFArrayRef runs;
+	CGPoint origin;
+	for (i = 0; i < count; i++) {
+		CTFrameGetLineOrigins((CTFrameRef)frame, CFRangeMake(i, 1), &origin);
+		runs = CTLineGetGlyphRuns((CTLineRef)CFArrayGetValueAtIndex(lines, i));
+		runCount = CFArrayGetCount(runs);
+		for (j = 0; j < runCount; j++) {
+			CGContextSetTextPosition(context, bounds.origin.x + origin.x, bounds.origin.y + origin.y);
+			PhiDrawRunWithPaint((CTRunRef)CFArrayGetValueAtIndex(runs, j), string, context);
+		}
+	}
+}
+
+- (CFRange)stringRangeOfLine:(CFTypeRef)line {
+	return CTLineGetStringRange((CTLineRef)line);
+}
+
+- (double)typographicBoundsOfLine:(CFTypeRef)line ascent:(CGFloat *)ascent descent:(CGFloat *)descent leading:(CGFloat *)leading {
+	return CTLineGetTypographicBounds((CTLineRef)line, ascent, descent, leading);
+}
+
+- (CGFloat)xHeightOfLine:(CFTypeRef)line {
+	CGFloat xHeight = 0.0;
+	CFArrayRef runs = CTLineGetGlyphRuns((CTLineRef)line);
+	if (runs && CFArrayGetCount(runs)) {
+		CTFontRef font = (CTFontRef)CFDictionaryGetValue(CTRunGetAttributes((CTRunRef)CFArrayGetValueAtIndex(runs, 0)), kCTFontAttributeName);
+		if (font)
+			xHeight = CTFontGetXHeight(font);
+	}
+	return xHeight;
+}
+
+- (CGFloat)offsetForStringIndex:(CFIndex)stringIndex inLine:(CFTypeRef)line {
+	return CTLineGetOffsetForStringIndex((CTLineRef)line, stringIndex, NULL);
+}
+
+- (CFIndex)stringIndexForPosition:(CGPoint)position inLine:(CFTypeRef)line {
+	return CTLineGetStringIndexForPosition((CTLineRef)line, position);
+}
+
+- (void)dealloc {
+	if (framesetter) {
+		CFRelease(framesetter);
+		framesetter = NULL;
+	}
+	[framesetterString release];
+	framesetterString = nil;
+	[super dealloc];
+}
+
+@end
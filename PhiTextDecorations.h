@@ -0,0 +1,117 @@
+//
+//  PhiTextDecorations.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class PhiTextDocument;
+@class PhiTextAnchorSet;
+
+/*! Number of edits remembered, so that decorations found in an older version of the text can be mapped to the current version. */
+#ifndef PHI_DECORATION_EDIT_LIMIT
+#define PHI_DECORATION_EDIT_LIMIT 64
+#endif
+
+typedef struct {
+	/*! Number of calls to setAttributes:ranges:count:inRange:forKey:version:. */
+	NSUInteger publishes;
+	/*! Number of publishes dropped because their version was too old (or not yet reached). */
+	NSUInteger stalePublishes;
+	/*! Number of decorations published. */
+	NSUInteger decorationsPublished;
+	/*! Number of decorations published against an older version, and so mapped through the edits since. */
+	NSUInteger decorationsMapped;
+	/*! Number of decorations dropped because an edit (or the mapping through an edit) removed all of their text; an edited decoration is counted when it is published over. */
+	NSUInteger decorationsCollapsed;
+	/*! Number of edits applied to the decorations. */
+	NSUInteger edits;
+	/*! Total time spent applying edits (in seconds). */
+	double editTime;
+	/*! Number of paint strings that decorations were merged into. */
+	NSUInteger merges;
+	/*! Total time spent merging decorations into paint strings (in seconds). */
+	double mergeTime;
+} PhiTextDecorationStatistics;
+
+typedef struct {
+	NSUInteger location;
+	NSUInteger length;
+	NSUInteger newLength;
+} PhiTextDecorationEdit;
+
+typedef struct PhiTextDecorationLayer PhiTextDecorationLayer;
+
+/*!
+ Paint-only attributes (see +[PhiTextStyle paintOnlyAttributeNames]) laid over ranges of a document's
+ text, without writing them into its store: no styling undo is registered and no frame is typeset again.
+ The decorations of each key (e.g. one per analyser) are kept apart and sorted by location. Their ends are
+ anchors (see PhiTextAnchorSet), so they follow the edits of the text in logarithmic time; a decoration whose
+ text is all removed is kept, empty, until it is published over. They are merged into the paint strings of
+ the frames when they are drawn (so they are only seen if the document's layoutEngine can draw with paint).
+ Decorations of keys that were published later take precedence.
+
+ Every edit increments the version of the text. An analyser, on any thread, reads a range of the text with
+ copySubstringWithRange:version:, and publishes what it finds against that version; decorations found in
+ an older version are mapped through the edits since, so the analyser needn't race the user's typing.
+ */
+@interface PhiTextDecorations : NSObject {
+@private
+	PhiTextDocument *document;
+	PhiTextDecorationLayer *layers;
+	NSUInteger layerCount;
+	PhiTextAnchorSet *anchors;
+	NSUInteger version;
+	PhiTextDecorationEdit edits[PHI_DECORATION_EDIT_LIMIT];
+	NSRange repaintRange;
+	PhiTextDecorationStatistics statistics;
+}
+
+/*! The document whose frames are repainted when decorations change; not retained. */
+@property (assign) PhiTextDocument *document;
+/*! The version of the text, incremented by every edit. */
+@property (readonly) NSUInteger version;
+
+- (id)initWithDocument:(PhiTextDocument *)document;
+
+/*! Returns a copy (that the caller must release) of the text in range, and sets version to the version that it was copied from. */
+- (NSString *)copySubstringWithRange:(NSRange)range version:(NSUInteger *)version;
+/*!
+ Replaces the decorations of key within region with the attributes (an array of dictionaries, one per
+ range) over ranges, which are sorted by location, don't overlap, and are clipped to region; the parts of
+ decorations outside region are kept.
+ The region and ranges are in the coordinates of the specified version of the text. Returns NO (and
+ changes nothing) if the version is more than PHI_DECORATION_EDIT_LIMIT edits old, in which case the
+ analyser should look again. May be called from any thread; the frames in region are repainted on the
+ main thread.
+ */
+- (BOOL)setAttributes:(NSArray *)attributes ranges:(const NSRange *)ranges count:(NSUInteger)count inRange:(NSRange)region forKey:(NSString *)key version:(NSUInteger)version;
+/*! Removes every decoration of key. */
+- (void)removeDecorationsForKey:(NSString *)key;
+
+/*! Returns whether any decoration intersects range. */
+- (BOOL)hasDecorationsInRange:(NSRange)range;
+/*! Adds the attributes of the decorations that intersect the string to it, where the string holds the text from location. */
+- (void)addAttributesToString:(NSMutableAttributedString *)string atLocation:(NSUInteger)location;
+
+/*! Moves the decorations for the replacement of the characters in range (in the coordinates before the edit) with length characters. */
+- (void)textDidReplaceCharactersInRange:(NSRange)range withLength:(NSUInteger)length;
+
+- (PhiTextDecorationStatistics)statistics;
+- (void)resetStatistics;
+
+@end
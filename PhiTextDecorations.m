@@ -0,0 +1,405 @@
+//
+//  PhiTextDecorations.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextDecorations.h"
+#import "PhiTextDocument.h"
+#import "PhiTextStorage.h"
+#import "PhiTextStyle.h"
+#import "PhiTextAnchorSet.h"
+
+@interface PhiTextDocument (PhiTextDecorations)
+
+- (CGRect)invalidateDocumentPaintNSRange:(NSRange)range;
+
+@end
+
+typedef struct {
+	/*! The ends of the decoration (retained); the start moves after text inserted at it and the end stays before it, so a decoration doesn't grow. */
+	PhiTextAnchor *start;
+	PhiTextAnchor *end;
+	/*! The paint-only attributes of the decoration (retained). */
+	NSDictionary *attributes;
+} PhiTextDecoration;
+
+struct PhiTextDecorationLayer {
+	NSString *key;
+	/*! Sorted by location and not overlapping; a decoration emptied by an edit is kept (and not painted) until it is published over or removed. */
+	PhiTextDecoration *decorations;
+	NSUInteger count;
+	NSUInteger capacity;
+};
+
+/*! Maps location through an edit; a location inside the replaced range moves to the end of the replacement if forward, otherwise to its start. */
+static NSUInteger PhiDecorationMapLocation(NSUInteger location, PhiTextDecorationEdit edit, BOOL forward) {
+	NSUInteger end = edit.location + edit.length;
+	if (location < edit.location)
+		return location;
+	if (location > end)
+		return location - edit.length + edit.newLength;
+	if (edit.length && location == edit.location)
+		return edit.location;
+	if (edit.length && location == end)
+		return edit.location + edit.newLength;
+	return forward ? edit.location + edit.newLength : edit.location;
+}
+
+/*! Maps range through an edit; a decoration doesn't grow to include text inserted at its ends, whereas a region (to be repainted) does. */
+static NSRange PhiDecorationMapRange(NSRange range, PhiTextDecorationEdit edit, BOOL grow) {
+	NSUInteger start = PhiDecorationMapLocation(range.location, edit, !grow);
+	NSUInteger end = PhiDecorationMapLocation(NSMaxRange(range), edit, grow);
+	return NSMakeRange(start, end > start ? end - start : 0);
+}
+
+static NSRange PhiDecorationRange(PhiTextDecoration *decoration) {
+	NSUInteger start = [decoration->start location], end = [decoration->end location];
+	return NSMakeRange(start, end > start ? end - start : 0);
+}
+
+/*! Returns the index of the first decoration that ends after location (the anchors keep the ends in order, however the text is edited). */
+static NSUInteger PhiDecorationSearch(PhiTextDecorationLayer *layer, NSUInteger location) {
+	NSUInteger low = 0, high = layer->count, mid;
+	while (low < high) {
+		mid = (low + high) / 2;
+		if ([layer->decorations[mid].end location] > location)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	return low;
+}
+
+static void PhiDecorationRelease(PhiTextDecoration *decoration) {
+	[decoration->start release];
+	[decoration->end release];
+	[decoration->attributes release];
+}
+
+static NSRange PhiDecorationUnionRange(NSRange range, NSRange other) {
+	if (range.location == NSNotFound)
+		return other;
+	return NSUnionRange(range, other);
+}
+
+/*! Returns the paint-only attributes (retained), or nil if there are none. */
+static NSDictionary *PhiDecorationCopyPaintAttributes(NSDictionary *attributes) {
+	NSMutableDictionary *rv = nil;
+	for (NSString *name in attributes) {
+		if (![PhiTextStyle isPaintOnlyAttribute:name]) {
+			rv = [[NSMutableDictionary alloc] initWithCapacity:[attributes count]];
+			break;
+		}
+	}
+	if (!rv)
+		return [attributes count] ? [attributes retain] : nil;
+	for (NSString *name in attributes) {
+		if ([PhiTextStyle isPaintOnlyAttribute:name])
+			[rv setObject:[attributes objectForKey:name] forKey:name];
+	}
+	if (![rv count]) {
+		[rv release];
+		rv = nil;
+	}
+	return rv;
+}
+
+@interface PhiTextDecorations ()
+
+- (PhiTextDecorationLayer *)layerForKey:(NSString *)key create:(BOOL)create;
+- (void)setNeedsRepaintInRange:(NSRange)range;
+- (void)repaint;
+
+@end
+
+@implementation PhiTextDecorations
+
+@synthesize document;
+
+- (id)init {
+	return [self initWithDocument:nil];
+}
+
+- (id)initWithDocument:(PhiTextDocument *)aDocument {
+	if (self = [super init]) {
+		document = aDocument;
+		layers = NULL;
+		layerCount = 0;
+		anchors = [[PhiTextAnchorSet alloc] init];
+		version = 0;
+		repaintRange = NSMakeRange(NSNotFound, 0);
+		memset(&statistics, 0, sizeof(statistics));
+	}
+	return self;
+}
+
+- (NSUInteger)version {
+	NSUInteger rv;
+	@synchronized(self) {
+		rv = version;
+	}
+	return rv;
+}
+
+- (NSString *)copySubstringWithRange:(NSRange)range version:(NSUInteger *)aVersion {
+	PhiTextStorage *store = [document store];
+	NSString *rv;
+	// Edits are reported with the store locked, so the text and version are read together
+	@synchronized(store) {
+		rv = [[store substringWithRange:range] retain];
+		if (aVersion)
+			*aVersion = [self version];
+	}
+	return rv;
+}
+
+- (PhiTextDecorationLayer *)layerForKey:(NSString *)key create:(BOOL)create {
+	NSUInteger i;
+	for (i = 0; i < layerCount; i++) {
+		if ([layers[i].key isEqualToString:key])
+			return layers + i;
+	}
+	if (!create)
+		return NULL;
+	layers = realloc(layers, (layerCount + 1) * sizeof(PhiTextDecorationLayer));
+	memset(layers + layerCount, 0, sizeof(PhiTextDecorationLayer));
+	layers[layerCount].key = [key copy];
+	return layers + layerCount++;
+}
+
+- (BOOL)setAttributes:(NSArray *)attributes ranges:(const NSRange *)ranges count:(NSUInteger)count inRange:(NSRange)region forKey:(NSString *)key version:(NSUInteger)aVersion {
+	PhiTextDecorationLayer *layer;
+	PhiTextDecoration *found, *decoration, tail;
+	NSUInteger i, v, n = 0, first, last, added;
+	NSRange range;
+	NSDictionary *paint;
+	count = MIN(count, [attributes count]);
+	@synchronized(self) {
+		statistics.publishes++;
+		if (aVersion > version || version - aVersion > PHI_DECORATION_EDIT_LIMIT) {
+			statistics.stalePublishes++;
+			return NO;
+		}
+		// Map what was found to the current version of the text
+		found = malloc((count + 1) * sizeof(PhiTextDecoration));
+		for (i = 0; i < count; i++) {
+			range = NSIntersectionRange(ranges[i], region);
+			for (v = aVersion; v < version && range.length; v++)
+				range = PhiDecorationMapRange(range, edits[v % PHI_DECORATION_EDIT_LIMIT], NO);
+			if (!range.length) {
+				statistics.decorationsCollapsed++;
+				continue;
+			}
+			paint = PhiDecorationCopyPaintAttributes([attributes objectAtIndex:i]);
+			if (paint) {
+				found[n].start = [anchors newAnchorAtLocation:range.location stickiness:PhiTextAnchorStickyForward];
+				found[n].end = [anchors newAnchorAtLocation:NSMaxRange(range) stickiness:PhiTextAnchorStickyBackward];
+				found[n].attributes = paint;
+				n++;
+			}
+		}
+		for (v = aVersion; v < version; v++)
+			region = PhiDecorationMapRange(region, edits[v % PHI_DECORATION_EDIT_LIMIT], YES);
+		statistics.decorationsPublished += n;
+		if (aVersion < version)
+			statistics.decorationsMapped += n;
+
+		layer = [self layerForKey:key create:YES];
+		// Replace the decorations within the region with what was found, keeping the parts of those that cross its edges
+		first = PhiDecorationSearch(layer, region.location);
+		added = n;
+		if (first < layer->count && [layer->decorations[first].start location] < region.location) {
+			decoration = layer->decorations + first;
+			if ([decoration->end location] > NSMaxRange(region)) {
+				// The decoration covers the region; its part after the region is a new decoration
+				tail.start = [anchors newAnchorAtLocation:NSMaxRange(region) stickiness:PhiTextAnchorStickyForward];
+				tail.end = decoration->end;
+				tail.attributes = [decoration->attributes retain];
+				found[added++] = tail;
+				decoration->end = [anchors newAnchorAtLocation:region.location stickiness:PhiTextAnchorStickyBackward];
+			} else {
+				[decoration->end setLocation:region.location];
+			}
+			first++;
+		}
+		last = first;
+		while (last < layer->count && [layer->decorations[last].start location] < NSMaxRange(region)) {
+			decoration = layer->decorations + last;
+			if ([decoration->end location] > NSMaxRange(region)) {
+				[decoration->start setLocation:NSMaxRange(region)];
+				break;
+			}
+			if (!PhiDecorationRange(decoration).length)
+				statistics.decorationsCollapsed++;
+			PhiDecorationRelease(decoration);
+			last++;
+		}
+		if (layer->count - (last - first) + added > layer->capacity) {
+			layer->capacity = MAX(layer->count - (last - first) + added, layer->capacity * 2);
+			layer->decorations = realloc(layer->decorations, layer->capacity * sizeof(PhiTextDecoration));
+		}
+		memmove(layer->decorations + first + added, layer->decorations + last, (layer->count - last) * sizeof(PhiTextDecoration));
+		if (added)
+			memcpy(layer->decorations + first, found, added * sizeof(PhiTextDecoration));
+		layer->count = layer->count - (last - first) + added;
+		free(found);
+		[self setNeedsRepaintInRange:region];
+	}
+	return YES;
+}
+
+- (void)removeDecorationsForKey:(NSString *)key {
+	PhiTextDecorationLayer *layer;
+	NSUInteger i;
+	@synchronized(self) {
+		layer = [self layerForKey:key create:NO];
+		if (layer) {
+			if (layer->count)
+				[self setNeedsRepaintInRange:NSUnionRange(PhiDecorationRange(layer->decorations), PhiDecorationRange(layer->decorations + layer->count - 1))];
+			for (i = 0; i < layer->count; i++)
+				PhiDecorationRelease(layer->decorations + i);
+			free(layer->decorations);
+			[layer->key release];
+			i = layer - layers;
+			memmove(layers + i, layers + i + 1, (layerCount - i - 1) * sizeof(PhiTextDecorationLayer));
+			layerCount--;
+		}
+	}
+}
+
+- (BOOL)hasDecorationsInRange:(NSRange)range {
+	PhiTextDecorationLayer *layer;
+	NSUInteger i;
+	NSRange decorationRange;
+	@synchronized(self) {
+		for (layer = layers; layer < layers + layerCount; layer++) {
+			for (i = PhiDecorationSearch(layer, range.location); i < layer->count; i++) {
+				decorationRange = PhiDecorationRange(layer->decorations + i);
+				if (decorationRange.location >= NSMaxRange(range))
+					break;
+				if (decorationRange.length)
+					return YES;
+			}
+		}
+	}
+	return NO;
+}
+
+- (void)addAttributesToString:(NSMutableAttributedString *)string atLocation:(NSUInteger)location {
+	PhiTextDecorationLayer *layer;
+	NSUInteger i, end = location + [string length];
+	NSRange range;
+	CFAbsoluteTime start;
+	@synchronized(self) {
+		start = CFAbsoluteTimeGetCurrent();
+		[string beginEditing];
+		for (layer = layers; layer < layers + layerCount; layer++) {
+			for (i = PhiDecorationSearch(layer, location); i < layer->count; i++) {
+				range = PhiDecorationRange(layer->decorations + i);
+				if (range.location >= end)
+					break;
+				if (!range.length)
+					continue;
+				range = NSIntersectionRange(range, NSMakeRange(location, end - location));
+				range.location -= location;
+				[string addAttributes:layer->decorations[i].attributes range:range];
+			}
+		}
+		[string endEditing];
+		statistics.merges++;
+		statistics.mergeTime += CFAbsoluteTimeGetCurrent() - start;
+	}
+}
+
+- (void)textDidReplaceCharactersInRange:(NSRange)range withLength:(NSUInteger)length {
+	PhiTextDecorationEdit edit;
+	CFAbsoluteTime start;
+	@synchronized(self) {
+		start = CFAbsoluteTimeGetCurrent();
+		edit.location = range.location;
+		edit.length = range.length;
+		edit.newLength = length;
+		edits[version % PHI_DECORATION_EDIT_LIMIT] = edit;
+		version++;
+		// The ends of every decoration are anchors, so the decorations after the edit are moved all at once
+		[anchors textDidReplaceCharactersInRange:range withLength:length];
+		if (repaintRange.location != NSNotFound)
+			repaintRange = PhiDecorationMapRange(repaintRange, edit, YES);
+		statistics.edits++;
+		statistics.editTime += CFAbsoluteTimeGetCurrent() - start;
+	}
+}
+
+- (void)setNeedsRepaintInRange:(NSRange)range {
+	@synchronized(self) {
+		if (repaintRange.location == NSNotFound)
+			[self performSelectorOnMainThread:@selector(repaint) withObject:nil waitUntilDone:NO];
+		repaintRange = PhiDecorationUnionRange(repaintRange, range);
+	}
+}
+
+/*! Repaints (without typesetting) the frames whose decorations changed since the last repaint. */
+- (void)repaint {
+	NSRange range;
+	@synchronized(self) {
+		range = repaintRange;
+		repaintRange = NSMakeRange(NSNotFound, 0);
+	}
+	if (range.location == NSNotFound || !document)
+		return;
+	// Without paint, the frames would be typeset again and still not show the decorations
+	if (![[document layoutEngine] respondsToSelector:@selector(drawFrame:withPaintFromAttributedString:inContext:)])
+		return;
+	[document addDamageRect:[document invalidateDocumentPaintNSRange:range]];
+}
+
+- (PhiTextDecorationStatistics)statistics {
+	PhiTextDecorationStatistics rv;
+	@synchronized(self) {
+		rv = statistics;
+	}
+	return rv;
+}
+
+- (void)resetStatistics {
+	@synchronized(self) {
+		memset(&statistics, 0, sizeof(statistics));
+	}
+}
+
+- (NSString *)description {
+	PhiTextDecorationStatistics stats = [self statistics];
+	return [NSString stringWithFormat:@"<%@: 0x%x; version %u; %u keys; %u published (%u mapped, %u stale publishes); %u collapsed; %u edits (%.3fs); %u merges (%.3fs)>",
+			NSStringFromClass([self class]), self, [self version], layerCount,
+			stats.decorationsPublished, stats.decorationsMapped, stats.stalePublishes, stats.decorationsCollapsed,
+			stats.edits, stats.editTime, stats.merges, stats.mergeTime];
+}
+
+- (void)dealloc {
+	NSUInteger i, j;
+	for (i = 0; i < layerCount; i++) {
+		for (j = 0; j < layers[i].count; j++)
+			PhiDecorationRelease(layers[i].decorations + j);
+		free(layers[i].decorations);
+		[layers[i].key release];
+	}
+	free(layers);
+	[anchors release];
+	[super dealloc];
+}
+
+@end
@@ -20,6 +20,7 @@
 #import <Foundation/Foundation.h>
 #import <UIKit/UIKit.h>
 #import <CoreText/CoreText.h>
+#import "PhiTextLayoutEngine.h"
 
 @class PhiTextEditorView;
 @class PhiTextPosition;
@@ -29,10 +30,50 @@
 @class PhiTextStyle;
 @class PhiTextLine;
 @class PhiTextUndoManager;
+@class PhiTextFrameCache;
+@class PhiTextTileCache;
+@class PhiTextBoundaryCache;
+@class PhiTextSearch;
+@class PhiTextAnchorSet;
+@class PhiTextDecorations;
+@class PhiTextLayoutSnapshot;
 @class PhiAATree;
 @class PhiAATreeNode;
 @class PhiAATreeRange;
 
+/*! Number of damaged rects kept between flushes, beyond which the nearest rects are merged. */
+#ifndef PHI_DAMAGE_RECT_LIMIT
+#define PHI_DAMAGE_RECT_LIMIT 8
+#endif
+
+typedef struct {
+	/*! Number of rects reported as damaged. */
+	NSUInteger reports;
+	/*! Number of times the damage was dispatched to the owner (at most once per run loop turn). */
+	NSUInteger flushes;
+	/*! Number of (merged) rects dispatched to the owner. */
+	NSUInteger rects;
+	/*! Total area (in square points, within the receiver's size) dispatched to the owner. */
+	double area;
+} PhiTextDamageStatistics;
+
+typedef struct {
+	/*! Number of requests for a snapshot satisfied by the latest, without locking the store. */
+	NSUInteger hits;
+	/*! Number of requests for a snapshot that had to lock the store to take a new one. */
+	NSUInteger misses;
+	/*! Number of snapshots taken of rects outside the viewport, which aren't published (so as not to displace the snapshot of the viewport). */
+	NSUInteger unpublished;
+	/*! Number of requests for a snapshot of typeset frames only, taken from frames that were all typeset. */
+	NSUInteger typesetMisses;
+	/*! Number of requests for a snapshot of typeset frames only, refused because a frame in the rect wasn't typeset. */
+	NSUInteger untypesetMisses;
+	/*! Total time spent waiting for the store's lock to take a snapshot (in seconds). */
+	double lockWaitTime;
+	/*! Total time the store's lock was held to take a snapshot (in seconds). */
+	double lockHoldTime;
+} PhiTextSnapshotStatistics;
+
 @interface PhiTextDocument : NSObject {
 @private
 	PhiTextEditorView *owner;
@@ -48,14 +89,33 @@
 	
 	CFDictionaryRef frameAttributes;
 	PhiAATree *textFrames;
+	PhiTextFrameCache *frameCache;
+	PhiTextTileCache *tileCache;
+	PhiTextBoundaryCache *boundaryCache;
+	PhiTextSearch *search;
+	PhiTextAnchorSet *anchors;
+	PhiTextDecorations *decorations;
+	id <PhiTextLayoutEngine> layoutEngine;
 	
 	NSInteger oldLength, diffLength;
 	NSRange invalidRange;
 	PhiAATreeNode *lastValidTextFrameNode;
+	NSUInteger layoutCacheGeneration;
+	NSUInteger layoutEngineCheckGeneration;
 	
 	PhiTextFrame *lastEmptyFrame;
 	
 	PhiTextUndoManager *undoManager;
+	
+	CGRect damageRects[PHI_DAMAGE_RECT_LIMIT];
+	NSUInteger damageCount;
+	BOOL damageFlushPending;
+	NSMutableSet *damagedTextFrames;
+	PhiTextDamageStatistics damageStatistics;
+	
+	PhiTextLayoutSnapshot *layoutSnapshot;
+	PhiTextSnapshotStatistics snapshotStatistics;
+	NSUInteger layoutGeneration;
 }
 
 @property (assign) PhiTextEditorView *owner;
@@ -63,6 +123,19 @@
 @property (retain) PhiTextUndoManager *undoManager;
 
 @property (nonatomic, readonly) PhiAATree *textFrames;
+@property (nonatomic, readonly) PhiTextFrameCache *frameCache;
+/*! Rasterised tiles of the receiver, as drawn by its owner's PhiTextViews; nil if tileCacheBudget was zero when the receiver was created. */
+@property (nonatomic, readonly) PhiTextTileCache *tileCache;
+/*! The word, sentence and paragraph boundaries of the receiver's store, kept up to date with its edits. */
+@property (nonatomic, readonly) PhiTextBoundaryCache *boundaryCache;
+/*! Finds (and replaces) occurrences of a string in the receiver's store; a background search is cancelled when the text changes. */
+@property (nonatomic, readonly) PhiTextSearch *search;
+/*! Locations in the receiver's store that follow its edits (e.g. the ends of the selection). */
+@property (nonatomic, readonly) PhiTextAnchorSet *anchors;
+/*! Paint-only attributes laid over the receiver's text by analysers (e.g. syntax highlighting), without changing its store. */
+@property (nonatomic, readonly) PhiTextDecorations *decorations;
+/*! The typesetter of the receiver's textFrames, an instance of layoutEngineClassName by default; setting it invalidates the document. */
+@property (nonatomic, retain) id <PhiTextLayoutEngine> layoutEngine;
 @property (nonatomic, retain) UIColor *currentColor;
 @property (nonatomic, retain) PhiTextStyle *baseStyle;
 @property (nonatomic, retain) PhiTextStyle *defaultStyle;
@@ -72,11 +145,49 @@
 @property (nonatomic, assign) CGSize size;
 @property (nonatomic, assign) CGFloat tileHeightHint;
 @property (nonatomic, retain, readonly) PhiTextFrame *lastEmptyFrame;
+/*! The latest snapshot of the layout of the viewport, or nil if the layout has changed since it was taken. */
+@property (retain, readonly) PhiTextLayoutSnapshot *layoutSnapshot;
+/*! Incremented whenever the layout of any text frame changes (i.e. whenever the layoutSnapshot is invalidated). */
+@property (readonly) NSUInteger layoutGeneration;
 
 - (void)invalidateDocument;
+/*! Begins looking for the layout of the receiver's text in the PhiTextLayoutCache, in the background; a layout that is found is restored on the main thread, unless the text changed in the meantime. */
+- (void)loadLayoutCache;
+/*! Stores the layout of the receiver's text in the PhiTextLayoutCache. */
+- (BOOL)saveLayoutCache;
 - (CGRect)invalidateTextFrameRange:(PhiAATreeRange *)range;
+/*!
+ Accumulates rect (in the coordinates of the owner, i.e. with padding) as needing display. The damage
+ reported during a turn of the run loop is merged and dispatched to the owner once, by flushDamage.
+ May be called from any thread.
+ */
+- (void)addDamageRect:(CGRect)rect;
+/*! Damages the whole of each edited frame that hasn't been typeset (and so reported the lines that changed) since its edit, and then dispatches the accumulated damage to the owner. */
+- (void)flushDamage;
+- (PhiTextDamageStatistics)damageStatistics;
+- (void)resetDamageStatistics;
+/*!
+ Returns a snapshot of the layout that covers rect (in the coordinates of the document). The latest
+ snapshot is returned, without locking the store, if it covers rect; otherwise the frames in rect
+ (and the viewport, if it intersects rect) are typeset, with the store locked, and a new snapshot
+ of them is taken. The new snapshot is published only if it covers the viewport, so the latest
+ snapshot is always of the viewport. May be called from any thread.
+ */
+- (PhiTextLayoutSnapshot *)layoutSnapshotForRect:(CGRect)rect;
+/*!
+ Like layoutSnapshotForRect:, but nothing is typeset: returns nil unless the frames covering rect are
+ already typeset. The snapshot isn't published. For drawing in the background (e.g. the tile cache's
+ renders), where typesetting must be left to the main thread.
+ */
+- (PhiTextLayoutSnapshot *)typesetLayoutSnapshotForRect:(CGRect)rect;
+/*! Discards the latest snapshot; called whenever the layout of a frame changes. */
+- (void)invalidateLayoutSnapshot;
+- (PhiTextSnapshotStatistics)snapshotStatistics;
+- (void)resetSnapshotStatistics;
 - (CGRect)invalidateDocumentRange:(PhiTextRange *)textRange;
 - (void)textWillChange;
+/*! Called by the store (with it locked) for each edit, with the range replaced (in the coordinates before the edit) and the length of its replacement; moves the anchors and decorations. */
+- (void)textDidReplaceCharactersInRange:(NSRange)range withLength:(NSUInteger)length;
 - (void)textDidChange;
 
 - (CGRect)firstRectForRange:(PhiTextRange *)range;
@@ -126,12 +237,21 @@
 - (void)buildPath:(CGMutablePathRef)path withFirstRect:(CGRect)firstRect toLastRect:(CGRect)lastRect;
 - (void)buildPath:(CGMutablePathRef)path withFirstRect:(CGRect)firstRect toLastRect:(CGRect)lastRect alignPixels:(BOOL)pixelsAligned toView:(UIView *)view;
 - (void)buildPath:(CGMutablePathRef)path forRange:(PhiTextRange *)range alignPixels:(BOOL)pixelsAligned toView:(UIView *)view;
+/*! Constructs the part of the path for range that lies in rect (in the coordinates of the owner, e.g. its
+ visible bounds); an end of the range beyond the frames in rect is not laid out, its line is replaced by
+ an edge of rect. Nothing is added to path if the range doesn't reach the frames in rect.
+ */
+- (void)buildPath:(CGMutablePathRef)path forRange:(PhiTextRange *)range inRect:(CGRect)rect alignPixels:(BOOL)pixelsAligned toView:(UIView *)view;
 
 - (void)addBaseStyle:(PhiTextStyle *)style;
 - (void)addDefaultStyle:(PhiTextStyle *)style;
+/*! The style methods return mutable styles; the internedStyle variants return shared, immutable styles (see PhiTextStyle) for reading attributes without allocating. */
 - (PhiTextStyle *)styleAtEndOfDocument;
 - (PhiTextStyle *)styleAtPosition:(PhiTextPosition *)position inDirection:(UITextStorageDirection)direction;
 - (PhiTextStyle *)styleFromPosition:(PhiTextPosition *)position toFarthestEffectivePosition:(PhiTextPosition **)endPtr notBeyondPosition:(PhiTextPosition *)limitingPosition;
+- (PhiTextStyle *)internedStyleAtEndOfDocument;
+- (PhiTextStyle *)internedStyleAtPosition:(PhiTextPosition *)position inDirection:(UITextStorageDirection)direction;
+- (PhiTextStyle *)internedStyleFromPosition:(PhiTextPosition *)position toFarthestEffectivePosition:(PhiTextPosition **)endPtr notBeyondPosition:(PhiTextPosition *)limitingPosition;
 - (void)setStyle:(PhiTextStyle *)style range:(PhiTextRange *)range;
 - (void)addStyle:(PhiTextStyle *)style range:(PhiTextRange *)range;
 
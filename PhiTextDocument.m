@@ -23,6 +23,16 @@
 #import "PhiTextPosition.h"
 #import "PhiTextRange.h"
 #import "PhiTextFrame.h"
+#import "PhiTextFrameCache.h"
+#import "PhiTextTileCache.h"
+#import "PhiTextBoundaryCache.h"
+#import "PhiTextSearch.h"
+#import "PhiTextAnchorSet.h"
+#import "PhiTextDecorations.h"
+#import "PhiTextLayoutSnapshot.h"
+#import "PhiTextLayoutCache.h"
+#import "PhiTextCoreTextLayoutEngine.h"
+#import "PhiTextMonospaceLayoutEngine.h"
 #import "PhiTextLine.h"
 #import "PhiTextStorage.h"
 #import "PhiTextStyle.h"
@@ -33,12 +43,22 @@
 
 #ifndef PHI_SET_OWNER_NEEDS_DISPLAY_IN_RECT
 #ifdef DEVELOPER
-#define PHI_SET_OWNER_NEEDS_DISPLAY_IN_RECT(_RECT_) NSLog(@"[%i] Updating editor rect: %@", __LINE__, NSStringFromCGRect(_RECT_)),[owner performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:(_RECT_)] waitUntilDone:NO]
+#define PHI_SET_OWNER_NEEDS_DISPLAY_IN_RECT(_RECT_) NSLog(@"[%i] Updating editor rect: %@", __LINE__, NSStringFromCGRect(_RECT_)),[self addDamageRect:(_RECT_)]
 #else
-#define PHI_SET_OWNER_NEEDS_DISPLAY_IN_RECT(_RECT_) [owner performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:(_RECT_)] waitUntilDone:NO]
+#define PHI_SET_OWNER_NEEDS_DISPLAY_IN_RECT(_RECT_) [self addDamageRect:(_RECT_)]
 #endif
 #endif
 
+/*! Damaged rects closer than this (in points) are merged. */
+#ifndef PHI_DAMAGE_MERGE_GAP
+#define PHI_DAMAGE_MERGE_GAP 1.0
+#endif
+
+/*! Delay (in seconds) after the last edit before checking (in the background) whether the whole text can be laid out by a PhiTextMonospaceLayoutEngine. */
+#ifndef PHI_LAYOUT_ENGINE_CHECK_DELAY
+#define PHI_LAYOUT_ENGINE_CHECK_DELAY 1.0
+#endif
+
 #ifndef PHI_CARET_WIDTH
 #define PHI_CARET_WIDTH (2.0)
 #endif
@@ -75,12 +95,79 @@ CGRect PhiUnionRectFrame (CGRect rect, PhiTextFrame *textFrame) {
 	return CGRectUnion(rect, frameRect);
 }
 
+/*! Returns the font of string (not retained) if every run of it has that fixed-pitch font and the same simple paragraph style, and every character takes a single column; otherwise nil. */
+static id PhiMonospaceFontOfString(NSAttributedString *string) {
+	NSUInteger length = [string length];
+	NSRange fontRange, styleRange;
+	id font, paragraphStyle;
+	if (!length)
+		return nil;
+	font = [string attribute:(NSString *)kCTFontAttributeName atIndex:0 longestEffectiveRange:&fontRange inRange:NSMakeRange(0, length)];
+	paragraphStyle = [string attribute:(NSString *)kCTParagraphStyleAttributeName atIndex:0 longestEffectiveRange:&styleRange inRange:NSMakeRange(0, length)];
+	if (fontRange.length == length && styleRange.length == length
+			&& [PhiTextMonospaceLayoutEngine canLayoutFont:(CTFontRef)font]
+			&& [PhiTextMonospaceLayoutEngine canLayoutParagraphStyle:(CTParagraphStyleRef)paragraphStyle]
+			&& [PhiTextMonospaceLayoutEngine canLayoutString:[string string] range:NSMakeRange(0, length)])
+		return font;
+	return nil;
+}
+
 @interface PhiTextDocument ()
 
 - (void)setDefaults;
+- (void)updateLayoutEngine;
+- (void)setLayoutEngineForMonospaceFont:(id)font;
+- (void)layoutDidChangeInRange:(NSRange)range;
+- (void)scheduleLayoutEngineCheck;
+- (void)checkLayoutEngine;
+- (CGRect)invalidateTextFrameRange:(PhiAATreeRange *)range forEditInRange:(NSRange)editRange changeInLength:(NSInteger)diff;
+- (void)scheduleFlushDamage;
+
+@property (retain, readwrite) PhiTextLayoutSnapshot *layoutSnapshot;
 
 @end
 
+/*! Styles handed to clients may be mutated, so an interned style is copied. */
+static PhiTextStyle *PhiMutableStyle(PhiTextStyle *style) {
+	return [style isInterned] ? [[style copy] autorelease] : style;
+}
+
+/*! Returns the rect covering everything below y (in the coordinates of the owner). */
+static CGRect PhiRectBelow(CGFloat y) {
+	if (isnan(y) || isinf(y))
+		y = 0.0;
+	return CGRectMake(CGRectGetMinX(CGRectInfinite), y, CGRectGetWidth(CGRectInfinite), CGRectGetMaxY(CGRectInfinite) - y);
+}
+
+/*! Adds rect to the count rects, merging it with those it touches or, if there is no room, with the nearest. Returns the new count. */
+static NSUInteger PhiAddDamageRect(CGRect *rects, NSUInteger count, CGRect rect) {
+	NSUInteger i = 0, nearest = 0;
+	CGFloat gap, nearestGap = CGFLOAT_MAX;
+	
+	while (i < count) {
+		if (CGRectIntersectsRect(CGRectInset(rects[i], -PHI_DAMAGE_MERGE_GAP, -PHI_DAMAGE_MERGE_GAP), rect)) {
+			rect = CGRectUnion(rect, rects[i]);
+			rects[i] = rects[--count];
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+	if (count == PHI_DAMAGE_RECT_LIMIT) {
+		for (i = 0; i < count; i++) {
+			gap = MAX(CGRectGetMinY(rects[i]) - CGRectGetMaxY(rect), CGRectGetMinY(rect) - CGRectGetMaxY(rects[i]));
+			if (gap < nearestGap) {
+				nearestGap = gap;
+				nearest = i;
+			}
+		}
+		rect = CGRectUnion(rect, rects[nearest]);
+		rects[nearest] = rects[--count];
+	}
+	rects[count++] = rect;
+	return count;
+}
+
 typedef CGFloat (*PhiConvertPixelToViewFunction)(CGFloat points, UIView *view);
 
 static CGFloat PhiFloorPixelToEdge(CGFloat points, UIView *view) {
@@ -148,6 +235,31 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 		
 		CFPreferencesSetAppValue(CFSTR("storageClassName"), CFSTR("PhiTextStorage"), suiteName);
 		
+#ifdef PHI_SYNC_DEFAULTS
+		CFPreferencesAppSynchronize(suiteName);
+#endif
+	}
+	
+	last = CFPreferencesCopyAppValue(CFSTR("layoutEngineClassName"), suiteName);
+	if (last) {
+		CFRelease(last);
+	} else {
+		CFPreferencesSetAppValue(CFSTR("layoutEngineClassName"), CFSTR("PhiTextCoreTextLayoutEngine"), suiteName);
+		
+#ifdef PHI_SYNC_DEFAULTS
+		CFPreferencesAppSynchronize(suiteName);
+#endif
+	}
+	
+	last = CFPreferencesCopyAppValue(CFSTR("monospaceLayout"), suiteName);
+	if (last) {
+		CFRelease(last);
+	} else {
+		anInt = 1;
+		aNumberValue = CFNumberCreate(NULL, kCFNumberIntType, &anInt);
+		CFPreferencesSetAppValue(CFSTR("monospaceLayout"), aNumberValue, suiteName);
+		CFRelease(aNumberValue);
+		
 #ifdef PHI_SYNC_DEFAULTS
 		CFPreferencesAppSynchronize(suiteName);
 #endif
@@ -157,19 +269,26 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 @synthesize owner, store, undoManager, tileHeightHint;
 @synthesize wrap, currentColor, defaultStyle, baseStyle;
 @synthesize paddingLeft, paddingTop, paddingRight, paddingBottom;
+@synthesize layoutSnapshot, layoutGeneration;
 
 - (void)setStore:(PhiTextStorage *)aStore {
 	if (store != aStore) {
 		if (store) {
+			[self saveLayoutCache];
 			[undoManager removeAllActionsWithTarget:store];
 			[self.owner storageWillChange];
+			[self textDidReplaceCharactersInRange:NSMakeRange(0, [store length]) withLength:[aStore length]];
 			[store release];
 		}
 		store = aStore;
+		[boundaryCache setSource:store];
+		[search setStore:store];
 		if (store) {
 			[store retain];
 			[self.owner storageDidChange];
+			[self updateLayoutEngine];
 			[self invalidateDocument];
+			[self loadLayoutCache];
 		}
 	}
 }
@@ -189,10 +308,17 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 }
 
 - (void)textWillChange {
+	[search cancel];
+	layoutCacheGeneration++;
 	oldLength = [[self store] length];
 	[[self owner] textWillChange];
 }
 
+- (void)textDidReplaceCharactersInRange:(NSRange)range withLength:(NSUInteger)length {
+	[anchors textDidReplaceCharactersInRange:range withLength:length];
+	[decorations textDidReplaceCharactersInRange:range withLength:length];
+}
+
 - (void)textDidChange {
 	[[self owner] textDidChange];
 }
@@ -201,6 +327,149 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 - (PhiAATree *)textFrames {
 	return textFrames;
 }
+- (PhiTextFrameCache *)frameCache {
+	return frameCache;
+}
+- (PhiTextTileCache *)tileCache {
+	return tileCache;
+}
+- (PhiTextBoundaryCache *)boundaryCache {
+	return boundaryCache;
+}
+- (PhiTextSearch *)search {
+	return search;
+}
+- (PhiTextAnchorSet *)anchors {
+	return anchors;
+}
+- (PhiTextDecorations *)decorations {
+	return decorations;
+}
+- (id <PhiTextLayoutEngine>)layoutEngine {
+	return layoutEngine;
+}
+- (void)setLayoutEngine:(id <PhiTextLayoutEngine>)engine {
+	if (layoutEngine != engine) {
+		@synchronized(store) {
+			[textFrames removeAllObjects];
+			[self invalidateLayoutSnapshot];
+			lastValidTextFrameNode = nil;
+			[layoutEngine release];
+			layoutEngine = [engine retain];
+		}
+		if (lastEmptyFrame)
+			[lastEmptyFrame invalidateFrame];
+		[self.owner performSelectorOnMainThread:@selector(setNeedsDisplay) withObject:nil waitUntilDone:NO];
+		[self performSelectorInBackground:@selector(calculateContentSize) withObject:nil];
+	}
+}
+/*! Switches to a PhiTextMonospaceLayoutEngine when every run of the text has the same fixed-pitch font
+ and the same simple paragraph style, and every character takes a single column (and monospaceLayout is
+ enabled), otherwise back to an instance of layoutEngineClassName. The whole text is checked on the calling
+ thread; see scheduleLayoutEngineCheck for a check that doesn't hold up the main thread. */
+- (void)updateLayoutEngine {
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	[defaults addSuiteNamed:@"com.phitext"];
+	NSAttributedString *string = [self.store attributedString];
+	
+	if (![string length])
+		return;
+	[self setLayoutEngineForMonospaceFont:[defaults boolForKey:@"monospaceLayout"] ? PhiMonospaceFontOfString(string) : nil];
+}
+/*! Switches to a PhiTextMonospaceLayoutEngine with font, or (if font is nil) back to an instance of layoutEngineClassName. */
+- (void)setLayoutEngineForMonospaceFont:(id)font {
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	[defaults addSuiteNamed:@"com.phitext"];
+	
+	if (font) {
+		if (![(id)layoutEngine isKindOfClass:[PhiTextMonospaceLayoutEngine class]]
+				|| !CFEqual([(PhiTextMonospaceLayoutEngine *)layoutEngine font], (CTFontRef)font)) {
+#ifdef DEVELOPER
+			NSLog(@"[%i] Switching to monospace layout.", __LINE__);
+#endif
+			PhiTextMonospaceLayoutEngine *engine = [[PhiTextMonospaceLayoutEngine alloc] initWithFont:(CTFontRef)font];
+			[self setLayoutEngine:engine];
+			[engine release];
+		}
+	} else if ([(id)layoutEngine isKindOfClass:[PhiTextMonospaceLayoutEngine class]]) {
+		Class layoutEngineClass = NSClassFromString([defaults stringForKey:@"layoutEngineClassName"]);
+		if (![layoutEngineClass conformsToProtocol:@protocol(PhiTextLayoutEngine)]
+				|| [layoutEngineClass isSubclassOfClass:[PhiTextMonospaceLayoutEngine class]])
+			layoutEngineClass = [PhiTextCoreTextLayoutEngine class];
+#ifdef DEVELOPER
+		NSLog(@"[%i] Switching to %@ layout.", __LINE__, NSStringFromClass(layoutEngineClass));
+#endif
+		id <PhiTextLayoutEngine> engine = [[layoutEngineClass alloc] init];
+		[self setLayoutEngine:engine];
+		[engine release];
+	}
+}
+/*! Called (from within the store's lock) when the characters or the attributes of range have changed.
+ A monospace engine only needs the changed range (and its neighbours) checked, and is abandoned as soon as
+ it can't lay them out (the whole text is then checked again, in case it is uniform in another font); any
+ other engine waits for the edits to pause before the whole text is checked. */
+- (void)layoutDidChangeInRange:(NSRange)range {
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	[defaults addSuiteNamed:@"com.phitext"];
+	if (![defaults boolForKey:@"monospaceLayout"])
+		return;
+	
+	layoutEngineCheckGeneration++;
+	if ([(id)layoutEngine isKindOfClass:[PhiTextMonospaceLayoutEngine class]]) {
+		NSUInteger length = [self.store length];
+		NSRange checkRange, fontRange, styleRange;
+		id font, paragraphStyle;
+		BOOL monospace = YES;
+		
+		if (!length)
+			return;
+		checkRange.location = MIN(range.location, length - 1);
+		checkRange.length = MIN(NSMaxRange(range), length) - checkRange.location;
+		// Neighbours too, which (the text having been uniform) must have the same attributes
+		if (checkRange.location > 0) {
+			checkRange.location--;
+			checkRange.length++;
+		}
+		if (NSMaxRange(checkRange) < length)
+			checkRange.length++;
+		font = [self.store attribute:(NSString *)kCTFontAttributeName atIndex:checkRange.location longestEffectiveRange:&fontRange inRange:checkRange];
+		paragraphStyle = [self.store attribute:(NSString *)kCTParagraphStyleAttributeName atIndex:checkRange.location longestEffectiveRange:&styleRange inRange:checkRange];
+		monospace = NSEqualRanges(fontRange, checkRange) && NSEqualRanges(styleRange, checkRange)
+			&& font && CFEqual([(PhiTextMonospaceLayoutEngine *)layoutEngine font], (CTFontRef)font)
+			&& [PhiTextMonospaceLayoutEngine canLayoutParagraphStyle:(CTParagraphStyleRef)paragraphStyle]
+			&& [PhiTextMonospaceLayoutEngine canLayoutString:[self.store string] range:checkRange];
+		if (!monospace) {
+			[self performSelectorOnMainThread:@selector(setLayoutEngineForMonospaceFont:) withObject:nil waitUntilDone:NO];
+			[self performSelectorOnMainThread:@selector(scheduleLayoutEngineCheck) withObject:nil waitUntilDone:NO];
+		}
+	} else {
+		[self performSelectorOnMainThread:@selector(scheduleLayoutEngineCheck) withObject:nil waitUntilDone:NO];
+	}
+}
+- (void)scheduleLayoutEngineCheck {
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(checkLayoutEngine) object:nil];
+	[self performSelector:@selector(checkLayoutEngine) withObject:nil afterDelay:PHI_LAYOUT_ENGINE_CHECK_DELAY];
+}
+/*! Checks a snapshot of the whole text in the background, so that a large document doesn't hold up the main thread. */
+- (void)checkLayoutEngine {
+	[self performSelectorInBackground:@selector(checkLayoutEngineOfGeneration:) withObject:[NSNumber numberWithUnsignedInteger:layoutEngineCheckGeneration]];
+}
+- (void)checkLayoutEngineOfGeneration:(NSNumber *)generation {
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	NSAttributedString *string = [self.store attributedString];
+	id font = PhiMonospaceFontOfString(string);
+	// An empty text keeps its engine, as in updateLayoutEngine
+	if ([string length])
+		[self performSelectorOnMainThread:@selector(layoutEngineCheckDidFinish:) withObject:[NSArray arrayWithObjects:generation, font ? font : [NSNull null], nil] waitUntilDone:NO];
+	[pool release];
+}
+/*! The result of a check is dropped if the text was edited since its snapshot was taken; the edit scheduled another check. */
+- (void)layoutEngineCheckDidFinish:(NSArray *)result {
+	id font = [result objectAtIndex:1];
+	if ([[result objectAtIndex:0] unsignedIntegerValue] != layoutEngineCheckGeneration)
+		return;
+	[self setLayoutEngineForMonospaceFont:font == [NSNull null] ? nil : font];
+}
 - (CGRect)suggestTileBounds {
 	CGRect rv = CGRectMake(0, 0, wrap?self.bounds.size.width:CGFLOAT_MAX, MIN(MAX([self tileHeightHint], 0.0), self.owner.bounds.size.height));
 	
@@ -257,16 +526,25 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	self.undoManager = [[[PhiTextUndoManager alloc] init] autorelease];
 
 	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(reloadDefaults) name:NSUserDefaultsDidChangeNotification object:nil];
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(saveLayoutCache) name:UIApplicationDidEnterBackgroundNotification object:nil];
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(saveLayoutCache) name:UIApplicationWillTerminateNotification object:nil];
 }
 
 - (void)reloadDefaults {
 	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
 	[defaults addSuiteNamed:@"com.phitext"];
 	
+	if (frameCache.budget != [defaults integerForKey:@"textFrameCacheBudget"]) {
+		frameCache.budget = [defaults integerForKey:@"textFrameCacheBudget"];
+	}
+	if (tileCache.budget != [defaults integerForKey:@"tileCacheBudget"]) {
+		tileCache.budget = [defaults integerForKey:@"tileCacheBudget"];
+	}
 	if (tileHeightHint != [defaults floatForKey:@"frameTileHeightHint"]) {
 		tileHeightHint = [defaults floatForKey:@"frameTileHeightHint"];
 		
 		[textFrames removeAllObjects];
+		[self invalidateLayoutSnapshot];
 		
 		[self invalidateDocument];
 	}
@@ -713,6 +991,34 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	
 	[self buildPath:path withFirstRect:firstRect toLastRect:lastRect alignPixels:pixelsAligned toView:view];
 }
+- (void)buildPath:(CGMutablePathRef)path forRange:(PhiTextRange *)range inRect:(CGRect)rect alignPixels:(BOOL)pixelsAligned toView:(UIView *)view {
+	PhiTextPosition *firstVisible, *lastVisible;
+	CGRect firstRect, lastRect;
+	BOOL firstClipped, lastClipped;
+
+	// The text of the frames at the corners of rect, as in caretRectForPosition:selectionAffinity:autoExpand:inRect:
+	firstVisible = (PhiTextPosition *)[[[[self searchLineWithPoint:CGPointMake(CGRectGetMinX(rect), CGRectGetMinY(rect))] frame] textRange] start];
+	lastVisible = (PhiTextPosition *)[[[[self searchLineWithPoint:CGPointMake(CGRectGetMaxX(rect), CGRectGetMaxY(rect))] frame] textRange] end];
+	if (firstVisible && [(PhiTextPosition *)[range end] compare:firstVisible] == NSOrderedAscending)
+		return;
+	if (lastVisible && [(PhiTextPosition *)[range start] compare:lastVisible] == NSOrderedDescending)
+		return;
+	firstClipped = firstVisible && [(PhiTextPosition *)[range start] compare:firstVisible] == NSOrderedAscending;
+	lastClipped = lastVisible && [(PhiTextPosition *)[range end] compare:lastVisible] == NSOrderedDescending;
+
+	if (firstClipped)
+		firstRect = CGRectMake(CGRectGetMinX(self.bounds), CGRectGetMinY(rect) - 1.0, 0.0, 1.0);
+	else
+		firstRect = [self firstRectForRange:range];
+	if (lastClipped)
+		lastRect = CGRectMake(CGRectGetMaxX(self.bounds), CGRectGetMaxY(rect), 0.0, 1.0);
+	else if (PhiRangeLength(range))
+		lastRect = [self lastRectForRange:range];
+	else
+		lastRect = firstRect;
+
+	[self buildPath:path withFirstRect:firstRect toLastRect:lastRect alignPixels:pixelsAligned toView:view];
+}
 
 #pragma mark Hit Testing Methods
 
@@ -808,6 +1114,18 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 		store = [[storageClass alloc] init];
 		store.owner = self;
 		textFrames = [[PhiAATree alloc] init];
+		frameCache = [[PhiTextFrameCache alloc] init];
+		damagedTextFrames = [[NSMutableSet alloc] init];
+		if ([defaults integerForKey:@"tileCacheBudget"])
+			tileCache = [[PhiTextTileCache alloc] init];
+		boundaryCache = [[PhiTextBoundaryCache alloc] initWithSource:store];
+		search = [[PhiTextSearch alloc] initWithStore:store];
+		anchors = [[PhiTextAnchorSet alloc] init];
+		decorations = [[PhiTextDecorations alloc] initWithDocument:self];
+		Class layoutEngineClass = NSClassFromString([defaults stringForKey:@"layoutEngineClassName"]);
+		if (![layoutEngineClass conformsToProtocol:@protocol(PhiTextLayoutEngine)])
+			layoutEngineClass = [PhiTextCoreTextLayoutEngine class];
+		layoutEngine = [[layoutEngineClass alloc] init];
 		[self setDefaults];
 	}
 	return self;
@@ -832,13 +1150,18 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 }
 
 - (void)invalidateDocument {
+	[boundaryCache invalidate];
+	[search cancel];
+	layoutCacheGeneration++;
 	if ([textFrames count]) {
 #ifdef TRACE
 		NSLog(@"%@Entering %s...", traceIndent, __FUNCTION__);
 #endif
 		@synchronized(store) {
 			[textFrames removeAllObjects];
+			[self invalidateLayoutSnapshot];
 		}
+		[self updateLayoutEngine];
 #ifdef DEVELOPER
 		NSLog(@"[%i] Updating editor.", __LINE__);
 #endif
@@ -850,16 +1173,106 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	}
 }
 
+- (void)loadLayoutCache {
+	PhiTextLayoutCache *layoutCache = [PhiTextLayoutCache sharedLayoutCache];
+	NSDictionary *request;
+	if ([store length] < [layoutCache minimumLength])
+		return;
+	// Hashing the text and reading the file are left to a background thread, with a copy of the text
+	request = [NSDictionary dictionaryWithObjectsAndKeys:
+			   [store attributedString], @"text",
+			   [NSNumber numberWithUnsignedLongLong:[layoutCache styleHashOfDocument:self]], @"styleHash",
+			   [NSValue valueWithCGSize:[self suggestTileBounds].size], @"tileSize",
+			   [NSNumber numberWithUnsignedInteger:layoutCacheGeneration], @"generation",
+			   nil];
+	[self performSelectorInBackground:@selector(findLayoutCache:) withObject:request];
+}
+- (void)findLayoutCache:(NSDictionary *)request {
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	NSMutableDictionary *result;
+	NSData *layout = [[PhiTextLayoutCache sharedLayoutCache] layoutOfText:[request objectForKey:@"text"]
+																styleHash:[[request objectForKey:@"styleHash"] unsignedLongLongValue]
+																 tileSize:[[request objectForKey:@"tileSize"] CGSizeValue]];
+	if (layout) {
+		result = [NSMutableDictionary dictionaryWithDictionary:request];
+		[result removeObjectForKey:@"text"];
+		[result setObject:layout forKey:@"layout"];
+		[self performSelectorOnMainThread:@selector(restoreLayoutCache:) withObject:result waitUntilDone:NO];
+	}
+	[pool release];
+}
+/*! Replaces the receiver's textFrames with the (untypeset) frames of a cached layout, unless the text has changed since it was requested; the frames are typeset lazily as they become visible. */
+- (void)restoreLayoutCache:(NSDictionary *)result {
+	CGSize contentSize = CGSizeZero;
+	NSArray *cachedFrames;
+	NSUInteger length, end;
+
+	if ([[result objectForKey:@"generation"] unsignedIntegerValue] != layoutCacheGeneration)
+		return;
+	cachedFrames = [[PhiTextLayoutCache sharedLayoutCache] textFramesWithLayout:[result objectForKey:@"layout"] forDocument:self contentSize:&contentSize];
+	if (![cachedFrames count])
+		return;
+
+	@synchronized(store) {
+		[textFrames removeAllObjects];
+		[self invalidateLayoutSnapshot];
+		[textFrames addObjects:cachedFrames];
+		// Only the frames that were saved are valid, the rest of the text is typeset (into new frames) as it is needed
+		lastValidTextFrameNode = [textFrames lastNode];
+		length = [store length];
+		end = NSMaxRange([[cachedFrames lastObject] rangeValue]);
+		invalidRange = NSMakeRange(end, length - end);
+		diffLength = 0;
+	}
+	[self setSize:contentSize invalidate:NO];
+#ifdef DEVELOPER
+	NSLog(@"[%i] Updating editor.", __LINE__);
+#endif
+	[self.owner performSelectorOnMainThread:@selector(setNeedsDisplay) withObject:nil waitUntilDone:NO];
+}
+
+/*! Persists the metrics of the receiver's valid textFrames to the layout cache. */
+- (BOOL)saveLayoutCache {
+	NSMutableArray *validFrames = nil;
+	@synchronized(store) {
+		if (lastValidTextFrameNode) {
+			validFrames = [NSMutableArray array];
+			for (PhiAATreeNode *node = [textFrames firstNode]; node; node = node.next) {
+				[validFrames addObject:node.object];
+				if (node == lastValidTextFrameNode)
+					break;
+			}
+		}
+	}
+	if (![validFrames count])
+		return NO;
+	return [[PhiTextLayoutCache sharedLayoutCache] storeTextFrames:validFrames forDocument:self tileSize:[self suggestTileBounds].size contentSize:[self size]];
+}
+
 - (CGRect)invalidateTextFrameRange:(PhiAATreeRange *)range {
+	return [self invalidateTextFrameRange:range forEditInRange:NSMakeRange(NSNotFound, 0) changeInLength:0];
+}
+/*! As invalidateTextFrameRange:, but visible frames that are typeset keep their lines, so that only
+ the lines changed by the edit are damaged when the frame is next typeset (or the whole frame, if it
+ isn't typeset by the next flushDamage); the returned rect excludes such frames. */
+- (CGRect)invalidateTextFrameRange:(PhiAATreeRange *)range forEditInRange:(NSRange)editRange changeInLength:(NSInteger)diff {
 #ifdef TRACE
 	NSLog(@"%@Entering -[%@ %@:%@]...", traceIndent, NSStringFromClass([self class]), NSStringFromSelector(_cmd), range);
 #endif
 	CGRect invalidRect = CGRectNull;
+	CGRect viewport = [frameCache viewport];
 	BOOL hasLastEmptyFrame = [self lastEmptyFrame] == self.textFrames.lastObject;
 	if (![[self textFrames] isEmpty] && ![range isEmpty]) {
 		for (PhiTextFrame *frame in range) {
-			invalidRect = PhiUnionRectFrame(invalidRect, frame);
-			[frame invalidateFrame];
+			if (editRange.location != NSNotFound && frame != [self lastEmptyFrame]
+				&& CGRectIntersectsRect(viewport, [frame CGRectValue])
+				&& [frame invalidateFrameForEditInRange:editRange changeInLength:diff]) {
+				[damagedTextFrames addObject:frame];
+				[self scheduleFlushDamage];
+			} else {
+				invalidRect = PhiUnionRectFrame(invalidRect, frame);
+				[frame invalidateFrame];
+			}
 
 			if (hasLastEmptyFrame) {
 				if (frame == [self lastEmptyFrame]) {
@@ -968,16 +1381,37 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	if (!textFrames.empty) {
 		PhiAATreeRange *range;// = NSMakeRange(0, 0);
 		range = [PhiAATreeRange rangeForAATree:textFrames withEnclosingObject:textRange withComparator:(CFComparatorFunction)PhiTextFrameCompareByRange];
-		invalidRect = [self invalidateTextFrameRange:range];
+		invalidRect = [self invalidateTextFrameRange:range forEditInRange:[textRange range] changeInLength:diff];
 		[self takeFromLastValidTextFrameNode:range.start.previous];
 	}
+	[boundaryCache textDidChangeInRange:[textRange range] changeInLength:diff];
 	diffLength += diff;
 	invalidRange = NSUnionRange(invalidRange, NSMakeRange(PhiRangeOffset(textRange) + (diff<0?diff:0), ABS(diff)));
 	return invalidRect;
 }
 - (CGRect)invalidateDocumentNSRange:(NSRange)range {
+	[self layoutDidChangeInRange:range];
 	return [self invalidateDocumentRange:[PhiTextRange textRangeWithRange:range]];
 }
+/*! Unlike invalidateDocumentNSRange:, the frames in the range keep their layout and are only repainted
+ (with the current paint-only attributes of the text), provided that the layoutEngine can do so. */
+- (CGRect)invalidateDocumentPaintNSRange:(NSRange)range {
+	if (![layoutEngine respondsToSelector:@selector(drawFrame:withPaintFromAttributedString:inContext:)])
+		return [self invalidateDocumentNSRange:range];
+#ifdef DEVELOPER
+	NSLog(@"%@Entering -[%@ %@:%@]...", traceIndent, NSStringFromClass([self class]), NSStringFromSelector(_cmd), NSStringFromRange(range));
+#endif
+	CGRect invalidRect = CGRectNull;
+	if (!textFrames.empty) {
+		PhiAATreeRange *frameRange;
+		frameRange = [PhiAATreeRange rangeForAATree:textFrames withEnclosingObject:[PhiTextRange textRangeWithRange:range] withComparator:(CFComparatorFunction)PhiTextFrameCompareByRange];
+		for (PhiTextFrame *frame in frameRange) {
+			invalidRect = PhiUnionRectFrame(invalidRect, frame);
+			[frame invalidatePaint];
+		}
+	}
+	return CGRectOffset(invalidRect, self.paddingLeft, self.paddingTop);
+}
 - (void)setSize:(CGSize)size invalidate:(BOOL)invalidate {
 	CGSize contentSize = [self size];
 	if (!CGSizeEqualToSize(contentSize, size)) {
@@ -1073,6 +1507,188 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	}
 }
 
+#pragma mark Damage Methods
+
+- (void)scheduleFlushDamage {
+	@synchronized(self) {
+		if (!damageFlushPending) {
+			damageFlushPending = YES;
+			[self performSelectorOnMainThread:@selector(flushDamage) withObject:nil waitUntilDone:NO];
+		}
+	}
+}
+- (void)addDamageRect:(CGRect)rect {
+	if (CGRectIsNull(rect) || CGRectIsEmpty(rect))
+		return;
+	@synchronized(self) {
+		damageStatistics.reports++;
+		damageCount = PhiAddDamageRect(damageRects, damageCount, rect);
+	}
+	[self scheduleFlushDamage];
+}
+- (void)flushDamage {
+	CGRect rects[PHI_DAMAGE_RECT_LIMIT], bounds;
+	NSUInteger i, count;
+	NSArray *frames = nil;
+
+	@synchronized(store) {
+		if ([damagedTextFrames count]) {
+			frames = [damagedTextFrames allObjects];
+			[damagedTextFrames removeAllObjects];
+			// The frames typeset since the edit (e.g. for the caret) have reported the lines that changed;
+			// the rest are damaged entirely, and left to be typeset when they are displayed
+			for (PhiTextFrame *textFrame in frames)
+				[textFrame discardStaleLineExtents];
+		}
+	}
+
+	@synchronized(self) {
+		count = damageCount;
+		memcpy(rects, damageRects, count * sizeof(CGRect));
+		damageCount = 0;
+		damageFlushPending = NO;
+		if (count) {
+			bounds.origin = CGPointZero;
+			bounds.size = [self size];
+			damageStatistics.flushes++;
+			damageStatistics.rects += count;
+			for (i = 0; i < count; i++) {
+				CGRect visible = CGRectIntersection(rects[i], bounds);
+				if (!CGRectIsNull(visible))
+					damageStatistics.area += visible.size.width * visible.size.height;
+			}
+		}
+	}
+
+#ifdef DEVELOPER
+	NSLog(@"Dispatching %u damaged rects.", count);
+#endif
+	if (count)
+		[owner setNeedsDisplayInRects:rects count:count];
+}
+- (PhiTextDamageStatistics)damageStatistics {
+	PhiTextDamageStatistics rv;
+	@synchronized(self) {
+		rv = damageStatistics;
+	}
+	return rv;
+}
+- (void)resetDamageStatistics {
+	@synchronized(self) {
+		memset(&damageStatistics, 0, sizeof(damageStatistics));
+	}
+}
+
+#pragma mark Snapshot Methods
+
+- (PhiTextLayoutSnapshot *)layoutSnapshotForRect:(CGRect)rect {
+	PhiTextLayoutSnapshot *snapshot = self.layoutSnapshot;
+	if (snapshot && CGRectContainsRect([snapshot rect], rect)) {
+		@synchronized(self) {
+			snapshotStatistics.hits++;
+		}
+		return snapshot;
+	}
+
+	CFAbsoluteTime waiting = CFAbsoluteTimeGetCurrent(), holding;
+	BOOL unpublished = NO;
+	@synchronized(store) {
+		holding = CFAbsoluteTimeGetCurrent();
+		// Another thread may have taken the snapshot while we waited
+		snapshot = self.layoutSnapshot;
+		if (!snapshot || !CGRectContainsRect([snapshot rect], rect)) {
+			// Only a snapshot of the viewport is published, so that the tiles outside it don't displace the visible ones
+			CGRect viewport = [frameCache viewport];
+			BOOL visible = CGRectIsNull(viewport) || CGRectIntersectsRect(viewport, rect);
+			if (visible && !CGRectIsNull(viewport))
+				rect = CGRectUnion(viewport, rect);
+			PhiAATreeRange *textFrameRange = [self beginContentAccessInRect:rect updateDisplay:NO];
+			snapshot = [[[PhiTextLayoutSnapshot alloc] initWithTextFrameRange:textFrameRange inRect:rect ofDocument:self] autorelease];
+			for (PhiTextFrame *textFrame in textFrameRange)
+				[textFrame endContentAccess];
+			if (visible)
+				self.layoutSnapshot = snapshot;
+			else
+				unpublished = YES;
+		}
+		@synchronized(self) {
+			snapshotStatistics.misses++;
+			if (unpublished)
+				snapshotStatistics.unpublished++;
+			snapshotStatistics.lockWaitTime += holding - waiting;
+			snapshotStatistics.lockHoldTime += CFAbsoluteTimeGetCurrent() - holding;
+		}
+	}
+	return snapshot;
+}
+- (PhiTextLayoutSnapshot *)typesetLayoutSnapshotForRect:(CGRect)rect {
+	PhiTextLayoutSnapshot *snapshot = self.layoutSnapshot;
+	PhiAATreeNode *node, *first = nil, *last = nil;
+	PhiTextFrame *textFrame;
+	CFIndex end = -1;
+	BOOL covered = NO;
+
+	if (snapshot && CGRectContainsRect([snapshot rect], rect)) {
+		@synchronized(self) {
+			snapshotStatistics.hits++;
+		}
+		return snapshot;
+	}
+
+	snapshot = nil;
+	@synchronized(store) {
+		if (![textFrames isEmpty]) {
+			node = [textFrames nodeClosestToObject:[NSValue valueWithCGRect:rect]
+										   inRange:[PhiAATreeRange rangeWithStartNode:[textFrames firstNode] andEndNode:[self lastValidTextFrameNode]]
+									withComparator:(CFComparatorFunction)PhiTextFrameCompareByRect reverse:NO];
+			if (node && CGRectGetMinY([node.object CGRectValue]) <= CGRectGetMinY(rect)) {
+				// Only frames that are typeset (and follow one another) down to the bottom of rect, or the end of the text
+				for (; node && !covered; node = node.next) {
+					textFrame = node.object;
+					if (textFrame != [self lastEmptyFrame]) {
+						if (![textFrame isContentTypeset] || (end >= 0 && PhiFrameOffset(textFrame) != end))
+							break;
+						end = PhiPositionOffset([[textFrame textRange] end]);
+					}
+					if (!first)
+						first = node;
+					last = node;
+					covered = textFrame == [self lastEmptyFrame]
+						|| end >= (CFIndex)[store length]
+						|| CGRectGetMaxY([textFrame CGRectValue]) >= CGRectGetMaxY(rect);
+				}
+			}
+			if (covered)
+				snapshot = [[[PhiTextLayoutSnapshot alloc] initWithTextFrameRange:[PhiAATreeRange rangeWithStartNode:first andEndNode:last]
+																		   inRect:rect ofDocument:self] autorelease];
+		}
+	}
+	@synchronized(self) {
+		if (snapshot)
+			snapshotStatistics.typesetMisses++;
+		else
+			snapshotStatistics.untypesetMisses++;
+	}
+	return snapshot;
+}
+- (void)invalidateLayoutSnapshot {
+	layoutGeneration++;
+	if (layoutSnapshot)
+		self.layoutSnapshot = nil;
+}
+- (PhiTextSnapshotStatistics)snapshotStatistics {
+	PhiTextSnapshotStatistics rv;
+	@synchronized(self) {
+		rv = snapshotStatistics;
+	}
+	return rv;
+}
+- (void)resetSnapshotStatistics {
+	@synchronized(self) {
+		memset(&snapshotStatistics, 0, sizeof(snapshotStatistics));
+	}
+}
+
 /*!
  */
 - (PhiAATreeRange *)beginContentAccessInRect:(CGRect)rect updateDisplay:(BOOL)shouldUpdateDisplay {
@@ -1176,14 +1792,11 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 		lastNode = firstNode;
 		// Lob off any old frames
 		while ([firstNode.object rangeValue].location > [[self store] length]) {
+			invalidRect = PhiRectBelow(CGRectGetMinY([lastNode.object CGRectValue]));
 			firstNode = firstNode.previous;
 			[textFrames pruneAtNode:lastNode];
 			lastNode = firstNode;
-			//TODO: finer setNeedsDisplay...
-#ifdef DEVELOPER
-			NSLog(@"[%i] Updating editor.", __LINE__);
-#endif
-			[self.owner performSelectorOnMainThread:@selector(setNeedsDisplay) withObject:nil waitUntilDone:NO];
+			PHI_WILL_OWNER_NEED_DISPLAY_IN_RECT_AND_RANGE(invalidRect);
 			[self.owner performSelectorOnMainThread:@selector(setNeedsLayout) withObject:nil waitUntilDone:NO];
 		}
 		// Find last frame (sequential search (starting at first frame), create frames if needed)
@@ -1272,6 +1885,8 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 				textFrame = (PhiTextFrame *)lastNode.object;
 				
 				invalidRect = [textFrame CGRectValue];
+				// A frame that kept its lines reports its own (line) damage when typeset
+				BOOL reportsLineDamage = [textFrame hasStaleLineExtents];
 				if (CGRectEqualToRect(invalidRect, CGRectNull)
 					|| !CGPointEqualToPoint(invalidRect.origin, tileBounds.origin)) {
 					//TODO: setNeeds(Display|Layout) on owner
@@ -1280,8 +1895,9 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 					textFrame.origin = tileBounds.origin;
 					invalidRect = PhiUnionRectFrame(invalidRect, textFrame);
 					PHI_WILL_OWNER_NEED_DISPLAY_IN_RECT_AND_RANGE(invalidRect);
-				} else if (diffLength // need to check diffLength since rect will not always change (consider one line per frame)
-						   || !CGRectEqualToRect(invalidRect, [textFrame rect])) {
+				} else if (!reportsLineDamage
+						   && (diffLength // need to check diffLength since rect will not always change (consider one line per frame)
+							   || !CGRectEqualToRect(invalidRect, [textFrame rect]))) {
 					invalidRect = PhiUnionRectFrame(invalidRect, textFrame);
                     if (shouldUpdateDisplay)
                         PHI_WILL_OWNER_NEED_DISPLAY_IN_RECT_AND_RANGE(invalidRect);
@@ -1303,12 +1919,9 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 				PHI_WILL_OWNER_NEED_DISPLAY_IN_RECT_AND_RANGE(invalidRect);
 			}
 			if (startIndex >= [[self store] length] && lastNode.next && lastNode.next.object != [self lastEmptyFrame]) {
+				invalidRect = PhiRectBelow(CGRectGetMaxY([lastNode.object CGRectValue]));
 				[textFrames pruneAtNode:lastNode.next];
-				//TODO: finer setNeedsDisplay...
-#ifdef DEVELOPER
-				NSLog(@"[%i] Updating editor.", __LINE__);
-#endif
-				[self.owner performSelectorOnMainThread:@selector(setNeedsDisplay) withObject:nil waitUntilDone:NO];
+				PHI_WILL_OWNER_NEED_DISPLAY_IN_RECT_AND_RANGE(invalidRect);
 				[self.owner performSelectorOnMainThread:@selector(setNeedsLayout) withObject:nil waitUntilDone:NO];
 			}
 			
@@ -1455,7 +2068,6 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 #ifdef TRACE
 	NSLog(@"%@Entering %s...", traceIndent, __FUNCTION__);
 #endif
-	CTFramesetterRef framesetter;
 	CGSize size;
 
 	if (constraints.width != CGFLOAT_MAX)
@@ -1463,9 +2075,7 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	if (constraints.height != CGFLOAT_MAX)
 		constraints.height -= self.paddingTop + self.paddingBottom;
 	
-	framesetter = CTFramesetterCreateWithAttributedString((CFAttributedStringRef)[self.store attributedString]);
-	size = CTFramesetterSuggestFrameSizeWithConstraints(framesetter, CFRangeMake(0, 0), NULL, constraints, NULL);
-	CFRelease(framesetter);
+	size = [layoutEngine suggestFrameSizeWithAttributedString:[self.store attributedString] range:CFRangeMake(0, 0) attributes:nil constraints:constraints];
 	
 	if (0.0 >= size.width || size.width > constraints.width)
 		size.width = constraints.width;
@@ -1507,14 +2117,14 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	[self setDefaultStyle:[[self defaultStyle] styleWithAddedStyle:style]];
 }
 
-- (PhiTextStyle *)styleAtEndOfDocument {
+- (PhiTextStyle *)internedStyleAtEndOfDocument {
 	PhiTextStyle *style;
 	if (![self.store length]) {
 		style = [self defaultStyle];
 	} else {
 		NSDictionary *attributes;
 		attributes = [self.store attributesAtIndex:[self.store length] - 1 effectiveRange:NULL];
-		style = [PhiTextStyle styleWithDictionary:attributes];
+		style = [PhiTextStyle internedStyleWithDictionary:attributes];
 	}	
 	return style;
 }
@@ -1541,7 +2151,7 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	
 	return style;
 }
-- (PhiTextStyle *)styleFromPosition:(PhiTextPosition *)position toFarthestEffectivePosition:(PhiTextPosition **)endPtr notBeyondPosition:(PhiTextPosition *)limitingPosition {
+- (PhiTextStyle *)internedStyleFromPosition:(PhiTextPosition *)position toFarthestEffectivePosition:(PhiTextPosition **)endPtr notBeyondPosition:(PhiTextPosition *)limitingPosition {
 	PhiTextStyle *style;
 	PhiTextRange *rod = [self textRangeOfDocument];
 	if ([position isEqual:[rod end]]) {
@@ -1559,12 +2169,12 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 			attributes = [self.store attributesAtIndex:PhiPositionOffset(position) effectiveRange:NULL];
 		}
 		
-		style = [PhiTextStyle styleWithDictionary:attributes];
+		style = [PhiTextStyle internedStyleWithDictionary:attributes];
 	}	
 	
 	return style;
 }
-- (PhiTextStyle *)styleAtPosition:(PhiTextPosition *)position inDirection:(UITextStorageDirection)direction {
+- (PhiTextStyle *)internedStyleAtPosition:(PhiTextPosition *)position inDirection:(UITextStorageDirection)direction {
 	PhiTextStyle *style;
 	PhiTextRange *rod = [self textRangeOfDocument];
 	if (![self.store length]
@@ -1577,12 +2187,22 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 		} else {
 			attributes = [self.store attributesAtIndex:PhiPositionOffset(position) effectiveRange:NULL];
 		}
-		style = [PhiTextStyle styleWithDictionary:attributes];
+		style = [PhiTextStyle internedStyleWithDictionary:attributes];
 	}	
 	
 	return style;
 }
 
+- (PhiTextStyle *)styleAtEndOfDocument {
+	return PhiMutableStyle([self internedStyleAtEndOfDocument]);
+}
+- (PhiTextStyle *)styleFromPosition:(PhiTextPosition *)position toFarthestEffectivePosition:(PhiTextPosition **)endPtr notBeyondPosition:(PhiTextPosition *)limitingPosition {
+	return PhiMutableStyle([self internedStyleFromPosition:position toFarthestEffectivePosition:endPtr notBeyondPosition:limitingPosition]);
+}
+- (PhiTextStyle *)styleAtPosition:(PhiTextPosition *)position inDirection:(UITextStorageDirection)direction {
+	return PhiMutableStyle([self internedStyleAtPosition:position inDirection:direction]);
+}
+
 - (void)setStyle:(PhiTextStyle *)style range:(PhiTextRange *)range {
 	PhiTextRange *rod = [self textRangeOfDocument];
 	if ([[range end] isEqual:[rod end]])
@@ -1590,6 +2210,7 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	if ([range length]) {
 		[self.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerStylingGroupingType];
 		[self.store setAttributes:(NSDictionary *)style.attributes range:PhiRangeRange(range)];
+		[self updateLayoutEngine];
 	} //else TODO: redisplay caret and/or line with new line height
 }
 
@@ -1600,6 +2221,7 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 	if ([range length]) {
 		[self.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerStylingGroupingType];
 		[self.store addAttributes:(NSDictionary *)style.attributes range:PhiRangeRange(range)];
+		[self updateLayoutEngine];
 	} //else TODO: redisplay caret and/or line with new line height
 }
 
@@ -1627,6 +2249,46 @@ static CGFloat PhiCeilPixelToCenter(CGFloat points, UIView *view) {
 		[lastEmptyFrame release];
 		lastEmptyFrame = nil;
 	}
+	if (frameCache) {
+		// The frames released by the cache ask the document for it as they are deallocated
+		PhiTextFrameCache *oldFrameCache = frameCache;
+		frameCache = nil;
+		[oldFrameCache release];
+	}
+	if (tileCache) {
+		[tileCache release];
+		tileCache = nil;
+	}
+	if (boundaryCache) {
+		[boundaryCache release];
+		boundaryCache = nil;
+	}
+	if (search) {
+		[search cancel];
+		[search release];
+		search = nil;
+	}
+	if (anchors) {
+		[anchors release];
+		anchors = nil;
+	}
+	if (decorations) {
+		[decorations setDocument:nil];
+		[decorations release];
+		decorations = nil;
+	}
+	if (damagedTextFrames) {
+		[damagedTextFrames release];
+		damagedTextFrames = nil;
+	}
+	if (layoutSnapshot) {
+		[layoutSnapshot release];
+		layoutSnapshot = nil;
+	}
+	if (layoutEngine) {
+		[layoutEngine release];
+		layoutEngine = nil;
+	}
 	[self setBaseStyle:nil];
 	[self setDefaultStyle:nil];
 	[self setCurrentColor:nil];
@@ -29,17 +29,29 @@
 @class PhiTextDocument;
 @class PhiTextView;
 @class PhiTextSelectionView;
+@class PhiTextMarkedTextView;
+@class PhiTextAnchor;
 @class PhiTextMagnifier;
 @class PhiTextSelectionHandleRecognizer;
 @class PhiTextRange;
 @class PhiTextPosition;
 @class PhiTextStyle;
+@class PhiTextLayoutPrefetcher;
 @protocol PhiTextSelectionViewDelegate;
 
 #ifndef PHI_CLAMP
 #define PHI_CLAMP(X, X_MIN, X_MAX) (MIN(MAX(X, X_MIN), X_MAX))
 #endif
 
+/*! Number of UTF-16 code units of pasted text inserted as a unit; longer pastes are inserted over several turns of the run loop. */
+#ifndef PHI_PASTE_CHUNK_LENGTH
+#define PHI_PASTE_CHUNK_LENGTH 32768
+#endif
+/*! Time (in seconds) spent inserting chunks of a paste in a turn of the run loop, before yielding to layout, display and events. */
+#ifndef PHI_PASTE_CHUNK_INTERVAL
+#define PHI_PASTE_CHUNK_INTERVAL 0.016
+#endif
+
 /*!
     @enum       PhiTextStorageDirection
     @abstract   Compatible with UITextStorageDirection
@@ -55,6 +67,69 @@ typedef enum {
     PhiTextStorageDirectionBackward
 } PhiTextStorageDirection;
 
+/*! The range of rows and columns of the grid of tiles (of size tileWidthHint by tileHeightHint) that are laid out; empty when maxRow < minRow. */
+typedef struct {
+	NSInteger minRow, maxRow;
+	NSInteger minColumn, maxColumn;
+} PhiTextTileGrid;
+
+typedef struct {
+	/*! Number of times the tiles were laid out. */
+	NSUInteger layouts;
+	/*! Total time spent laying out tiles (in seconds). */
+	double layoutTime;
+	/*! Number of tiles that entered the buffered bounds. */
+	NSUInteger tilesAdded;
+	/*! Number of tiles that left the buffered bounds. */
+	NSUInteger tilesRemoved;
+	/*! Number of entering tiles taken from the reuse pool with their content intact (i.e. for the same cell). */
+	NSUInteger tilesRestored;
+	/*! Number of entering tiles taken from the reuse pool for a different cell (and so redrawn). */
+	NSUInteger tilesRecycled;
+	/*! Number of entering tiles allocated. */
+	NSUInteger tilesAllocated;
+	/*! Number of reusable tiles released to stay within the limit, the budget or after a memory warning. */
+	NSUInteger evictions;
+	/*! Number of tiles laid out (visible or buffered) after the last layout. */
+	NSUInteger tilesLive;
+	/*! Number of tiles kept for reuse after the last layout. */
+	NSUInteger tilesReusable;
+	/*! Bytes of the backing stores of the live and reusable tiles after the last layout. */
+	NSUInteger bytes;
+	/*! This editor's share of tileBufferBudget at the last layout. */
+	NSUInteger budget;
+} PhiTextTilingStatistics;
+
+typedef struct {
+	/*! Number of calls to setMarkedText:selectedRange:. */
+	NSUInteger updates;
+	/*! Number of edits of the store made by compositions (at most one each, when it ends). */
+	NSUInteger edits;
+	/*! Number of code units of the store replaced by those edits. */
+	NSUInteger unitsReplaced;
+	/*! Number of compositions ended (committed, rejected or cancelled), each of which registers at most one undo action. */
+	NSUInteger compositions;
+	/*! Total time spent in setMarkedText:selectedRange: (in seconds). */
+	double updateTime;
+	/*! Longest time spent in a call to setMarkedText:selectedRange: (in seconds). */
+	double maxUpdateTime;
+} PhiTextCompositionStatistics;
+
+typedef struct {
+	/*! Number of pastes longer than PHI_PASTE_CHUNK_LENGTH, inserted a chunk at a time. */
+	NSUInteger pastes;
+	/*! Number of chunks inserted. */
+	NSUInteger chunks;
+	/*! Number of chunked pastes cancelled (and rolled back). */
+	NSUInteger cancelled;
+	/*! Total time from paste: until the editor returned to the run loop with the first chunks inserted (in seconds). */
+	double responseTime;
+	/*! Longest time spent inserting chunks in a turn of the run loop (in seconds). */
+	double maxTurnTime;
+	/*! Total time from paste: until the last chunk was inserted (in seconds). */
+	double pasteTime;
+} PhiTextPasteStatistics;
+
 
 @class PhiTextEditorView;
 
@@ -87,8 +162,11 @@ typedef enum {
 	PhiTextDocument *textDocument;
 	PhiTextSelectionView *selectionView;
 	PhiTextSelectionView *markedTextView;
-	NSMutableArray *textViews;
-	NSMutableSet *reusableTextViews;
+	NSMutableDictionary *textViews;
+	NSMutableDictionary *reusableTextViews;
+	PhiTextTileGrid tileGrid;
+	PhiTextTilingStatistics tilingStatistics;
+	PhiTextLayoutPrefetcher *prefetcher;
 	NSMutableArray *undoStack;
 	NSMutableArray *redoStack;
 	
@@ -113,7 +191,10 @@ typedef enum {
 		unsigned int enableMenuPositionAdjustment :1;
 		unsigned int menuArrowDirectionOverride :1;
 
-		unsigned int reserved :16;
+		unsigned int composing :1;
+		unsigned int pasteSelectionMoved :1;
+
+		unsigned int reserved :14;
 	} flags;
 	PhiTextMagnifier *magnifier;
 	PhiTextSelectionHandleRecognizer *selectionModifier;
@@ -131,8 +212,20 @@ typedef enum {
 	
 	UITextStorageDirection selectionAffinity;
 	UITextRange *selectedTextRange;
+	PhiTextAnchor *selectionStart, *selectionEnd;       // The ends of the selection, which follow every edit of the store.
 	PhiTextStyle *currentTextStyle;
 	UITextRange *markedTextRange;                       // Nil if no marked text.
+	NSString *markedText;                               // Not in the store until the composition ends.
+	NSRange markedTextReplacedRange;                    // The range of the store that the marked text replaces.
+	PhiTextAnchor *markedTextStart, *markedTextEnd;     // The ends of markedTextReplacedRange.
+	PhiTextMarkedTextView *markedTextOverlay;
+	PhiTextCompositionStatistics compositionStatistics;
+	NSString *pasteText;
+	NSDictionary *pasteAttributes;
+	NSAttributedString *pasteReplacedText;
+	NSUInteger pasteLocation, pasteInserted;
+	CFAbsoluteTime pasteStartTime;
+	PhiTextPasteStatistics pasteStatistics;
 	NSDictionary *markedTextStyle;                          // Describes how the marked text should be drawn.
 	id <UITextInputDelegate> inputDelegate;				// Don't set this 
 	NSObject <UITextInputTokenizer> *tokenizer;
@@ -153,6 +246,14 @@ typedef enum {
 
 + (NSString *)versionString;
 
+/*!
+ The budget (in bytes) for the backing stores of the tiles of every editor on screen (defaults to
+ tileBufferBudget), shared equally among them. The visible tiles are always laid out; the budget
+ determines how many tiles are buffered around them and kept for reuse.
+ */
++ (NSUInteger)tileBufferBudget;
++ (void)setTileBufferBudget:(NSUInteger)bytes;
+
 @property (getter=shouldEnableMenuPositionAdjustment) BOOL enableMenuPositionAdjustment;
 @property (nonatomic, readonly, getter=isMenuShown) BOOL menuShown;
 @property (nonatomic, assign) BOOL enableMenuPaging;
@@ -168,6 +269,23 @@ typedef enum {
 - (void)changeTextInRange:(PhiTextRange *)range replacementText:(NSString *)text;
 - (void)changeSelectedText:(NSString *)text;
 
+/*! Prefetches the layout ahead of scrolling. */
+@property (nonatomic, readonly) PhiTextLayoutPrefetcher *prefetcher;
+
+- (PhiTextTilingStatistics)tilingStatistics;
+- (void)resetTilingStatistics;
+- (PhiTextCompositionStatistics)compositionStatistics;
+- (void)resetCompositionStatistics;
+
+/*! Whether a long paste is being inserted, a chunk per turn of the run loop (with the selection following it). */
+@property (nonatomic, readonly, getter=isPasting) BOOL pasting;
+/*! Inserts the rest of the paste being inserted, if any, at once; called before any other edit. */
+- (void)finishPaste;
+/*! Stops inserting the paste, if any, and removes what was inserted of it (restoring the text it replaced). */
+- (void)cancelPaste;
+- (PhiTextPasteStatistics)pasteStatistics;
+- (void)resetPasteStatistics;
+
 @property (nonatomic, retain) PhiTextStyle *textStyleForSelectedRange;
 - (void)addTextStyleForSelectedRange:(PhiTextStyle *)style;
 
@@ -460,6 +578,8 @@ typedef enum {
 - (BOOL)moveCaretToClosestSnapPositionAtPoint:(CGPoint)point;
 
 - (void)setSelectionNeedsDisplay;
+/*! Marks the (vertical extent of) each of the specified rects as needing display, with at most one request per tile. */
+- (void)setNeedsDisplayInRects:(const CGRect *)rects count:(NSUInteger)count;
 
 /*! @group Magnifier Management */
 #pragma mark Magnifier Methods
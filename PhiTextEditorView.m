@@ -26,7 +26,13 @@
 #import "PhiTextLine.h"
 #import "PhiTextView.h"
 #import "PhiTextFrame.h"
+#import "PhiTextFrameCache.h"
+#import "PhiTextTileCache.h"
+#import "PhiTextBoundaryCache.h"
+#import "PhiTextAnchorSet.h"
+#import "PhiTextLayoutPrefetcher.h"
 #import "PhiTextSelectionView.h"
+#import "PhiTextMarkedTextView.h"
 #import "PhiTextMagnifier.h"
 #import "PhiTextSelectionHandle.h"
 #import "PhiTextSelectionHandleRecognizer.h"
@@ -38,6 +44,55 @@
 #define PHI_ACCESS_FRAME_BEFORE_DISPLAY 0
 #endif
 
+/*! Number of tiles kept (with their content) for reuse after leaving the buffered bounds. */
+#ifndef PHI_REUSABLE_TEXT_VIEW_LIMIT
+#define PHI_REUSABLE_TEXT_VIEW_LIMIT 8
+#endif
+
+static const PhiTextTileGrid PhiTextTileGridEmpty = {0, -1, 0, -1};
+
+static BOOL PhiTileGridContainsCell(PhiTextTileGrid grid, NSInteger row, NSInteger column) {
+	return row >= grid.minRow && row <= grid.maxRow && column >= grid.minColumn && column <= grid.maxColumn;
+}
+
+static NSNumber *PhiTileKey(NSInteger row, NSInteger column) {
+	return [NSNumber numberWithLongLong:((long long)row << 32) | (uint32_t)column];
+}
+
+/*! Time (in seconds) after a memory warning during which the tile budget is reduced. */
+#ifndef PHI_TILE_MEMORY_PRESSURE_INTERVAL
+#define PHI_TILE_MEMORY_PRESSURE_INTERVAL 10.0
+#endif
+/*! Factor by which the tile budget is reduced after a memory warning. */
+#ifndef PHI_TILE_MEMORY_PRESSURE_DIVISOR
+#define PHI_TILE_MEMORY_PRESSURE_DIVISOR 4
+#endif
+
+/*! The budget (in bytes) of the backing stores of the tiles of every editor on screen (see tileBufferBudget). */
+static NSUInteger PhiTileBufferBudget = 0;
+/*! The editors (not retained) that share the budget, i.e. those in a window. */
+static CFMutableSetRef PhiTileBufferEditors = NULL;
+static CFAbsoluteTime PhiTileMemoryWarningTime = 0.0;
+
+static NSUInteger PhiTileCostInBytes(CGSize size, CGFloat scale) {
+	return (NSUInteger)ceil(size.width * scale) * 4 * (NSUInteger)ceil(size.height * scale);
+}
+
+static void PhiSetEditorNeedsLayout(const void *value, void *context) {
+	[(UIView *)value setNeedsLayout];
+}
+
+/*! Moves anchor to location, returning it; or releases it and returns a new anchor in anchors, if it isn't one of them. */
+static PhiTextAnchor *PhiMoveAnchor(PhiTextAnchor *anchor, PhiTextAnchorSet *anchors, NSUInteger location, PhiTextAnchorStickiness stickiness) {
+	if (anchor && [anchor anchorSet] == anchors) {
+		if ([anchor location] != location)
+			[anchor setLocation:location];
+		return anchor;
+	}
+	[anchor release];
+	return [anchors newAnchorAtLocation:location stickiness:stickiness];
+}
+
 #if PHI_DIRTY_FRAMES_IN_VIEW
 @interface PhiTextView (PhiTextEditorView)
 @property (nonatomic, readonly) NSMutableSet *dirtyTextFrames;
@@ -57,16 +112,34 @@
 #define PHI_AUTO_SCROLL_GAP      50.0f
 #define PHI_AUTO_SCROLL_DURATION 0.3f
 #define PHI_AUTO_SCROLL_SPEED    1.62f
+#define PHI_TILE_BUFFER_BUDGET   (1 << 24)
 
 #pragma mark -
 
-@interface PhiTextEditorView ()
+@interface PhiTextEditorView () <PhiTextMagnifierSubject>
 
 @property (nonatomic, retain) PhiTextStyle *currentTextStyle;
 
 - (void)setupGestures;
 - (void)tearDownGestures;
 - (void)_addMoreItems;
+- (void)removeAllTextViewTiles;
+- (NSUInteger)documentLength;
+- (NSUInteger)storeIndexForIndex:(NSUInteger)index;
+- (NSUInteger)indexForStoreIndex:(NSUInteger)index;
+- (PhiTextRange *)storeRangeForRange:(PhiTextRange *)range;
+- (PhiTextPosition *)storePositionForPosition:(PhiTextPosition *)position offset:(CGPoint *)offset;
+- (CGRect)markedTextCaretRect;
+- (void)layoutMarkedText;
+- (void)endCompositionWithText:(NSString *)text;
+- (void)anchorSelection;
+- (void)releaseAnchors;
+- (void)selectionFollowTextChange;
+- (void)beginPasteOfText:(NSString *)text;
+- (BOOL)insertPasteChunksForInterval:(NSTimeInterval)interval;
+- (void)insertPasteRange:(NSRange)range;
+- (void)movePasteSelectionFromIndex:(NSUInteger)index;
+- (void)endPaste;
 
 @end
 
@@ -79,6 +152,7 @@
 @synthesize selectedTextRange, markedTextRange, markedTextStyle;
 @synthesize autocapitalizationType, autocorrectionType, keyboardType, keyboardAppearance, returnKeyType;
 @synthesize currentTextStyle;
+@synthesize prefetcher;
 
 #pragma mark Helper Methods
 
@@ -86,8 +160,9 @@
 #ifdef TRACE
 	NSLog(@"%@Entering [clampRange:(%d, %d)]...", traceIndent, range.location, range.length);
 #endif
-	range.location = PHI_CLAMP(range.location, 0, [self.textDocument.store length]);
-	range.length   = PHI_CLAMP(range.length,   0, [self.textDocument.store length] - range.location);
+	NSUInteger length = [self documentLength];
+	range.location = PHI_CLAMP(range.location, 0, length);
+	range.length   = PHI_CLAMP(range.length,   0, length - range.location);
 #ifdef TRACE
 	NSLog(@"%@Exiting %s:(%d, %d)...", traceIndent, __FUNCTION__, range.location, range.length);
 #endif
@@ -166,13 +241,19 @@
 	scrollBuffer = [defaults floatForKey:@"scrollBuffer"];
 	if (scrollBuffer <= 0.0)
 		scrollBuffer = 2.5 * MIN(tileWidthHint, tileHeightHint);
+	if (!PhiTileBufferBudget)
+		PhiTileBufferBudget = [defaults objectForKey:@"tileBufferBudget"] ? [defaults integerForKey:@"tileBufferBudget"] : PHI_TILE_BUFFER_BUDGET;
 
 	if (textViews)
 		[textViews release];
-	textViews = [[NSMutableArray alloc] init];
+	textViews = [[NSMutableDictionary alloc] init];
 	if (reusableTextViews)
 		[reusableTextViews release];
-	reusableTextViews = [[NSMutableSet alloc] init];
+	reusableTextViews = [[NSMutableDictionary alloc] init];
+	tileGrid = PhiTextTileGridEmpty;
+	if (prefetcher)
+		[prefetcher release];
+	prefetcher = [[PhiTextLayoutPrefetcher alloc] init];
 	Class selectionViewClass = NSClassFromString([defaults stringForKey:@"selectionViewClassName"]);
 	if (!selectionViewClass)
 		selectionViewClass = [PhiTextSelectionView class];
@@ -192,6 +273,11 @@
 	[mtv setSelectionColor:[mtc colorWithAlphaComponent:0.1]];
 	self.markedTextView = mtv;
 	[mtv release];
+	if (!markedTextOverlay) {
+		markedTextOverlay = [[PhiTextMarkedTextView alloc] initWithFrame:CGRectZero];
+		[markedTextOverlay setHidden:YES];
+		[self addSubview:markedTextOverlay];
+	}
 
 	flags.willTextChange = flags.willSelectionChange = NO;
 	flags.shouldNotifyInputDelegate = YES;
@@ -221,6 +307,9 @@
 	if (markedTextRange)
 		[markedTextRange release];
 	markedTextRange = nil;
+	if (markedText)
+		[markedText release];
+	markedText = nil;
 	self.markedTextStyle = nil;
 	self.inputDelegate = nil;
 	if (tokenizer) [tokenizer release];
@@ -258,6 +347,7 @@
 	//[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(adjustMenuPosition) name:UIMenuControllerWillShowMenuNotification object:nil];
 	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(keyboardWillShow:) name:UIKeyboardWillShowNotification object:nil];
 	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(keyboardWillHide:) name:UIKeyboardWillHideNotification object:nil];
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didReceiveMemoryWarning) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
 }
 
 - (void)reloadDefaults {
@@ -271,15 +361,7 @@
         tileHeightHint = MAX(0, [defaults floatForKey:@"tileHeightHint"]);
         if (tileHeightHint <= 0.0) tileHeightHint = PHI_TILE_HEIGHT_HINT;
 
-		if (textViews) {
-			for (UIView *view in textViews)
-				[view removeFromSuperview];
-			[textViews release];
-		}
-		textViews = [[NSMutableArray alloc] init];
-		if (reusableTextViews)
-			[reusableTextViews release];
-		reusableTextViews = [[NSMutableSet alloc] init];
+		[self removeAllTextViewTiles];
 
 		[self setNeedsLayout];
 	}
@@ -290,6 +372,8 @@
 	scrollBuffer = [defaults floatForKey:@"scrollBuffer"];
 	if (scrollBuffer <= 0.0)
 		scrollBuffer = 2.5 * MIN(tileWidthHint, tileHeightHint);
+	if ([defaults objectForKey:@"tileBufferBudget"] && PhiTileBufferBudget != [defaults integerForKey:@"tileBufferBudget"])
+		[PhiTextEditorView setTileBufferBudget:[defaults integerForKey:@"tileBufferBudget"]];
 	
 	if (textDocument) {
 		Class textDocumentClass = NSClassFromString([defaults stringForKey:@"textDocumentClassName"]);
@@ -363,6 +447,8 @@
 
 - (void)dealloc {
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	if (PhiTileBufferEditors)
+		CFSetRemoveValue(PhiTileBufferEditors, self);
 	
 	if (eod) [eod release];
 	eod = nil;
@@ -374,6 +460,11 @@
 	if (reusableTextViews)
 		[reusableTextViews release];
 	reusableTextViews = nil;
+	if (prefetcher) {
+		[prefetcher cancel];
+		[prefetcher release];
+	}
+	prefetcher = nil;
 	if (autoScrollTimer) {
 		[autoScrollTimer invalidate];
 		[autoScrollTimer release];
@@ -396,6 +487,14 @@
 	if (markedTextRange)
 		[markedTextRange release];
 	markedTextRange = nil;
+	if (markedText)
+		[markedText release];
+	markedText = nil;
+	if (markedTextOverlay) {
+		[markedTextOverlay removeFromSuperview];
+		[markedTextOverlay release];
+	}
+	markedTextOverlay = nil;
 	
 	self.magnifier = nil;
 	
@@ -416,6 +515,12 @@
 	NSLog(@"%@Entering -[PhiTextEditorView setTextDocument:%@]...", traceIndent, document);
 #endif
 	if (textDocument != document) {
+		[self unmarkText];
+		[self finishPaste];
+		// The line cursor refers to the frames of the old document
+		if ([tokenizer isKindOfClass:[PhiTextInputTokenizer class]])
+			[(PhiTextInputTokenizer *)tokenizer resetLineCursor];
+		[self releaseAnchors];
 		if (textDocument) {
 			[[NSNotificationCenter defaultCenter] removeObserver:self name:nil object:textDocument.undoManager];
 			[textDocument setOwner:nil];
@@ -428,6 +533,10 @@
 			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didOpenUndoGroup:) name:NSUndoManagerDidOpenUndoGroupNotification object:textDocument.undoManager];
 			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didUndo) name:NSUndoManagerDidUndoChangeNotification object:textDocument.undoManager];
 			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didRedo) name:NSUndoManagerDidRedoChangeNotification object:textDocument.undoManager];
+			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(cancelPaste) name:NSUndoManagerWillUndoChangeNotification object:textDocument.undoManager];
+			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(cancelPaste) name:NSUndoManagerWillRedoChangeNotification object:textDocument.undoManager];
+			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(unmarkText) name:NSUndoManagerWillUndoChangeNotification object:textDocument.undoManager];
+			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(unmarkText) name:NSUndoManagerWillRedoChangeNotification object:textDocument.undoManager];
 			[self performSelectorInBackground:@selector(calculateContentSize) withObject:nil];
 		}
 	}
@@ -628,6 +737,7 @@
 	NSLog(@"%@Entering %s willTextChange:%s...", traceIndent, __FUNCTION__, flags.willTextChange?"YES":"NO");
 #endif
 	if (flags.willTextChange) {
+		[self selectionFollowTextChange];
 		if (inputDelegate && flags.shouldNotifyInputDelegate) {
 #ifdef TRACE
 			NSLog(@"%@Executing textDidChange...", traceIndent);
@@ -777,7 +887,9 @@
 	CGRect documentBounds = CGRectOffset([self bounds], -[self.textDocument paddingLeft], -[self.textDocument paddingTop]);
 	PhiAATreeRange *textFrameRange = [self.textDocument beginContentAccessInRect:documentBounds];
 #endif
-	[textViews makeObjectsPerformSelector:@selector(setNeedsDisplay)];
+	[self.textDocument.tileCache invalidateAllTiles];
+	[[textViews allValues] makeObjectsPerformSelector:@selector(setNeedsDisplay)];
+	[[reusableTextViews allValues] makeObjectsPerformSelector:@selector(setNeedsDisplay)];
 	[self setSelectionNeedsDisplay];
 #if PHI_ACCESS_FRAME_BEFORE_DISPLAY
 	for (PhiTextFrame *textFrame in textFrameRange)
@@ -800,72 +912,187 @@
 	CGRect documentBounds = CGRectOffset([self bounds], -[self.textDocument paddingLeft], -[self.textDocument paddingTop]);
 	PhiAATreeRange *textFrameRange = [self.textDocument beginContentAccessInRect:documentBounds];
 #endif
-	CGRect wideRect;
-	for (UIView *tile in textViews) {
-		wideRect = CGRectMake(tile.frame.origin.x,   rect.origin.y,
-							  tile.frame.size.width, rect.size.height);
-		if (CGRectIntersectsRect(wideRect, tile.frame))
-			[tile setNeedsDisplayInRect:wideRect];
+	CGRect wideRect = CGRectMake(CGRectGetMinX(CGRectInfinite), rect.origin.y,
+								 CGRectGetWidth(CGRectInfinite), rect.size.height);
+	[self.textDocument.tileCache invalidateTilesInRect:wideRect];
+	for (NSDictionary *tiles in [NSArray arrayWithObjects:textViews, reusableTextViews, nil]) {
+		for (UIView *tile in [tiles objectEnumerator]) {
+			wideRect = CGRectMake(tile.frame.origin.x,   rect.origin.y,
+								  tile.frame.size.width, rect.size.height);
+			if (CGRectIntersectsRect(wideRect, tile.frame))
+				[tile setNeedsDisplayInRect:wideRect];
+		}
 	}
 #if PHI_ACCESS_FRAME_BEFORE_DISPLAY
 	for (PhiTextFrame *textFrame in textFrameRange)
 		[textFrame autoEndContentAccess];
 #endif
 }
+- (void)setNeedsDisplayInRects:(const CGRect *)rects count:(NSUInteger)count {
+#ifdef TRACE
+	NSLog(@"%@Entering -[%@ %@:%u]...", traceIndent, NSStringFromClass([self class]), NSStringFromSelector(_cmd), count);
+#endif
+	NSUInteger i;
+	CGRect wideRect, tileRect;
+	for (i = 0; i < count; i++) {
+		wideRect = CGRectMake(CGRectGetMinX(CGRectInfinite), rects[i].origin.y,
+							  CGRectGetWidth(CGRectInfinite), rects[i].size.height);
+		[self.textDocument.tileCache invalidateTilesInRect:wideRect];
+	}
+	for (NSDictionary *tiles in [NSArray arrayWithObjects:textViews, reusableTextViews, nil]) {
+		for (UIView *tile in [tiles objectEnumerator]) {
+			tileRect = CGRectNull;
+			for (i = 0; i < count; i++) {
+				wideRect = CGRectMake(tile.frame.origin.x,   rects[i].origin.y,
+									  tile.frame.size.width, rects[i].size.height);
+				tileRect = CGRectUnion(tileRect, CGRectIntersection(wideRect, tile.frame));
+			}
+			if (!CGRectIsNull(tileRect))
+				[tile setNeedsDisplayInRect:tileRect];
+		}
+	}
+}
 
 - (void)addSubviewToBack:(UIView *)view {
 	[self insertSubview:view atIndex:0];
 	[view setNeedsDisplay];
 }
-- (void)insertTextViewTileWithFrame:(CGRect)tileFrame atIndex:(NSUInteger)index {
-	PhiTextView *tile = [reusableTextViews anyObject];
-	if (!tile) {
+- (CGRect)frameOfTileAtRow:(NSInteger)row column:(NSInteger)column {
+	return CGRectMake(column * tileWidthHint, row * tileHeightHint, tileWidthHint, tileHeightHint);
+}
+/*! Returns the key of the reusable tile farthest from rect, or nil if there are none. */
+- (NSNumber *)keyOfReusableTextViewFarthestFromRect:(CGRect)rect {
+	NSNumber *farthestKey = nil;
+	CGRect tileFrame;
+	CGFloat distance, farthest = -1.0;
+	for (NSNumber *key in reusableTextViews) {
+		tileFrame = [[reusableTextViews objectForKey:key] frame];
+		distance = fabs(CGRectGetMidX(tileFrame) - CGRectGetMidX(rect)) + fabs(CGRectGetMidY(tileFrame) - CGRectGetMidY(rect));
+		if (distance > farthest) {
+			farthest = distance;
+			farthestKey = key;
+		}
+	}
+	return farthestKey;
+}
+/*! Lays out a tile for the cell, preferring the reusable tile that last displayed the cell (whose content may still be valid). */
+- (void)addTextViewTileAtRow:(NSInteger)row column:(NSInteger)column nearRect:(CGRect)rect {
+	NSNumber *key = PhiTileKey(row, column);
+	PhiTextView *tile = [reusableTextViews objectForKey:key];
+	if (tile) {
+		[[tile retain] autorelease];
+		[reusableTextViews removeObjectForKey:key];
+		tile.document = self.textDocument;
+		[self insertSubview:tile atIndex:0];
+		tilingStatistics.tilesRestored++;
+	} else {
+		NSNumber *reusableKey = [self keyOfReusableTextViewFarthestFromRect:rect];
+		if (reusableKey) {
+			tile = [[[reusableTextViews objectForKey:reusableKey] retain] autorelease];
+			[reusableTextViews removeObjectForKey:reusableKey];
+			[tile prepareForReuse];
+			tilingStatistics.tilesRecycled++;
+		} else {
 #ifdef DEVELOPER
-		NSLog(@"Creating new text view with frame:(%.1f, %.1f) (%.1f, %.1f)", CGRectComp(tileFrame));
+			NSLog(@"Creating new text view for row %d, column %d", row, column);
 #endif
-		tile = [[PhiTextView alloc] initWithFrame:CGRectZero];
-	} else {
-		[reusableTextViews removeObject:[[tile retain] autorelease]];
-		[tile prepareForReuse];
-	}
-	tile.frame = tileFrame;
-	tile.document = self.textDocument;
-	if (CGRectIntersectsRect(tileFrame, self.bounds)) {
+			tile = [[[PhiTextView alloc] initWithFrame:CGRectZero] autorelease];
+			tilingStatistics.tilesAllocated++;
+		}
+		tile.frame = [self frameOfTileAtRow:row column:column];
+		tile.document = self.textDocument;
 		[self addSubviewToBack:tile];
-	} else {
-		[self performSelectorOnMainThread:@selector(addSubviewToBack:) withObject:tile waitUntilDone:NO];
-	}
-	if (index < [textViews count]) {
-		[textViews insertObject:tile atIndex:index];
-	} else {
-		[textViews addObject:tile];
 	}
+	[textViews setObject:tile forKey:key];
+	tilingStatistics.tilesAdded++;
 #if PHI_DIRTY_FRAMES_IN_VIEW
 	//DONE: beginContentAccess to textFrames in the tile
-	for (PhiTextFrame *textFrame in [self.textDocument beginContentAccessInRect:tileFrame]) {
+	for (PhiTextFrame *textFrame in [self.textDocument beginContentAccessInRect:tile.frame]) {
 		[tile.dirtyTextFrames addObject:textFrame];
 	}
 #endif
 }
-- (void)addTextViewTileWithFrame:(CGRect)tileFrame {
-	[self insertTextViewTileWithFrame:tileFrame atIndex:NSUIntegerMax];
-}
-- (void)removeTextViewTile:(PhiTextView *)tile {
-	[reusableTextViews addObject:tile];
-	[tile removeFromSuperview];
+/*! Moves the tile of the cell to the reuse pool, keeping its content. */
+- (void)removeTextViewTileAtRow:(NSInteger)row column:(NSInteger)column {
+	NSNumber *key = PhiTileKey(row, column);
+	PhiTextView *tile = [textViews objectForKey:key];
+	if (tile) {
+		[reusableTextViews setObject:tile forKey:key];
+		[tile removeFromSuperview];
 #if PHI_DIRTY_FRAMES_IN_VIEW
-	//DONE: endContentAccess to textFrames in tile
-	for (PhiTextFrame *textFrame in tile.dirtyTextFrames)
-		[textFrame endContentAccess];
-	[tile.dirtyTextFrames removeAllObjects];
-#endif
+		//DONE: endContentAccess to textFrames in tile
+		for (PhiTextFrame *textFrame in tile.dirtyTextFrames)
+			[textFrame endContentAccess];
+		[tile.dirtyTextFrames removeAllObjects];
+#endif
+		[textViews removeObjectForKey:key];
+		tilingStatistics.tilesRemoved++;
+	}
+}
+- (void)removeAllTextViewTiles {
+	for (UIView *view in [textViews objectEnumerator])
+		[view removeFromSuperview];
+	[textViews removeAllObjects];
+	[reusableTextViews removeAllObjects];
+	tileGrid = PhiTextTileGridEmpty;
+}
++ (NSUInteger)tileBufferBudget {
+	return PhiTileBufferBudget;
+}
++ (void)setTileBufferBudget:(NSUInteger)bytes {
+	PhiTileBufferBudget = bytes;
+	if (PhiTileBufferEditors)
+		CFSetApplyFunction(PhiTileBufferEditors, PhiSetEditorNeedsLayout, NULL);
+}
+/*! Returns this editor's share of the budget: an equal share of the editors on screen, reduced for a time after a memory warning. */
+- (NSUInteger)tileBufferShare {
+	NSUInteger share = PhiTileBufferBudget / MAX(PhiTileBufferEditors ? CFSetGetCount(PhiTileBufferEditors) : 0, 1);
+	if (CFAbsoluteTimeGetCurrent() - PhiTileMemoryWarningTime < PHI_TILE_MEMORY_PRESSURE_INTERVAL)
+		share /= PHI_TILE_MEMORY_PRESSURE_DIVISOR;
+	return share;
+}
+- (void)didMoveToWindow {
+	[super didMoveToWindow];
+	if (!PhiTileBufferEditors)
+		PhiTileBufferEditors = CFSetCreateMutable(NULL, 0, NULL);
+	if ([self window])
+		CFSetAddValue(PhiTileBufferEditors, self);
+	else
+		CFSetRemoveValue(PhiTileBufferEditors, self);
+	// The share of every editor on screen has changed
+	CFSetApplyFunction(PhiTileBufferEditors, PhiSetEditorNeedsLayout, NULL);
+}
+/*! Releases the reusable tiles and sheds the buffered tiles (at the next layout), keeping the visible tiles; the buffer is restored once the pressure interval has passed. */
+- (void)didReceiveMemoryWarning {
+	PhiTileMemoryWarningTime = CFAbsoluteTimeGetCurrent();
+	tilingStatistics.evictions += [reusableTextViews count];
+	[reusableTextViews removeAllObjects];
+	[self setNeedsLayout];
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(setNeedsLayout) object:nil];
+	[self performSelector:@selector(setNeedsLayout) withObject:nil afterDelay:PHI_TILE_MEMORY_PRESSURE_INTERVAL];
+}
+- (PhiTextTilingStatistics)tilingStatistics {
+	return tilingStatistics;
+}
+- (void)resetTilingStatistics {
+	memset(&tilingStatistics, 0, sizeof(tilingStatistics));
+}
+- (PhiTextCompositionStatistics)compositionStatistics {
+	return compositionStatistics;
+}
+- (void)resetCompositionStatistics {
+	memset(&compositionStatistics, 0, sizeof(compositionStatistics));
+}
+- (PhiTextPasteStatistics)pasteStatistics {
+	return pasteStatistics;
+}
+- (void)resetPasteStatistics {
+	memset(&pasteStatistics, 0, sizeof(pasteStatistics));
 }
 - (void)layoutSubviews {
 #ifdef DEVELOPER
 	NSLog(@"%@Entering %s...", traceIndent, __FUNCTION__);
 #endif
-	PhiTextView *tile = nil;
-	BOOL aboveTop = YES;
 	CGRect tileFrame = CGRectMake(0, 0, tileWidthHint, tileHeightHint);
 	CGSize bufferSize = CGSizeMake(MAX(scrollBuffer, autoScrollGap * autoScrollSpeed), MAX(scrollBuffer, autoScrollGap * autoScrollSpeed));
 	if (self.bounds.size.width >= self.contentSize.width) {
@@ -878,130 +1105,82 @@
 		bufferSize.height = 0;
 	CGRect bufferedBounds = CGRectNull;
 	CGRect visibleBounds = [[self.layer presentationLayer] bounds];
+	[self.textDocument.frameCache setViewport:CGRectOffset(visibleBounds, -[self.textDocument paddingLeft], -[self.textDocument paddingTop])];
+	[self.textDocument.tileCache setViewport:visibleBounds];
 	
-#define SIZE_LIMIT 1500000.0
-	CGFloat n = 0.0;
+	// Limit the buffer to the tiles that fit in this editor's share of the budget, after the visible tiles
+	PhiTextView *anyTile = [[textViews objectEnumerator] nextObject];
+	CGFloat scale = anyTile ? [anyTile tileScale] : [self contentScaleFactor];
+	NSUInteger tileBytes = MAX(PhiTileCostInBytes(tileFrame.size, scale), 1);
+	NSUInteger share = [self tileBufferShare];
+	NSUInteger maxTiles = share / tileBytes;
+	NSUInteger columns = (NSUInteger)ceilf(self.bounds.size.width / tileFrame.size.width) + 1;
+	NSUInteger rows = (NSUInteger)ceilf(self.bounds.size.height / tileFrame.size.height) + 1;
+	NSUInteger spare = maxTiles > rows * columns ? maxTiles - rows * columns : 0;
+	// (but never less than auto scrolling moves in one step)
+	CGFloat autoScrollBuffer = autoScrollGap * autoScrollSpeed;
+	CGFloat n;
 	if (bufferSize.width * bufferSize.height > 0.0) {
-		if ((ceilf((self.bounds.size.width + bufferSize.width) / tileFrame.size.width) + ceilf(bufferSize.width / tileFrame.size.width))
-			* (ceilf((self.bounds.size.height + bufferSize.height) / tileFrame.size.height) + ceilf(bufferSize.height / tileFrame.size.height))
-			   > SIZE_LIMIT / (tileFrame.size.width * tileFrame.size.height))
-		{
-			CGFloat t = MAX(tileFrame.size.width, tileFrame.size.height);
-			CGFloat sum = ceilf(self.bounds.size.width / t) + ceilf(self.bounds.size.height / t);
-			CGFloat prd = ceilf(self.bounds.size.width / t) * ceilf(self.bounds.size.height / t);
-			n = (sqrtf(sum * sum - 4 * prd + 4.0 * SIZE_LIMIT / (t * t)) - sum) / 4.0;
-			bufferSize.width = bufferSize.height = MAX(autoScrollGap * autoScrollSpeed, t * floorf(n));
-		}
+		// Rings of n tiles around the visible tiles: 4n^2 + 2n(rows + columns) <= spare
+		n = floorf((sqrtf((rows + columns) * (rows + columns) + 4.0 * spare) - (rows + columns)) / 4.0);
+		bufferSize.width = MIN(bufferSize.width, MAX(autoScrollBuffer, tileFrame.size.width * n));
+		bufferSize.height = MIN(bufferSize.height, MAX(autoScrollBuffer, tileFrame.size.height * n));
 	} else if (bufferSize.width > 0.0) {
-		if (ceilf(self.bounds.size.width / tileFrame.size.width) + 2.0 * (bufferSize.width / tileFrame.size.width)
-			> SIZE_LIMIT / (tileFrame.size.width * self.bounds.size.height))
-		{
-			CGFloat h = ceilf(self.bounds.size.height / tileFrame.size.height) * tileFrame.size.height;
-			n = (SIZE_LIMIT / (tileFrame.size.width * h) - ceilf(self.bounds.size.width / tileFrame.size.width)) / 2.0;
-			bufferSize.width = MAX(autoScrollGap * autoScrollSpeed, tileFrame.size.width * floorf(n));
-		}
+		n = floorf(spare / (2.0 * rows));
+		bufferSize.width = MIN(bufferSize.width, MAX(autoScrollBuffer, tileFrame.size.width * n));
 	} else if (bufferSize.height > 0.0) {
-		if (ceilf(self.bounds.size.height / tileFrame.size.height) + 2.0 * (bufferSize.height / tileFrame.size.height)
-			> SIZE_LIMIT / (tileFrame.size.height * self.bounds.size.width))
-		{
-			CGFloat w = ceilf(self.bounds.size.width / tileFrame.size.width) * tileFrame.size.width;
-			n = (SIZE_LIMIT / (tileFrame.size.height * w) - ceilf(self.bounds.size.height / tileFrame.size.height)) / 2.0;
-			bufferSize.height = MAX(autoScrollGap * autoScrollSpeed, tileFrame.size.height * floorf(n));
-		}
+		n = floorf(spare / (2.0 * columns));
+		bufferSize.height = MIN(bufferSize.height, MAX(autoScrollBuffer, tileFrame.size.height * n));
 	}
-
 	bufferedBounds = CGRectInset(self.bounds, -bufferSize.width, -bufferSize.height);
-	while (bufferedBounds.size.width * bufferedBounds.size.height > SIZE_LIMIT) {
-		bufferSize.width /= 2.0;
-		bufferSize.height /= 2.0;
-		bufferedBounds = CGRectInset(self.bounds, -bufferSize.width, -bufferSize.height);
-	}
 
 	// Auto expand if wrap is on
 	//if (self.textDocument.wrap)
 	//	self.contentSize = self.bounds.size;
 	
-	//Recycle tiles that are not visible
-	NSUInteger i, j, count = [textViews count];
-	if (count) {
-		for (i = 0; i < count; i++) {
-			tile = [textViews objectAtIndex:i];
-			if (!CGRectIntersectsRect(tile.frame, bufferedBounds)) {
-				// Get tile out of the way
-				[self performSelectorOnMainThread:@selector(removeTextViewTile:) withObject:tile waitUntilDone:NO];
-				[textViews removeObject:tile];
-				count--, i--;
-			} else {
-				if (aboveTop && CGRectGetMinY(tile.frame) > CGRectGetMinY(bufferedBounds)) {
-					// Fill rows at top of editor with tiles
-					tileFrame.origin.y = tile.frame.origin.y - tileHeightHint;
-					do {
-						tileFrame.origin.x = bufferedBounds.origin.x;
-						j = 0;
-						// Fill row
-						do {
-							[self insertTextViewTileWithFrame:tileFrame atIndex:j++];
-							count++, i++;
-							tileFrame.origin.x += tileWidthHint;
-						} while (CGRectGetMinX(tileFrame) < CGRectGetMaxX(bufferedBounds));
-						tileFrame.origin.y -= tileHeightHint;
-					} while (CGRectGetMaxY(tileFrame) > CGRectGetMinY(bufferedBounds));
-					tile = [textViews objectAtIndex:i];
-				}
-				tileFrame.origin.y = tile.frame.origin.y;
-				if (CGRectGetMinX(tile.frame) > CGRectGetMinX(bufferedBounds)) {
-					// Fill columns at front of current row
-					tileFrame.origin.x = tile.frame.origin.x - tileWidthHint;
-					j = i;
-					do {
-						[self insertTextViewTileWithFrame:tileFrame atIndex:j];
-						count++, i++;
-						tileFrame.origin.x -= tileWidthHint;
-					} while (CGRectGetMaxX(tileFrame) > CGRectGetMinX(bufferedBounds));
-				}
-				// Skip all columns in current row
-				while (i < count - 1 && tileFrame.origin.y == tile.frame.origin.y)
-				{
-					if (!CGRectIntersectsRect(tile.frame, visibleBounds))
-						[tile setNeedsDisplay];
-					tile = [textViews objectAtIndex:++i];
-				}
-				// Step back if we overshot
-				if (tileFrame.origin.y != tile.frame.origin.y ) {
-					tile = [textViews objectAtIndex:--i];
-				}
-				tileFrame.origin = tile.frame.origin;
-				while (CGRectGetMaxX(tileFrame) < CGRectGetMaxX(bufferedBounds)) {
-					tileFrame.origin.x += tileWidthHint;
-					[self insertTextViewTileWithFrame:tileFrame atIndex:++i];
-					count++;
-				}
-			}
-			aboveTop = NO;
-		}
-		tileFrame.origin = tile.frame.origin;
-		// Fill rows at bottom of editor
-		while (CGRectGetMaxY(tileFrame) < CGRectGetMaxY(bufferedBounds)) {
-			tileFrame.origin.x = bufferedBounds.origin.x;
-			tileFrame.origin.y += tileHeightHint;
-			// Fill row
-			do {
-				[self addTextViewTileWithFrame:tileFrame];
-				tileFrame.origin.x += tileWidthHint;
-			} while (CGRectGetMinX(tileFrame) < CGRectGetMaxX(bufferedBounds));
-		}
-	}
-	if (!count) {
-		tileFrame.origin.y = bufferedBounds.origin.y;
-		do {
-			tileFrame.origin.x = bufferedBounds.origin.x;
-			do {
-				[self addTextViewTileWithFrame:tileFrame];
-				tileFrame.origin.x += tileWidthHint;
-			} while (CGRectGetMinX(tileFrame) < CGRectGetMaxX(bufferedBounds));
-			tileFrame.origin.y += tileHeightHint;
-		} while (CGRectGetMinY(tileFrame) < CGRectGetMaxY(bufferedBounds));
-	}
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	PhiTextTileGrid grid = PhiTextTileGridEmpty;
+	NSInteger row, column;
+	NSNumber *key;
+	if (!CGRectIsEmpty(bufferedBounds) && tileWidthHint > 0.0 && tileHeightHint > 0.0) {
+		grid.minRow = (NSInteger)floor(CGRectGetMinY(bufferedBounds) / tileHeightHint);
+		grid.maxRow = (NSInteger)ceil(CGRectGetMaxY(bufferedBounds) / tileHeightHint) - 1;
+		grid.minColumn = (NSInteger)floor(CGRectGetMinX(bufferedBounds) / tileWidthHint);
+		grid.maxColumn = (NSInteger)ceil(CGRectGetMaxX(bufferedBounds) / tileWidthHint) - 1;
+	}
+
+	// Recycle the tiles that left the buffered bounds (skipping those that remain)
+	for (row = tileGrid.minRow; row <= tileGrid.maxRow; row++) {
+		for (column = tileGrid.minColumn; column <= tileGrid.maxColumn; column++) {
+			if (PhiTileGridContainsCell(grid, row, column))
+				column = grid.maxColumn;
+			else
+				[self removeTextViewTileAtRow:row column:column];
+		}
+	}
+	// Lay out the tiles that entered the buffered bounds
+	for (row = grid.minRow; row <= grid.maxRow; row++) {
+		for (column = grid.minColumn; column <= grid.maxColumn; column++) {
+			if (PhiTileGridContainsCell(tileGrid, row, column))
+				column = tileGrid.maxColumn;
+			else
+				[self addTextViewTileAtRow:row column:column nearRect:visibleBounds];
+		}
+	}
+	tileGrid = grid;
+	// Release the reusable tiles beyond the limit (or the budget), farthest first
+	while (([reusableTextViews count] > PHI_REUSABLE_TEXT_VIEW_LIMIT
+			|| [textViews count] + [reusableTextViews count] > maxTiles)
+		   && (key = [self keyOfReusableTextViewFarthestFromRect:visibleBounds])) {
+		[reusableTextViews removeObjectForKey:key];
+		tilingStatistics.evictions++;
+	}
+	tilingStatistics.tilesLive = [textViews count];
+	tilingStatistics.tilesReusable = [reusableTextViews count];
+	tilingStatistics.bytes = (tilingStatistics.tilesLive + tilingStatistics.tilesReusable) * tileBytes;
+	tilingStatistics.budget = share;
+	tilingStatistics.layouts++;
+	tilingStatistics.layoutTime += CFAbsoluteTimeGetCurrent() - start;
 
 	/*/Invalidate textFrames not in textViews
 	if ([textViews count]) { 
@@ -1011,6 +1190,14 @@
 	if (![[self selectedTextRange] isEmpty]) {
 		[selectionView setNeedsLayout];
 	}
+	if (markedText) {
+		CGRect caretRect = [self markedTextCaretRect], markedRect = [markedTextOverlay frame];
+		if (CGRectGetMinY(markedRect) != CGRectGetMinY(caretRect)
+			|| CGRectGetMinX(markedRect) + [markedTextOverlay firstLineIndent] != CGRectGetMinX(caretRect)) {
+			// The layout of the text before the marked text has changed
+			[self layoutMarkedText];
+		}
+	}
 	if (flags.menuShown)
 		[self showMenu];
 
@@ -1197,7 +1384,7 @@
 	return bod;
 }
 - (UITextPosition *)endOfDocument {
-	NSUInteger length = [self.textDocument.store length];
+	NSUInteger length = [self documentLength];
 	if (eod == nil || length != PhiPositionOffset(eod)) {
 		if (eod) [eod release];
 		eod = [[PhiTextPosition textPositionWithPosition:length] retain];
@@ -1242,6 +1429,17 @@
 #ifdef TRACE
 	NSLog(@"%@Entering changeSelectedRange:%@ scroll:%s endUndoGrouping:%s...", traceIndent, textRange, scrollToSelection?"YES":"NO", ensureUndoGroupingEnded?"YES":"NO");
 #endif
+	if (markedText && !flags.composing) {
+		NSRange range = textRange ? [textRange range] : NSMakeRange(NSNotFound, 0);
+		NSUInteger location = markedTextReplacedRange.location;
+		if (range.location >= location && NSMaxRange(range) <= location + [markedText length]) {
+			// The selection moves within the marked text, which stays marked
+			[markedTextOverlay setSelectedRange:NSMakeRange(range.location - location, range.length)];
+		} else {
+			// Any other selection commits the composition
+			[self unmarkText];
+		}
+	}
 	if (textRange) {
 		textRange = [self clampTextRange:textRange];
 /*		NSUInteger endIndex = PhiPositionOffset([textRange end]);
@@ -1275,10 +1473,12 @@
 			if (scrollToSelection)
 				[self scrollSelectionToVisible];
 		}
+		[self anchorSelection];
 	} else if (selectedTextRange) {
 		[self selectionWillChange];
 		[selectedTextRange release];
 		selectedTextRange = nil;
+		[self anchorSelection];
 		[self selectionDidChange];
 	}
 	if (ensureUndoGroupingEnded)
@@ -1293,7 +1493,8 @@
 
 - (PhiTextStyle *)textStyleForSelectedRange {
 	if (!self.selectedTextRange || (self.currentTextStyle && self.selectedTextRange.empty))
-		return self.currentTextStyle;
+		// The current style may be interned (e.g. kept from a deletion), and the caller may mutate it
+		return [self.currentTextStyle isInterned] ? [[self.currentTextStyle copy] autorelease] : self.currentTextStyle;
 	if (self.selectedTextRange.empty)
 		return [self.textDocument styleAtPosition:(PhiTextPosition *)[self.selectedTextRange start]
 									  inDirection:UITextStorageDirectionForward];
@@ -1328,7 +1529,7 @@
 #ifdef DEVELOPER
 	NSLog(@"%@Entering [textStylingAtPosition:%d inDirection:%s]...", traceIndent, PhiPositionOffset(position), direction==UITextStorageDirectionForward?"UITextStorageDirectionForward":"UITextStorageDirectionBackward");
 #endif
-	PhiTextStyle *style = [self.textDocument styleAtPosition:position inDirection:direction];
+	PhiTextStyle *style = [self.textDocument internedStyleAtPosition:position inDirection:direction];
 	NSDictionary *styling = [NSDictionary dictionaryWithObjectsAndKeys:
 							 [style.font UIFont], UITextInputTextFontKey,
 							 nil];
@@ -1338,7 +1539,22 @@
 
 - (NSString *)textInRange:(PhiTextRange *)range {
 	NSString *string = nil;
-	if (range) {
+	if (range && markedText) {
+		// Compose the text before, within and after the marked text
+		NSMutableString *composed = [NSMutableString stringWithCapacity:[range length]];
+		NSUInteger location = markedTextReplacedRange.location, markedEnd = location + [markedText length];
+		NSRange part = NSIntersectionRange([range range], NSMakeRange(0, location));
+		if (part.length)
+			[composed appendString:[self.textDocument.store substringWithRange:part]];
+		part = NSIntersectionRange([range range], NSMakeRange(location, [markedText length]));
+		if (part.length)
+			[composed appendString:[markedText substringWithRange:NSMakeRange(part.location - location, part.length)]];
+		part = NSIntersectionRange([range range], NSMakeRange(markedEnd, [self documentLength] - markedEnd));
+		if (part.length)
+			[composed appendString:[self.textDocument.store substringWithRange:
+									NSMakeRange([self storeIndexForIndex:part.location], part.length)]];
+		string = composed;
+	} else if (range) {
 		string = [self.textDocument.store substringWithRange:[range range]];
 	}
 #ifdef TRACE
@@ -1350,12 +1566,15 @@
 #ifdef TRACE
 	NSLog(@"%@Entering changeTextInRange:%@ replacementText:'%@'...", traceIndent, range, text);
 #endif
+	[self unmarkText];
+	[self finishPaste];
 	PhiTextRange *selectedText = (PhiTextRange *)[self selectedTextRange];
 	BOOL shouldReplace = text != nil;
 	if (shouldReplace && [self.delegate respondsToSelector:@selector(textView:shouldChangeTextInRange:replacementText:)]) {
 		shouldReplace = [self.delegate textView:self shouldChangeTextInRange:selectedText replacementText:text];
 	}
 	if(shouldReplace && [text compare:[self textInRange:range]]) {
+		// The selection follows the edit on its anchors (see selectionFollowTextChange)
 		//NSRange invalidRange = NSMakeRange(PhiRangeOffset(range), MAX(PhiRangeLength(range), [text length]));
 		[self.textDocument.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerReplaceGroupingType];
 		//[self.textDocument invalidateDocumentNSRange:invalidRange]; // the store does this...
@@ -1363,29 +1582,6 @@
 		[self.textDocument.store replaceCharactersInRange:[range range] withString:text];
 		flags.shouldInvalidateTextDocument = YES;
 		[self.textDocument.undoManager endUndoGrouping:PhiTextUndoManagerReplaceGroupingType];
-		
-		NSInteger diff = text.length - range.range.length;
-		NSInteger location, length;
-		if (selectedText && diff != 0 && NSMaxRange(selectedText.range) > range.range.location) {
-			if (NSMaxRange(range.range) <= selectedText.range.location) {
-				location = selectedText.range.location + diff;
-				length = selectedText.range.length;
-			} else {
-				if (NSMaxRange(range.range) <= NSMaxRange(selectedText.range)) {
-					location = selectedText.range.location + text.length;
-					length = NSMaxRange(selectedText.range) + diff - selectedText.range.location;
-				} else if (range.range.location >= selectedText.range.location) {
-					location = selectedText.range.location;
-					length = range.range.location - selectedText.range.location;
-				} else {
-					location = range.range.location;
-					length = range.range.length + diff;
-				}
-			}
-			[self changeSelectedRange:[PhiTextRange textRangeWithRange:
-										[self clampRange:NSMakeRange(location, length)]]
-							   scroll:NO endUndoGrouping:NO];
-		}
 	}
 #ifdef TRACE
 	NSLog(@"%@Exiting changeTextInRange:replacementText:.", traceIndent);
@@ -1407,61 +1603,221 @@
 #endif
 }
 
-- (void)setMarkedText:(NSString *)markedText selectedRange:(NSRange)selectedRange {
+/*!
+ While composing, the marked text is kept out of the store: markedTextOverlay draws it, and the rest of its
+ line, over the text that it replaces, and the receiver presents the document to the text input system
+ (textInRange:, endOfDocument, the caret and first rects, and the closest positions to points) as if it
+ were already in place. So an
+ update neither edits the store nor typesets any frame; the store is edited once, with one undo action, when
+ the composition is committed (unmarkText or insertText:) or cancelled (nil marked text).
+ */
+- (void)setMarkedText:(NSString *)text selectedRange:(NSRange)selectedRange {
 #ifdef DEVELOPER
-	NSLog(@"%@Entering setMarkedText:'%@' selectedRange:%@...", traceIndent, markedText, NSStringFromRange(selectedRange));
-#endif
-	PhiTextRange *caret = (PhiTextRange *)[self selectedTextRange];
-	if (markedTextRange) {
-		caret = (PhiTextRange *)markedTextRange;
-		[markedTextRange autorelease];
-		markedTextRange = nil;
-	}
-	NSUInteger startIndex = PhiRangeOffset(caret);
-	PhiTextRange *newSelection = [PhiTextRange textRangeWithRange:
-										  NSMakeRange(startIndex + selectedRange.location,
-													  selectedRange.length)];
-	if (markedText) {
-		markedTextRange = [[PhiTextRange alloc] initWithRange:NSMakeRange(startIndex, markedText.length)];
+	NSLog(@"%@Entering setMarkedText:'%@' selectedRange:%@...", traceIndent, text, NSStringFromRange(selectedRange));
+#endif
+	[self finishPaste];
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent(), elapsed;
+	compositionStatistics.updates++;
+	if (text) {
+		if (!markedText) {
+			// A composition begins, in place of the selection
+			PhiTextRange *caret = [self clampTextRange:(PhiTextRange *)[self selectedTextRange]];
+			markedTextReplacedRange = caret ? [caret range] : NSMakeRange([self.textDocument.store length], 0);
+			// Text inserted at either end of the replaced text by another edit (e.g. a replace all) stays outside it
+			markedTextStart = PhiMoveAnchor(markedTextStart, self.textDocument.anchors, markedTextReplacedRange.location, PhiTextAnchorStickyForward);
+			markedTextEnd = PhiMoveAnchor(markedTextEnd, self.textDocument.anchors, NSMaxRange(markedTextReplacedRange), PhiTextAnchorStickyBackward);
+		} else {
+			[markedText release];
+		}
+		markedText = [text copy];
+		if (markedTextRange)
+			[markedTextRange release];
+		markedTextRange = [[PhiTextRange alloc] initWithRange:NSMakeRange(markedTextReplacedRange.location, [markedText length])];
+		selectedRange.location = MIN(selectedRange.location, [markedText length]);
+		selectedRange.length = MIN(selectedRange.length, [markedText length] - selectedRange.location);
+		[markedTextOverlay setSelectedRange:selectedRange];
+		[self layoutMarkedText];
+		[self.markedTextView setHidden:YES];
 		flags.shouldNotifyInputDelegate = NO; {
-			PhiTextStyle *style = self.currentTextStyle;
-			flags.shouldInvalidateTextDocument = NO; {
-				[self.textDocument.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerTypingGroupingType | PhiTextUndoManagerPastingGroupingType];
-				if (caret && ![caret.start isEqual:[self endOfDocument]]) {
-					if (caret.empty && style) {
-						[self.textDocument.store insertAttributedString:
-						 [[[NSMutableAttributedString alloc] initWithString:markedText
-																 attributes:(NSDictionary *)[style attributes]] autorelease]
-																atIndex:PhiRangeOffset(caret)];
-					} else {
-						[self.textDocument.store replaceCharactersInRange:[caret range] withString:markedText];
-					}
-				} else {
-					if (!style)
-						style = [[self textDocument] styleAtEndOfDocument];
-					[self.textDocument.store appendAttributedString:
-					 [[[NSMutableAttributedString alloc] initWithString:markedText
-															 attributes:(NSDictionary *)[style attributes]] autorelease]];
-				}
-			} flags.shouldInvalidateTextDocument = YES;
-			[self changeSelectedRange:newSelection scroll:NO endUndoGrouping:NO];
+			flags.composing = YES;
+			[self changeSelectedRange:[PhiTextRange textRangeWithRange:
+									   NSMakeRange(markedTextReplacedRange.location + selectedRange.location, selectedRange.length)]
+							   scroll:NO endUndoGrouping:NO];
+			flags.composing = NO;
+		} flags.shouldNotifyInputDelegate = YES;
+		[self.selectionView invalidateCaretGeometry];
+	} else if (markedText) {
+		flags.shouldNotifyInputDelegate = NO; {
+			[self endCompositionWithText:@""];
 		} flags.shouldNotifyInputDelegate = YES;
-		[self.markedTextView setHidden:NO];
-		[self.markedTextView setNeedsLayout];
-		[self.markedTextView setNeedsDisplay];
-	} else {
-		markedTextRange = nil;
-		[self.markedTextView setHidden:YES];
-		if ([caret length]) {
-			flags.shouldNotifyInputDelegate = NO; {
-				[self.textDocument.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerTypingGroupingType | PhiTextUndoManagerPastingGroupingType];
-				[self.textDocument.store deleteCharactersInRange:[(PhiTextRange *)markedTextRange range]];
-			} flags.shouldInvalidateTextDocument = YES;
-			[self changeSelectedRange:newSelection scroll:NO endUndoGrouping:NO];
-		}
 	}
 
 	[self scrollSelectionToVisible];
+	elapsed = CFAbsoluteTimeGetCurrent() - start;
+	compositionStatistics.updateTime += elapsed;
+	compositionStatistics.maxUpdateTime = MAX(compositionStatistics.maxUpdateTime, elapsed);
+}
+/*! Returns the length of the text, including the marked text (in place of the text it replaces). */
+- (NSUInteger)documentLength {
+	NSUInteger length = [self.textDocument.store length];
+	if (markedText)
+		length = length + [markedText length] - markedTextReplacedRange.length;
+	return length;
+}
+/*! Returns the index of the store at index of the text; indexes within the marked text map to its start. */
+- (NSUInteger)storeIndexForIndex:(NSUInteger)index {
+	NSUInteger location = markedTextReplacedRange.location;
+	if (!markedText || index <= location)
+		return index;
+	if (index < location + [markedText length])
+		return location;
+	return index - [markedText length] + markedTextReplacedRange.length;
+}
+/*! Returns the index of the text at index of the store; indexes within the replaced text map to the start of the marked text. */
+- (NSUInteger)indexForStoreIndex:(NSUInteger)index {
+	NSUInteger location = markedTextReplacedRange.location;
+	if (!markedText || index <= location)
+		return index;
+	if (index < NSMaxRange(markedTextReplacedRange))
+		return location;
+	return index + [markedText length] - markedTextReplacedRange.length;
+}
+- (PhiTextRange *)storeRangeForRange:(PhiTextRange *)range {
+	NSUInteger location, end;
+	if (!markedText || !range)
+		return range;
+	location = [self storeIndexForIndex:PhiRangeOffset(range)];
+	end = [self storeIndexForIndex:NSMaxRange([range range])];
+	return [PhiTextRange textRangeWithRange:NSMakeRange(location, end - location)];
+}
+/*!
+ Returns the position of the store at which to find the geometry of position, and sets offset to the
+ distance from there: within the marked text, or the rest of its line, that of the position in the overlay.
+ */
+- (PhiTextPosition *)storePositionForPosition:(PhiTextPosition *)position offset:(CGPoint *)offset {
+	NSUInteger index = PhiPositionOffset(position), location = markedTextReplacedRange.location;
+	CGPoint origin, point;
+	*offset = CGPointZero;
+	if (!markedText || !position || index < location)
+		return position;
+	if (index <= location + [markedTextOverlay length]) {
+		origin = [markedTextOverlay pointForIndex:0];
+		point = [markedTextOverlay pointForIndex:index - location];
+		*offset = CGPointMake(point.x - origin.x, point.y - origin.y);
+		return [PhiTextPosition textPositionWithPosition:location];
+	}
+	return [PhiTextPosition textPositionWithPosition:[self storeIndexForIndex:index]];
+}
+/*! Returns the rect, as high as its line, whose origin is the point before the replaced text. */
+- (CGRect)markedTextCaretRect {
+	PhiTextPosition *position = [PhiTextPosition textPositionWithPosition:markedTextReplacedRange.location];
+	PhiTextLine *line;
+	CGRect rect = CGRectNull;
+	@synchronized(self.textDocument.store) {
+		line = [textDocument searchLineWithPosition:position selectionAffinity:UITextStorageDirectionForward];
+		if (line)
+			rect = [textDocument rectForLine:line withOffset:CGPointMake([line offsetForPosition:position], 0.0) includeLeading:YES];
+	}
+	if (CGRectIsNull(rect))
+		rect = [textDocument caretRectForPosition:position selectionAffinity:UITextStorageDirectionForward];
+	return rect;
+}
+/*!
+ Sets the marked text of the overlay (with the current style), followed by the rest of the line that the
+ replaced text ends on, and places it across the text area from the point before the replaced text, so
+ that it masks the lines of the replaced text and typesets the composition and the rest of the line again.
+ Should the composition wrap onto more lines than it masks, the extra lines cover the lines below them.
+ */
+- (void)layoutMarkedText {
+	PhiTextStyle *style = self.currentTextStyle;
+	PhiTextStorage *store = self.textDocument.store;
+	NSAttributedString *string;
+	PhiTextLine *line;
+	NSUInteger end = NSMaxRange(markedTextReplacedRange), lineEnd = end;
+	CGRect bounds = [textDocument bounds], caretRect, maskRect, frame;
+	if (!markedText) {
+		[markedTextOverlay setHidden:YES];
+		[markedTextOverlay setMarkedText:nil];
+		[markedTextOverlay setTrailingText:nil];
+		return;
+	}
+	if (!style)
+		style = [self.textDocument internedStyleAtPosition:[PhiTextPosition textPositionWithPosition:markedTextReplacedRange.location]
+											   inDirection:UITextStorageDirectionForward];
+	string = [[NSAttributedString alloc] initWithString:markedText attributes:(NSDictionary *)[style attributes]];
+	[markedTextOverlay setMarkedText:string];
+	[string release];
+	string = nil;
+	caretRect = maskRect = [self markedTextCaretRect];
+	@synchronized(store) {
+		line = [textDocument searchLineWithPosition:[PhiTextPosition textPositionWithPosition:end]
+								 selectionAffinity:UITextStorageDirectionForward];
+		if (line) {
+			// The rest of the line moves with the composition, up to its line break
+			lineEnd = MAX(PhiPositionOffset([[line textRange] end]), end);
+			if (lineEnd > end && [store isLineBreakAtIndex:lineEnd - 1])
+				lineEnd--;
+			maskRect = CGRectUnion(maskRect, [textDocument rectForLine:line withOffset:CGPointZero includeLeading:YES]);
+		}
+		if (lineEnd > end)
+			string = [store attributedSubstringFromRange:NSMakeRange(end, lineEnd - end)];
+	}
+	[markedTextOverlay setTrailingText:string];
+	[markedTextOverlay setFirstLineIndent:CGRectGetMinX(caretRect) - CGRectGetMinX(bounds)];
+	[markedTextOverlay setLineHeight:caretRect.size.height];
+	frame.origin = CGPointMake(CGRectGetMinX(bounds), CGRectGetMinY(caretRect));
+	frame.size = [markedTextOverlay sizeThatFits:CGSizeMake([textDocument willWrap] ? bounds.size.width : CGFLOAT_MAX, 0.0)];
+	if ([textDocument willWrap])
+		frame.size.width = bounds.size.width;
+	else
+		frame.size.width = MAX(frame.size.width, MAX(CGRectGetMaxX(bounds), CGRectGetMaxX(maskRect)) - CGRectGetMinX(bounds));
+	frame.size.height = MAX(frame.size.height, CGRectGetMaxY(maskRect) - CGRectGetMinY(caretRect));
+	[markedTextOverlay setMaskColor:self.backgroundColor];
+	[markedTextOverlay setHighlightColor:[self.markedTextView selectionColor]];
+	[markedTextOverlay setFrame:frame];
+	[markedTextOverlay setNeedsDisplay];
+	[markedTextOverlay setHidden:NO];
+	[self insertSubview:markedTextOverlay belowSubview:self.selectionView];
+}
+/*!
+ Ends the composition: unless text is nil (the composition was rejected), the replaced text is replaced
+ with text in one edit of the store, and so one undo action. The selection is left where the composition
+ put it, at the start of the replaced text if it was cancelled, or on the replaced text if it was rejected.
+ */
+- (void)endCompositionWithText:(NSString *)text {
+	NSRange range = markedTextReplacedRange, selection = [self clampRange:[(PhiTextRange *)[self selectedTextRange] range]];
+	PhiTextStyle *style = self.currentTextStyle;
+	PhiTextUndoManager *undoManager = self.textDocument.undoManager;
+	[markedText release];
+	markedText = nil;
+	if (markedTextRange)
+		[markedTextRange release];
+	markedTextRange = nil;
+	[markedTextStart release];
+	markedTextStart = nil;
+	[markedTextEnd release];
+	markedTextEnd = nil;
+	[self layoutMarkedText];
+	if (text && ([text length] || range.length)) {
+		[undoManager ensureUndoGroupingBegan:PhiTextUndoManagerTypingGroupingType | PhiTextUndoManagerPastingGroupingType];
+		flags.shouldInvalidateTextDocument = NO; {
+			if (style) {
+				[self.textDocument.store replaceCharactersInRange:range withAttributedString:
+				 [[[NSAttributedString alloc] initWithString:text attributes:(NSDictionary *)[style attributes]] autorelease]];
+			} else {
+				[self.textDocument.store replaceCharactersInRange:range withString:text];
+			}
+		} flags.shouldInvalidateTextDocument = YES;
+		compositionStatistics.edits++;
+		compositionStatistics.unitsReplaced += range.length + [text length];
+	}
+	compositionStatistics.compositions++;
+	if (!text)
+		selection = range;
+	else if (![text length])
+		selection = NSMakeRange(range.location, 0);
+	[self changeSelectedRange:[PhiTextRange textRangeWithRange:[self clampRange:selection]] scroll:NO endUndoGrouping:NO];
+	[self.selectionView invalidateCaretGeometry];
 }
 - (UITextRange *)markedTextRange {
 #ifdef DEVELOPER
@@ -1473,21 +1829,84 @@
 #ifdef DEVELOPER
 	NSLog(@"%@Entering %s...", traceIndent, __FUNCTION__);
 #endif
-	if (markedTextRange) {
+	if (markedText) {
 		BOOL shouldReplace = YES;
 		if (shouldReplace && [self.delegate respondsToSelector:@selector(textView:shouldChangeTextInRange:replacementText:)]) {
-			shouldReplace = [self.delegate textView:self shouldChangeTextInRange:(PhiTextRange *)markedTextRange replacementText:
-							 [self.textDocument.store substringWithRange:[(PhiTextRange *)markedTextRange range]]];
-		}
-		if (!shouldReplace) {
-			[self.textDocument.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerTypingGroupingType | PhiTextUndoManagerPastingGroupingType];
-			[self.textDocument.store deleteCharactersInRange:[(PhiTextRange *)markedTextRange range]];
-			[self changeSelectedRange:[PhiTextRange textRangeWithPosition:(PhiTextPosition *)[markedTextRange start]]];
-		}
-		[markedTextRange release];
-		[self.markedTextView setHidden:YES];
-	}
-	markedTextRange = nil;
+			shouldReplace = [self.delegate textView:self shouldChangeTextInRange:[PhiTextRange textRangeWithRange:markedTextReplacedRange]
+									replacementText:markedText];
+		}
+		[self endCompositionWithText:shouldReplace ? [[markedText retain] autorelease] : nil];
+	}
+}
+/*! Moves the anchors of the selection to its ends; while composing, the selection is kept relative to the marked text instead. */
+- (void)anchorSelection {
+	NSRange range;
+	if (markedText)
+		return;
+	if (!selectedTextRange) {
+		[selectionStart release];
+		selectionStart = nil;
+		[selectionEnd release];
+		selectionEnd = nil;
+		return;
+	}
+	range = [(PhiTextRange *)selectedTextRange range];
+	selectionStart = PhiMoveAnchor(selectionStart, self.textDocument.anchors, range.location, PhiTextAnchorStickyForward);
+	selectionEnd = PhiMoveAnchor(selectionEnd, self.textDocument.anchors, NSMaxRange(range), PhiTextAnchorStickyBackward);
+}
+- (void)releaseAnchors {
+	[selectionStart release];
+	selectionStart = nil;
+	[selectionEnd release];
+	selectionEnd = nil;
+	[markedTextStart release];
+	markedTextStart = nil;
+	[markedTextEnd release];
+	markedTextEnd = nil;
+}
+/*!
+ Moves the selection to its anchors after any edit of the store (by the editor, an undo, a chunked paste
+ or a replace all): its start moves after text inserted at it, and its end stays before it; a caret stays
+ before text inserted at it, and a selection covered by the edit becomes the replacement. While composing,
+ the marked text (and the selection within it) follows the text it replaces instead.
+ */
+- (void)selectionFollowTextChange {
+	NSUInteger start, end;
+	NSRange selection;
+	if (markedText) {
+		if (!markedTextStart)
+			return;
+		start = [markedTextStart location];
+		end = MAX([markedTextEnd location], start);
+		if (start == markedTextReplacedRange.location && end == NSMaxRange(markedTextReplacedRange)) {
+			// The rest of the line may have changed
+			[self layoutMarkedText];
+			return;
+		}
+		markedTextReplacedRange = NSMakeRange(start, end - start);
+		if (markedTextRange)
+			[markedTextRange release];
+		markedTextRange = [[PhiTextRange alloc] initWithRange:NSMakeRange(start, [markedText length])];
+		[self layoutMarkedText];
+		selection = [markedTextOverlay selectedRange];
+		selection.location += start;
+		flags.composing = YES;
+		[self changeSelectedRange:[PhiTextRange textRangeWithRange:selection] scroll:NO endUndoGrouping:NO];
+		flags.composing = NO;
+		[self.selectionView invalidateCaretGeometry];
+		return;
+	}
+	if (!selectionStart)
+		return;
+	start = [selectionStart location];
+	end = [selectionEnd location];
+	if (end >= start)
+		selection = NSMakeRange(start, end - start);
+	else if ([selectedTextRange isEmpty])
+		selection = NSMakeRange(end, 0);
+	else
+		selection = NSMakeRange(end, start - end);
+	[self changeSelectedRange:[PhiTextRange textRangeWithRange:selection] scroll:NO endUndoGrouping:NO];
 }
 - (NSDictionary *)markedTextStyle {
 #ifdef DEVELOPER
@@ -1645,7 +2064,18 @@
 #ifdef TRACE
 	NSLog(@"%@Entering [PhiTextEditorView firstRectForRange:%@]...", traceIndent, range);
 #endif
-	CGRect firstRect = [textDocument firstRectForRange:(PhiTextRange *)range];
+	CGRect firstRect;
+	NSUInteger location = markedTextReplacedRange.location, start = PhiRangeOffset(range);
+	NSUInteger overlayEnd = location + [markedTextOverlay length];
+	if (markedText && start >= location && start <= overlayEnd) {
+		// The range starts within the marked text, or the rest of its line, which the overlay typesets
+		firstRect = [markedTextOverlay firstRectForRange:
+					 NSMakeRange(start - location, MIN(NSMaxRange([(PhiTextRange *)range range]), overlayEnd) - start)];
+		firstRect.origin.x += CGRectGetMinX([markedTextOverlay frame]);
+		firstRect.origin.y += CGRectGetMinY([markedTextOverlay frame]);
+	} else {
+		firstRect = [textDocument firstRectForRange:[self storeRangeForRange:(PhiTextRange *)range]];
+	}
 #ifdef TRACE
 	NSLog(@"%@Exiting %s:(%.f, %.f), (%.f, %.f).", traceIndent, __FUNCTION__, CGRectComp(firstRect));
 #endif
@@ -1655,20 +2085,24 @@
 #ifdef TRACE
 	NSLog(@"%@Entering [PhiTextEditorView lastRectForRange:%@]...", traceIndent, range);
 #endif
-	CGRect lastRect = [textDocument lastRectForRange:(PhiTextRange *)range];
+	CGRect lastRect = [textDocument lastRectForRange:[self storeRangeForRange:(PhiTextRange *)range]];
 #ifdef TRACE
 	NSLog(@"%@Exiting %s:(%.f, %.f), (%.f, %.f).", traceIndent, __FUNCTION__, CGRectComp(lastRect));
 #endif
 	return lastRect;
 }
 - (CGRect)visibleCaretRectForPosition:(UITextPosition *)position alignPixels:(BOOL)pixelsAligned toView:(UIView *)view {
-	UITextStorageDirection affinity = [self selectionAffinityForPosition:(PhiTextPosition *)position];
-	CGRect caretRect = [textDocument caretRectForPosition:(PhiTextPosition *)position
+	CGPoint offset;
+	PhiTextPosition *storePosition = [self storePositionForPosition:(PhiTextPosition *)position offset:&offset];
+	UITextStorageDirection affinity = [self selectionAffinityForPosition:storePosition];
+	CGRect caretRect = [textDocument caretRectForPosition:storePosition
 										selectionAffinity:affinity
 											   autoExpand:![[self selectedTextRange] isEmpty]
 												   inRect:self.bounds
 											  alignPixels:pixelsAligned
 												   toView:view];
+	caretRect.origin.x += pixelsAligned ? round(offset.x) : offset.x;
+	caretRect.origin.y += pixelsAligned ? round(offset.y) : offset.y;
 #ifdef TRACE
 	NSLog(@"%@Getting [PhiTextEditorView visibleCaretRectForPosition:%@]:(%.f, %.f), (%.f, %.f)", traceIndent, position, CGRectComp(caretRect));
 #endif
@@ -1678,21 +2112,43 @@
 	return [self visibleCaretRectForPosition:position alignPixels:NO toView:nil];
 }
 - (CGRect)caretRectForPosition:(UITextPosition *)position {
-	CGRect caretRect = [textDocument caretRectForPosition:(PhiTextPosition *)position
-										selectionAffinity:[self selectionAffinityForPosition:(PhiTextPosition *)position]];
+	CGPoint offset;
+	PhiTextPosition *storePosition = [self storePositionForPosition:(PhiTextPosition *)position offset:&offset];
+	CGRect caretRect = [textDocument caretRectForPosition:storePosition
+										selectionAffinity:[self selectionAffinityForPosition:storePosition]];
+	caretRect.origin.x += offset.x;
+	caretRect.origin.y += offset.y;
 #ifdef TRACE
 	NSLog(@"%@Getting [PhiTextEditorView caretRectForPosition:%@]:(%.f, %.f), (%.f, %.f)", traceIndent, position, CGRectComp(caretRect));
 #endif
 	return caretRect;
 }
 - (UITextPosition *)closestPositionToPoint:(CGPoint)point {
-	return [textDocument closestPositionToPoint:point];
+	CGRect markedRect = [markedTextOverlay frame];
+	NSUInteger index;
+	if (!markedText)
+		return [textDocument closestPositionToPoint:point];
+	if (CGRectContainsPoint(markedRect, point)) {
+		index = [markedTextOverlay indexForPoint:CGPointMake(point.x - CGRectGetMinX(markedRect), point.y - CGRectGetMinY(markedRect))];
+		if (index != NSNotFound)
+			return [PhiTextPosition textPositionWithPosition:markedTextReplacedRange.location + index];
+	}
+	return [PhiTextPosition textPositionWithPosition:[self indexForStoreIndex:PhiPositionOffset([textDocument closestPositionToPoint:point])]];
 }
 - (UITextPosition *)closestPositionToPoint:(CGPoint)point withinRange:(PhiTextRange *)range {
-	return [textDocument closestPositionToPoint:point withinRange:range];
+	if (!markedText)
+		return [textDocument closestPositionToPoint:point withinRange:range];
+	return [PhiTextPosition textPositionWithPosition:[self indexForStoreIndex:
+			PhiPositionOffset([textDocument closestPositionToPoint:point withinRange:[self storeRangeForRange:range]])]];
 }
 - (UITextRange *)characterRangeAtPoint:(CGPoint)point {
-	return [textDocument characterRangeAtPoint:point];
+	PhiTextRange *range = (PhiTextRange *)[textDocument characterRangeAtPoint:point];
+	NSUInteger location, end;
+	if (!markedText || !range)
+		return range;
+	location = [self indexForStoreIndex:PhiRangeOffset(range)];
+	end = [self indexForStoreIndex:NSMaxRange([range range])];
+	return [PhiTextRange textRangeWithRange:NSMakeRange(location, end - location)];
 }
 
 - (void)scrollRangeToVisible:(PhiTextRange *)range {
@@ -1718,7 +2174,7 @@
 #ifdef TRACE
 	NSLog(@"%@Entering hasText...", traceIndent);
 #endif
-    if ([self.textDocument.store length] > 0) {
+    if ([self documentLength] > 0) {
         return YES;
     }
     return NO;
@@ -1727,6 +2183,8 @@
 #ifdef TRACE
 	NSLog(@"%@Entering changeSelectedText:'%@'...", traceIndent, text);
 #endif
+	[self unmarkText];
+	[self finishPaste];
 	PhiTextRange *caret = [self clampTextRange:(PhiTextRange *)[self selectedTextRange]];
 	BOOL shouldReplace = YES;
 	if (shouldReplace && [self.delegate respondsToSelector:@selector(textView:shouldChangeTextInRange:replacementText:)]) {
@@ -1755,7 +2213,7 @@
 		} else {
 			if (text) {
 				if (!style)
-					style = [[self textDocument] styleAtEndOfDocument];
+					style = [[self textDocument] internedStyleAtEndOfDocument];
 				[self.textDocument.store appendAttributedString:
 				 [[[NSMutableAttributedString alloc] initWithString:text
 														 attributes:(NSDictionary *)[style attributes]] autorelease]];
@@ -1776,10 +2234,16 @@
 #ifdef TRACE
 	NSLog(@"%@Entering insertText:'%@'...", traceIndent, text);
 #endif
-	flags.shouldNotifyInputDelegate = NO;
-	[self.textDocument.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerTypingGroupingType];
-	[self changeSelectedText:text];
-	flags.shouldNotifyInputDelegate = YES;
+	if (markedText) {
+		// The text replaces the marked text, and commits the composition
+		[self setMarkedText:text selectedRange:NSMakeRange([text length], 0)];
+		[self unmarkText];
+	} else {
+		flags.shouldNotifyInputDelegate = NO;
+		[self.textDocument.undoManager ensureUndoGroupingBegan:PhiTextUndoManagerTypingGroupingType];
+		[self changeSelectedText:text];
+		flags.shouldNotifyInputDelegate = YES;
+	}
 	[self scrollSelectionToVisible];
 #ifdef TRACE
 	NSLog(@"%@Exiting insertText", traceIndent);
@@ -1805,10 +2269,11 @@
 #ifdef TRACE
 	NSLog(@"%@Entering %s...", traceIndent, __FUNCTION__);
 #endif
+	[self unmarkText];
 	if ([self hasDeletableTokenInDirection:UITextStorageDirectionBackward]) {
 		PhiTextRange *range = (PhiTextRange *)[self rangeOfNextDeletableTokenInDirection:UITextStorageDirectionBackward];
 		NSUInteger startPosition = PhiPositionOffset([range start]);
-		PhiTextStyle *saveStyle = [self.textDocument styleAtPosition:(PhiTextPosition *)[range start] inDirection:UITextStorageDirectionForward];
+		PhiTextStyle *saveStyle = [self.textDocument internedStyleAtPosition:(PhiTextPosition *)[range start] inDirection:UITextStorageDirectionForward];
 		if (flags.wordSelected && startPosition > 0
 			&& [self.textDocument.store characterAtIndex:startPosition - 1] == ' ') {
 			range = [PhiTextRange textRangeWithRange:NSMakeRange(startPosition - 1, PhiRangeLength(range) + 1)];
@@ -1846,6 +2311,12 @@
 
 - (void)scrollViewDidScroll:(UIScrollView *)scrollView {
 //	if (![self.selectedTextRange isEmpty]) [self showMenu];
+	if ([prefetcher prefetchTiles]) {
+		PhiTextView *tile = [[textViews objectEnumerator] nextObject];
+		if (tile)
+			[prefetcher setTileSize:CGSizeMake(tileWidthHint, tileHeightHint) renderer:[tile tileRenderer] scale:[tile tileScale]];
+	}
+	[prefetcher prefetchAheadOfRect:[self bounds] inDocument:self.textDocument];
 	if ([self.delegate respondsToSelector:@selector(scrollViewDidScroll:)]) {
 		[self.delegate scrollViewDidScroll:scrollView];
 	}
@@ -1974,6 +2445,9 @@
 - (PhiTextRange *)textSelectionViewSelectedTextRange:(PhiTextSelectionView *)view {
 	if (view == self.markedTextView)
 		return (PhiTextRange *)[self markedTextRange];
+	// The overlay shows the selection within the marked text; the selection view shows only its caret
+	if (markedText)
+		return [PhiTextRange textRangeWithPosition:(PhiTextPosition *)[[self selectedTextRange] end]];
 	return (PhiTextRange *)[self selectedTextRange];
 }
 
@@ -2140,6 +2614,7 @@
 #ifdef TRACE
 	NSLog(@"%@Entering [PhiTextEditorView closestWordPositionToPoint:(%.f, %.f) inDirection:%s]", traceIndent, point.x, point.y, direction==PhiTextStorageDirectionAny?"PhiTextStorageDirectionAny":(direction==PhiTextStorageDirectionForward?"PhiTextStorageDirectionForward":(direction==PhiTextStorageDirectionBackward?"PhiTextStorageDirectionBackward":"(unknown)")));
 #endif
+	CFAbsoluteTime snapStart = CFAbsoluteTimeGetCurrent();
 	UITextPosition *position = [self closestPositionToPoint:point];
 	UITextPosition *word = nil, *back = nil, *forward = nil;
 	NSInteger backOffset = NSIntegerMax, forwardOffset = NSIntegerMax, wordOffset;
@@ -2184,6 +2659,7 @@
 	if (ABS(backOffset) < ABS(forwardOffset)) {
 		position = back;
 	}
+	[[self.textDocument boundaryCache] addSnapTime:CFAbsoluteTimeGetCurrent() - snapStart];
 #ifdef TRACE
 	NSLog(@"%@Exiting %s:%@...", traceIndent, __FUNCTION__, position);
 #endif
@@ -2199,6 +2675,7 @@
 #ifdef TRACE
 	NSLog(@"%@Entering [PhiTextEditorView closestSnapPositionToPoint:(%.f, %.f) inDirection:%s]", traceIndent, point.x, point.y, direction==PhiTextStorageDirectionAny?"PhiTextStorageDirectionAny":(direction==PhiTextStorageDirectionForward?"PhiTextStorageDirectionForward":(direction==PhiTextStorageDirectionBackward?"PhiTextStorageDirectionBackward":"(unknown)")));
 #endif
+	CFAbsoluteTime snapStart = CFAbsoluteTimeGetCurrent();
 	UITextPosition *position = [self closestPositionToPoint:point];
 	UITextPosition *word = nil, *para = nil,// *line = nil,
 		*back = nil, *forward = nil;
@@ -2280,6 +2757,7 @@
 #endif
 			position = [PhiTextPosition textPositionWithTextPosition:(PhiTextPosition *)position offset:-1];
 	}
+	[[self.textDocument boundaryCache] addSnapTime:CFAbsoluteTimeGetCurrent() - snapStart];
 	
 #ifdef TRACE
 	NSLog(@"%@Exiting %s:%@...", traceIndent, __FUNCTION__, position);
@@ -2446,6 +2924,64 @@
 - (void)hideSelectionMagnifierToPoint:(CGPoint)point {
 	[self hideCaretMagnifierToPoint:point];
 }
+/*!
+ Draws the tiles under the magnifier from the document's tileCache, where possible, so that the
+ magnifier does not render every tile on every move; only the selection and marked text (which
+ follow the touch) are rendered from their layers. Tiles are taken from the cache at the magnified
+ scale (the scale of context), so that they aren't stretched; a tile that isn't cached at that
+ scale is drawn from the layout (and rendered in the background for the next move).
+ */
+- (BOOL)drawMagnifiedRect:(CGRect)rect inContext:(CGContextRef)context {
+	PhiTextDocument *document = self.textDocument;
+	PhiTextTileCache *tileCache = [document tileCache];
+	CGAffineTransform deviceTransform = CGContextGetUserSpaceToDeviceSpaceTransform(context);
+	CGFloat scale = sqrt(deviceTransform.a * deviceTransform.a + deviceTransform.b * deviceTransform.b);
+	id <PhiTextTileRenderer> renderer;
+	CGImageRef image;
+	CGRect tileRect, drawRect;
+	UIView *view;
+
+	if (self.backgroundColor) {
+		CGContextSetFillColorWithColor(context, self.backgroundColor.CGColor);
+		CGContextFillRect(context, rect);
+	}
+	for (PhiTextView *tile in [textViews objectEnumerator]) {
+		tileRect = [tile frame];
+		if (tile.hidden || !CGRectIntersectsRect(rect, tileRect))
+			continue;
+		image = tileCache ? [tileCache copyImageForTileRect:tileRect scale:scale] : NULL;
+		renderer = [tile tileRenderer];
+		CGContextSaveGState(context); {
+			if (image) {
+				CGContextTranslateCTM(context, CGRectGetMinX(tileRect), CGRectGetMaxY(tileRect));
+				CGContextScaleCTM(context, 1.0, -1.0);
+				CGContextDrawImage(context, CGRectMake(0.0, 0.0, tileRect.size.width, tileRect.size.height), image);
+				CGImageRelease(image);
+			} else if (renderer) {
+				drawRect = CGRectIntersection(rect, tileRect);
+				CGContextClipToRect(context, drawRect);
+				[renderer drawTileRect:drawRect
+						  withSnapshot:[document layoutSnapshotForRect:CGRectOffset(drawRect, -[document paddingLeft], -[document paddingTop])]
+							ofDocument:document inContext:context];
+				if (tileCache)
+					[tileCache renderTileRect:tileRect scale:scale ofDocument:document withRenderer:renderer];
+			} else {
+				CGContextTranslateCTM(context, CGRectGetMinX(tileRect), CGRectGetMinY(tileRect));
+				[[tile layer] renderInContext:context];
+			}
+		} CGContextRestoreGState(context);
+	}
+	for (int i = 0; i < 2; i++) {
+		view = i ? (UIView *)self.selectionView : (UIView *)markedTextOverlay;
+		if (view && !view.hidden && CGRectIntersectsRect(rect, view.frame)) {
+			CGContextSaveGState(context); {
+				CGContextTranslateCTM(context, CGRectGetMinX(view.frame), CGRectGetMinY(view.frame));
+				[[view layer] renderInContext:context];
+			} CGContextRestoreGState(context);
+		}
+	}
+	return YES;
+}
 
 - (void)changeSelection:(PhiTextSelectionHandleRecognizer *)pan {
 #ifdef DEVELOPER
@@ -2958,13 +3494,173 @@
 				[text appendString:@" "];
 			}
 		}
+		[self unmarkText];
+		[self finishPaste];
+		[self hideMenu];
+		if ([text length] > PHI_PASTE_CHUNK_LENGTH) {
+			[self beginPasteOfText:text];
+			return;
+		}
 		[[textDocument undoManager] ensureUndoGroupingBegan:PhiTextUndoManagerPastingGroupingType];
 		[self changeSelectedText:text];
 		[[textDocument undoManager] ensureUndoGroupingEnded];
-		[self hideMenu];
 		[self scrollSelectionToVisible];
 	}
 }
+
+#pragma mark Chunked Paste
+
+/*!
+ Inserts a long paste a chunk at a time, over as many turns of the run loop as it takes, so that the
+ editor stays responsive and the text (and the selection after it) is laid out and displayed as it
+ arrives. The chunks are inserted with undo registration disabled; the paste registers one undo
+ action, in the paste undo group opened before the first chunk, when the last chunk is inserted.
+ Any other edit finishes the paste first (inserting the rest in one edit), whereas an undo or redo
+ cancels it (the paste was not yet an action to be undone). The caret follows the inserted text
+ until the user moves the selection.
+ */
+- (void)beginPasteOfText:(NSString *)text {
+	PhiTextRange *caret = [self clampTextRange:(PhiTextRange *)[self selectedTextRange]];
+	PhiTextStyle *style = self.currentTextStyle;
+	NSUInteger length = [self.textDocument.store length];
+	BOOL shouldReplace = YES;
+	if (shouldReplace && [self.delegate respondsToSelector:@selector(textView:shouldChangeTextInRange:replacementText:)]) {
+		shouldReplace = [self.delegate textView:self shouldChangeTextInRange:caret replacementText:text];
+	}
+	if (!shouldReplace)
+		return;
+	if (!caret)
+		caret = [PhiTextRange textRangeWithRange:NSMakeRange(length, 0)];
+
+	// The attributes that changeSelectedText: would give the text
+	if (caret.empty && style)
+		pasteAttributes = (NSDictionary *)[style attributes];
+	else if (PhiRangeOffset(caret) < length)
+		pasteAttributes = [self.textDocument.store attributesAtIndex:(caret.empty && PhiRangeOffset(caret)) ? PhiRangeOffset(caret) - 1 : PhiRangeOffset(caret) effectiveRange:NULL];
+	else
+		pasteAttributes = (NSDictionary *)[(style ? style : [[self textDocument] internedStyleAtEndOfDocument]) attributes];
+	[pasteAttributes retain];
+	pasteText = [text copy];
+	pasteReplacedText = [[self.textDocument.store attributedSubstringFromRange:[caret range]] retain];
+	pasteLocation = PhiRangeOffset(caret);
+	pasteInserted = 0;
+	flags.pasteSelectionMoved = NO;
+	pasteStartTime = CFAbsoluteTimeGetCurrent();
+	pasteStatistics.pastes++;
+
+	[[textDocument undoManager] ensureUndoGroupingBegan:PhiTextUndoManagerPastingGroupingType];
+	if ([self insertPasteChunksForInterval:PHI_PASTE_CHUNK_INTERVAL])
+		[self endPaste];
+	else
+		[self performSelector:@selector(insertPasteChunks) withObject:nil afterDelay:0.0];
+	pasteStatistics.responseTime += CFAbsoluteTimeGetCurrent() - pasteStartTime;
+}
+- (void)insertPasteChunks {
+	if (!pasteText)
+		return;
+	if ([self insertPasteChunksForInterval:PHI_PASTE_CHUNK_INTERVAL])
+		[self endPaste];
+	else
+		[self performSelector:@selector(insertPasteChunks) withObject:nil afterDelay:0.0];
+}
+/*! Inserts chunks of the paste until interval has elapsed, and moves the selection after them; returns whether the whole paste has been inserted. */
+- (BOOL)insertPasteChunksForInterval:(NSTimeInterval)interval {
+	PhiTextUndoManager *undoManager = self.textDocument.undoManager;
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	NSUInteger length = [pasteText length], previous = pasteInserted;
+
+	flags.shouldInvalidateTextDocument = NO; {
+		[undoManager disableUndoRegistration]; {
+			do {
+				[self insertPasteRange:[pasteText rangeOfComposedCharacterSequencesForRange:
+										NSMakeRange(pasteInserted, MIN(PHI_PASTE_CHUNK_LENGTH, length - pasteInserted))]];
+			} while (pasteInserted < length && CFAbsoluteTimeGetCurrent() - start < interval);
+		} [undoManager enableUndoRegistration];
+	} flags.shouldInvalidateTextDocument = YES;
+	[self movePasteSelectionFromIndex:pasteLocation + previous];
+	pasteStatistics.maxTurnTime = MAX(pasteStatistics.maxTurnTime, CFAbsoluteTimeGetCurrent() - start);
+	return pasteInserted == length;
+}
+/*! Inserts range of the paste (which starts where the last chunk ended) into the store, in place of the replaced text if it is the first. */
+- (void)insertPasteRange:(NSRange)range {
+	NSAttributedString *chunk = [[NSAttributedString alloc] initWithString:[pasteText substringWithRange:range] attributes:pasteAttributes];
+	if (pasteInserted)
+		[self.textDocument.store insertAttributedString:chunk atIndex:pasteLocation + pasteInserted];
+	else
+		[self.textDocument.store replaceCharactersInRange:NSMakeRange(pasteLocation, [pasteReplacedText length]) withAttributedString:chunk];
+	[chunk release];
+	pasteInserted = NSMaxRange(range);
+	pasteStatistics.chunks++;
+}
+/*!
+ Moves the caret from index (where the previous chunks ended) to after the inserted chunks, unless the
+ user has moved the selection since the paste last moved it, in which case the paste stops moving it
+ (and its anchors keep it on its text).
+ */
+- (void)movePasteSelectionFromIndex:(NSUInteger)index {
+	PhiTextRange *selection = (PhiTextRange *)[self selectedTextRange];
+	NSRange range = selection ? [selection range] : NSMakeRange(NSNotFound, 0);
+	// Before the first chunk the selection is the replaced text (which the chunk selected); after it, the caret the paste left
+	if (index != pasteLocation && (range.location != index || range.length))
+		flags.pasteSelectionMoved = YES;
+	if (!flags.pasteSelectionMoved)
+		[self changeSelectedRange:[PhiTextRange textRangeWithRange:NSMakeRange(pasteLocation + pasteInserted, 0)] scroll:NO endUndoGrouping:NO];
+}
+- (void)endPaste {
+	PhiTextUndoManager *undoManager = self.textDocument.undoManager;
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(insertPasteChunks) object:nil];
+	[undoManager ensureUndoGroupingBegan:PhiTextUndoManagerPastingGroupingType];
+	[[undoManager prepareWithInvocationTarget:self.textDocument.store] replaceCharactersInRange:NSMakeRange(pasteLocation, pasteInserted)
+																		   withAttributedString:pasteReplacedText];
+	[undoManager ensureUndoGroupingEnded];
+	pasteStatistics.pasteTime += CFAbsoluteTimeGetCurrent() - pasteStartTime;
+	[pasteText release];
+	pasteText = nil;
+	[pasteAttributes release];
+	pasteAttributes = nil;
+	[pasteReplacedText release];
+	pasteReplacedText = nil;
+	[self scrollSelectionToVisible];
+}
+- (BOOL)isPasting {
+	return pasteText != nil;
+}
+- (void)finishPaste {
+	if (!pasteText)
+		return;
+	PhiTextUndoManager *undoManager = self.textDocument.undoManager;
+	NSUInteger previous = pasteInserted;
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(insertPasteChunks) object:nil];
+	if (pasteInserted < [pasteText length]) {
+		// The rest of the paste is inserted in one edit, rather than a chunk at a time
+		flags.shouldInvalidateTextDocument = NO; {
+			[undoManager disableUndoRegistration]; {
+				[self insertPasteRange:NSMakeRange(pasteInserted, [pasteText length] - pasteInserted)];
+			} [undoManager enableUndoRegistration];
+		} flags.shouldInvalidateTextDocument = YES;
+		[self movePasteSelectionFromIndex:pasteLocation + previous];
+	}
+	[self endPaste];
+}
+- (void)cancelPaste {
+	if (!pasteText)
+		return;
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(insertPasteChunks) object:nil];
+	flags.shouldInvalidateTextDocument = NO; {
+		[self.textDocument.undoManager disableUndoRegistration]; {
+			[self.textDocument.store replaceCharactersInRange:NSMakeRange(pasteLocation, pasteInserted) withAttributedString:pasteReplacedText];
+		} [self.textDocument.undoManager enableUndoRegistration];
+	} flags.shouldInvalidateTextDocument = YES;
+	[self changeSelectedRange:[PhiTextRange textRangeWithRange:NSMakeRange(pasteLocation, [pasteReplacedText length])] scroll:NO endUndoGrouping:NO];
+	[self.textDocument.undoManager ensureUndoGroupingEnded];
+	pasteStatistics.cancelled++;
+	[pasteText release];
+	pasteText = nil;
+	[pasteAttributes release];
+	pasteAttributes = nil;
+	[pasteReplacedText release];
+	pasteReplacedText = nil;
+}
 - (void)select:(id)sender {
 	[self hideMenu];
 	[self selectWord];
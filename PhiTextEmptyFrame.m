@@ -24,6 +24,7 @@
 #import "PhiTextRange.h"
 #import "PhiAATree.h"
 #import "PhiTextStyle.h"
+#import "PhiTextLayoutEngine.h"
 
 @interface PhiTextFrame (PhiTextEmptyFrame)
 - (void)validateFrameRect;
@@ -53,12 +54,11 @@
 */
 - (void)_validateFrame {
 	if (!textFrame) {
-		CTFramesetterRef framesetter;
-		CFAttributedStringRef attributedString = CFAttributedStringCreate(NULL, CFSTR("\n"), (CFDictionaryRef)[[document styleAtEndOfDocument] attributes]);
-		framesetter = CTFramesetterCreateWithAttributedString(attributedString);
+		id <PhiTextLayoutEngine> engine = [document layoutEngine];
+		NSAttributedString *attributedString = [[NSAttributedString alloc] initWithString:@"\n" attributes:(NSDictionary *)[[document internedStyleAtEndOfDocument] attributes]];
 		
 		CGSize suggestedSize = CGSizeMake(CGFLOAT_MAX, CGFLOAT_MAX);
-		suggestedSize = CTFramesetterSuggestFrameSizeWithConstraints(framesetter, CFRangeMake(0, 1), (CFDictionaryRef)frameAttributes, suggestedSize, NULL);
+		suggestedSize = [engine suggestFrameSizeWithAttributedString:attributedString range:CFRangeMake(0, 1) attributes:frameAttributes constraints:suggestedSize];
 		CGRect suggestedRect = CGPathGetBoundingBox(path);
 		suggestedRect.size.width = MAX(suggestedRect.size.width, suggestedSize.width);
 		suggestedRect.size.height = MAX(suggestedRect.size.height, suggestedSize.height);
@@ -67,9 +67,13 @@
 		CGPathAddRect((CGMutablePathRef)path, NULL, suggestedRect);
 
 		do {
-			textFrame = CTFramesetterCreateFrame(framesetter, CFRangeMake(0, 1), path, (CFDictionaryRef)frameAttributes);
-			CFRange visibleRange = CTFrameGetVisibleStringRange(textFrame);
-			CFIndex nol = CFArrayGetCount(CTFrameGetLines(textFrame));
+			textFrame = [engine createFrameWithAttributedString:attributedString range:CFRangeMake(0, 1) path:path attributes:frameAttributes];
+			CFRange visibleRange = CFRangeMake(0, 0);
+			CFIndex nol = 0;
+			if (textFrame) {
+				visibleRange = [engine visibleStringRangeOfFrame:textFrame];
+				nol = CFArrayGetCount([engine linesOfFrame:textFrame]);
+			}
 			if (!textFrame || !visibleRange.length || !nol) {
 				if (textFrame) {
 					CFRelease(textFrame);
@@ -87,13 +91,9 @@
 			}
 		} while (!textFrame);
 
-		if (framesetter) {
-			CFRelease(framesetter);
-			framesetter = NULL;
-		}
 		if (attributedString) {
-			CFRelease(attributedString);
-			attributedString = NULL;
+			[attributedString release];
+			attributedString = nil;
 		}
 		rect.size = CGSizeZero;
 	}
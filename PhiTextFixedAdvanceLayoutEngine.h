@@ -0,0 +1,62 @@
+//
+//  PhiTextFixedAdvanceLayoutEngine.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import "PhiTextLayoutEngine.h"
+
+/*!
+ A deterministic layout engine in which every character has the same advance and
+ every line the same metrics, regardless of the attributes of the text.
+ Lines are broken at line separators, or (when the path is narrower than the line)
+ after the last space or tab that fits, otherwise after the last character that fits.
+ Tabs advance to the next multiple of tabWidth columns. Columns are counted per cluster: an
+ East Asian wide (or fullwidth) character takes two columns, and combining marks, trail
+ surrogates and zero width characters none, so a line is never broken inside a cluster.
+ The engine only depends on Foundation and CoreGraphics so that the frame management
+ of PhiTextDocument can be exercised without Core Text (the frame management itself
+ still needs UIKit, so it is exercised on the simulator, see PhiTextLayoutHarnessTests);
+ it draws nothing, subclasses that can render text override
+ drawLine:ofAttributedString:atPoint:inContext:.
+ */
+@interface PhiTextFixedAdvanceLayoutEngine : NSObject <PhiTextLayoutEngine> {
+@protected
+	CGFloat advance;
+	CGFloat ascent;
+	CGFloat descent;
+	CGFloat leading;
+	CGFloat xHeight;
+	NSUInteger tabWidth;
+}
+
+@property (nonatomic, assign) CGFloat advance;
+@property (nonatomic, assign) CGFloat ascent;
+@property (nonatomic, assign) CGFloat descent;
+@property (nonatomic, assign) CGFloat leading;
+@property (nonatomic, assign) CGFloat xHeight;
+/*! The number of columns between tab stops. */
+@property (nonatomic, assign) NSUInteger tabWidth;
+
+/*! Returns the number of columns (0, 1 or 2) taken by the specified character; a tab is counted as 1. */
++ (NSUInteger)columnsOfCharacter:(unichar)c;
+/*! Returns the number of columns occupied by the specified range of string, starting at the specified column. */
+- (NSUInteger)columnsOfString:(NSString *)string range:(NSRange)range fromColumn:(NSUInteger)column;
+/*! Called by drawFrame:inContext: for each line that intersects the context's clip; string is the attributed string the frame was created with. */
+- (void)drawLine:(CFTypeRef)line ofAttributedString:(NSAttributedString *)string atPoint:(CGPoint)point inContext:(CGContextRef)context;
+
+@end
@@ -0,0 +1,316 @@
+//
+//  PhiTextFixedAdvanceLayoutEngine.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextFixedAdvanceLayoutEngine.h"
+
+#ifndef PHI_FIXED_ADVANCE_BUFFER_LENGTH
+#define PHI_FIXED_ADVANCE_BUFFER_LENGTH 1024
+#endif
+
+static BOOL PhiIsLineSeparator(unichar c) {
+	return c == '\n' || c == '\r' || c == 0x2028 || c == 0x2029 || c == 0x0085;
+}
+
+/*! East Asian wide and fullwidth characters (of the Basic Multilingual Plane) per UAX #11. */
+static BOOL PhiIsWideCharacter(unichar c) {
+	return (c >= 0x1100 && c <= 0x115F)
+		|| (c >= 0x2E80 && c <= 0x303E)
+		|| (c >= 0x3041 && c <= 0x33FF)
+		|| (c >= 0x3400 && c <= 0x4DBF)
+		|| (c >= 0x4E00 && c <= 0x9FFF)
+		|| (c >= 0xA000 && c <= 0xA4CF)
+		|| (c >= 0xAC00 && c <= 0xD7A3)
+		|| (c >= 0xF900 && c <= 0xFAFF)
+		|| (c >= 0xFE30 && c <= 0xFE4F)
+		|| (c >= 0xFF00 && c <= 0xFF60)
+		|| (c >= 0xFFE0 && c <= 0xFFE6)
+		// Lead surrogates of the emoji blocks (U+1F000 to U+1FBFF) and of planes 2 and 3
+		|| (c >= 0xD83C && c <= 0xD83E)
+		|| (c >= 0xD840 && c <= 0xD8BF);
+}
+
+/*! Characters that join the preceding character's cluster: combining marks, trail surrogates, conjoining vowels and finals of Hangul, and zero width format characters. */
+static BOOL PhiIsZeroWidthCharacter(unichar c) {
+	static CFCharacterSetRef nonBase = NULL;
+	if (c < 0x0300)
+		return NO;
+	if (CFStringIsSurrogateLowCharacter(c)
+			|| (c >= 0x1160 && c <= 0x11FF)
+			|| (c >= 0x200B && c <= 0x200F)
+			|| (c >= 0x2060 && c <= 0x2064)
+			|| c == 0xFEFF)
+		return YES;
+	if (!nonBase)
+		nonBase = CFCharacterSetGetPredefined(kCFCharacterSetNonBase);
+	return CFCharacterSetIsCharacterMember(nonBase, c);
+}
+
+static NSUInteger PhiColumnWidth(unichar c, NSUInteger column, NSUInteger tabWidth) {
+	if (c == '\t') {
+		tabWidth = MAX(tabWidth, 1);
+		return tabWidth - column % tabWidth;
+	}
+	if (c < 0x0300)
+		return PhiIsLineSeparator(c) ? 0 : 1;
+	if (PhiIsZeroWidthCharacter(c) || PhiIsLineSeparator(c))
+		return 0;
+	return PhiIsWideCharacter(c) ? 2 : 1;
+}
+
+@interface PhiTextFixedAdvanceLine : NSObject {
+@public
+	NSString *text;
+	CFIndex textOffset;
+	CFRange range;
+	CGPoint origin;
+	NSUInteger columns;
+}
+@end
+
+@implementation PhiTextFixedAdvanceLine
+- (void)dealloc {
+	[text release];
+	[super dealloc];
+}
+@end
+
+@interface PhiTextFixedAdvanceFrame : NSObject {
+@public
+	NSAttributedString *string;
+	NSArray *lines;
+	CFRange visibleRange;
+	CGPoint pathOrigin;
+}
+@end
+
+@implementation PhiTextFixedAdvanceFrame
+- (void)dealloc {
+	[string release];
+	[lines release];
+	[super dealloc];
+}
+@end
+
+@implementation PhiTextFixedAdvanceLayoutEngine
+
+@synthesize advance, ascent, descent, leading, xHeight, tabWidth;
+
+- (id)init {
+	if (self = [super init]) {
+		advance = 8.0;
+		ascent = 12.0;
+		descent = 4.0;
+		leading = 0.0;
+		xHeight = 7.0;
+		tabWidth = 4;
+	}
+	return self;
+}
+
++ (NSUInteger)columnsOfCharacter:(unichar)c {
+	return c == '\t' ? 1 : PhiColumnWidth(c, 0, 1);
+}
+
+- (NSUInteger)columnsOfString:(NSString *)string range:(NSRange)range fromColumn:(NSUInteger)column {
+	NSUInteger i, start = column;
+	unichar c;
+	for (i = range.location; i < NSMaxRange(range); i++) {
+		c = [string characterAtIndex:i];
+		column += PhiColumnWidth(c, column, tabWidth);
+	}
+	return column - start;
+}
+
+/*! Breaks lines from the specified range of string, as many as fit in the specified size. */
+- (NSArray *)linesOfString:(NSString *)string range:(CFRange)range size:(CGSize)size {
+	NSMutableArray *lines = [NSMutableArray array];
+	NSString *text = [string substringWithRange:NSMakeRange(range.location, range.length)];
+	CGFloat lineHeight = ascent + descent + leading;
+	CGFloat consumed = 0.0;
+	NSUInteger maxColumns = NSUIntegerMax;
+	unichar buffer[PHI_FIXED_ADVANCE_BUFFER_LENGTH];
+	CFIndex bufferStart = 0, bufferLength = 0;
+	CFIndex i = 0, j, lastBreak, end = range.length;
+	NSUInteger column, breakColumns, width;
+	unichar c;
+
+	if (advance > 0.0 && size.width < CGFLOAT_MAX)
+		maxColumns = MAX((NSUInteger)floor(size.width / advance), 1);
+
+#define PHI_CHARACTER_AT(__INDEX__) \
+	(((__INDEX__) >= bufferStart && (__INDEX__) < bufferStart + bufferLength) ? buffer[(__INDEX__) - bufferStart] : \
+	 (bufferStart = (__INDEX__), bufferLength = MIN(end - bufferStart, PHI_FIXED_ADVANCE_BUFFER_LENGTH), \
+	  [text getCharacters:buffer range:NSMakeRange(bufferStart, bufferLength)], buffer[0]))
+
+	while (i < end && consumed + ascent + descent <= size.height) {
+		column = 0;
+		lastBreak = -1;
+		breakColumns = 0;
+		for (j = i; j < end; j++) {
+			c = PHI_CHARACTER_AT(j);
+			if (PhiIsLineSeparator(c)) {
+				j++;
+				if (c == '\r' && j < end && PHI_CHARACTER_AT(j) == '\n')
+					j++;
+				break;
+			}
+			width = PhiColumnWidth(c, column, tabWidth);
+			if (column + width > maxColumns && j > i) {
+				if (lastBreak > i) {
+					j = lastBreak;
+					column = breakColumns;
+				}
+				break;
+			}
+			column += width;
+			if (c == ' ' || c == '\t') {
+				lastBreak = j + 1;
+				breakColumns = column;
+			}
+		}
+
+		PhiTextFixedAdvanceLine *line = [[PhiTextFixedAdvanceLine alloc] init];
+		line->text = [text retain];
+		line->textOffset = range.location;
+		line->range = CFRangeMake(range.location + i, j - i);
+		line->origin = CGPointMake(0.0, size.height - consumed - ascent);
+		line->columns = column;
+		[lines addObject:line];
+		[line release];
+
+		consumed += lineHeight;
+		i = j;
+	}
+#undef PHI_CHARACTER_AT
+	return lines;
+}
+
+- (CFTypeRef)createFrameWithAttributedString:(NSAttributedString *)string range:(CFRange)range path:(CGPathRef)path attributes:(NSDictionary *)attributes {
+	if (range.length == 0)
+		range.length = [string length] - range.location;
+	CGRect bounds = CGPathGetBoundingBox(path);
+	PhiTextFixedAdvanceFrame *frame = [[PhiTextFixedAdvanceFrame alloc] init];
+	frame->string = [string retain];
+	frame->pathOrigin = bounds.origin;
+	frame->lines = [[self linesOfString:[string string] range:range size:bounds.size] retain];
+	frame->visibleRange = CFRangeMake(range.location, 0);
+	if ([frame->lines count]) {
+		CFRange lastRange = ((PhiTextFixedAdvanceLine *)[frame->lines lastObject])->range;
+		frame->visibleRange.length = lastRange.location + lastRange.length - range.location;
+	}
+	return (CFTypeRef)frame;
+}
+
+- (CGSize)suggestFrameSizeWithAttributedString:(NSAttributedString *)string range:(CFRange)range attributes:(NSDictionary *)attributes constraints:(CGSize)constraints {
+	if (range.length == 0)
+		range.length = [string length] - range.location;
+	NSArray *lines = [self linesOfString:[string string] range:range size:constraints];
+	NSUInteger maxColumns = 0;
+	for (PhiTextFixedAdvanceLine *line in lines)
+		maxColumns = MAX(maxColumns, line->columns);
+	return CGSizeMake(maxColumns * advance, [lines count] * (ascent + descent + leading));
+}
+
+- (CFRange)visibleStringRangeOfFrame:(CFTypeRef)frame {
+	return ((PhiTextFixedAdvanceFrame *)frame)->visibleRange;
+}
+
+- (CFArrayRef)linesOfFrame:(CFTypeRef)frame {
+	return (CFArrayRef)((PhiTextFixedAdvanceFrame *)frame)->lines;
+}
+
+- (void)getLineOrigins:(CGPoint *)origins inRange:(CFRange)range ofFrame:(CFTypeRef)frame {
+	NSArray *lines = ((PhiTextFixedAdvanceFrame *)frame)->lines;
+	CFIndex i;
+	if (range.length == 0)
+		range.length = [lines count] - range.location;
+	for (i = 0; i < range.length; i++)
+		origins[i] = ((PhiTextFixedAdvanceLine *)[lines objectAtIndex:range.location + i])->origin;
+}
+
+- (void)drawFrame:(CFTypeRef)aFrame inContext:(CGContextRef)context {
+	[self drawFrame:aFrame withPaintFromAttributedString:((PhiTextFixedAdvanceFrame *)aFrame)->string inContext:context];
+}
+
+/*! Every line is drawn from string, so the paint is simply that of string. */
+- (void)drawFrame:(CFTypeRef)aFrame withPaintFromAttributedString:(NSAttributedString *)string inContext:(CGContextRef)context {
+	PhiTextFixedAdvanceFrame *frame = (PhiTextFixedAdvanceFrame *)aFrame;
+	CGRect clip = CGContextGetClipBoundingBox(context);
+	CGPoint point;
+	if ([string length] < frame->visibleRange.location + frame->visibleRange.length)
+		string = frame->string;
+	for (PhiTextFixedAdvanceLine *line in frame->lines) {
+		point = CGPointMake(frame->pathOrigin.x + line->origin.x, frame->pathOrigin.y + line->origin.y);
+		if (point.y + ascent < CGRectGetMinY(clip) || point.y - descent > CGRectGetMaxY(clip))
+			continue;
+		[self drawLine:(CFTypeRef)line ofAttributedString:string atPoint:point inContext:context];
+	}
+}
+
+- (void)drawLine:(CFTypeRef)line ofAttributedString:(NSAttributedString *)string atPoint:(CGPoint)point inContext:(CGContextRef)context {
+	// Headless; nothing to draw
+}
+
+- (CFRange)stringRangeOfLine:(CFTypeRef)line {
+	return ((PhiTextFixedAdvanceLine *)line)->range;
+}
+
+- (double)typographicBoundsOfLine:(CFTypeRef)line ascent:(CGFloat *)ascentPtr descent:(CGFloat *)descentPtr leading:(CGFloat *)leadingPtr {
+	if (ascentPtr)
+		*ascentPtr = ascent;
+	if (descentPtr)
+		*descentPtr = descent;
+	if (leadingPtr)
+		*leadingPtr = leading;
+	return ((PhiTextFixedAdvanceLine *)line)->columns * advance;
+}
+
+- (CGFloat)xHeightOfLine:(CFTypeRef)line {
+	return xHeight;
+}
+
+- (CGFloat)offsetForStringIndex:(CFIndex)stringIndex inLine:(CFTypeRef)aLine {
+	PhiTextFixedAdvanceLine *line = (PhiTextFixedAdvanceLine *)aLine;
+	stringIndex = MIN(MAX(stringIndex, line->range.location), line->range.location + line->range.length);
+	return [self columnsOfString:line->text
+						   range:NSMakeRange(line->range.location - line->textOffset, stringIndex - line->range.location)
+					  fromColumn:0] * advance;
+}
+
+- (CFIndex)stringIndexForPosition:(CGPoint)position inLine:(CFTypeRef)aLine {
+	PhiTextFixedAdvanceLine *line = (PhiTextFixedAdvanceLine *)aLine;
+	CFIndex i, end = line->range.location + line->range.length;
+	NSUInteger column = 0, width;
+	unichar c;
+	for (i = line->range.location; i < end; i++) {
+		c = [line->text characterAtIndex:i - line->textOffset];
+		if (PhiIsLineSeparator(c))
+			break;
+		width = PhiColumnWidth(c, column, tabWidth);
+		// Never between a character and the marks (or trail surrogate) that follow it
+		if (!width)
+			continue;
+		if (position.x < (column + width / 2.0) * advance)
+			break;
+		column += width;
+	}
+	return i;
+}
+
+@end
@@ -23,6 +23,22 @@
 
 @class UIFont;
 
+/*! Number of fonts held by the font cache before it is emptied. */
+#ifndef PHI_FONT_CACHE_LIMIT
+#define PHI_FONT_CACHE_LIMIT 256
+#endif
+
+typedef struct {
+	NSUInteger hits;
+	NSUInteger misses;
+	NSUInteger count;
+} PhiTextFontCacheStatistics;
+
+/*!
+ Wraps a CTFont. The CTFonts created for a descriptor and size (by fontWithFont:andSize:,
+ fontWithCTFontDescriptor:andSize:, fontWithSize: and setSize:) are shared process-wide
+ through a thread-safe cache, which is emptied on memory warnings.
+ */
 @interface PhiTextFont : NSObject {
 	CTFontRef _CTFont;
 }
@@ -52,8 +68,13 @@
 - (id)initWithCTFont:(CTFontRef)font;
 - (PhiTextFont *)fontWithSize:(CGFloat)size;
 
+/*! Returns the receiver's CTFont, retained (CTFonts are immutable so it is shared, not copied). */
 - (CTFontRef)copyCTFont;
 - (CTFontDescriptorRef)copyCTFontDescriptor;
 
++ (PhiTextFontCacheStatistics)cacheStatistics;
++ (void)resetCacheStatistics;
++ (void)removeAllCachedFonts;
+
 
 @end
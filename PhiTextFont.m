@@ -19,24 +19,104 @@
 
 #import "PhiTextFont.h"
 #import <UIKit/UIFont.h>
+#import <UIKit/UIApplication.h>
+
+typedef struct {
+	CTFontDescriptorRef descriptor;
+	CGFloat size;
+} PhiTextFontCacheKey;
+
+static const void *PhiFontCacheKeyRetain(CFAllocatorRef allocator, const void *value) {
+	const PhiTextFontCacheKey *key = value;
+	PhiTextFontCacheKey *rv = CFAllocatorAllocate(allocator, sizeof(PhiTextFontCacheKey), 0);
+	rv->descriptor = CFRetain(key->descriptor);
+	rv->size = key->size;
+	return rv;
+}
+static void PhiFontCacheKeyRelease(CFAllocatorRef allocator, const void *value) {
+	PhiTextFontCacheKey *key = (PhiTextFontCacheKey *)value;
+	CFRelease(key->descriptor);
+	CFAllocatorDeallocate(allocator, key);
+}
+static Boolean PhiFontCacheKeyEqual(const void *value1, const void *value2) {
+	const PhiTextFontCacheKey *key1 = value1, *key2 = value2;
+	return key1->size == key2->size && CFEqual(key1->descriptor, key2->descriptor);
+}
+static CFHashCode PhiFontCacheKeyHash(const void *value) {
+	const PhiTextFontCacheKey *key = value;
+	return CFHash(key->descriptor) * 31 + (CFHashCode)(key->size * 64.0);
+}
+static const CFDictionaryKeyCallBacks PhiFontCacheKeyCallBacks = {
+	0, PhiFontCacheKeyRetain, PhiFontCacheKeyRelease, NULL, PhiFontCacheKeyEqual, PhiFontCacheKeyHash
+};
+
+static CFMutableDictionaryRef cachedFonts = NULL;
+static PhiTextFontCacheStatistics cacheStatistics;
+
+/*! Returns a (retained) CTFont shared by every caller with an equal descriptor and size. */
+static CTFontRef PhiCopyCachedFont(CTFontDescriptorRef descriptor, CGFloat size) {
+	PhiTextFontCacheKey key = { descriptor, size };
+	CTFontRef font;
+	@synchronized([PhiTextFont class]) {
+		font = CFDictionaryGetValue(cachedFonts, &key);
+		if (font) {
+			cacheStatistics.hits++;
+			CFRetain(font);
+		} else {
+			cacheStatistics.misses++;
+			font = CTFontCreateWithFontDescriptor(descriptor, size, NULL);
+			if (font) {
+				if (CFDictionaryGetCount(cachedFonts) >= PHI_FONT_CACHE_LIMIT)
+					CFDictionaryRemoveAllValues(cachedFonts);
+				CFDictionarySetValue(cachedFonts, &key, font);
+			}
+		}
+	}
+	return font;
+}
 
 @implementation PhiTextFont
 
++ (void)initialize {
+	if (self == [PhiTextFont class]) {
+		cachedFonts = CFDictionaryCreateMutable(NULL, 0, &PhiFontCacheKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		memset(&cacheStatistics, 0, sizeof(cacheStatistics));
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(removeAllCachedFonts) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	}
+}
+
++ (PhiTextFontCacheStatistics)cacheStatistics {
+	PhiTextFontCacheStatistics rv;
+	@synchronized([PhiTextFont class]) {
+		rv = cacheStatistics;
+		rv.count = CFDictionaryGetCount(cachedFonts);
+	}
+	return rv;
+}
++ (void)resetCacheStatistics {
+	@synchronized([PhiTextFont class]) {
+		memset(&cacheStatistics, 0, sizeof(cacheStatistics));
+	}
+}
++ (void)removeAllCachedFonts {
+	@synchronized([PhiTextFont class]) {
+		CFDictionaryRemoveAllValues(cachedFonts);
+	}
+}
+
 + (id)fontWithCTFont:(CTFontRef)font {
 	return [[[PhiTextFont alloc] initWithCTFont:font] autorelease];
 }
 
 + (id)fontWithFont:(PhiTextFont *)font andSize:(CGFloat)size {
 	CTFontDescriptorRef descriptor = [font copyCTFontDescriptor];
-	CTFontRef ctFont = CTFontCreateWithFontDescriptor(descriptor, size, NULL);
-	id rv = [[[PhiTextFont alloc] initWithCTFont:ctFont] autorelease];
-	CFRelease(ctFont);
+	id rv = [PhiTextFont fontWithCTFontDescriptor:descriptor andSize:size];
 	CFRelease(descriptor);
 	return rv;
 }
 
 + (id)fontWithCTFontDescriptor:(CTFontDescriptorRef)descriptor andSize:(CGFloat)size {
-	CTFontRef font = CTFontCreateWithFontDescriptor(descriptor, size, NULL);
+	CTFontRef font = PhiCopyCachedFont(descriptor, size);
 	id rv = [[[PhiTextFont alloc] initWithCTFont:font] autorelease];
 	CFRelease(font);
 	return rv;
@@ -44,7 +124,7 @@
 
 - (id)initWithCTFont:(CTFontRef)font {
 	if (self = [super init])
-		_CTFont = CTFontCreateCopyWithAttributes(font, 0.0, NULL, NULL);
+		_CTFont = CFRetain(font);
 	return self;
 }
 
@@ -57,7 +137,7 @@
 }
 
 - (CTFontRef)copyCTFont {
-	return CTFontCreateCopyWithAttributes(_CTFont, 0.0, NULL, NULL);
+	return CFRetain(_CTFont);
 }
 
 - (void)setCTFont:(CTFontRef)font {
@@ -66,7 +146,7 @@
 			CFRelease(_CTFont);
 		}
 		if (font) {
-			_CTFont = CTFontCreateCopyWithAttributes(font, 0.0, NULL, NULL);
+			_CTFont = CFRetain(font);
 		} else {
 			_CTFont = NULL;
 		}
@@ -180,7 +260,9 @@
 
 - (void)setSize:(CGFloat)points {
 	if (points != self.size) {
-		CTFontRef newFont = CTFontCreateCopyWithAttributes(_CTFont, points, NULL, NULL);
+		CTFontDescriptorRef descriptor = CTFontCopyFontDescriptor(_CTFont);
+		CTFontRef newFont = PhiCopyCachedFont(descriptor, points);
+		CFRelease(descriptor);
 		if (_CTFont)
 			CFRelease(_CTFont);
 		_CTFont = newFont;
@@ -44,6 +44,16 @@ typedef CFOptionFlags PhiTextFrameCompareFlags;
 
 typedef CFComparisonResult (*PhiTextFrameComparatorFunction)(id searchValue, id value, BOOL backwards);
 
+/*! The string range and vertical extent of a typeset line. */
+typedef struct PhiTextFrameLineExtent PhiTextFrameLineExtent;
+
+/*! The metrics of a typeset line needed to rule it, relative to the bottom of the frame (as are line origins). */
+typedef struct {
+	CGFloat baseline;
+	CGFloat descent;
+	CGFloat xHeight;
+} PhiTextFrameGuideline;
+
 /*!
  Compares the rectangles of two the specified PhiTextFrames or NSValues.
  Returns kCFCompareGreaterThan if the top of the otherTextFrame is below
@@ -64,10 +74,6 @@ CFComparisonResult PhiTextFrameCompareByRectIn (id textFrame, id otherTextFrame,
 CFComparisonResult PhiTextFrameCompareByRange (id textFrame, id otherTextFrame, BOOL backwards);
 CFComparisonResult PhiTextFrameCompareByRangeIn (id textFrame, id otherTextFrame, BOOL backwards);
 
-#ifndef PHI_FRAMESETTER_MEMBER
-#define PHI_FRAMESETTER_MEMBER 0
-#endif
-
 @interface PhiTextFrame : NSObject /*TODO:<NSDiscardableContent>*/ {
 @protected
 	CGPathRef path;
@@ -83,14 +89,29 @@ CFComparisonResult PhiTextFrameCompareByRangeIn (id textFrame, id otherTextFrame
 	CGRect staleRect;
 	CGPoint tileOffset;
 	PhiTextRange *textRange;
-#if PHI_FRAMESETTER_MEMBER
-	CTFramesetterRef framesetter;
-#endif
-	CTFrameRef textFrame;
+	/*! Created by the document's layoutEngine. */
+	CFTypeRef textFrame;
 	BOOL hasEmptyLastLine;
 	
 	int accessCount;
 	BOOL deferEndAccess;
+	
+	NSUInteger staleLineCount;
+	NSUInteger contentCost;
+	BOOL contentEvicted;
+	
+	BOOL paintStale;
+	NSAttributedString *paintString;
+	
+	PhiTextFrameLineExtent *staleLineExtents;
+	CFIndex staleLineExtentCount;
+	NSRange staleEditRange;
+	NSInteger staleEditDiff;
+	CGFloat staleHeight;
+	
+	PhiTextFrameGuideline *guidelines;
+	CFIndex guidelineCount;
+	NSUInteger contentGeneration;
 }
 
 + (PhiTextFrame *)textFrameInPath:(CGPathRef)constraints beginningAt:(CFIndex)stringIndex forDocument:(PhiTextDocument *)document;
@@ -106,20 +127,51 @@ CFComparisonResult PhiTextFrameCompareByRangeIn (id textFrame, id otherTextFrame
 @property (nonatomic, readonly) CGPoint tileOffset;
 @property (nonatomic, readonly) CFIndex firstStringIndex;
 @property (nonatomic, readonly) NSUInteger firstLineNumber;
+/*! Incremented whenever the frame discards its content (i.e. its lines), so that those who keep a line can tell whether it is still current. */
+@property (readonly) NSUInteger contentGeneration;
 @property (nonatomic, assign) PhiTextDocument *document;
 @property (nonatomic, retain) NSDictionary *frameAttributes;
+/*! The number of lines when last typeset, available even after the content is discarded. */
+@property (nonatomic, readonly) NSUInteger staleLineCount;
+/*! The estimated number of bytes held by the typeset content. */
+@property (nonatomic, readonly) NSUInteger contentCost;
+@property (nonatomic, readonly, getter=isContentEvicted) BOOL contentEvicted;
+/*! Whether the frame holds typeset content, whether or not it is being accessed. */
+@property (nonatomic, readonly, getter=isContentTypeset) BOOL contentTypeset;
+/*! Returns the frame created by the document's layoutEngine, which must be released. */
+- (CFTypeRef)copyLayoutFrame;
+/*! As copyLayoutFrame, but returns NULL unless the frame is a CTFrame. */
 - (CTFrameRef)copyCTFrame;
+/*! Marks the paint (e.g. colours) of the typeset content as stale, without discarding the content. */
+- (void)invalidatePaint;
+/*! Returns the text of the frame, from the store, if its paint is stale; otherwise nil. */
+- (NSAttributedString *)paintAttributedString;
 
 - (id)initInPath:(CGPathRef)constraints beginningAt:(CFIndex)stringIndex forDocument:(PhiTextDocument *)document attributes:(NSDictionary *)attributes;
 
 - (NSUInteger)lineCount;
+/*! Returns the guidelines of every line, as fetched when the frame was last typeset, or NULL if it has not been. */
+- (const PhiTextFrameGuideline *)guidelinesWithCount:(CFIndex *)count;
 - (PhiTextLine *)lineAtIndex:(CFIndex)index;
+/*! Returns (a malloc'd copy of) the string range of every line, in the coordinates of the document, or NULL if the frame can not be typeset. */
+- (CFRange *)copyLineRanges:(CFIndex *)count;
 - (CGRect)CGRectValue;
 - (CGFloat)realWidth;
 - (NSRange)rangeValue;
 
 // Use the NSDiscardableContent methods instead
 - (void)invalidateFrame;
+/*!
+ As invalidateFrame, but the lines of the current layout are kept so that, when the frame is next
+ typeset, only the lines that differ (given that the text in range, in the coordinates of the edited
+ text, was changed and the length of the text changed by diff) are reported to the document as damaged.
+ Returns NO, and the frame is simply invalidated, if the frame has no layout to compare with.
+ */
+- (BOOL)invalidateFrameForEditInRange:(NSRange)range changeInLength:(NSInteger)diff;
+/*! Returns YES if the frame is waiting to compare its lines with those kept by invalidateFrameForEditInRange:changeInLength:. */
+- (BOOL)hasStaleLineExtents;
+/*! Forgets the lines kept by invalidateFrameForEditInRange:changeInLength:, reporting the whole frame as damaged. */
+- (void)discardStaleLineExtents;
 //- (void)validateFrameRect;
 //- (void)validateFrame;
 - (BOOL)beginContentAccess;
@@ -127,6 +179,7 @@ CFComparisonResult PhiTextFrameCompareByRangeIn (id textFrame, id otherTextFrame
 - (PhiTextFrame *)autoEndContentAccess;
 - (void)discardContentIfPossible;
 - (BOOL)isContentDiscarded;
+- (BOOL)isContentAccessed;
 
 - (PhiTextLine *)searchLineWithPosition:(PhiTextPosition *)position selectionAffinity:(UITextStorageDirection)selectionAffinity;
 - (PhiTextLine *)searchLineWithRange:(PhiTextRange *)range andPoint:(CGPoint)point;
@@ -25,6 +25,9 @@
 #import "PhiTextLine.h"
 #import "PhiTextStyle.h"
 #import "PhiTextParagraphStyle.h"
+#import "PhiTextFrameCache.h"
+#import "PhiTextLayoutEngine.h"
+#import "PhiTextDecorations.h"
 
 #ifndef PHI_FRAME_USE_CTLINE_API
 #define PHI_FRAME_USE_CTLINE_API 1
@@ -34,6 +37,16 @@
 #define DEBUG_CONTENT_ACCESS 1
 #endif
 
+#ifndef PHI_FRAME_LINE_DAMAGE_OUTSET
+#define PHI_FRAME_LINE_DAMAGE_OUTSET 2.0
+#endif
+
+struct PhiTextFrameLineExtent {
+	CFRange range;
+	CGFloat top;
+	CGFloat bottom;
+};
+
 NSUInteger textRangeLengthHint = 0;
 NSUInteger textRangeLengthMax = 0;
 
@@ -210,9 +223,9 @@ CFComparisonResult PhiTextFrameCompareByRangeIn (id textFrame, id otherTextFrame
 	return result;
 }
 
-CFComparisonResult PhiTextFrameComparePositionToLine (CFIndex offset, CTLineRef line, BOOL selectionAffinityBackward, BOOL hasLineBreak) {
+CFComparisonResult PhiTextFrameComparePositionToLine (id <PhiTextLayoutEngine> engine, CFIndex offset, CFTypeRef line, BOOL selectionAffinityBackward, BOOL hasLineBreak) {
 	CFComparisonResult rv = kCFCompareEqualTo;
-	CFRange stringRange = CTLineGetStringRange(line);
+	CFRange stringRange = [engine stringRangeOfLine:line];
 	if (offset < stringRange.location
 		|| (selectionAffinityBackward && /*!hasLineBreak &&*/ offset == stringRange.location)
 	) {
@@ -241,11 +254,11 @@ CFComparisonResult PhiTextFrameComparePositionToLine (CFIndex offset, CTLineRef
 #endif
 	return rv;
 }
-CFIndex PhiTextFrameBSearchLineWithPosition (CFArrayRef theArray, NSRange range, CFIndex position, BOOL selectionAffinityBackward, BOOL hasLineBreak, BOOL searchBackwards) {
+CFIndex PhiTextFrameBSearchLineWithPosition (id <PhiTextLayoutEngine> engine, CFArrayRef theArray, NSRange range, CFIndex position, BOOL selectionAffinityBackward, BOOL hasLineBreak, BOOL searchBackwards) {
 	CFIndex pivot;
 	while (range.length > 1) {
 		pivot = range.location + range.length / 2;
-		if ((PhiTextFrameComparePositionToLine(position, CFArrayGetValueAtIndex(theArray, pivot), selectionAffinityBackward, hasLineBreak) == kCFCompareLessThan) ^ searchBackwards) {
+		if ((PhiTextFrameComparePositionToLine(engine, position, CFArrayGetValueAtIndex(theArray, pivot), selectionAffinityBackward, hasLineBreak) == kCFCompareLessThan) ^ searchBackwards) {
 			range.length = MAX(0, pivot - range.location);
 		} else {
 			range.length = MAX(0, range.length - pivot + range.location);
@@ -254,13 +267,13 @@ CFIndex PhiTextFrameBSearchLineWithPosition (CFArrayRef theArray, NSRange range,
 	}
 	return range.location;
 }
-CFComparisonResult PhiTextFrameComparePointToLine (CGPoint point, CTLineRef line, CGPoint lineOrigin, CGRect rect) {
+CFComparisonResult PhiTextFrameComparePointToLine (id <PhiTextLayoutEngine> engine, CGPoint point, CFTypeRef line, CGPoint lineOrigin, CGRect rect) {
 #ifdef TRACE
 	NSLog(@"Entering PhiTextFrameComparePointToLine((%.f, %.f), %@, (%.f, %.f), (%.f, %.f) (%.f, %.f))", point.x, point.y, line, lineOrigin.x, lineOrigin.y, CGRectComp(rect));
 #endif
 	CFComparisonResult result = kCFCompareEqualTo;
 	CGFloat ascent, descent, leading, bottomBound, topBound;
-	CTLineGetTypographicBounds(line, &ascent, &descent, &leading);
+	[engine typographicBoundsOfLine:line ascent:&ascent descent:&descent leading:&leading];
 	topBound = rect.origin.y + rect.size.height - lineOrigin.y - ascent - leading / 2.0;
 	bottomBound = rect.origin.y + rect.size.height - lineOrigin.y + descent + leading / 2.0;
 	
@@ -273,15 +286,15 @@ CFComparisonResult PhiTextFrameComparePointToLine (CGPoint point, CTLineRef line
 #endif
 	return result;
 }
-CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textLines, CFRange range, CGPoint point, CGRect rect) {
+CFIndex PhiTextFrameBSearchLineWithPoint (id <PhiTextLayoutEngine> engine, CFTypeRef textFrame, CFArrayRef textLines, CFRange range, CGPoint point, CGRect rect) {
 	CFIndex pivot;
-	CTLineRef line;
+	CFTypeRef line;
 	CGPoint lineOrigin;
 	while (range.length > 1) {
 		pivot = range.location + range.length / 2;
 		line = CFArrayGetValueAtIndex(textLines, pivot);
-		CTFrameGetLineOrigins(textFrame, CFRangeMake(pivot, 1), &lineOrigin);
-		if (PhiTextFrameComparePointToLine(point, line, lineOrigin, rect) == kCFCompareLessThan) {
+		[engine getLineOrigins:&lineOrigin inRange:CFRangeMake(pivot, 1) ofFrame:textFrame];
+		if (PhiTextFrameComparePointToLine(engine, point, line, lineOrigin, rect) == kCFCompareLessThan) {
 			range.length = MAX(0, pivot - range.location);
 		} else {
 			range.length = MAX(0, range.length - pivot + range.location);
@@ -333,10 +346,11 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 }
 @synthesize textRange, rect, hasEmptyLastLine;
 @synthesize document, frameAttributes, firstStringIndex, firstLineNumber;
+@synthesize staleLineCount, contentCost, contentEvicted, contentGeneration;
 
 - (PhiTextLine *)_lineAtIndex:(CFIndex)index fromTextLines:(CFArrayRef)textLines {
 	if (!textLines) {
-		textLines = CTFrameGetLines(textFrame);
+		textLines = [[document layoutEngine] linesOfFrame:textFrame];
 	}
 	//TODO: cache or at least keep in sparse array
 	return [PhiTextLine textLineWithLine:CFArrayGetValueAtIndex(textLines, index) index:index frame:self];
@@ -368,8 +382,9 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 		document = doc;
 		self.frameAttributes = attributes;
 		hasEmptyLastLine = NO;
-		
-		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(discardContentIfPossible) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+		staleLineCount = 0;
+		contentCost = 0;
+		contentEvicted = NO;
 	}
 	return self;
 }
@@ -382,7 +397,8 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 		staleRect.origin = rect.origin;
 	}
 	if (rect.size.height == 0.0) {
-		CFArrayRef textLines = CTFrameGetLines(textFrame);
+		id <PhiTextLayoutEngine> engine = [document layoutEngine];
+		CFArrayRef textLines = [engine linesOfFrame:textFrame];
 		CFIndex count = 0;
 		if (textLines)
 			count = CFArrayGetCount(textLines);
@@ -398,21 +414,21 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 #if PHI_FRAME_USE_CTLINE_API
 			CGPoint originInFrame;
 			CGFloat descent;
-			CTLineRef firstLine = CFArrayGetValueAtIndex(textLines, 0);
-			CTLineRef lastLine = CFArrayGetValueAtIndex(textLines, count - 1);
+			CFTypeRef firstLine = CFArrayGetValueAtIndex(textLines, 0);
+			CFTypeRef lastLine = CFArrayGetValueAtIndex(textLines, count - 1);
 			CFRange lineRange;
-			CTFrameGetLineOrigins(textFrame, CFRangeMake(count - 1, 1), &originInFrame);
-			CTLineGetTypographicBounds(firstLine, NULL, NULL, &spacingBefore);
-			CTLineGetTypographicBounds(lastLine, NULL, &descent, NULL);
+			[engine getLineOrigins:&originInFrame inRange:CFRangeMake(count - 1, 1) ofFrame:textFrame];
+			[engine typographicBoundsOfLine:firstLine ascent:NULL descent:NULL leading:&spacingBefore];
+			[engine typographicBoundsOfLine:lastLine ascent:NULL descent:&descent leading:NULL];
 			rect.size.height = bounds.size.height - originInFrame.y + descent;
-			lineRange = CTLineGetStringRange(lastLine);
+			lineRange = [engine stringRangeOfLine:lastLine];
 			lineRange.location += firstStringIndex;
-			bottomStyle = [document styleFromPosition:[PhiTextPosition textPositionWithPosition:lineRange.location]
+			bottomStyle = [document internedStyleFromPosition:[PhiTextPosition textPositionWithPosition:lineRange.location]
 						  toFarthestEffectivePosition:NULL
 									notBeyondPosition:[PhiTextPosition textPositionWithPosition:lineRange.location + lineRange.length]];
-			lineRange = CTLineGetStringRange(firstLine);
+			lineRange = [engine stringRangeOfLine:firstLine];
 			lineRange.location += firstStringIndex;
-			topStyle = [document styleFromPosition:[PhiTextPosition textPositionWithPosition:lineRange.location]
+			topStyle = [document internedStyleFromPosition:[PhiTextPosition textPositionWithPosition:lineRange.location]
 						  toFarthestEffectivePosition:NULL
 									notBeyondPosition:[PhiTextPosition textPositionWithPosition:lineRange.location + lineRange.length]];
 #else
@@ -436,6 +452,8 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 			rect.size.height += spacingBefore;
 		}
 		staleRect.size = rect.size;
+		if (staleLineExtents)
+			[self reportLineDamage];
 		[self.document adjustSizeToTextFrame:self exansionOnly:YES];
 	}
 }
@@ -455,21 +473,19 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 	} else {
 		range = NSMakeRange(firstStringIndex, MIN(MAX(textRangeLengthHint, 2), maxStringLength));
 	}
-#if !PHI_FRAMESETTER_MEMBER
-	CTFramesetterRef framesetter = NULL;
-#endif
+	id <PhiTextLayoutEngine> engine = [document layoutEngine];
+	attributedSubstring = nil;
 	
 	hasEmptyLastLine = NO;
 	do {
-		if (!framesetter) {
+		if (!attributedSubstring)
 			attributedSubstring = [[document store] attributedSubstringFromRange:range];
-			framesetter = CTFramesetterCreateWithAttributedString((CFAttributedStringRef)attributedSubstring);
-		}
-		textFrame = CTFramesetterCreateFrame(framesetter, CFRangeMake(0, range.length), path, (CFDictionaryRef)frameAttributes);
-		visibleRange = CTFrameGetVisibleStringRange(textFrame);
+		textFrame = [engine createFrameWithAttributedString:attributedSubstring range:CFRangeMake(0, range.length) path:path attributes:frameAttributes];
+		visibleRange = CFRangeMake(0, 0);
 		CFIndex lineCount = 0;
 		if (textFrame) {
-			CFArrayRef lines = CTFrameGetLines(textFrame);
+			visibleRange = [engine visibleStringRangeOfFrame:textFrame];
+			CFArrayRef lines = [engine linesOfFrame:textFrame];
 			if (lines)
 				lineCount = CFArrayGetCount(lines);
 		}
@@ -497,17 +513,12 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 			//if (maxStringLength == textRangeLengthMax) {}
 			visibleRange.location = range.location;
 		} else {
-			CFRelease(framesetter);
-			framesetter = NULL;
+			attributedSubstring = nil;
 			CFRelease(textFrame);
 			textFrame = NULL;
 			range.length = MIN(range.length * 2, maxStringLength);
 		}
 	} while (!textFrame);
-	if (framesetter) {
-		CFRelease(framesetter);
-		framesetter = NULL;
-	}
 #ifdef DEVELOPER
 	NSLog(@"visibleRange: %@", NSStringFromRange(NSMakeRange(visibleRange.location, visibleRange.length)));
 #endif
@@ -529,6 +540,56 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 	NSLog(@"%@Exiting %s.", traceIndent, __FUNCTION__);
 #endif
 }
+- (void)freeGuidelines {
+	if (guidelines) {
+		free(guidelines);
+		guidelines = NULL;
+	}
+	guidelineCount = 0;
+}
+/*! Fetches the guidelines of every line, with one call for the origins of all of them. */
+- (void)cacheGuidelinesOfTextLines:(CFArrayRef)textLines {
+	id <PhiTextLayoutEngine> engine = [document layoutEngine];
+	CGFloat ascent, descent, leading;
+	CGPoint *origins;
+	CFTypeRef line;
+	CFIndex i;
+
+	[self freeGuidelines];
+	guidelineCount = textLines ? CFArrayGetCount(textLines) : 0;
+	if (guidelineCount) {
+		guidelines = malloc(guidelineCount * sizeof(PhiTextFrameGuideline));
+		origins = malloc(guidelineCount * sizeof(CGPoint));
+		[engine getLineOrigins:origins inRange:CFRangeMake(0, guidelineCount) ofFrame:textFrame];
+		for (i = 0; i < guidelineCount; i++) {
+			line = CFArrayGetValueAtIndex(textLines, i);
+			[engine typographicBoundsOfLine:line ascent:&ascent descent:&descent leading:&leading];
+			guidelines[i].baseline = origins[i].y;
+			guidelines[i].descent = descent;
+			guidelines[i].xHeight = [engine xHeightOfLine:line];
+		}
+		free(origins);
+	}
+}
+- (const PhiTextFrameGuideline *)guidelinesWithCount:(CFIndex *)count {
+	if (count)
+		*count = guidelineCount;
+	return guidelines;
+}
+- (void)didTypesetContent {
+	CFArrayRef textLines = NULL;
+	if (textFrame)
+		textLines = [[document layoutEngine] linesOfFrame:textFrame];
+	if (textLines)
+		staleLineCount = CFArrayGetCount(textLines);
+	else
+		staleLineCount = 0;
+	[self cacheGuidelinesOfTextLines:textLines];
+	contentCost = staleStringLength * PHI_FRAME_CACHE_BYTES_PER_GLYPH + staleLineCount * (PHI_FRAME_CACHE_BYTES_PER_LINE + sizeof(PhiTextFrameGuideline));
+	[[document frameCache] textFrameDidTypeset:self];
+	contentEvicted = NO;
+	[self resetPaint];
+}
 - (void)validateFrame:(BOOL)includeGeometry {
 	NSAssert(accessCount > 0, @"The content of this PhiTextFrame has been discarded and can not be used, call the beginContentAccess method first.");
 
@@ -539,9 +600,12 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 		if (!textFrame) {
 			if ([[document store] length] >= firstStringIndex) {
 				[self _validateFrame];
+				[self didTypesetContent];
 			} else {
 				includeGeometry = NO;
 			}
+		} else if (accessCount == 1) {
+			[[document frameCache] textFrameDidBeginContentAccess:self];
 		}
 		if (includeGeometry)
 			[self validateFrameRect];
@@ -572,8 +636,13 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 - (void)endContentAccess {
 	NSAssert(accessCount > 0, @"Access to the content of this PhiTextFrame has not began, call the beginContentAccess method first.");
 	accessCount--;
-	if (!deferEndAccess)
-		[self discardContentIfPossible];
+	if (!deferEndAccess && accessCount <= 0) {
+		PhiTextFrameCache *frameCache = [document frameCache];
+		if (frameCache)
+			[frameCache textFrameDidEndContentAccess:self];
+		else
+			[self discardContentIfPossible];
+	}
 }
 
 - (void)deferedEndContentAccess {
@@ -602,28 +671,182 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 #ifdef TRACE
 	NSLog(@"%@Entering -[%x invalidateFrame]...", traceIndent, self);
 #endif
+	[self discardStaleLineExtents];
+	[self _invalidateFrame];
+}
+- (void)_invalidateFrame {
+	[document invalidateLayoutSnapshot];
+	[self freeGuidelines];
+	contentGeneration++;
 	[[NSNotificationCenter defaultCenter] postNotificationName:PhiTextFrameWillDiscardContentNotification object:self];
-#if PHI_FRAMESETTER_MEMBER
-	if (framesetter) {
-		CFRelease(framesetter);
-		framesetter = NULL;
-	}
-#endif
 	if (textFrame) {
 		CFRelease(textFrame);
 		textFrame = NULL;
+		[[document frameCache] textFrameDidDiscardContent:self];
 	}
+	contentEvicted = NO;
+	[self resetPaint];
 	//TODO: invalidate any PhiTextLines associated with this frame
 	//TODO: should we use (NAN, NAN) instead of (0, 0)??
 	rect.size = CGSizeZero;
 	[[NSNotificationCenter defaultCenter] postNotificationName:PhiTextFrameDidDiscardContentNotification object:self];
 }
+/*! Returns (in a buffer that must be freed) the range, in the store, and the extent, from the top of rect, of each typeset line. */
+- (PhiTextFrameLineExtent *)copyLineExtents:(CFIndex *)count {
+	id <PhiTextLayoutEngine> engine = [document layoutEngine];
+	CFArrayRef textLines = [engine linesOfFrame:textFrame];
+	CFIndex i, n = textLines ? CFArrayGetCount(textLines) : 0;
+	PhiTextFrameLineExtent *extents = NULL;
+	CGFloat height = rect.size.height + tileOffset.y;
+	CGFloat ascent, descent, leading;
+	CGPoint origin;
+	CFTypeRef line;
+	
+	if (n) {
+		extents = malloc(n * sizeof(PhiTextFrameLineExtent));
+		for (i = 0; i < n; i++) {
+			line = CFArrayGetValueAtIndex(textLines, i);
+			[engine getLineOrigins:&origin inRange:CFRangeMake(i, 1) ofFrame:textFrame];
+			[engine typographicBoundsOfLine:line ascent:&ascent descent:&descent leading:&leading];
+			extents[i].range = [engine stringRangeOfLine:line];
+			extents[i].range.location += firstStringIndex;
+			// As drawn, i.e. flipped about the bottom of the frame (see PhiTextView)
+			extents[i].top = height - origin.y - ascent;
+			extents[i].bottom = height - origin.y + descent + leading;
+		}
+	}
+	*count = n;
+	return extents;
+}
+/*!
+ The range of an edit covers both what was replaced and its replacement (i.e. it is as long as the longer
+ of the two), so in the coordinates before the edit it ends at editEnd - MAX(diff, 0), and after the edit at
+ editEnd + MIN(diff, 0). Returns where the specified location (before the edit) is after the edit; a location
+ within the replaced characters maps to the end of their replacement.
+ */
+static NSUInteger PhiMapLocationThroughEdit(NSUInteger location, NSRange edit, NSInteger diff) {
+	if (location <= edit.location)
+		return location;
+	if ((NSInteger)location >= (NSInteger)NSMaxRange(edit) - MAX(diff, 0))
+		return location + diff;
+	return NSMaxRange(edit) + MIN(diff, 0);
+}
+
+- (BOOL)invalidateFrameForEditInRange:(NSRange)range changeInLength:(NSInteger)diff {
+	if (staleLineExtents) {
+		// Edited again before being typeset; map the earlier edit through this one and widen it to cover both
+		NSUInteger end = MAX(PhiMapLocationThroughEdit(NSMaxRange(staleEditRange), range, diff), NSMaxRange(range));
+		staleEditRange.location = MIN(staleEditRange.location, range.location);
+		staleEditRange.length = end - staleEditRange.location;
+		staleEditDiff += diff;
+	} else if (textFrame && rect.size.height > 0.0) {
+		staleLineExtents = [self copyLineExtents:&staleLineExtentCount];
+		staleEditRange = range;
+		staleEditDiff = diff;
+		staleHeight = rect.size.height;
+	}
+	[self _invalidateFrame];
+	return staleLineExtents != NULL;
+}
+- (BOOL)hasStaleLineExtents {
+	return staleLineExtents != NULL;
+}
+- (void)freeStaleLineExtents {
+	if (staleLineExtents) {
+		free(staleLineExtents);
+		staleLineExtents = NULL;
+		staleLineExtentCount = 0;
+	}
+}
+- (void)discardStaleLineExtents {
+	if (staleLineExtents) {
+		[self freeStaleLineExtents];
+		CGRect damage = staleRect;
+		CGSize size = [self tileSize];
+		if (size.width * size.height > 0.0)
+			damage.size = size;
+		[document addDamageRect:CGRectOffset(damage, [document paddingLeft], [document paddingTop])];
+	}
+}
+/*!
+ Compares the lines just typeset with those kept by invalidateFrameForEditInRange:changeInLength:.
+ A line is unchanged if it lies wholly before or after the edit, its range (shifted by the change in
+ length if after the edit) is the same and it is drawn at the same position; the rest are damaged.
+ */
+- (void)reportLineDamage {
+	CFIndex i, j = 0, count, location;
+	CFIndex editStart = staleEditRange.location, editEnd = NSMaxRange(staleEditRange);
+	PhiTextFrameLineExtent *extents = [self copyLineExtents:&count];
+	BOOL *matched = calloc(MAX(staleLineExtentCount, 1), sizeof(BOOL));
+	CGFloat top = CGFLOAT_MAX, bottom = -CGFLOAT_MAX;
+	
+	for (i = 0; i < count; i++) {
+		location = kCFNotFound;
+		if (extents[i].range.location + extents[i].range.length <= editStart)
+			location = extents[i].range.location;
+		else if (extents[i].range.location >= editEnd)
+			location = extents[i].range.location - staleEditDiff;
+		if (location != kCFNotFound) {
+			while (j < staleLineExtentCount && staleLineExtents[j].range.location < location)
+				j++;
+			if (j < staleLineExtentCount
+				&& staleLineExtents[j].range.location == location
+				&& staleLineExtents[j].range.length == extents[i].range.length
+				&& staleLineExtents[j].top == extents[i].top
+				&& staleLineExtents[j].bottom == extents[i].bottom) {
+				matched[j] = YES;
+				continue;
+			}
+		}
+		top = MIN(top, extents[i].top);
+		bottom = MAX(bottom, extents[i].bottom);
+	}
+	for (j = 0; j < staleLineExtentCount; j++) {
+		if (!matched[j]) {
+			top = MIN(top, staleLineExtents[j].top);
+			bottom = MAX(bottom, staleLineExtents[j].bottom);
+		}
+	}
+	if (staleHeight != rect.size.height) {
+		top = MIN(top, MIN(staleHeight, rect.size.height));
+		bottom = MAX(bottom, MAX(staleHeight, rect.size.height));
+	}
+	free(matched);
+	if (extents)
+		free(extents);
+	[self freeStaleLineExtents];
+	
+#ifdef DEVELOPER
+	NSLog(@"Line damage in %@: (%.1f, %.1f)", self, top, bottom);
+#endif
+	if (top < bottom)
+		[document addDamageRect:CGRectMake(rect.origin.x + [document paddingLeft],
+										   rect.origin.y + top + [document paddingTop] - PHI_FRAME_LINE_DAMAGE_OUTSET,
+										   rect.size.width, bottom - top + 2.0 * PHI_FRAME_LINE_DAMAGE_OUTSET)];
+}
+/*! Unlike invalidateFrame, the metrics of the frame (rect, text range and line count) are kept. */
+- (void)discardContent {
+#ifdef TRACE
+	NSLog(@"%@Entering -[%x discardContent]...", traceIndent, self);
+#endif
+	if (textFrame) {
+		contentGeneration++;
+		[[NSNotificationCenter defaultCenter] postNotificationName:PhiTextFrameWillDiscardContentNotification object:self];
+		CFRelease(textFrame);
+		textFrame = NULL;
+		[self freeGuidelines];
+		contentEvicted = YES;
+		[self resetPaint];
+		[[document frameCache] textFrameDidDiscardContent:self];
+		[[NSNotificationCenter defaultCenter] postNotificationName:PhiTextFrameDidDiscardContentNotification object:self];
+	}
+}
 - (void)discardContentIfPossible {
 #ifdef TRACE
 	NSLog(@"%@Entering -[%x discardContentIfPossible] %d...", traceIndent, self, accessCount);
 #endif
 	if (accessCount <= 0 || (accessCount == 1 && deferEndAccess)) {
-		[self invalidateFrame];
+		[self discardContent];
 	}
 #ifdef TRACE
 	NSLog(@"%@Exiting %s.", traceIndent, __FUNCTION__);
@@ -632,10 +855,16 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 - (BOOL)isContentDiscarded {
 	return textFrame == NULL || accessCount <= 0;
 }
+- (BOOL)isContentAccessed {
+	return accessCount > 0;
+}
+- (BOOL)isContentTypeset {
+	return textFrame != NULL;
+}
 
-/*! Since CTFrame is immutable (and has no copy method) retain is used instead of copy. */
-- (CTFrameRef)copyCTFrame {
-	CTFrameRef rv = NULL;
+/*! Since the frame is immutable (and has no copy method) retain is used instead of copy. */
+- (CFTypeRef)copyLayoutFrame {
+	CFTypeRef rv = NULL;
 	if ([self beginContentAccess]) {
 		rv = CFRetain(textFrame);
 		[self autoEndContentAccess];
@@ -643,9 +872,64 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 	
 	return rv;
 }
+- (void)invalidatePaint {
+	[document invalidateLayoutSnapshot];
+	if (textFrame) {
+		paintStale = YES;
+		if (paintString) {
+			[paintString release];
+			paintString = nil;
+		}
+	}
+}
+- (void)resetPaint {
+	paintStale = NO;
+	if (paintString) {
+		[paintString release];
+		paintString = nil;
+	}
+}
+/*! The string is indexed as was the text given to the layoutEngine, i.e. from firstStringIndex; it
+ includes the document's decorations, so it is made (while the frame's paint is not stale) if any
+ decoration intersects the frame. */
+- (NSAttributedString *)paintAttributedString {
+	if (!textFrame)
+		return nil;
+	if (!paintString) {
+		PhiTextDecorations *decorations = [document decorations];
+		CFRange visibleRange = [[document layoutEngine] visibleStringRangeOfFrame:textFrame];
+		NSUInteger length = [[document store] length];
+		NSRange range = NSMakeRange(firstStringIndex, visibleRange.location + visibleRange.length);
+		BOOL decorated;
+		if (range.location > length)
+			return nil;
+		if (NSMaxRange(range) > length)
+			range.length = length - range.location;
+		decorated = [decorations hasDecorationsInRange:range];
+		if (!paintStale && !decorated)
+			return nil;
+		if (decorated) {
+			NSMutableAttributedString *string = [[[document store] attributedSubstringFromRange:range] mutableCopy];
+			[decorations addAttributesToString:string atLocation:range.location];
+			paintString = string;
+		} else {
+			paintString = [[[document store] attributedSubstringFromRange:range] retain];
+		}
+	}
+	return paintString;
+}
+- (CTFrameRef)copyCTFrame {
+	CFTypeRef rv = [self copyLayoutFrame];
+	if (rv && CFGetTypeID(rv) != CTFrameGetTypeID()) {
+		CFRelease(rv);
+		rv = NULL;
+	}
+	return (CTFrameRef)rv;
+}
 
 - (void)setOrigin:(CGPoint)origin {
 	if (!CGPointEqualToPoint(rect.origin, origin)) {
+		[document invalidateLayoutSnapshot];
 		rect.origin = origin;
 		staleRect.origin = origin;
 		if (![self isContentDiscarded])
@@ -700,11 +984,12 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 		if ([self beginContentAccess]) {
 			width = rect.size.width;
 			if (width == CGFLOAT_MAX) {
-				CFArrayRef lines = CTFrameGetLines(textFrame);
+				id <PhiTextLayoutEngine> engine = [document layoutEngine];
+				CFArrayRef lines = [engine linesOfFrame:textFrame];
 				CGFloat maxWidth = 0.0;
 				CFIndex count = CFArrayGetCount(lines);
 				for (CFIndex i = 0; i < count; i++) {
-					width = CTLineGetTypographicBounds(CFArrayGetValueAtIndex(lines, i), NULL, NULL, NULL);
+					width = [engine typographicBoundsOfLine:CFArrayGetValueAtIndex(lines, i) ascent:NULL descent:NULL leading:NULL];
 					maxWidth = MAX(maxWidth, width);
 				}
 				width = rect.size.width = maxWidth;
@@ -764,8 +1049,32 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 - (void)setFirstLineNumber:(NSUInteger)number {
 	firstLineNumber = number;
 }
+/*! Used by PhiTextLayoutCache to restore the metrics of a frame without typesetting it; the content is typeset when next accessed. */
+- (void)restoreTextLength:(CFIndex)length lineCount:(NSUInteger)count rect:(CGRect)aRect hasEmptyLastLine:(BOOL)emptyLastLine {
+	[document invalidateLayoutSnapshot];
+	[self freeStaleLineExtents];
+	[self freeGuidelines];
+	if (textFrame) {
+		CFRelease(textFrame);
+		textFrame = NULL;
+		[[document frameCache] textFrameDidDiscardContent:self];
+	}
+	accessCount = 0;
+	staleStringLength = length;
+	staleLineCount = count;
+	stringIndexDiff = 0;
+	contentCost = staleStringLength * PHI_FRAME_CACHE_BYTES_PER_GLYPH + staleLineCount * PHI_FRAME_CACHE_BYTES_PER_LINE;
+	rect = staleRect = aRect;
+	hasEmptyLastLine = emptyLastLine;
+	if (textRange)
+		[textRange release];
+	textRange = [[PhiTextRange textRangeWithRange:NSMakeRange(firstStringIndex, staleStringLength)] retain];
+}
 - (void)setTextRange:(PhiTextRange *)aRange {
 	if (![textRange isEqual:aRange]) {
+		[self discardStaleLineExtents];
+		[document invalidateLayoutSnapshot];
+		[self freeGuidelines];
 		if (textFrame) {
 			CFRelease(textFrame);
 			textFrame = NULL;
@@ -785,22 +1094,19 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 		NSRange range = [textRange range];
 		CFRange visibleRange;
 		NSAttributedString *attributedSubstring;
-#if !PHI_FRAMESETTER_MEMBER
-		CTFramesetterRef framesetter = NULL;
-#endif
+		id <PhiTextLayoutEngine> engine = [document layoutEngine];
 		
 		if (firstStringIndex >= 0 && path && document && [document store]) {
 			hasEmptyLastLine = NO;
+			attributedSubstring = [[document store] attributedSubstringFromRange:range];
 			do {
-				if (framesetter) {
-					CFRelease(framesetter);
-					framesetter = NULL;
+				textFrame = [engine createFrameWithAttributedString:attributedSubstring range:CFRangeMake(0, range.length) path:path attributes:frameAttributes];
+				visibleRange = CFRangeMake(0, 0);
+				CFIndex lineCount = 0;
+				if (textFrame) {
+					visibleRange = [engine visibleStringRangeOfFrame:textFrame];
+					lineCount = CFArrayGetCount([engine linesOfFrame:textFrame]);
 				}
-				attributedSubstring = [[document store] attributedSubstringFromRange:range];
-				framesetter = CTFramesetterCreateWithAttributedString((CFAttributedStringRef)attributedSubstring);
-				textFrame = CTFramesetterCreateFrame(framesetter, CFRangeMake(0, range.length), path, (CFDictionaryRef)frameAttributes);
-				visibleRange = CTFrameGetVisibleStringRange(textFrame);
-				CFIndex lineCount = CFArrayGetCount(CTFrameGetLines(textFrame));
 				// Grow path if it is too small for any text
 				if (!textFrame || !visibleRange.length || !lineCount) {
 					if (textFrame) {
@@ -820,10 +1126,6 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 				// Workaround for line ending at string end rendering issue
 				visibleRange.location = range.location;
 			} while (!textFrame);
-			if (framesetter) {
-				CFRelease(framesetter);
-				framesetter = NULL;
-			}
 			
 			if (visibleRange.length > 0
 				&& (visibleRange.length == 1 || [[document store] isLineBreakAtIndex:range.location + visibleRange.length - 2])
@@ -838,6 +1140,7 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 			stringIndexDiff += visibleRange.length - staleStringLength;
 			staleStringLength = visibleRange.length;
 			rect.size = CGSizeZero;
+			[self didTypesetContent];
 
 			[self validateFrameRect];
 
@@ -871,17 +1174,12 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 }
 
 - (void)dealloc {
-#if PHI_FRAMESETTER_MEMBER
-	if (framesetter) {
-		CFRelease(framesetter);
-		framesetter = NULL;
-	}
-#endif
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 
 	if (textFrame) {
 		CFRelease(textFrame);
 		textFrame = NULL;
+		[[document frameCache] textFrameDidDiscardContent:self];
 	}
 	if (path) {
 		CGPathRelease(path);
@@ -896,13 +1194,19 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 		[frameAttributes release];
 		frameAttributes = nil;
 	}
+	if (paintString) {
+		[paintString release];
+		paintString = nil;
+	}
+	[self freeStaleLineExtents];
+	[self freeGuidelines];
 	[super dealloc];
 }
 
 - (NSUInteger)lineCount {
 	CFIndex rv = 0;
 	if ([self beginTextAccess]) {
-		CFArrayRef textLines = CTFrameGetLines(textFrame);
+		CFArrayRef textLines = [[document layoutEngine] linesOfFrame:textFrame];
 		rv = CFArrayGetCount(textLines);
 		[self autoEndContentAccess];
 	}
@@ -912,13 +1216,34 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 - (PhiTextLine *)lineAtIndex:(CFIndex)index {
 	PhiTextLine *rv = nil;
 	if ([self beginTextAccess]) {
-		CFArrayRef textLines = CTFrameGetLines(textFrame);
+		CFArrayRef textLines = [[document layoutEngine] linesOfFrame:textFrame];
 		rv = [self _lineAtIndex:index fromTextLines:textLines];
 		[self autoEndContentAccess];
 	}
 	return rv;
 }
 
+- (CFRange *)copyLineRanges:(CFIndex *)count {
+	CFRange *ranges = NULL;
+	CFIndex i, n = 0;
+	if ([self beginTextAccess]) {
+		id <PhiTextLayoutEngine> engine = [document layoutEngine];
+		CFArrayRef textLines = [engine linesOfFrame:textFrame];
+		n = textLines ? CFArrayGetCount(textLines) : 0;
+		if (n) {
+			ranges = malloc(n * sizeof(CFRange));
+			for (i = 0; i < n; i++) {
+				ranges[i] = [engine stringRangeOfLine:CFArrayGetValueAtIndex(textLines, i)];
+				ranges[i].location += firstStringIndex;
+			}
+		}
+		[self autoEndContentAccess];
+	}
+	if (count)
+		*count = n;
+	return ranges;
+}
+
 - (PhiTextLine *)searchLineWithPosition:(PhiTextPosition *)position selectionAffinity:(UITextStorageDirection)selectionAffinity {
 #ifdef TRACE
 	NSLog(@"%@Entering [PhiTextFrame searchLineWithPosition:%@ selectionAffinity:%s]...", traceIndent, position, selectionAffinity==UITextStorageDirectionForward?"UITextStorageDirectionForward":"UITextStorageDirectionBackward");
@@ -928,7 +1253,8 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 	/**/
 	if ([self beginTextAccess]) {
 		CFIndex i = NSNotFound, count = 0;
-		textLines = CTFrameGetLines(textFrame);
+		id <PhiTextLayoutEngine> engine = [document layoutEngine];
+		textLines = [engine linesOfFrame:textFrame];
 		count = CFArrayGetCount(textLines);
 		
 		// Check position is in frame
@@ -951,11 +1277,11 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 		else {
 			CFIndex offset = PhiPositionOffset(position) - PhiRangeOffset(textRange);
 			if (offset <= 0) {
-				i = PhiTextFrameBSearchLineWithPosition(textLines, NSMakeRange(0, count), offset, (BOOL)selectionAffinity, YES, NO);
+				i = PhiTextFrameBSearchLineWithPosition(engine, textLines, NSMakeRange(0, count), offset, (BOOL)selectionAffinity, YES, NO);
 			} else {
 				BOOL hasForcedLineBreak = [[document store] isLineBreakAtIndex:PhiPositionOffset(position) - 1];
 				//TODO: check document store length
-				i = PhiTextFrameBSearchLineWithPosition(textLines, NSMakeRange(0, count), offset,
+				i = PhiTextFrameBSearchLineWithPosition(engine, textLines, NSMakeRange(0, count), offset,
 														(BOOL)selectionAffinity,
 														//(BOOL)selectionAffinity && !(hasForcedLineBreak && [[document store] isLineBreakAtIndex:PhiPositionOffset(position)]),
 														hasForcedLineBreak, NO);
@@ -984,7 +1310,8 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 	}
 
 	if ([self beginContentAccess]) {
-		CFArrayRef textLines = CTFrameGetLines(textFrame);
+		id <PhiTextLayoutEngine> engine = [document layoutEngine];
+		CFArrayRef textLines = [engine linesOfFrame:textFrame];
 		/**/
 		CFIndex i, count;
 		CGFloat bottomBound, topBound;
@@ -1010,7 +1337,7 @@ CFIndex PhiTextFrameBSearchLineWithPoint (CTFrameRef textFrame, CFArrayRef textL
 #endif
 			if (point.y >= topBound) {
 				// Search through lines.
-				i = PhiTextFrameBSearchLineWithPoint(textFrame, textLines, CFRangeMake(i, count - i), point, bounds);
+				i = PhiTextFrameBSearchLineWithPoint(engine, textFrame, textLines, CFRangeMake(i, count - i), point, bounds);
 				line = [self _lineAtIndex:i fromTextLines:textLines];
 #ifdef DEVELOPER
 				NSLog(@"%@line %d bottomBound:%.f topBound:%.f", traceIndent, line.index, bottomBound, topBound);
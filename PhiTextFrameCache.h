@@ -0,0 +1,87 @@
+//
+//  PhiTextFrameCache.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+
+@class PhiTextFrame;
+
+/*! Estimated cost (in bytes) of each glyph (glyph, position, advance and string index) held by a CTFrame. */
+#ifndef PHI_FRAME_CACHE_BYTES_PER_GLYPH
+#define PHI_FRAME_CACHE_BYTES_PER_GLYPH 48
+#endif
+/*! Estimated cost (in bytes) of each CTLine (and its runs) held by a CTFrame. */
+#ifndef PHI_FRAME_CACHE_BYTES_PER_LINE
+#define PHI_FRAME_CACHE_BYTES_PER_LINE 512
+#endif
+/*! Number of least recently used frames considered for eviction, of which the frame farthest from the viewport is evicted first. */
+#ifndef PHI_FRAME_CACHE_EVICTION_WINDOW
+#define PHI_FRAME_CACHE_EVICTION_WINDOW 4
+#endif
+
+typedef struct {
+	NSUInteger hits;
+	NSUInteger misses;
+	/*! Misses on frames whose content had been evicted (i.e. scroll-back re-typesets). */
+	NSUInteger retypesets;
+	NSUInteger evictions;
+	unsigned long long evictedBytes;
+	NSUInteger count;
+	NSUInteger totalBytes;
+	NSUInteger budget;
+} PhiTextFrameCacheStatistics;
+
+/*!
+ Holds the typeset content (CTFrame) of PhiTextFrames, no longer being accessed, for
+ as long as the total estimated cost remains within a budget (textFrameCacheBudget).
+ Frames are evicted least recently used first, preferring frames far from the viewport.
+ Evicted frames keep their metrics (rect, range and line count) so that they can be
+ positioned without being typeset again.
+ The frames are retained by the cache while they hold content; a frame removes itself when
+ its content is discarded.
+ */
+@interface PhiTextFrameCache : NSObject {
+@private
+	CFMutableArrayRef frames;
+	CFMutableDictionaryRef costs;
+	NSUInteger budget;
+	NSUInteger totalBytes;
+	CGRect viewport;
+	PhiTextFrameCacheStatistics statistics;
+}
+
+@property (nonatomic, assign) NSUInteger budget;
+@property (nonatomic, readonly) NSUInteger totalBytes;
+/*! The visible portion of the document (in document coordinates, i.e. without padding). */
+@property (assign) CGRect viewport;
+
+- (void)textFrameDidTypeset:(PhiTextFrame *)textFrame;
+- (void)textFrameDidBeginContentAccess:(PhiTextFrame *)textFrame;
+- (void)textFrameDidEndContentAccess:(PhiTextFrame *)textFrame;
+- (void)textFrameDidDiscardContent:(PhiTextFrame *)textFrame;
+
+/*! Evicts frames, that are not being accessed, until the total cost is no more than the specified number of bytes. */
+- (void)evictToCost:(NSUInteger)bytes;
+/*! Discards the content of every frame that is not being accessed. */
+- (void)discardContentIfPossible;
+
+- (PhiTextFrameCacheStatistics)statistics;
+- (void)resetStatistics;
+
+@end
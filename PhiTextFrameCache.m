@@ -0,0 +1,281 @@
+//
+//  PhiTextFrameCache.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <UIKit/UIKit.h>
+#import "PhiTextFrameCache.h"
+#import "PhiTextFrame.h"
+#import "PhiTextDocument.h"
+
+static CGFloat PhiDistanceFromRectToRect(CGRect rect, CGRect otherRect) {
+	if (CGRectIsNull(rect) || CGRectIsNull(otherRect) || CGRectIntersectsRect(rect, otherRect))
+		return 0.0;
+	if (CGRectGetMaxY(rect) < CGRectGetMinY(otherRect))
+		return CGRectGetMinY(otherRect) - CGRectGetMaxY(rect);
+	if (CGRectGetMinY(rect) > CGRectGetMaxY(otherRect))
+		return CGRectGetMinY(rect) - CGRectGetMaxY(otherRect);
+	return 0.0;
+}
+
+@implementation PhiTextFrameCache
+
++ (void)initialize {
+	CFStringRef suiteName = CFSTR("com.phitext");
+	NSInteger aNSInt;
+	CFNumberRef aNumberValue;
+
+	CFPropertyListRef last = CFPreferencesCopyAppValue(CFSTR("textFrameCacheBudget"), suiteName);
+	if (last) {
+		CFRelease(last);
+	} else {
+		aNSInt = 1 << 22;
+		aNumberValue = CFNumberCreate(NULL, kCFNumberNSIntegerType, &aNSInt);
+		CFPreferencesSetAppValue(CFSTR("textFrameCacheBudget"), aNumberValue, suiteName);
+		CFRelease(aNumberValue);
+
+#ifdef PHI_SYNC_DEFAULTS
+		CFPreferencesAppSynchronize(suiteName);
+#endif
+	}
+}
+
+@synthesize budget, totalBytes, viewport;
+
+- (id)init {
+	if (self = [super init]) {
+		NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+		[defaults addSuiteNamed:@"com.phitext"];
+
+		frames = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+		costs = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+		budget = [defaults integerForKey:@"textFrameCacheBudget"];
+		totalBytes = 0;
+		viewport = CGRectNull;
+		memset(&statistics, 0, sizeof(statistics));
+
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(discardContentIfPossible) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	}
+	return self;
+}
+
+- (void)setBudget:(NSUInteger)bytes {
+	@synchronized(self) {
+		budget = bytes;
+	}
+	[self evictToCost:bytes];
+}
+
+/*! The frame is autoreleased, rather than released, since it may be the caller (e.g. in discardContent). */
+- (void)_removeTextFrame:(PhiTextFrame *)textFrame {
+	CFIndex i;
+	if (!frames)
+		return;
+	i = CFArrayGetFirstIndexOfValue(frames, CFRangeMake(0, CFArrayGetCount(frames)), textFrame);
+	if (i != kCFNotFound) {
+		[[textFrame retain] autorelease];
+		CFArrayRemoveValueAtIndex(frames, i);
+		totalBytes -= (NSUInteger)CFDictionaryGetValue(costs, textFrame);
+		CFDictionaryRemoveValue(costs, textFrame);
+	}
+}
+
+- (void)_addTextFrame:(PhiTextFrame *)textFrame {
+	if (frames && !CFDictionaryContainsKey(costs, textFrame)) {
+		CFArrayAppendValue(frames, textFrame);
+		CFDictionarySetValue(costs, textFrame, (const void *)[textFrame contentCost]);
+		totalBytes += [textFrame contentCost];
+	}
+}
+
+- (void)textFrameDidTypeset:(PhiTextFrame *)textFrame {
+	@synchronized(self) {
+		statistics.misses++;
+		if ([textFrame isContentEvicted])
+			statistics.retypesets++;
+		[self _removeTextFrame:textFrame];
+		[self _addTextFrame:textFrame];
+	}
+	[self evictToCost:budget];
+}
+
+- (void)textFrameDidBeginContentAccess:(PhiTextFrame *)textFrame {
+	@synchronized(self) {
+		CFIndex count = CFArrayGetCount(frames);
+		CFIndex i = CFArrayGetLastIndexOfValue(frames, CFRangeMake(0, count), textFrame);
+		if (i != kCFNotFound) {
+			statistics.hits++;
+			if (i < count - 1) {
+				// Appended before it is removed, so that the array doesn't release the last reference
+				CFArrayAppendValue(frames, textFrame);
+				CFArrayRemoveValueAtIndex(frames, i);
+			}
+		}
+	}
+}
+
+- (void)textFrameDidEndContentAccess:(PhiTextFrame *)textFrame {
+	BOOL overBudget;
+	@synchronized(self) {
+		overBudget = totalBytes > budget;
+	}
+	if (overBudget)
+		[self evictToCost:budget];
+}
+
+- (void)textFrameDidDiscardContent:(PhiTextFrame *)textFrame {
+	@synchronized(self) {
+		[self _removeTextFrame:textFrame];
+	}
+}
+
+/*!
+ Discards the content of the victims (already removed from the cache) outside of the cache's lock, since discarding posts notifications; a victim that began to be accessed in the meantime keeps its content and is put back.
+ Each victim is discarded under the lock of its document's store, as frames are typeset under it on background threads (so the store is always locked before the cache).
+ */
+- (void)_discardContentOfVictims:(NSArray *)victims costs:(const NSUInteger *)victimCosts {
+	NSUInteger i = 0, evictions = 0;
+	unsigned long long evictedBytes = 0;
+	for (PhiTextFrame *victim in victims) {
+		@synchronized([[victim document] store]) {
+			[victim discardContentIfPossible];
+		}
+		@synchronized(self) {
+			if ([victim isContentTypeset]) {
+				[self _addTextFrame:victim];
+			} else if ([victim isContentEvicted]) {
+				evictions++;
+				evictedBytes += victimCosts[i];
+			}
+		}
+		i++;
+	}
+	@synchronized(self) {
+		statistics.evictions += evictions;
+		statistics.evictedBytes += evictedBytes;
+	}
+}
+
+- (void)evictToCost:(NSUInteger)bytes {
+	NSMutableArray *victims = nil;
+	NSUInteger *victimCosts = NULL;
+	@synchronized(self) {
+		PhiTextFrame *textFrame, *victim;
+		CGFloat distance, farthest;
+		CFIndex i, window, count = CFArrayGetCount(frames);
+		NSUInteger cost;
+
+		while (totalBytes > bytes && count) {
+			victim = nil;
+			farthest = -1.0;
+			window = PHI_FRAME_CACHE_EVICTION_WINDOW;
+			for (i = 0; i < count && window > 0; i++) {
+				textFrame = (PhiTextFrame *)CFArrayGetValueAtIndex(frames, i);
+				if (![textFrame isContentAccessed]) {
+					distance = PhiDistanceFromRectToRect([textFrame CGRectValue], viewport);
+					if (distance > farthest) {
+						victim = textFrame;
+						farthest = distance;
+					}
+					window--;
+				}
+			}
+			if (!victim)
+				break;
+
+			cost = (NSUInteger)CFDictionaryGetValue(costs, victim);
+#ifdef DEVELOPER
+			NSLog(@"Evicting %@ (%u bytes, %.f points from viewport).", victim, cost, farthest);
+#endif
+			if (!victims)
+				victims = [[NSMutableArray alloc] init];
+			victimCosts = realloc(victimCosts, ([victims count] + 1) * sizeof(NSUInteger));
+			victimCosts[[victims count]] = cost;
+			[victims addObject:victim];
+			[self _removeTextFrame:victim];
+			count = CFArrayGetCount(frames);
+		}
+	}
+	if (victims) {
+		[self _discardContentOfVictims:victims costs:victimCosts];
+		[victims release];
+		free(victimCosts);
+	}
+}
+
+- (void)discardContentIfPossible {
+	NSMutableArray *victims = nil;
+	NSUInteger *victimCosts = NULL;
+	NSUInteger i = 0;
+	@synchronized(self) {
+		victims = [[NSMutableArray alloc] initWithArray:(NSArray *)frames];
+		victimCosts = malloc(MAX([victims count], 1) * sizeof(NSUInteger));
+		for (PhiTextFrame *textFrame in victims)
+			victimCosts[i++] = (NSUInteger)CFDictionaryGetValue(costs, textFrame);
+		CFArrayRemoveAllValues(frames);
+		CFDictionaryRemoveAllValues(costs);
+		totalBytes = 0;
+	}
+	[self _discardContentOfVictims:victims costs:victimCosts];
+	[victims release];
+	free(victimCosts);
+#ifdef DEVELOPER
+	NSLog(@"Memory warning: frame cache reduced to %u frames (%u bytes).", [self statistics].count, [self totalBytes]);
+#endif
+}
+
+- (PhiTextFrameCacheStatistics)statistics {
+	PhiTextFrameCacheStatistics rv;
+	@synchronized(self) {
+		rv = statistics;
+		rv.count = CFArrayGetCount(frames);
+		rv.totalBytes = totalBytes;
+		rv.budget = budget;
+	}
+	return rv;
+}
+
+- (void)resetStatistics {
+	@synchronized(self) {
+		memset(&statistics, 0, sizeof(statistics));
+	}
+}
+
+- (NSString *)description {
+	PhiTextFrameCacheStatistics stats = [self statistics];
+	return [NSString stringWithFormat:@"<%@: 0x%x; %u frames; %u/%u bytes; %u hits; %u misses; %u retypesets; %u evictions; %llu evicted bytes>",
+			NSStringFromClass([self class]), self, stats.count, stats.totalBytes, stats.budget,
+			stats.hits, stats.misses, stats.retypesets, stats.evictions, stats.evictedBytes];
+}
+
+- (void)dealloc {
+	CFMutableArrayRef oldFrames = frames;
+	CFMutableDictionaryRef oldCosts = costs;
+
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+
+	// The frames released here may message the cache as they are deallocated
+	frames = NULL;
+	costs = NULL;
+	if (oldCosts)
+		CFRelease(oldCosts);
+	if (oldFrames)
+		CFRelease(oldFrames);
+	[super dealloc];
+}
+
+@end
@@ -21,9 +21,44 @@
 #import <UIKit/UITextInput.h>
 
 @class PhiTextEditorView;
+@class PhiTextDocument;
+@class PhiTextFrame;
+
+typedef struct {
+	/*! Number of line-granularity moves (positionFromPosition:toBoundary:inDirection:). */
+	NSUInteger moves;
+	/*! Number of moves answered from the line cursor, without searching the document. */
+	NSUInteger hits;
+	/*! Number of times the line cursor was (re)bound to a frame, e.g. when a move crosses into the next frame. */
+	NSUInteger loads;
+	/*! Total time spent on line-granularity moves (in seconds). */
+	double moveTime;
+} PhiTextLineCursorStatistics;
+
+/*!
+ The lines of one text frame, as they were in a layout generation of the document, so that
+ consecutive line moves within the frame do not search the document (or allocate PhiTextLines).
+ Neither the frame nor the document is retained (a frame must not outlive its document); the
+ cursor is stale once the owner's document is not the same document, or not in the same generation.
+ */
+typedef struct {
+	PhiTextFrame *frame;
+	PhiTextDocument *document;
+	NSUInteger generation;
+	CFRange *lines;
+	CFIndex count;
+	CFIndex index;
+} PhiTextLineCursor;
 
 @interface PhiTextInputTokenizer : UITextInputStringTokenizer {
 	PhiTextEditorView *owner;
+	PhiTextLineCursor lineCursor;
+	PhiTextLineCursorStatistics lineCursorStatistics;
 }
 
+/*! Unbinds the line cursor; called by the owner before its document is changed (or released). */
+- (void)resetLineCursor;
+- (PhiTextLineCursorStatistics)lineCursorStatistics;
+- (void)resetLineCursorStatistics;
+
 @end
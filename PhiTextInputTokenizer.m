@@ -26,13 +26,194 @@
 #import "PhiTextPosition.h"
 #import "PhiAATree.h"
 #import "PhiTextStorage.h"
+#import "PhiTextBoundaryCache.h"
 
 @interface PhiTextDocument (PhiTextInputTokenizer)
 - (PhiTextLine *)searchLineWithPosition:(PhiTextPosition *)position selectionAffinity:(UITextStorageDirection)affinity inRect:(CGRect)rect frameNode:(PhiAATreeNode **)frameNode;
 @end
 
+static PhiTextBoundary PhiTextStartBoundaryOfGranularity(UITextGranularity granularity) {
+	switch (granularity) {
+		case UITextGranularityWord:
+			return PhiTextWordStartBoundary;
+		case UITextGranularitySentence:
+			return PhiTextSentenceStartBoundary;
+		case UITextGranularityParagraph:
+			return PhiTextParagraphStartBoundary;
+		default:
+			return 0;
+	}
+}
+static PhiTextBoundary PhiTextEndBoundaryOfGranularity(UITextGranularity granularity) {
+	return PhiTextStartBoundaryOfGranularity(granularity) << 1;
+}
+static BOOL PhiTextDirectionIsForward(UITextDirection direction) {
+	return direction == UITextStorageDirectionForward || direction == UITextLayoutDirectionRight;
+}
+
 @implementation PhiTextInputTokenizer
 
+/*!
+ Returns the range of the unit (of the specified boundaries) that encloses the character after
+ position, if direction is forward, otherwise the character before position; or NSNotFound.
+ */
+- (NSRange)rangeOfUnitEnclosingIndex:(NSUInteger)index startBoundary:(PhiTextBoundary)startBoundary endBoundary:(PhiTextBoundary)endBoundary inDirection:(UITextDirection)direction {
+	PhiTextBoundaryCache *boundaries = owner.textDocument.boundaryCache;
+	NSUInteger start, end;
+	if (PhiTextDirectionIsForward(direction) && ([boundaries boundariesAtIndex:index] & startBoundary))
+		start = index;
+	else
+		start = [boundaries indexOfBoundary:startBoundary beforeIndex:index];
+	if (start == NSNotFound)
+		return NSMakeRange(NSNotFound, 0);
+	end = [boundaries indexOfBoundary:endBoundary afterIndex:start];
+	if (end == NSNotFound || end < index || (end == index && PhiTextDirectionIsForward(direction)))
+		return NSMakeRange(NSNotFound, 0);
+	return NSMakeRange(start, end - start);
+}
+
+#pragma mark Line Cursor
+
+- (void)resetLineCursor {
+	if (lineCursor.lines)
+		free(lineCursor.lines);
+	memset(&lineCursor, 0, sizeof(lineCursor));
+}
+
+/*! Binds the line cursor to the frame of the line at index; returns NO if that frame can not be cached (e.g. it is the last empty frame). */
+- (BOOL)loadLineCursorAtIndex:(NSUInteger)index affinity:(UITextStorageDirection)affinity {
+	PhiTextDocument *document = owner.textDocument;
+	PhiTextLine *line = [document searchLineWithPosition:[PhiTextPosition textPositionWithPosition:index] selectionAffinity:affinity];
+	PhiTextFrame *frame = [line frame];
+	[self resetLineCursor];
+	if (!frame || frame == [document lastEmptyFrame])
+		return NO;
+	lineCursor.lines = [frame copyLineRanges:&lineCursor.count];
+	if (!lineCursor.lines)
+		return NO;
+	lineCursor.frame = frame;
+	lineCursor.index = line.index;
+	lineCursor.document = document;
+	lineCursor.generation = [document layoutGeneration];
+	lineCursorStatistics.loads++;
+	return YES;
+}
+
+/*! Returns the line (of the line cursor) that contains index, or kCFNotFound if the cursor is stale or index is not in its frame. */
+- (CFIndex)lineCursorLineAtIndex:(NSUInteger)index affinity:(UITextStorageDirection)affinity {
+	PhiTextDocument *document = owner.textDocument;
+	CFRange *lines = lineCursor.lines;
+	CFIndex i = kCFNotFound, low, high, mid;
+	if (!lines || lineCursor.document != document || lineCursor.generation != [document layoutGeneration])
+		return kCFNotFound;
+	// Consecutive moves land on the current line or one of its neighbours
+	for (low = MAX(lineCursor.index - 1, 0), high = MIN(lineCursor.index + 1, lineCursor.count - 1); low <= high; low++) {
+		if (lines[low].location <= (CFIndex)index && (CFIndex)index < lines[low].location + lines[low].length) {
+			i = low;
+			break;
+		}
+	}
+	if (i == kCFNotFound) {
+		low = 0;
+		high = lineCursor.count - 1;
+		while (low <= high) {
+			mid = (low + high) / 2;
+			if ((CFIndex)index < lines[mid].location)
+				high = mid - 1;
+			else if ((CFIndex)index >= lines[mid].location + lines[mid].length)
+				low = mid + 1;
+			else {
+				i = mid;
+				break;
+			}
+		}
+	}
+	if (affinity == UITextStorageDirectionBackward) {
+		// The end of a wrapped line (or of the frame) belongs to the line it ends
+		if (i == kCFNotFound) {
+			if (lineCursor.count && (CFIndex)index == lines[lineCursor.count - 1].location + lines[lineCursor.count - 1].length)
+				i = lineCursor.count - 1;
+		} else if (i > 0 && lines[i].location == (CFIndex)index
+				   && lines[i - 1].location + lines[i - 1].length == (CFIndex)index
+				   && ![owner.textDocument.store isLineBreakAtIndex:index - 1]) {
+			i--;
+		}
+	}
+	return i;
+}
+
+/*!
+ Answers a line move (see positionFromPosition:toBoundary:inDirection:) from the line cursor, rebinding
+ it if the move leaves its frame; returns nil if it can not, in which case the document is searched.
+ */
+- (UITextPosition *)positionFromIndex:(NSUInteger)position toLineBoundaryInDirection:(UITextDirection)direction {
+	PhiTextStorage *store = owner.textDocument.store;
+	UITextStorageDirection affinity = owner.selectionAffinity;
+	CFIndex i = [self lineCursorLineAtIndex:position affinity:affinity];
+	NSUInteger rv, next;
+	CFRange line;
+
+	if (i != kCFNotFound)
+		lineCursorStatistics.hits++;
+	else if (![self loadLineCursorAtIndex:position affinity:affinity]
+			 || (i = [self lineCursorLineAtIndex:position affinity:affinity]) == kCFNotFound)
+		return nil;
+	line = lineCursor.lines[i];
+	if (direction == UITextStorageDirectionBackward || direction == UITextLayoutDirectionRight) {
+		rv = line.location;
+		if (rv > 0 && rv == position) {
+			if (i > 0)
+				i--;
+			else if (![self loadLineCursorAtIndex:rv - 1 affinity:UITextStorageDirectionBackward]
+					 || (i = [self lineCursorLineAtIndex:rv - 1 affinity:UITextStorageDirectionBackward]) == kCFNotFound)
+				return nil;
+			line = lineCursor.lines[i];
+			rv = line.location + line.length;
+			if (rv > 0 && [store isLineBreakAtIndex:rv - 1])
+				rv--;
+			else if (rv > 0 && rv == position)
+				rv = line.location;
+		}
+	} else if (direction == UITextStorageDirectionForward || direction == UITextLayoutDirectionLeft) {
+		rv = line.location + line.length;
+		if (rv > 0 && [store isLineBreakAtIndex:rv - 1])
+			rv--;
+		if (rv == position) {
+			if (i < lineCursor.count - 1) {
+				i++;
+			} else {
+				next = line.location + line.length;
+				// The last (empty) line of the document is left to the search
+				if (next >= [store length]
+					|| ![self loadLineCursorAtIndex:next affinity:UITextStorageDirectionForward]
+					|| (i = [self lineCursorLineAtIndex:next affinity:UITextStorageDirectionForward]) == kCFNotFound)
+					return nil;
+			}
+			line = lineCursor.lines[i];
+			rv = line.location;
+			if (rv == position)
+				rv = line.location + line.length;
+		}
+	} else {
+		return nil;
+	}
+	lineCursor.index = i;
+	return [PhiTextPosition textPositionWithPosition:rv];
+}
+
+- (PhiTextLineCursorStatistics)lineCursorStatistics {
+	return lineCursorStatistics;
+}
+
+- (void)resetLineCursorStatistics {
+	memset(&lineCursorStatistics, 0, sizeof(lineCursorStatistics));
+}
+
+- (void)dealloc {
+	[self resetLineCursor];
+	[super dealloc];
+}
+
 - (id)initWithTextInput:(UIResponder < UITextInput > *)textInput {
 	if (self = [super initWithTextInput:textInput]) {
 		if ([textInput isKindOfClass:[PhiTextEditorView class]]) {
@@ -63,6 +244,13 @@
 				rv = line.textRange;
 		} else
 			rv = line.textRange;
+	} else if (owner && PhiTextStartBoundaryOfGranularity(granularity)) {
+		NSRange range = [self rangeOfUnitEnclosingIndex:PhiPositionOffset(position)
+										  startBoundary:PhiTextStartBoundaryOfGranularity(granularity)
+											endBoundary:PhiTextEndBoundaryOfGranularity(granularity)
+											inDirection:direction];
+		if (range.location != NSNotFound)
+			rv = [PhiTextRange textRangeWithRange:range];
 	} else
 		rv = [super rangeEnclosingPosition:position withGranularity:granularity inDirection:direction];
 #ifdef TRACE
@@ -92,6 +280,12 @@
 		else if ((direction == UITextStorageDirectionBackward || direction == UITextLayoutDirectionLeft)
 			&& [(PhiTextPosition *)position compare:(PhiTextPosition *)[line.textRange start]] == NSOrderedSame)
 			rv = YES;
+	} else if (owner && PhiTextStartBoundaryOfGranularity(granularity)) {
+		PhiTextBoundary boundaries = [owner.textDocument.boundaryCache boundariesAtIndex:PhiPositionOffset(position)];
+		if (PhiTextDirectionIsForward(direction))
+			rv = (boundaries & PhiTextEndBoundaryOfGranularity(granularity)) != 0;
+		else
+			rv = (boundaries & PhiTextStartBoundaryOfGranularity(granularity)) != 0;
 	} else
 		rv = [super isPosition:position atBoundary:granularity inDirection:direction];
 #ifdef TRACE
@@ -109,8 +303,13 @@
 	NSLog(@"%@Executing [UITextInputStringTokenizer positionFromPosition:%@ toBoundary:%d inDirection:%d]...", traceIndent, position, granularity, direction);
 	traceIndent = [traceIndent stringByAppendingString:@"    "];
 #endif
+	CFAbsoluteTime moveStart = CFAbsoluteTimeGetCurrent();
 	UITextPosition *rv = nil;
-	if (owner && granularity == UITextGranularityLine) {
+	if (owner && granularity == UITextGranularityLine)
+		rv = [self positionFromIndex:PhiPositionOffset(position) toLineBoundaryInDirection:direction];
+	if (rv) {
+		// Answered by the line cursor
+	} else if (owner && granularity == UITextGranularityLine) {
 		//TODO: confirm this is the correct selectionAffinity or should we use owner.selectionAffinity?
 		PhiAATreeNode *node;
 		PhiTextLine *line = [owner.textDocument searchLineWithPosition:(PhiTextPosition *)position selectionAffinity:owner.selectionAffinity inRect:CGRectNull frameNode:&node];
@@ -150,8 +349,20 @@
 				}
 			}
 		}
+	} else if (owner && PhiTextStartBoundaryOfGranularity(granularity)) {
+		NSUInteger index;
+		if (PhiTextDirectionIsForward(direction))
+			index = [owner.textDocument.boundaryCache indexOfBoundary:PhiTextEndBoundaryOfGranularity(granularity) afterIndex:PhiPositionOffset(position)];
+		else
+			index = [owner.textDocument.boundaryCache indexOfBoundary:PhiTextStartBoundaryOfGranularity(granularity) beforeIndex:PhiPositionOffset(position)];
+		if (index != NSNotFound)
+			rv = [PhiTextPosition textPositionWithPosition:index];
 	} else
 		rv = [super positionFromPosition:position toBoundary:granularity inDirection:direction];
+	if (owner && granularity == UITextGranularityLine) {
+		lineCursorStatistics.moves++;
+		lineCursorStatistics.moveTime += CFAbsoluteTimeGetCurrent() - moveStart;
+	}
 #ifdef TRACE
 	traceIndent = [traceIndent substringToIndex:[traceIndent length] - 4];
 	NSLog(@"%@Executed [UITextInputStringTokenizer positionFromPosition:toBoundary:inDirection:]:%@.", traceIndent, rv);
@@ -172,6 +383,11 @@
 		if ((PhiPositionOffset(position) == 0 && direction == UITextStorageDirectionBackward)
 			|| (PhiPositionOffset(position) == [owner.textDocument.store length] && UITextStorageDirectionForward))
 			rv = NO;
+	} else if (owner && PhiTextStartBoundaryOfGranularity(granularity)) {
+		rv = [self rangeOfUnitEnclosingIndex:PhiPositionOffset(position)
+							   startBoundary:PhiTextStartBoundaryOfGranularity(granularity)
+								 endBoundary:PhiTextEndBoundaryOfGranularity(granularity)
+								 inDirection:direction].location != NSNotFound;
 	} else
 		rv = [super isPosition:position withinTextUnit:granularity inDirection:direction];
 #ifdef TRACE
@@ -0,0 +1,55 @@
+//
+//  PhiTextLayoutCache.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+
+@class PhiTextDocument;
+
+/*!
+ Persists the frame layout of a document (the break offsets, line counts and rects of its
+ text frames) to the caches directory, so that a document can be reopened without being
+ typeset from the beginning.
+ A layout is keyed by a hash of the document's text and of the layout affecting attributes
+ (fonts and paragraph styles) of the text and of its base and default styles, and is only
+ used when it was made with the same tile size.
+ Only documents of at least layoutCacheMinimumLength characters are cached.
+ */
+@interface PhiTextLayoutCache : NSObject {
+@private
+	NSString *directory;
+	NSUInteger minimumLength;
+}
+
+@property (nonatomic, copy) NSString *directory;
+@property (nonatomic, assign) NSUInteger minimumLength;
+
++ (PhiTextLayoutCache *)sharedLayoutCache;
+
+/*! Returns the hash of the layout affecting properties of document (its layoutEngine, baseStyle and defaultStyle). */
+- (uint64_t)styleHashOfDocument:(PhiTextDocument *)document;
+/*! Returns the cached layout of text, made with the style hash and tile size, or nil when none is cached; hashes the text and reads the file, so may be called from any thread. */
+- (NSData *)layoutOfText:(NSAttributedString *)text styleHash:(uint64_t)styleHash tileSize:(CGSize)tileSize;
+/*! Returns an array of (discarded) PhiTextFrames, from the start of document, and its content size, as found by layoutOfText:styleHash:tileSize:; or nil when the layout doesn't fit the document. */
+- (NSArray *)textFramesWithLayout:(NSData *)layout forDocument:(PhiTextDocument *)document contentSize:(CGSize *)contentSize;
+/*! Persists the metrics of the specified frames, which must be contiguous and begin at the start of the document. */
+- (BOOL)storeTextFrames:(id <NSFastEnumeration>)textFrames forDocument:(PhiTextDocument *)document tileSize:(CGSize)tileSize contentSize:(CGSize)contentSize;
+- (void)removeAllLayouts;
+
+@end
@@ -0,0 +1,382 @@
+//
+//  PhiTextLayoutCache.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <CoreText/CoreText.h>
+#import "PhiTextLayoutCache.h"
+#import "PhiTextDocument.h"
+#import "PhiTextStorage.h"
+#import "PhiTextStyle.h"
+#import "PhiTextFrame.h"
+#import "PhiTextEmptyFrame.h"
+
+#define PHI_LAYOUT_CACHE_MAGIC 0x5068694C /* PhiL */
+#define PHI_LAYOUT_CACHE_VERSION 2
+
+#ifndef PHI_LAYOUT_CACHE_HASH_BUFFER_LENGTH
+#define PHI_LAYOUT_CACHE_HASH_BUFFER_LENGTH 4096
+#endif
+
+#define PHI_FNV_OFFSET_BASIS 14695981039346656037ULL
+#define PHI_FNV_PRIME 1099511628211ULL
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t reserved;
+	uint64_t contentHash;
+	uint64_t styleHash;
+	uint64_t length;
+	uint64_t count;
+	double tileWidth;
+	double tileHeight;
+	double contentWidth;
+	double contentHeight;
+} PhiTextLayoutCacheHeader;
+
+typedef struct {
+	int64_t location;
+	int64_t length;
+	int64_t firstLineNumber;
+	int64_t lineCount;
+	double x, y, width, height;
+	double tileWidth, tileHeight;
+	int32_t hasEmptyLastLine;
+	int32_t reserved;
+} PhiTextLayoutCacheRecord;
+
+@interface PhiTextFrame (PhiTextLayoutCache)
+
+- (CGSize)tileSize;
+- (void)setFirstLineNumber:(NSUInteger)number;
+- (void)restoreTextLength:(CFIndex)length lineCount:(NSUInteger)count rect:(CGRect)aRect hasEmptyLastLine:(BOOL)emptyLastLine;
+
+@end
+
+/*! FNV-1a over 64-bit words (rather than bytes), so that hashing a long text takes an eighth of the multiplications; the bytes that don't fill a word are hashed one at a time. */
+static uint64_t PhiHashBytes(uint64_t hash, const void *bytes, size_t length) {
+	const unsigned char *p = (const unsigned char *)bytes;
+	uint64_t word;
+	while (length >= sizeof(word)) {
+		memcpy(&word, p, sizeof(word));
+		hash ^= word;
+		hash *= PHI_FNV_PRIME;
+		p += sizeof(word);
+		length -= sizeof(word);
+	}
+	while (length--) {
+		hash ^= *p++;
+		hash *= PHI_FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t PhiHashCFString(uint64_t hash, CFStringRef string) {
+	UniChar buffer[PHI_LAYOUT_CACHE_HASH_BUFFER_LENGTH];
+	const UniChar *characters = CFStringGetCharactersPtr(string);
+	CFIndex i, n, length = CFStringGetLength(string);
+	if (characters)
+		return PhiHashBytes(hash, characters, length * sizeof(UniChar));
+	for (i = 0; i < length; i += n) {
+		n = MIN(length - i, PHI_LAYOUT_CACHE_HASH_BUFFER_LENGTH);
+		CFStringGetCharacters(string, CFRangeMake(i, n), buffer);
+		hash = PhiHashBytes(hash, buffer, n * sizeof(UniChar));
+	}
+	return hash;
+}
+
+/*! Hashes the parts of an attribute that affect layout; colours and the like are ignored. */
+static uint64_t PhiHashLayoutAttribute(CFStringRef key, CFTypeRef value) {
+	uint64_t hash = PhiHashCFString(PHI_FNV_OFFSET_BASIS, key);
+	CFTypeID type = CFGetTypeID(value);
+	if (type == CTFontGetTypeID()) {
+		CFStringRef name = CTFontCopyPostScriptName((CTFontRef)value);
+		double size = CTFontGetSize((CTFontRef)value);
+		if (name) {
+			hash = PhiHashCFString(hash, name);
+			CFRelease(name);
+		}
+		hash = PhiHashBytes(hash, &size, sizeof(size));
+	} else if (type == CTParagraphStyleGetTypeID()) {
+		static const CTParagraphStyleSpecifier specifiers[] = {
+			kCTParagraphStyleSpecifierFirstLineHeadIndent,
+			kCTParagraphStyleSpecifierHeadIndent,
+			kCTParagraphStyleSpecifierTailIndent,
+			kCTParagraphStyleSpecifierDefaultTabInterval,
+			kCTParagraphStyleSpecifierLineHeightMultiple,
+			kCTParagraphStyleSpecifierMaximumLineHeight,
+			kCTParagraphStyleSpecifierMinimumLineHeight,
+			kCTParagraphStyleSpecifierLineSpacing,
+			kCTParagraphStyleSpecifierParagraphSpacing,
+			kCTParagraphStyleSpecifierParagraphSpacingBefore
+		};
+		CTTextAlignment alignment = kCTNaturalTextAlignment;
+		CTLineBreakMode lineBreakMode = kCTLineBreakByWordWrapping;
+		CGFloat aFloat;
+		int i;
+		CTParagraphStyleGetValueForSpecifier((CTParagraphStyleRef)value, kCTParagraphStyleSpecifierAlignment, sizeof(alignment), &alignment);
+		CTParagraphStyleGetValueForSpecifier((CTParagraphStyleRef)value, kCTParagraphStyleSpecifierLineBreakMode, sizeof(lineBreakMode), &lineBreakMode);
+		hash = PhiHashBytes(hash, &alignment, sizeof(alignment));
+		hash = PhiHashBytes(hash, &lineBreakMode, sizeof(lineBreakMode));
+		for (i = 0; i < sizeof(specifiers) / sizeof(CTParagraphStyleSpecifier); i++) {
+			aFloat = 0.0;
+			CTParagraphStyleGetValueForSpecifier((CTParagraphStyleRef)value, specifiers[i], sizeof(aFloat), &aFloat);
+			hash = PhiHashBytes(hash, &aFloat, sizeof(aFloat));
+		}
+	} else if (type == CFStringGetTypeID()) {
+		hash = PhiHashCFString(hash, (CFStringRef)value);
+	} else if (type == CFNumberGetTypeID()) {
+		double aDouble = 0.0;
+		CFNumberGetValue((CFNumberRef)value, kCFNumberDoubleType, &aDouble);
+		hash = PhiHashBytes(hash, &aDouble, sizeof(aDouble));
+	}
+	return hash;
+}
+
+static void PhiHashLayoutAttributeApplier(const void *key, const void *value, void *context) {
+	// Summed so that the order of the attributes does not matter
+	*(uint64_t *)context += PhiHashLayoutAttribute((CFStringRef)key, (CFTypeRef)value);
+}
+
+static uint64_t PhiHashLayoutAttributes(uint64_t hash, CFDictionaryRef attributes) {
+	uint64_t sum = 0;
+	if (attributes)
+		CFDictionaryApplyFunction(attributes, PhiHashLayoutAttributeApplier, &sum);
+	return PhiHashBytes(hash, &sum, sizeof(sum));
+}
+
+static PhiTextLayoutCache *sharedLayoutCache = nil;
+
+@implementation PhiTextLayoutCache
+
+@synthesize directory, minimumLength;
+
++ (void)initialize {
+	CFStringRef suiteName = CFSTR("com.phitext");
+	NSInteger aNSInt;
+	CFNumberRef aNumberValue;
+
+	CFPropertyListRef last = CFPreferencesCopyAppValue(CFSTR("layoutCacheMinimumLength"), suiteName);
+	if (last) {
+		CFRelease(last);
+	} else {
+		aNSInt = 1 << 16;
+		aNumberValue = CFNumberCreate(NULL, kCFNumberNSIntegerType, &aNSInt);
+		CFPreferencesSetAppValue(CFSTR("layoutCacheMinimumLength"), aNumberValue, suiteName);
+		CFRelease(aNumberValue);
+
+#ifdef PHI_SYNC_DEFAULTS
+		CFPreferencesAppSynchronize(suiteName);
+#endif
+	}
+}
+
++ (PhiTextLayoutCache *)sharedLayoutCache {
+	@synchronized(self) {
+		if (sharedLayoutCache == nil)
+			sharedLayoutCache = [[PhiTextLayoutCache alloc] init];
+	}
+	return sharedLayoutCache;
+}
+
+- (id)init {
+	if (self = [super init]) {
+		NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+		[defaults addSuiteNamed:@"com.phitext"];
+
+		NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+		if ([paths count])
+			self.directory = [[[paths objectAtIndex:0] stringByAppendingPathComponent:@"com.phitext"] stringByAppendingPathComponent:@"Layouts"];
+		minimumLength = [defaults integerForKey:@"layoutCacheMinimumLength"];
+	}
+	return self;
+}
+
+- (uint64_t)styleHashOfDocument:(PhiTextDocument *)document {
+	uint64_t hash = PHI_FNV_OFFSET_BASIS;
+	hash = PhiHashCFString(hash, (CFStringRef)NSStringFromClass([[document layoutEngine] class]));
+	hash = PhiHashLayoutAttributes(hash, [[document baseStyle] attributes]);
+	hash = PhiHashLayoutAttributes(hash, [[document defaultStyle] attributes]);
+	return hash;
+}
+
+- (uint64_t)contentHashOfText:(NSAttributedString *)text {
+	uint64_t hash = PHI_FNV_OFFSET_BASIS;
+	NSUInteger index = 0, length = [text length];
+	NSRange range;
+	NSDictionary *attributes;
+
+	hash = PhiHashCFString(hash, (CFStringRef)[text string]);
+	while (index < length) {
+		attributes = [text attributesAtIndex:index effectiveRange:&range];
+		hash = PhiHashBytes(hash, &range.length, sizeof(range.length));
+		hash = PhiHashLayoutAttributes(hash, (CFDictionaryRef)attributes);
+		index = NSMaxRange(range);
+	}
+	return hash;
+}
+
+- (NSString *)pathForContentHash:(uint64_t)contentHash {
+	return [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"%016llx.layout", contentHash]];
+}
+
+- (NSData *)layoutOfText:(NSAttributedString *)text styleHash:(uint64_t)styleHash tileSize:(CGSize)tileSize {
+	NSUInteger length = [text length];
+	if (!directory || length < minimumLength)
+		return nil;
+#ifdef DEVELOPER
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+#endif
+
+	uint64_t contentHash = [self contentHashOfText:text];
+	NSData *data = [NSData dataWithContentsOfFile:[self pathForContentHash:contentHash] options:NSDataReadingMappedIfSafe error:NULL];
+	if ([data length] < sizeof(PhiTextLayoutCacheHeader))
+		return nil;
+
+	const PhiTextLayoutCacheHeader *header = (const PhiTextLayoutCacheHeader *)[data bytes];
+	if (header->magic != PHI_LAYOUT_CACHE_MAGIC
+		|| header->version != PHI_LAYOUT_CACHE_VERSION
+		|| header->recordSize != sizeof(PhiTextLayoutCacheRecord)
+		|| header->contentHash != contentHash
+		|| header->styleHash != styleHash
+		|| header->length != length
+		|| header->tileWidth != tileSize.width
+		|| header->tileHeight != tileSize.height
+		|| !header->count
+		|| [data length] < sizeof(PhiTextLayoutCacheHeader) + header->count * sizeof(PhiTextLayoutCacheRecord))
+		return nil;
+#ifdef DEVELOPER
+	NSLog(@"Found layout of %u characters in layout cache in %.3f seconds.", length, CFAbsoluteTimeGetCurrent() - start);
+#endif
+	return data;
+}
+
+- (NSArray *)textFramesWithLayout:(NSData *)layout forDocument:(PhiTextDocument *)document contentSize:(CGSize *)contentSize {
+	const PhiTextLayoutCacheHeader *header = (const PhiTextLayoutCacheHeader *)[layout bytes];
+	const PhiTextLayoutCacheRecord *record = (const PhiTextLayoutCacheRecord *)(header + 1);
+	NSUInteger length = [[document store] length];
+	NSMutableArray *textFrames;
+	PhiTextFrame *textFrame;
+	CGMutablePathRef path;
+	int64_t nextLocation = 0;
+	uint64_t i;
+
+	if (!header || header->length != length)
+		return nil;
+	textFrames = [NSMutableArray arrayWithCapacity:header->count];
+	for (i = 0; i < header->count; i++, record++) {
+		// Frames must be contiguous from the start of the document
+		if (record->location != nextLocation || record->length <= 0 || record->location + record->length > length)
+			return nil;
+		nextLocation = record->location + record->length;
+
+		path = CGPathCreateMutable();
+		CGPathAddRect(path, NULL, CGRectMake(0, 0, record->tileWidth, record->tileHeight));
+		textFrame = [[PhiTextFrame alloc] initInPath:path beginningAt:(CFIndex)record->location forDocument:document attributes:nil];
+		CGPathRelease(path);
+		[textFrame restoreTextLength:(CFIndex)record->length
+						   lineCount:(NSUInteger)record->lineCount
+								rect:CGRectMake(record->x, record->y, record->width, record->height)
+					hasEmptyLastLine:record->hasEmptyLastLine != 0];
+		[textFrame setFirstLineNumber:(NSUInteger)record->firstLineNumber];
+		[textFrames addObject:textFrame];
+		[textFrame release];
+	}
+	if (contentSize)
+		*contentSize = CGSizeMake(header->contentWidth, header->contentHeight);
+#ifdef DEVELOPER
+	NSLog(@"Restored %u frames (%u of %u characters) from layout cache.", [textFrames count], (NSUInteger)nextLocation, length);
+#endif
+	return textFrames;
+}
+
+- (BOOL)storeTextFrames:(id <NSFastEnumeration>)textFrames forDocument:(PhiTextDocument *)document tileSize:(CGSize)tileSize contentSize:(CGSize)contentSize {
+	NSUInteger length = [[document store] length];
+	if (!directory || length < minimumLength)
+		return NO;
+
+	PhiTextLayoutCacheHeader header;
+	PhiTextLayoutCacheRecord record;
+	NSMutableData *data = [NSMutableData dataWithLength:sizeof(header)];
+	NSRange range;
+	CGRect rect;
+	CGSize frameTileSize;
+	int64_t nextLocation = 0;
+
+	memset(&header, 0, sizeof(header));
+	for (PhiTextFrame *textFrame in textFrames) {
+		if ([textFrame isKindOfClass:[PhiTextEmptyFrame class]])
+			break;
+		range = [textFrame rangeValue];
+		rect = [textFrame CGRectValue];
+		frameTileSize = [textFrame tileSize];
+		// Only the (contiguous) frames that have been typeset can be stored
+		if (range.location != nextLocation || !range.length || ![textFrame staleLineCount]
+			|| CGRectIsNull(rect) || rect.size.height <= 0.0)
+			break;
+		nextLocation = NSMaxRange(range);
+
+		memset(&record, 0, sizeof(record));
+		record.location = range.location;
+		record.length = range.length;
+		record.firstLineNumber = [textFrame firstLineNumber];
+		record.lineCount = [textFrame staleLineCount];
+		record.x = rect.origin.x;
+		record.y = rect.origin.y;
+		record.width = rect.size.width;
+		record.height = rect.size.height;
+		record.tileWidth = frameTileSize.width;
+		record.tileHeight = frameTileSize.height;
+		record.hasEmptyLastLine = [textFrame hasEmptyLastLine];
+		[data appendBytes:&record length:sizeof(record)];
+		header.count++;
+	}
+	if (!header.count)
+		return NO;
+
+	header.magic = PHI_LAYOUT_CACHE_MAGIC;
+	header.version = PHI_LAYOUT_CACHE_VERSION;
+	header.recordSize = sizeof(PhiTextLayoutCacheRecord);
+	header.contentHash = [self contentHashOfText:[[document store] attributedString]];
+	header.styleHash = [self styleHashOfDocument:document];
+	header.length = length;
+	header.tileWidth = tileSize.width;
+	header.tileHeight = tileSize.height;
+	header.contentWidth = contentSize.width;
+	header.contentHeight = contentSize.height;
+	[data replaceBytesInRange:NSMakeRange(0, sizeof(header)) withBytes:&header];
+
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+#ifdef DEVELOPER
+	NSLog(@"Storing %llu frames (%lld of %u characters) in layout cache.", header.count, nextLocation, length);
+#endif
+	return [data writeToFile:[self pathForContentHash:header.contentHash] atomically:YES];
+}
+
+- (void)removeAllLayouts {
+	if (directory)
+		[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+- (void)dealloc {
+	self.directory = nil;
+	[super dealloc];
+}
+
+@end
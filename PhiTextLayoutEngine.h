@@ -0,0 +1,59 @@
+//
+//  PhiTextLayoutEngine.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+
+/*!
+ The typesetter used by a PhiTextDocument (and its PhiTextFrames and PhiTextLines).
+ Frames and lines are opaque CF (or Objective-C) objects owned by the engine that
+ created them; a Core Text engine simply hands out CTFrames and CTLines.
+ String ranges are relative to the attributed string given to the engine, which must not
+ be mutated afterwards: an engine may keep what it derived from a string (e.g. its framesetter)
+ for as long as the same string is given to it again.
+ Line origins are relative to the bottom left corner of the frame's path, as with
+ CTFrameGetLineOrigins.
+ */
+@protocol PhiTextLayoutEngine <NSObject>
+
+/*! Returns a new frame (that the caller must release) holding as much of the specified range of string as fits within path, or NULL. */
+- (CFTypeRef)createFrameWithAttributedString:(NSAttributedString *)string range:(CFRange)range path:(CGPathRef)path attributes:(NSDictionary *)attributes;
+- (CGSize)suggestFrameSizeWithAttributedString:(NSAttributedString *)string range:(CFRange)range attributes:(NSDictionary *)attributes constraints:(CGSize)constraints;
+
+- (CFRange)visibleStringRangeOfFrame:(CFTypeRef)frame;
+/*! Returns the lines of the specified frame; the array is owned by the frame. */
+- (CFArrayRef)linesOfFrame:(CFTypeRef)frame;
+- (void)getLineOrigins:(CGPoint *)origins inRange:(CFRange)range ofFrame:(CFTypeRef)frame;
+- (void)drawFrame:(CFTypeRef)frame inContext:(CGContextRef)context;
+
+- (CFRange)stringRangeOfLine:(CFTypeRef)line;
+- (double)typographicBoundsOfLine:(CFTypeRef)line ascent:(CGFloat *)ascent descent:(CGFloat *)descent leading:(CGFloat *)leading;
+- (CGFloat)xHeightOfLine:(CFTypeRef)line;
+- (CGFloat)offsetForStringIndex:(CFIndex)stringIndex inLine:(CFTypeRef)line;
+- (CFIndex)stringIndexForPosition:(CGPoint)position inLine:(CFTypeRef)line;
+
+@optional
+/*!
+ Draws the frame as drawFrame:inContext: does, keeping its layout, but painted with the
+ paint-only attributes (see +[PhiTextStyle paintOnlyAttributeNames]) of the specified
+ string, which is indexed as was the string the frame was created with.
+ */
+- (void)drawFrame:(CFTypeRef)frame withPaintFromAttributedString:(NSAttributedString *)string inContext:(CGContextRef)context;
+
+@end
@@ -0,0 +1,95 @@
+//
+//  PhiTextLayoutPrefetcher.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+#import "PhiTextTileCache.h"
+
+@class PhiTextDocument;
+
+/*! Height (in points) of each band of the document that is prefetched as a unit (and may be cancelled as a unit). */
+#ifndef PHI_PREFETCH_BAND_HEIGHT
+#define PHI_PREFETCH_BAND_HEIGHT 512.0
+#endif
+/*! Scroll samples further apart than this (in seconds) do not contribute to the velocity. */
+#ifndef PHI_PREFETCH_MAX_SAMPLE_INTERVAL
+#define PHI_PREFETCH_MAX_SAMPLE_INTERVAL 0.25
+#endif
+
+typedef struct {
+	/*! Number of bands scheduled for prefetching. */
+	NSUInteger scheduled;
+	/*! Number of bands typeset (and, if enabled, rendered) ahead of display. */
+	NSUInteger completed;
+	/*! Number of bands cancelled before they were prefetched. */
+	NSUInteger cancelled;
+	/*! Number of times the scroll direction reversed, cancelling every pending band. */
+	NSUInteger reversals;
+	/*! Total time spent prefetching in the background (in seconds). */
+	double prefetchTime;
+} PhiTextPrefetchStatistics;
+
+/*!
+ Typesets the text frames (and, if prefetchTiles is set, renders the tiles) of the part of the
+ document that scrolling is about to reveal, on a background queue, so that the display of a
+ fast fling does not wait on layout. How far ahead is the distance scrolled in prefetchLookahead
+ seconds at the current (vertical) velocity, but no more than prefetchDistance points; the pending
+ work is cancelled when the direction of scrolling reverses.
+ */
+@interface PhiTextLayoutPrefetcher : NSObject {
+@private
+	NSOperationQueue *prefetchQueue;
+	NSUInteger generation;
+	CGFloat distance;
+	NSTimeInterval lookahead;
+	BOOL prefetchTiles;
+
+	CGFloat lastOffset;
+	CFAbsoluteTime lastTime;
+	CGFloat velocity;
+	NSInteger direction;
+	CGFloat prefetchedLimit;
+
+	CGSize tileSize;
+	id <PhiTextTileRenderer> tileRenderer;
+	CGFloat tileScale;
+
+	PhiTextPrefetchStatistics statistics;
+}
+
+/*! The furthest (in points) that is prefetched ahead of the visible rect. */
+@property (nonatomic, assign) CGFloat distance;
+/*! The time (in seconds) ahead of scrolling that is prefetched. */
+@property (nonatomic, assign) NSTimeInterval lookahead;
+@property (nonatomic, assign) BOOL prefetchTiles;
+/*! The current vertical scrolling velocity (in points per second). */
+@property (nonatomic, readonly) CGFloat velocity;
+
+/*! Sets how tiles are rendered into the document's tileCache when prefetchTiles is set; tiles lie on a grid of the specified size. */
+- (void)setTileSize:(CGSize)size renderer:(id <PhiTextTileRenderer>)renderer scale:(CGFloat)scale;
+
+/*! Samples the scroll position of rect (the visible rect of the document's owner) and schedules the bands ahead of it, if necessary. */
+- (void)prefetchAheadOfRect:(CGRect)rect inDocument:(PhiTextDocument *)document;
+/*! Cancels every pending band. */
+- (void)cancel;
+
+- (PhiTextPrefetchStatistics)statistics;
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,251 @@
+//
+//  PhiTextLayoutPrefetcher.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextLayoutPrefetcher.h"
+#import "PhiTextDocument.h"
+#import "PhiTextFrame.h"
+#import "PhiAATree.h"
+
+@interface PhiTextPrefetchRequest : NSObject {
+@public
+	CGRect rect;
+	NSUInteger generation;
+	PhiTextDocument *document;
+	CGSize tileSize;
+	id <PhiTextTileRenderer> tileRenderer;
+	CGFloat tileScale;
+}
+@end
+
+@implementation PhiTextPrefetchRequest
+- (void)dealloc {
+	[document release];
+	[tileRenderer release];
+	[super dealloc];
+}
+@end
+
+@interface PhiTextLayoutPrefetcher ()
+
+- (void)prefetchRequest:(PhiTextPrefetchRequest *)request;
+
+@end
+
+@implementation PhiTextLayoutPrefetcher
+
++ (void)initialize {
+	CFStringRef suiteName = CFSTR("com.phitext");
+	float aFloat;
+	CFNumberRef aNumberValue;
+
+	CFPropertyListRef last = CFPreferencesCopyAppValue(CFSTR("prefetchDistance"), suiteName);
+	if (last) {
+		CFRelease(last);
+	} else {
+		aFloat = 2048.0f;
+		aNumberValue = CFNumberCreate(NULL, kCFNumberFloatType, &aFloat);
+		CFPreferencesSetAppValue(CFSTR("prefetchDistance"), aNumberValue, suiteName);
+		CFRelease(aNumberValue);
+
+		aFloat = 0.5f;
+		aNumberValue = CFNumberCreate(NULL, kCFNumberFloatType, &aFloat);
+		CFPreferencesSetAppValue(CFSTR("prefetchLookahead"), aNumberValue, suiteName);
+		CFRelease(aNumberValue);
+
+		CFPreferencesSetAppValue(CFSTR("prefetchTiles"), kCFBooleanFalse, suiteName);
+
+#ifdef PHI_SYNC_DEFAULTS
+		CFPreferencesAppSynchronize(suiteName);
+#endif
+	}
+}
+
+@synthesize distance, lookahead, prefetchTiles, velocity;
+
+- (id)init {
+	if (self = [super init]) {
+		NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+		[defaults addSuiteNamed:@"com.phitext"];
+
+		prefetchQueue = [[NSOperationQueue alloc] init];
+		[prefetchQueue setMaxConcurrentOperationCount:1];
+		distance = MAX(0.0, [defaults floatForKey:@"prefetchDistance"]);
+		lookahead = MAX(0.0, [defaults floatForKey:@"prefetchLookahead"]);
+		prefetchTiles = [defaults boolForKey:@"prefetchTiles"];
+		generation = 0;
+		lastTime = 0.0;
+		velocity = 0.0;
+		direction = 0;
+		prefetchedLimit = NAN;
+		tileSize = CGSizeZero;
+		tileScale = 1.0;
+		memset(&statistics, 0, sizeof(statistics));
+	}
+	return self;
+}
+
+- (void)setTileSize:(CGSize)size renderer:(id <PhiTextTileRenderer>)renderer scale:(CGFloat)scale {
+	@synchronized(self) {
+		tileSize = size;
+		if (tileRenderer != renderer) {
+			[tileRenderer release];
+			tileRenderer = [renderer retain];
+		}
+		tileScale = scale;
+	}
+}
+
+- (void)prefetchAheadOfRect:(CGRect)rect inDocument:(PhiTextDocument *)document {
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+	CGFloat offset = CGRectGetMinY(rect);
+	CGFloat start, end, target, limit;
+	NSInteger newDirection;
+
+	if (lastTime > 0.0 && now - lastTime > 0.0 && now - lastTime <= PHI_PREFETCH_MAX_SAMPLE_INTERVAL)
+		velocity = 0.5 * velocity + 0.5 * (offset - lastOffset) / (now - lastTime);
+	else
+		velocity = 0.0;
+	lastOffset = offset;
+	lastTime = now;
+
+	newDirection = velocity > 0.0 ? 1 : (velocity < 0.0 ? -1 : 0);
+	if (!newDirection || !document || distance <= 0.0)
+		return;
+	if (newDirection != direction) {
+		if (direction) {
+			[self cancel];
+			@synchronized(self) {
+				statistics.reversals++;
+			}
+		}
+		direction = newDirection;
+		prefetchedLimit = NAN;
+	}
+
+	limit = [document size].height;
+	target = MIN(distance, fabs(velocity) * lookahead);
+	if (direction > 0) {
+		start = CGRectGetMaxY(rect);
+		if (!isnan(prefetchedLimit))
+			start = MAX(start, prefetchedLimit);
+		end = MIN(CGRectGetMaxY(rect) + target, limit);
+	} else {
+		start = CGRectGetMinY(rect);
+		if (!isnan(prefetchedLimit))
+			start = MIN(start, prefetchedLimit);
+		end = MAX(CGRectGetMinY(rect) - target, 0.0);
+	}
+
+	// Schedule the bands between what was last scheduled and the target, nearest first
+	while ((end - start) * direction > 0.0) {
+		CGFloat height = MIN(PHI_PREFETCH_BAND_HEIGHT, fabs(end - start));
+		PhiTextPrefetchRequest *request = [[PhiTextPrefetchRequest alloc] init];
+		request->rect = CGRectMake(0.0, direction > 0 ? start : start - height, [document size].width, height);
+		request->document = [document retain];
+		@synchronized(self) {
+			request->generation = generation;
+			if (prefetchTiles && [document tileCache] && tileRenderer) {
+				request->tileSize = tileSize;
+				request->tileRenderer = [tileRenderer retain];
+				request->tileScale = tileScale;
+			}
+			statistics.scheduled++;
+		}
+		NSInvocationOperation *operation = [[NSInvocationOperation alloc] initWithTarget:self selector:@selector(prefetchRequest:) object:request];
+		[prefetchQueue addOperation:operation];
+		[operation release];
+		[request release];
+		start += direction * height;
+	}
+	prefetchedLimit = start;
+}
+
+/*! Typesets the frames in the requested band and, if requested, renders its tiles into the tile cache. */
+- (void)prefetchRequest:(PhiTextPrefetchRequest *)request {
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	PhiTextDocument *document = request->document;
+	BOOL current;
+	@synchronized(self) {
+		current = request->generation == generation;
+	}
+	if (current) {
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		CGRect documentRect = CGRectOffset(request->rect, -[document paddingLeft], -[document paddingTop]);
+		PhiAATreeRange *textFrameRange = [document beginContentAccessInRect:documentRect updateDisplay:YES];
+		for (PhiTextFrame *textFrame in textFrameRange)
+			[textFrame endContentAccess];
+
+		if (request->tileRenderer && request->tileSize.width > 0.0 && request->tileSize.height > 0.0) {
+			CGRect tileRect = CGRectMake(0.0, 0.0, request->tileSize.width, request->tileSize.height);
+			NSInteger row, column;
+			for (row = (NSInteger)floor(CGRectGetMinY(request->rect) / tileRect.size.height);
+				 row * tileRect.size.height < CGRectGetMaxY(request->rect); row++) {
+				for (column = 0; column * tileRect.size.width < CGRectGetMaxX(request->rect); column++) {
+					tileRect.origin = CGPointMake(column * tileRect.size.width, row * tileRect.size.height);
+					[[document tileCache] renderTileRect:tileRect scale:request->tileScale ofDocument:document withRenderer:request->tileRenderer];
+				}
+			}
+		}
+
+		@synchronized(self) {
+			statistics.completed++;
+			statistics.prefetchTime += CFAbsoluteTimeGetCurrent() - start;
+		}
+	}
+	[pool release];
+}
+
+- (void)cancel {
+	@synchronized(self) {
+		generation++;
+		statistics.cancelled += [prefetchQueue operationCount];
+	}
+	[prefetchQueue cancelAllOperations];
+	prefetchedLimit = NAN;
+}
+
+- (PhiTextPrefetchStatistics)statistics {
+	PhiTextPrefetchStatistics rv;
+	@synchronized(self) {
+		rv = statistics;
+	}
+	return rv;
+}
+
+- (void)resetStatistics {
+	@synchronized(self) {
+		memset(&statistics, 0, sizeof(statistics));
+	}
+}
+
+- (NSString *)description {
+	PhiTextPrefetchStatistics stats = [self statistics];
+	return [NSString stringWithFormat:@"<%@: 0x%x; %.f points/s; %u scheduled; %u completed (%.3fs); %u cancelled; %u reversals>",
+			NSStringFromClass([self class]), self, velocity,
+			stats.scheduled, stats.completed, stats.prefetchTime, stats.cancelled, stats.reversals];
+}
+
+- (void)dealloc {
+	[prefetchQueue cancelAllOperations];
+	[prefetchQueue release];
+	[tileRenderer release];
+	[super dealloc];
+}
+
+@end
@@ -0,0 +1,82 @@
+//
+//  PhiTextLayoutSnapshot.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+#import "PhiTextLayoutEngine.h"
+#import "PhiTextFrame.h"
+
+@class PhiTextDocument, PhiAATreeNode, PhiAATreeRange;
+
+/*! The layout of a PhiTextFrame, as it was when the snapshot was taken. */
+@interface PhiTextFrameSnapshot : NSObject {
+@private
+	CGRect rect;
+	CGPoint tileOffset;
+	CFTypeRef layoutFrame;
+	NSAttributedString *paintString;
+	NSUInteger firstLineNumber;
+	CFIndex lineCount;
+	PhiTextFrameGuideline *guidelines;
+	BOOL lastEmptyFrame;
+	int treeLevel;
+	BOOL leftChild;
+}
+
+@property (nonatomic, readonly) CGRect rect;
+@property (nonatomic, readonly) CGPoint tileOffset;
+/*! The frame created by the layout engine, or NULL if there is nothing to draw. */
+@property (nonatomic, readonly) CFTypeRef layoutFrame;
+/*! The string to paint layoutFrame with, or nil if it should be drawn as is. */
+@property (nonatomic, readonly) NSAttributedString *paintString;
+@property (nonatomic, readonly) NSUInteger firstLineNumber;
+@property (nonatomic, readonly) CFIndex lineCount;
+@property (nonatomic, readonly, getter=isLastEmptyFrame) BOOL lastEmptyFrame;
+/*! The level of the frame's node in the document's textFrames, and whether it is a left child (or the root); for outlining the tree when debugging. */
+@property (nonatomic, readonly) int treeLevel;
+@property (nonatomic, readonly, getter=isLeftChild) BOOL leftChild;
+
+/*! Returns the guidelines of every line (lineCount of them), copied from the frame's cache. */
+- (const PhiTextFrameGuideline *)guidelines;
+
+@end
+
+/*!
+ An immutable copy of the layout of the text frames of a document that cover a rect (in the
+ coordinates of the document). A snapshot is taken with the document's store locked, after
+ which it may be drawn without the lock on any thread.
+ */
+@interface PhiTextLayoutSnapshot : NSObject {
+@private
+	CGRect rect;
+	NSArray *textFrames;
+	id <PhiTextLayoutEngine> layoutEngine;
+}
+
+/*! The rect (in the coordinates of the document) that the textFrames cover. */
+@property (nonatomic, readonly) CGRect rect;
+/*! PhiTextFrameSnapshots, in document order. */
+@property (nonatomic, readonly) NSArray *textFrames;
+/*! The engine that created the frames, with which they must be drawn. */
+@property (nonatomic, readonly) id <PhiTextLayoutEngine> layoutEngine;
+
+/*! Copies the layout of the PhiTextFrames in range (of the document's textFrames), which must have been accessed (see beginContentAccess) and must not change during the call. */
+- (id)initWithTextFrameRange:(PhiAATreeRange *)range inRect:(CGRect)rect ofDocument:(PhiTextDocument *)document;
+
+@end
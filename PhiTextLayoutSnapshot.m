@@ -0,0 +1,108 @@
+//
+//  PhiTextLayoutSnapshot.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextLayoutSnapshot.h"
+#import "PhiTextDocument.h"
+#import "PhiTextFrame.h"
+#import "PhiAATree.h"
+
+@interface PhiTextFrameSnapshot ()
+
+- (id)initWithTextFrameNode:(PhiAATreeNode *)node ofDocument:(PhiTextDocument *)document;
+
+@end
+
+@implementation PhiTextFrameSnapshot
+
+@synthesize rect, tileOffset, layoutFrame, paintString, firstLineNumber, lineCount, lastEmptyFrame, treeLevel, leftChild;
+
+- (id)initWithTextFrameNode:(PhiAATreeNode *)node ofDocument:(PhiTextDocument *)document {
+	if (self = [super init]) {
+		PhiTextFrame *textFrame = node.object;
+		const PhiTextFrameGuideline *frameGuidelines;
+
+		rect = [textFrame rect];
+		tileOffset = [textFrame tileOffset];
+		firstLineNumber = [textFrame firstLineNumber];
+		lastEmptyFrame = textFrame == [document lastEmptyFrame];
+		treeLevel = node.level;
+		leftChild = !node.up || node == node.up.left;
+		layoutFrame = [textFrame copyLayoutFrame];
+		paintString = [[textFrame paintAttributedString] retain];
+		lineCount = 0;
+		frameGuidelines = layoutFrame ? [textFrame guidelinesWithCount:&lineCount] : NULL;
+		if (frameGuidelines && lineCount) {
+			guidelines = malloc(lineCount * sizeof(PhiTextFrameGuideline));
+			memcpy(guidelines, frameGuidelines, lineCount * sizeof(PhiTextFrameGuideline));
+		} else {
+			lineCount = 0;
+		}
+	}
+	return self;
+}
+
+- (const PhiTextFrameGuideline *)guidelines {
+	return guidelines;
+}
+
+- (void)dealloc {
+	if (layoutFrame)
+		CFRelease(layoutFrame);
+	[paintString release];
+	if (guidelines)
+		free(guidelines);
+	[super dealloc];
+}
+
+@end
+
+@implementation PhiTextLayoutSnapshot
+
+@synthesize rect, textFrames, layoutEngine;
+
+- (id)initWithTextFrameRange:(PhiAATreeRange *)range inRect:(CGRect)aRect ofDocument:(PhiTextDocument *)document {
+	if (self = [super init]) {
+		NSMutableArray *snapshots = [[NSMutableArray alloc] init];
+		PhiTextFrameSnapshot *snapshot;
+		PhiAATreeNode *node;
+
+		for (node = range.start; node; node = node == range.end ? nil : node.next) {
+			snapshot = [[PhiTextFrameSnapshot alloc] initWithTextFrameNode:node ofDocument:document];
+			[snapshots addObject:snapshot];
+			[snapshot release];
+		}
+		rect = aRect;
+		textFrames = snapshots;
+		layoutEngine = [[document layoutEngine] retain];
+	}
+	return self;
+}
+
+- (NSString *)description {
+	return [NSString stringWithFormat:@"<%@: 0x%x; rect = %@; %u frames>",
+			NSStringFromClass([self class]), self, NSStringFromCGRect(rect), [textFrames count]];
+}
+
+- (void)dealloc {
+	[textFrames release];
+	[layoutEngine release];
+	[super dealloc];
+}
+
+@end
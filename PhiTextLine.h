@@ -27,7 +27,7 @@
 
 @interface PhiTextLine : NSObject {
 	PhiTextFrame *frame;
-	CTLineRef textLine;
+	CFTypeRef textLine;
 	CFIndex index;
 	CGPoint origin;
 	PhiTextRange *textRange;
@@ -41,7 +41,8 @@
 @property (nonatomic, readonly) PhiTextFrame *frame;
 @property (nonatomic, readonly) PhiTextRange *textRange;
 @property (nonatomic, readonly, getter=isEmpty) BOOL empty;
-@property (nonatomic, readonly) CTLineRef textLine;
+/*! Created by the document's layoutEngine (a CTLine when typeset by Core Text). */
+@property (nonatomic, readonly) CFTypeRef textLine;
 @property (nonatomic, readonly) CFIndex index;
 @property (nonatomic, readonly) NSUInteger number;
 @property (nonatomic, readonly) CGPoint originInFrame;
@@ -52,10 +53,12 @@
 @property (nonatomic, readonly) CGFloat leading;
 @property (nonatomic, readonly) CGFloat height;
 
-+ (id)textLineWithLine:(CTLineRef)line index:(CFIndex)index frame:(PhiTextFrame *)frame;
+@property (nonatomic, readonly) CGFloat xHeight;
+
++ (id)textLineWithLine:(CFTypeRef)line index:(CFIndex)index frame:(PhiTextFrame *)frame;
 + (id)textLineWithIndex:(CFIndex)index frame:(PhiTextFrame *)frame;
 
-- (id)initWithLine:(CTLineRef)line index:(CFIndex)i frame:(PhiTextFrame *)textFrame;
+- (id)initWithLine:(CFTypeRef)line index:(CFIndex)i frame:(PhiTextFrame *)textFrame;
 
 /*! exclusive of document's bounds.origin */
 - (CGFloat)offsetForPosition:(PhiTextPosition *)position;
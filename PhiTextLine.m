@@ -24,16 +24,13 @@
 #import "PhiTextPosition.h"
 #import "PhiTextDocument.h"
 #import "PhiTextStorage.h"
-
-@interface PhiTextPosition (PhiTextLine)
-@property (retain, nonatomic, readwrite) PhiTextLine *line;
-@end
+#import "PhiTextLayoutEngine.h"
 
 @implementation PhiTextLine
 
 @synthesize index, frame, textLine;
 
-+ (id)textLineWithLine:(CTLineRef)line index:(CFIndex)index frame:(PhiTextFrame *)frame {
++ (id)textLineWithLine:(CFTypeRef)line index:(CFIndex)index frame:(PhiTextFrame *)frame {
 	return [[[PhiTextLine alloc] initWithLine:line index:index frame:frame] autorelease];
 }
 
@@ -41,7 +38,7 @@
 	return [[[PhiTextLine alloc] initWithLine:NULL index:index frame:frame] autorelease];
 }
 
-- (id)initWithLine:(CTLineRef)line index:(CFIndex)i frame:(PhiTextFrame *)textFrame {
+- (id)initWithLine:(CFTypeRef)line index:(CFIndex)i frame:(PhiTextFrame *)textFrame {
 	if (self = [super init]) {
 		if (line)
 			textLine = CFRetain(line);
@@ -76,11 +73,17 @@
 	return [frame firstLineNumber] + index;
 }
 
-- (CTLineRef)textLine {
+- (id <PhiTextLayoutEngine>)layoutEngine {
+	return [[frame document] layoutEngine];
+}
+
+- (CFTypeRef)textLine {
 	if (frame && !textLine) {
-		CTFrameRef _frame = [frame copyCTFrame];
-		textLine = CFRetain(CFArrayGetValueAtIndex(CTFrameGetLines(_frame), index));
-		CFRelease(_frame);
+		CFTypeRef _frame = [frame copyLayoutFrame];
+		if (_frame) {
+			textLine = CFRetain(CFArrayGetValueAtIndex([[self layoutEngine] linesOfFrame:_frame], index));
+			CFRelease(_frame);
+		}
 	}
 	
 	return textLine;
@@ -88,9 +91,11 @@
 
 - (CGPoint)originInFrame {
 	if (frame && (isnan(origin.x) || isnan(origin.y))) {
-		CTFrameRef _frame = [frame copyCTFrame];
-		CTFrameGetLineOrigins(_frame, CFRangeMake(index, 1), &origin);
-		CFRelease(_frame);
+		CFTypeRef _frame = [frame copyLayoutFrame];
+		if (_frame) {
+			[[self layoutEngine] getLineOrigins:&origin inRange:CFRangeMake(index, 1) ofFrame:_frame];
+			CFRelease(_frame);
+		}
 	}
 	
 	return origin;
@@ -108,32 +113,36 @@
 
 - (CGFloat)width {
 	if (isnan(width) && textLine)
-		width = CTLineGetTypographicBounds(textLine, &ascent, &descent, &leading);
+		width = [[self layoutEngine] typographicBoundsOfLine:textLine ascent:&ascent descent:&descent leading:&leading];
 	
 	return width;
 }
 
+- (CGFloat)xHeight {
+	return [[self layoutEngine] xHeightOfLine:[self textLine]];
+}
+
 - (CGFloat)height {
 	return self.ascent + self.descent + self.leading;
 }
 
 - (CGFloat)ascent {
 	if (isnan(ascent) && textLine)
-		width = CTLineGetTypographicBounds(textLine, &ascent, &descent, &leading);
+		width = [[self layoutEngine] typographicBoundsOfLine:textLine ascent:&ascent descent:&descent leading:&leading];
 	
 	return ascent;
 }
 
 - (CGFloat)descent {
 	if (isnan(descent) && textLine)
-		width = CTLineGetTypographicBounds(textLine, &ascent, &descent, &leading);
+		width = [[self layoutEngine] typographicBoundsOfLine:textLine ascent:&ascent descent:&descent leading:&leading];
 	
 	return descent;
 }
 
 - (CGFloat)leading {
 	if (isnan(leading) && textLine)
-		width = CTLineGetTypographicBounds(textLine, &ascent, &descent, &leading);
+		width = [[self layoutEngine] typographicBoundsOfLine:textLine ascent:&ascent descent:&descent leading:&leading];
 	
 	return leading;
 }
@@ -141,7 +150,7 @@
 /*! Relative to document. */
 - (PhiTextRange *)textRange {
 	if (!textRange) {
-		CFRange lineRange = CTLineGetStringRange(textLine);
+		CFRange lineRange = [[self layoutEngine] stringRangeOfLine:textLine];
 		lineRange.location += [frame firstStringIndex];
 		textRange = [[PhiTextRange textRangeWithCFRange:lineRange] retain];
 	}
@@ -151,10 +160,9 @@
 
 - (PhiTextStyle *)textStyle {
 	PhiTextPosition *effectivePosition;
-	PhiTextStyle *style = [[frame document] styleFromPosition:(PhiTextPosition *)[[self textRange] start]
+	PhiTextStyle *style = [[frame document] internedStyleFromPosition:(PhiTextPosition *)[[self textRange] start]
 								  toFarthestEffectivePosition:&effectivePosition
 											notBeyondPosition:(PhiTextPosition *)[[self textRange] end]];
-	effectivePosition.line = self;
 	return style;
 }
 
@@ -167,14 +175,14 @@
 		[[[frame document] store] isLineBreakAtIndex:x - 1]) {
 		x--;
 	}
-	offset = CTLineGetOffsetForStringIndex(textLine, x - [frame firstStringIndex], NULL);
+	offset = [[self layoutEngine] offsetForStringIndex:x - [frame firstStringIndex] inLine:textLine];
 	return offset;
 }
 
 - (PhiTextPosition *)positionForPoint:(CGPoint)point {
 	CGPoint oid = [self originInDocument];
 	CGPoint position = CGPointMake(point.x - oid.x, point.x - oid.x);
-	CFIndex stringIndex = CTLineGetStringIndexForPosition(textLine, position);
+	CFIndex stringIndex = [[self layoutEngine] stringIndexForPosition:position inLine:textLine];
 	stringIndex += frame.firstStringIndex;
 	if (stringIndex == PhiPositionOffset(self.textRange.end) && [[[frame document] store] isLineBreakAtIndex:stringIndex - 1]) {
 		stringIndex--;
@@ -21,6 +21,34 @@
 #import <UIKit/UIKit.h>
 #import <QuartzCore/QuartzCore.h>
 
+/*!
+ Implemented by a subject view that can draw its content more cheaply than rendering its
+ whole layer tree, e.g. by compositing tiles that have already been rasterised.
+ */
+@protocol PhiTextMagnifierSubject <NSObject>
+
+/*! Draws the content of the receiver that lies in rect (in its coordinates) into context; returns NO if it could not, in which case the receiver's layer is rendered instead. */
+- (BOOL)drawMagnifiedRect:(CGRect)rect inContext:(CGContextRef)context;
+
+@end
+
+typedef struct {
+	/*! Number of times the loupe was drawn. */
+	NSUInteger frames;
+	/*! Number of frames whose content was drawn by the subject view (see PhiTextMagnifierSubject). */
+	NSUInteger subjectDraws;
+	/*! Number of frames whose content was rendered from the subject view's layer tree. */
+	NSUInteger layerRenders;
+	/*! Number of times the rim, glow and gloss were rendered (once per size and scale). */
+	NSUInteger chromeRenders;
+	/*! Total time spent drawing the loupe (in seconds). */
+	double drawTime;
+	/*! The part of drawTime spent drawing the subject's content. */
+	double contentTime;
+	/*! Total time the loupe was shown (in seconds); frames / shownTime is the frame rate while dragging. */
+	double shownTime;
+} PhiTextMagnifierStatistics;
+
 @interface PhiTextMagnifier : UIView {
 @private
 	//CGSize originalSize;
@@ -35,6 +63,14 @@
 	BOOL rightHandPreferred;
 	CGPoint originInSubjectView;
 	UIWindow *overlay;
+	
+	CGLayerRef chromeLayer;
+	CGLayerRef glossLayer;
+	CGRect chromeBounds;
+	CGRect chromeClippingBounds;
+	CGFloat chromeScale;
+	CFAbsoluteTime shownAt;
+	PhiTextMagnifierStatistics statistics;
 }
 
 @property (nonatomic, retain) UIColor *defaultSubjectBackgoundColor;
@@ -54,4 +90,7 @@
  */
 - (void)shrinkToPoint:(CGPoint)point;
 
+- (PhiTextMagnifierStatistics)statistics;
+- (void)resetStatistics;
+
 @end
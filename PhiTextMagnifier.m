@@ -134,6 +134,12 @@
 
 @end
 
+@interface PhiTextMagnifier ()
+
+- (void)releaseChrome;
+
+@end
+
 @implementation PhiTextMagnifier
 
 + (void)initialize {
@@ -198,6 +204,15 @@
 }
 @synthesize subjectView, magnification, clippingBounds, offscreenThreshold, rightHandPreferred, defaultSubjectBackgoundColor, glassTintColor, active;
 
+- (void)setGlassTintColor:(UIColor *)color {
+	if (glassTintColor != color) {
+		[glassTintColor release];
+		glassTintColor = [color retain];
+		[self releaseChrome];
+		[self setNeedsDisplay];
+	}
+}
+
 - (id<CAAction>)actionForLayer:(CALayer *)theLayer forKey:(NSString *)key {
 	if ([theLayer presentationLayer] && [key isEqualToString:@"anchorPoint"] || [key isEqualToString:@"hidden"]) {
 		return nil;
@@ -350,6 +365,8 @@
 		[overlay addSubview:self];
 	}
 	overlay.hidden = NO;
+	if (self.hidden)
+		shownAt = CFAbsoluteTimeGetCurrent();
 
 	[self setCenter:[self.window convertPoint:pointInSubjectView fromView:self.subjectView]];
 	self.hidden = NO;
@@ -357,71 +374,60 @@
 
 - (void)shrinkToPoint:(CGPoint)point {
 	self.center = [self convertPoint:point toView:self.superview];
+	if (!self.hidden && shownAt > 0.0) {
+		statistics.shownTime += CFAbsoluteTimeGetCurrent() - shownAt;
+		shownAt = 0.0;
+	}
 	self.hidden = YES;
 }
 
-- (void)drawRect:(CGRect)rect {
-#ifdef TRACE
-	NSLog(@"Entering [PhiTextMagnifier drawRect:(%.f, %.f), (%.f, %.f)]...", rect.origin.x, rect.origin.y, rect.size.width, rect.size.height);
-#endif
+- (void)releaseChrome {
+	if (chromeLayer) {
+		CGLayerRelease(chromeLayer);
+		chromeLayer = NULL;
+	}
+	if (glossLayer) {
+		CGLayerRelease(glossLayer);
+		glossLayer = NULL;
+	}
+}
+/*! Returns a layer the size of the receiver's bounds (in pixels), whose context draws in the coordinates of the receiver's bounds. */
+- (CGLayerRef)newChromeLayerWithContext:(CGContextRef)context {
+	CGLayerRef layer = CGLayerCreateWithContext(context, CGSizeMake(chromeBounds.size.width * chromeScale, chromeBounds.size.height * chromeScale), NULL);
+	CGContextRef layerContext = CGLayerGetContext(layer);
+	CGContextScaleCTM(layerContext, chromeScale, chromeScale);
+	CGContextTranslateCTM(layerContext, -CGRectGetMinX(chromeBounds), -CGRectGetMinY(chromeBounds));
+	return layer;
+}
+/*! Renders the rim and glass (which do not depend on the subject) once per size and scale, rather than on every move. */
+- (void)prepareChromeWithContext:(CGContextRef)referenceContext {
 	CGContextRef context;
-	CGPoint subjectOrigin;
-	//CGRect subjectClippingBounds;
+	if (chromeLayer && glossLayer
+		&& CGRectEqualToRect(chromeBounds, self.bounds)
+		&& CGRectEqualToRect(chromeClippingBounds, self.clippingBounds)
+		&& chromeScale == self.contentScaleFactor)
+		return;
+	[self releaseChrome];
+	chromeBounds = self.bounds;
+	chromeClippingBounds = self.clippingBounds;
+	chromeScale = self.contentScaleFactor;
+	statistics.chromeRenders++;
+
 	CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
 	CGRect glassRect = CGRectInset(self.clippingBounds,  1.0,  1.0);
 	CGRect rimRect = CGRectInset(self.clippingBounds, -2.0, -2.0);
 	UIColor *rimFillColor = [UIColor whiteColor];
 	UIColor *rimStrokeColor = [UIColor colorWithRed:0.25 green:0.25 blue:0.25 alpha:1.0];
-	
-	//subjectClippingBounds = CGRectMake(0.0, 0.0,  self.clippingBounds.size.width, self.clippingBounds.size.height);
-	subjectOrigin = CGPointMake(self.center.x, self.center.y);
-	subjectOrigin = [self.superview convertPoint:subjectOrigin toView:self.subjectView];
-	subjectOrigin.x -= self.clippingBounds.size.width / self.magnification / 2.0;
-	subjectOrigin.y -= self.clippingBounds.size.height / self.magnification / 2.0;
-	
-	context = UIGraphicsGetCurrentContext();
 
-	/*/Shadow and background
-	UIColor *subjectBackgroundColor = self.subjectView.backgroundColor;
-	if (subjectBackgroundColor == nil || [subjectBackgroundColor isEqual:[UIColor clearColor]]) {
-		subjectBackgroundColor = self.defaultSubjectBackgoundColor;
-	}
-	if (self.active) {
-		subjectBackgroundColor = [subjectBackgroundColor colorWithAlphaComponent:1.0];
-	} else {
-		//TODO: confirm 0.5
-		subjectBackgroundColor = [subjectBackgroundColor colorWithAlphaComponent:0.5];
-	}
-	CGContextSaveGState(context); {
-		CGContextBeginPath(context);
-		CGContextAddEllipseInRect(context, rimRect);
-		[subjectBackgroundColor set];
-		CGContextSetShadow(context, CGSizeMake(0.0, 2.0), 4.0);
-		CGContextDrawPath(context, kCGPathFill);
-	} CGContextRestoreGState(context);
-	/**/
-	//Subject's content
-	CGContextSaveGState(context); {
-		CGContextBeginPath(context);
-		CGContextAddEllipseInRect(context, self.clippingBounds);
-		CGContextClip(context);
-		if (self.active) {
-			//TODO: Use CGLayer in PhiTextView and reuse here
-			CALayer *layer = self.subjectView.layer;// presentationLayer];
-			//CGContextSetInterpolationQuality(context, kCGInterpolationHigh);
-			CGContextScaleCTM(context, self.magnification, self.magnification);
-			CGContextTranslateCTM(context, -subjectOrigin.x, -subjectOrigin.y);
-			[layer renderInContext:context];
-		}
-	} CGContextRestoreGState(context);
-	/**/
+	chromeLayer = [self newChromeLayerWithContext:referenceContext];
+	context = CGLayerGetContext(chromeLayer);
 	//Rim
 	CGContextSaveGState(context); {
 		CGContextBeginPath(context);
 		CGContextAddEllipseInRect(context, rimRect);
 		CGContextAddEllipseInRect(context, glassRect);
-		[rimFillColor setFill];
-		[rimStrokeColor setStroke];
+		CGContextSetFillColorWithColor(context, rimFillColor.CGColor);
+		CGContextSetStrokeColorWithColor(context, rimStrokeColor.CGColor);
 		CGContextDrawPath(context, kCGPathEOFillStroke);
 	} CGContextRestoreGState(context);
 	/**/
@@ -444,13 +450,15 @@
 									glowOrigin, CGRectGetMaxY(glassRect) - 26.0f,
 									kCGGradientDrawsBeforeStartLocation | kCGGradientDrawsAfterEndLocation);
 		CGContextAddEllipseInRect(context, glassRect);
-		[self.glassTintColor setFill];
+		CGContextSetFillColorWithColor(context, self.glassTintColor.CGColor);
 		CGContextDrawPath(context, kCGPathFill);
 		
 		CGGradientRelease(glowGradient);
 	} CGContextRestoreGState(context);
 	/**/
-	//Glass gloss
+	//Glass gloss (screened over the content and glow when composited)
+	glossLayer = [self newChromeLayerWithContext:referenceContext];
+	context = CGLayerGetContext(glossLayer);
 	CGContextSaveGState(context); {
 		CGFloat glossColorGradient[] =  {
 			1.0f, 1.0f, 1.0f, 1.00f * 0.5f,// Start color
@@ -466,7 +474,6 @@
 		CGContextBeginPath(context);
 		CGContextAddArc(context, CGRectGetMidX(glassRect), CGRectGetMidY(glassRect), glassRect.size.height * 0.5f, 0.0, M_PI, 1);
 		CGContextClip(context);
-		CGContextSetBlendMode(context, kCGBlendModeScreen);
 		CGContextDrawLinearGradient(context, glossGradient,
 									CGPointMake(CGRectGetMinX(glassRect), CGRectGetMinY(glassRect) + glassRect.size.height * 0.25f),
 									CGPointMake(CGRectGetMinX(glassRect), CGRectGetMinY(glassRect) + glassRect.size.height * 1.25f),
@@ -479,13 +486,76 @@
 	CGColorSpaceRelease(colorSpace);
 }
 
+- (void)drawRect:(CGRect)rect {
+#ifdef TRACE
+	NSLog(@"Entering [PhiTextMagnifier drawRect:(%.f, %.f), (%.f, %.f)]...", rect.origin.x, rect.origin.y, rect.size.width, rect.size.height);
+#endif
+	CFAbsoluteTime drawStart = CFAbsoluteTimeGetCurrent();
+	CGContextRef context;
+	CGPoint subjectOrigin;
+	CGRect subjectRect;
+	UIView *subject = self.subjectView;
+	
+	subjectOrigin = CGPointMake(self.center.x, self.center.y);
+	subjectOrigin = [self.superview convertPoint:subjectOrigin toView:subject];
+	subjectOrigin.x -= self.clippingBounds.size.width / self.magnification / 2.0;
+	subjectOrigin.y -= self.clippingBounds.size.height / self.magnification / 2.0;
+	subjectRect = CGRectMake(subjectOrigin.x, subjectOrigin.y,
+							 self.clippingBounds.size.width / self.magnification,
+							 self.clippingBounds.size.height / self.magnification);
+	
+	context = UIGraphicsGetCurrentContext();
+	[self prepareChromeWithContext:context];
+
+	//Subject's content
+	CGContextSaveGState(context); {
+		CGContextBeginPath(context);
+		CGContextAddEllipseInRect(context, self.clippingBounds);
+		CGContextClip(context);
+		if (self.active) {
+			CGContextScaleCTM(context, self.magnification, self.magnification);
+			CGContextTranslateCTM(context, -subjectOrigin.x, -subjectOrigin.y);
+			// Prefer the subject's cached content over rendering its whole layer tree on every move
+			if ([subject conformsToProtocol:@protocol(PhiTextMagnifierSubject)]
+				&& [(id <PhiTextMagnifierSubject>)subject drawMagnifiedRect:subjectRect inContext:context]) {
+				statistics.subjectDraws++;
+			} else {
+				[subject.layer renderInContext:context];
+				statistics.layerRenders++;
+			}
+		}
+	} CGContextRestoreGState(context);
+	statistics.contentTime += CFAbsoluteTimeGetCurrent() - drawStart;
+
+	//Rim, glow and gloss
+	CGContextDrawLayerInRect(context, chromeBounds, chromeLayer);
+	CGContextSaveGState(context); {
+		CGContextSetBlendMode(context, kCGBlendModeScreen);
+		CGContextDrawLayerInRect(context, chromeBounds, glossLayer);
+	} CGContextRestoreGState(context);
+
+	statistics.frames++;
+	statistics.drawTime += CFAbsoluteTimeGetCurrent() - drawStart;
+}
+
+- (PhiTextMagnifierStatistics)statistics {
+	return statistics;
+}
+
+- (void)resetStatistics {
+	memset(&statistics, 0, sizeof(statistics));
+}
+
 - (void)dealloc {
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 	[overlay release];
 	overlay = nil;
 	self.subjectView = nil;
-	self.glassTintColor = nil;
+	// Not through the setter, which would rebuild the chrome
+	[glassTintColor release];
+	glassTintColor = nil;
 	self.defaultSubjectBackgoundColor = nil;
+	[self releaseChrome];
     [super dealloc];
 }
 
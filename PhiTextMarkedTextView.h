@@ -0,0 +1,74 @@
+//
+//  PhiTextMarkedTextView.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+#import <CoreText/CoreText.h>
+
+/*!
+ Draws the marked text of a composition in place of the text that it will replace, so that the store needn't
+ be edited until the composition ends. The rest of the line (the trailing text) is typeset again after the
+ marked text, wrapped to the width of the view, over a background that masks the original glyphs: right of
+ firstLineIndent on the first line, and across the whole view below it.
+ The marked text is underlined, and its selected range (the clause being converted) is underlined more heavily.
+ Indexes count the marked text and then the trailing text.
+ */
+@interface PhiTextMarkedTextView : UIView {
+@private
+	NSAttributedString *markedText;
+	NSAttributedString *trailingText;
+	NSRange selectedRange;
+	CGFloat firstLineIndent;
+	CGFloat lineHeight;
+	CFArrayRef lines;
+	CGFloat typesetWidth;
+	UIColor *maskColor;
+	UIColor *highlightColor;
+	UIColor *underlineColor;
+}
+
+/*! The marked text, with the attributes that it will have in the store. */
+@property (nonatomic, copy) NSAttributedString *markedText;
+/*! The text that follows the replaced text on its line, which moves with the marked text. */
+@property (nonatomic, copy) NSAttributedString *trailingText;
+/*! The range of the marked text that is selected. */
+@property (nonatomic, assign) NSRange selectedRange;
+/*! The distance from the view's left edge to the start of the marked text. */
+@property (nonatomic, assign) CGFloat firstLineIndent;
+/*! The height of each line, that of the caret. */
+@property (nonatomic, assign) CGFloat lineHeight;
+/*! The colour of the background that masks the original text. Default is white. */
+@property (nonatomic, retain) UIColor *maskColor;
+/*! The colour laid over the background of the marked text. Default is nil. */
+@property (nonatomic, retain) UIColor *highlightColor;
+/*! The colour of the underlines. Default is dark grey. */
+@property (nonatomic, retain) UIColor *underlineColor;
+/*! The length of the marked text and the trailing text. */
+@property (nonatomic, readonly) NSUInteger length;
+
+/*! Returns the width of size, and the height of the lines when typeset to that width. */
+- (CGSize)sizeThatFits:(CGSize)size;
+/*! Returns the top left of the caret before index, in the view's coordinates. */
+- (CGPoint)pointForIndex:(NSUInteger)index;
+/*! Returns the first rectangle enclosing range, in the view's coordinates. */
+- (CGRect)firstRectForRange:(NSRange)range;
+/*! Returns the index nearest to point (in the view's coordinates), or NSNotFound left of the first line. */
+- (NSUInteger)indexForPoint:(CGPoint)point;
+
+@end
@@ -0,0 +1,264 @@
+//
+//  PhiTextMarkedTextView.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextMarkedTextView.h"
+
+@interface PhiTextMarkedTextView ()
+
+- (void)invalidateLines;
+- (void)typesetToWidth:(CGFloat)width;
+- (CFIndex)lineIndexForIndex:(NSUInteger)index;
+- (CGFloat)offsetForIndex:(NSUInteger)index inLine:(CFIndex)lineIndex;
+
+@end
+
+@implementation PhiTextMarkedTextView
+
+@synthesize markedText, trailingText, selectedRange, firstLineIndent, lineHeight;
+@synthesize maskColor, highlightColor, underlineColor;
+
+- (id)initWithFrame:(CGRect)frame {
+	if (self = [super initWithFrame:frame]) {
+		self.opaque = NO;
+		self.userInteractionEnabled = NO;
+		self.contentMode = UIViewContentModeRedraw;
+		self.underlineColor = [UIColor darkGrayColor];
+	}
+	return self;
+}
+
+- (void)setMarkedText:(NSAttributedString *)text {
+	if (markedText != text) {
+		[markedText release];
+		markedText = [text copy];
+		[self invalidateLines];
+	}
+}
+- (void)setTrailingText:(NSAttributedString *)text {
+	if (trailingText != text) {
+		[trailingText release];
+		trailingText = [text copy];
+		[self invalidateLines];
+	}
+}
+- (void)setFirstLineIndent:(CGFloat)indent {
+	if (firstLineIndent != indent) {
+		firstLineIndent = indent;
+		[self invalidateLines];
+	}
+}
+- (void)setLineHeight:(CGFloat)height {
+	if (lineHeight != height) {
+		lineHeight = height;
+		[self setNeedsDisplay];
+	}
+}
+- (void)setSelectedRange:(NSRange)range {
+	if (!NSEqualRanges(selectedRange, range)) {
+		selectedRange = range;
+		[self setNeedsDisplay];
+	}
+}
+- (NSUInteger)length {
+	return [markedText length] + [trailingText length];
+}
+
+- (void)invalidateLines {
+	if (lines)
+		CFRelease(lines);
+	lines = NULL;
+	[self setNeedsDisplay];
+}
+/*! Typesets the marked text and the trailing text, the first line from firstLineIndent, unless already typeset to width. */
+- (void)typesetToWidth:(CGFloat)width {
+	NSMutableAttributedString *text;
+	CTTypesetterRef typesetter = NULL;
+	CFMutableArrayRef newLines;
+	CTLineRef line;
+	CFIndex start = 0, count, length;
+
+	if (lines && width == typesetWidth)
+		return;
+	if (lines)
+		CFRelease(lines);
+	typesetWidth = width;
+	newLines = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	text = [[NSMutableAttributedString alloc] init];
+	if (markedText)
+		[text appendAttributedString:markedText];
+	if (trailingText)
+		[text appendAttributedString:trailingText];
+	length = [text length];
+	if (length)
+		typesetter = CTTypesetterCreateWithAttributedString((CFAttributedStringRef)text);
+	if (typesetter) {
+		do {
+			// However narrow the first line, each line holds at least one cluster
+			count = CTTypesetterSuggestLineBreak(typesetter, start, MAX(start ? width : width - firstLineIndent, 1.0));
+			line = CTTypesetterCreateLine(typesetter, CFRangeMake(start, count));
+			CFArrayAppendValue(newLines, line);
+			CFRelease(line);
+			start += count;
+		} while (count > 0 && start < length);
+		CFRelease(typesetter);
+	}
+	[text release];
+	lines = newLines;
+}
+/*! Returns the line of index; an index at a line break belongs to the next line. */
+- (CFIndex)lineIndexForIndex:(NSUInteger)index {
+	CFIndex i, count = CFArrayGetCount(lines);
+	CFRange range;
+	for (i = 0; i < count - 1; i++) {
+		range = CTLineGetStringRange((CTLineRef)CFArrayGetValueAtIndex(lines, i));
+		if ((CFIndex)index < range.location + range.length)
+			break;
+	}
+	return i;
+}
+- (CGFloat)offsetForIndex:(NSUInteger)index inLine:(CFIndex)lineIndex {
+	CTLineRef line = (CTLineRef)CFArrayGetValueAtIndex(lines, lineIndex);
+	return (lineIndex ? 0.0 : firstLineIndent) + CTLineGetOffsetForStringIndex(line, index, NULL);
+}
+
+- (CGSize)sizeThatFits:(CGSize)size {
+	CFIndex i, count;
+	CGFloat width = 0.0;
+	[self typesetToWidth:size.width];
+	count = CFArrayGetCount(lines);
+	for (i = 0; i < count; i++)
+		width = MAX(width, (i ? 0.0 : firstLineIndent) + CTLineGetTypographicBounds((CTLineRef)CFArrayGetValueAtIndex(lines, i), NULL, NULL, NULL));
+	return CGSizeMake(MIN(size.width, ceil(width) + 1.0), MAX(count, 1) * lineHeight);
+}
+- (CGPoint)pointForIndex:(NSUInteger)index {
+	CFIndex i;
+	[self typesetToWidth:self.bounds.size.width];
+	if (!CFArrayGetCount(lines))
+		return CGPointMake(firstLineIndent, 0.0);
+	index = MIN(index, self.length);
+	i = [self lineIndexForIndex:index];
+	return CGPointMake([self offsetForIndex:index inLine:i], i * lineHeight);
+}
+- (CGRect)firstRectForRange:(NSRange)range {
+	CGPoint start = [self pointForIndex:range.location];
+	CFIndex i;
+	CFRange lineRange;
+	CGFloat end = start.x;
+	if (CFArrayGetCount(lines)) {
+		i = [self lineIndexForIndex:MIN(range.location, self.length)];
+		lineRange = CTLineGetStringRange((CTLineRef)CFArrayGetValueAtIndex(lines, i));
+		end = [self offsetForIndex:MIN(NSMaxRange(range), (NSUInteger)(lineRange.location + lineRange.length)) inLine:i];
+	}
+	return CGRectMake(start.x, start.y, MAX(end - start.x, 0.0), lineHeight);
+}
+- (NSUInteger)indexForPoint:(CGPoint)point {
+	CFIndex i, count, index;
+	CTLineRef line;
+	[self typesetToWidth:self.bounds.size.width];
+	i = lineHeight > 0.0 ? (CFIndex)floor(point.y / lineHeight) : 0;
+	if (i <= 0 && point.x < firstLineIndent)
+		return NSNotFound;
+	count = CFArrayGetCount(lines);
+	if (!count)
+		return 0;
+	// Below the last line, where the original lines are masked, is the end of the text
+	if (i >= count)
+		return self.length;
+	i = MAX(i, 0);
+	line = (CTLineRef)CFArrayGetValueAtIndex(lines, i);
+	index = CTLineGetStringIndexForPosition(line, CGPointMake(point.x - (i ? 0.0 : firstLineIndent), 0.0));
+	if (index == kCFNotFound)
+		index = CTLineGetStringRange(line).location;
+	return MIN((NSUInteger)index, self.length);
+}
+
+- (void)drawRect:(CGRect)rect {
+	CGContextRef context = UIGraphicsGetCurrentContext();
+	CGRect bounds = self.bounds;
+	NSUInteger markedLength = [markedText length], start, end;
+	CFIndex i, count;
+	CFRange range;
+	CTLineRef line;
+	CGFloat ascent, descent, top, baseline, x;
+
+	[self typesetToWidth:bounds.size.width];
+	// Mask the original text: right of the indent on the first line, and everything below it
+	CGContextSetFillColorWithColor(context, (maskColor ? maskColor : [UIColor whiteColor]).CGColor);
+	CGContextFillRect(context, CGRectMake(firstLineIndent, 0.0, bounds.size.width - firstLineIndent, lineHeight));
+	CGContextFillRect(context, CGRectMake(0.0, lineHeight, bounds.size.width, bounds.size.height - lineHeight));
+
+	count = CFArrayGetCount(lines);
+	for (i = 0; i < count; i++) {
+		line = (CTLineRef)CFArrayGetValueAtIndex(lines, i);
+		range = CTLineGetStringRange(line);
+		CTLineGetTypographicBounds(line, &ascent, &descent, NULL);
+		top = i * lineHeight;
+		// The baseline centres the line in the caret's height
+		baseline = top + lineHeight - floor((lineHeight - ascent - descent) / 2.0 + descent);
+
+		// The part of the marked text on this line is highlighted and underlined
+		start = range.location;
+		end = MIN(markedLength, (NSUInteger)(range.location + range.length));
+		if (start < end && highlightColor) {
+			x = [self offsetForIndex:start inLine:i];
+			CGContextSetFillColorWithColor(context, highlightColor.CGColor);
+			CGContextFillRect(context, CGRectMake(x, top, [self offsetForIndex:end inLine:i] - x, lineHeight));
+		}
+
+		x = i ? 0.0 : firstLineIndent;
+		CGContextSaveGState(context); {
+			CGContextSetTextMatrix(context, CGAffineTransformIdentity);
+			CGContextTranslateCTM(context, x, baseline);
+			CGContextScaleCTM(context, 1.0, -1.0);
+			CGContextSetTextPosition(context, 0.0, 0.0);
+			CTLineDraw(line, context);
+		} CGContextRestoreGState(context);
+
+		if (start < end) {
+			x = [self offsetForIndex:start inLine:i];
+			CGContextSetFillColorWithColor(context, underlineColor.CGColor);
+			CGContextFillRect(context, CGRectMake(x, baseline + 1.0, [self offsetForIndex:end inLine:i] - x, 1.0));
+			start = MAX(start, selectedRange.location);
+			end = MIN(end, NSMaxRange(selectedRange));
+			if (start < end) {
+				x = [self offsetForIndex:start inLine:i];
+				CGContextFillRect(context, CGRectMake(x, baseline + 1.0, [self offsetForIndex:end inLine:i] - x, 2.0));
+			}
+		}
+	}
+}
+
+- (void)dealloc {
+	if (lines)
+		CFRelease(lines);
+	lines = NULL;
+	[markedText release];
+	markedText = nil;
+	[trailingText release];
+	trailingText = nil;
+	[maskColor release];
+	maskColor = nil;
+	[highlightColor release];
+	highlightColor = nil;
+	[underlineColor release];
+	underlineColor = nil;
+	[super dealloc];
+}
+
+@end
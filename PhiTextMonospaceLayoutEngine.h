@@ -0,0 +1,48 @@
+//
+//  PhiTextMonospaceLayoutEngine.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreText/CoreText.h>
+#import "PhiTextFixedAdvanceLayoutEngine.h"
+
+/*!
+ Lays out text set in a single fixed-pitch font arithmetically (columns × advance),
+ using the metrics of that font; Core Text is only used to draw each line.
+ PhiTextDocument switches to this engine (when monospaceLayout is enabled) if every
+ run of its text has the same fixed-pitch font and the same simple paragraph style, and every
+ character takes a single column; it switches back as soon as an edit breaks any of these.
+ */
+@interface PhiTextMonospaceLayoutEngine : PhiTextFixedAdvanceLayoutEngine {
+@private
+	CTFontRef font;
+	CTParagraphStyleRef tabStyle;
+}
+
+@property (nonatomic, readonly) CTFontRef font;
+
+/*! Returns YES if the specified font is fixed-pitch. */
++ (BOOL)canLayoutFont:(CTFontRef)font;
+/*! Returns YES if every character of the specified range of string is drawn a single advance wide by a fixed-pitch font, i.e. it holds no East Asian wide characters, combining marks, surrogate pairs or zero width characters (which Core Text draws at other advances, often from fallback fonts). */
++ (BOOL)canLayoutString:(NSString *)string range:(NSRange)range;
+/*! Returns YES if the specified paragraph style (which may be NULL) is left aligned, wraps lines and has no spacing, indents or line height constraints. */
++ (BOOL)canLayoutParagraphStyle:(CTParagraphStyleRef)paragraphStyle;
+
+- (id)initWithFont:(CTFontRef)font;
+
+@end
@@ -0,0 +1,171 @@
+//
+//  PhiTextMonospaceLayoutEngine.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "PhiTextMonospaceLayoutEngine.h"
+
+@implementation PhiTextMonospaceLayoutEngine
+
+@synthesize font;
+
++ (BOOL)canLayoutFont:(CTFontRef)aFont {
+	return aFont && (CTFontGetSymbolicTraits(aFont) & kCTFontMonoSpaceTrait);
+}
+
++ (BOOL)canLayoutString:(NSString *)string range:(NSRange)range {
+	CFStringInlineBuffer buffer;
+	CFIndex i;
+	UniChar c;
+	CFStringInitInlineBuffer((CFStringRef)string, &buffer, CFRangeMake(range.location, range.length));
+	for (i = 0; i < range.length; i++) {
+		c = CFStringGetCharacterFromInlineBuffer(&buffer, i);
+		if (c < 0x0300 || c == '\t' || c == 0x2028 || c == 0x2029)
+			continue;
+		if (CFStringIsSurrogateHighCharacter(c) || [self columnsOfCharacter:c] != 1)
+			return NO;
+	}
+	return YES;
+}
+
++ (BOOL)canLayoutParagraphStyle:(CTParagraphStyleRef)paragraphStyle {
+	if (!paragraphStyle)
+		return YES;
+
+	static const CTParagraphStyleSpecifier zeroSpecifiers[] = {
+		kCTParagraphStyleSpecifierFirstLineHeadIndent,
+		kCTParagraphStyleSpecifierHeadIndent,
+		kCTParagraphStyleSpecifierTailIndent,
+		kCTParagraphStyleSpecifierMaximumLineHeight,
+		kCTParagraphStyleSpecifierMinimumLineHeight,
+		kCTParagraphStyleSpecifierLineSpacing,
+		kCTParagraphStyleSpecifierParagraphSpacing,
+		kCTParagraphStyleSpecifierParagraphSpacingBefore
+	};
+	CTTextAlignment alignment = kCTNaturalTextAlignment;
+	CTLineBreakMode lineBreakMode = kCTLineBreakByWordWrapping;
+	CGFloat value;
+	int i;
+
+	CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierAlignment, sizeof(alignment), &alignment);
+	if (alignment != kCTNaturalTextAlignment && alignment != kCTLeftTextAlignment)
+		return NO;
+	CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierLineBreakMode, sizeof(lineBreakMode), &lineBreakMode);
+	if (lineBreakMode != kCTLineBreakByWordWrapping && lineBreakMode != kCTLineBreakByCharWrapping)
+		return NO;
+	value = 0.0;
+	CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierLineHeightMultiple, sizeof(value), &value);
+	if (value != 0.0 && value != 1.0)
+		return NO;
+	for (i = 0; i < sizeof(zeroSpecifiers) / sizeof(CTParagraphStyleSpecifier); i++) {
+		value = 0.0;
+		CTParagraphStyleGetValueForSpecifier(paragraphStyle, zeroSpecifiers[i], sizeof(value), &value);
+		if (value != 0.0)
+			return NO;
+	}
+	return YES;
+}
+
+- (id)initWithFont:(CTFontRef)aFont {
+	if (self = [super init]) {
+		UniChar space = ' ';
+		CGGlyph glyph;
+
+		font = CFRetain(aFont);
+		tabStyle = NULL;
+		if (CTFontGetGlyphsForCharacters(font, &space, &glyph, 1))
+			advance = CTFontGetAdvancesForGlyphs(font, kCTFontDefaultOrientation, &glyph, NULL, 1);
+		else
+			advance = CTFontGetSize(font) * 0.6;
+		ascent = CTFontGetAscent(font);
+		descent = CTFontGetDescent(font);
+		leading = CTFontGetLeading(font);
+		xHeight = CTFontGetXHeight(font);
+	}
+	return self;
+}
+
+- (id)init {
+	CTFontRef aFont = CTFontCreateWithName(CFSTR("Courier"), 12.0, NULL);
+	self = [self initWithFont:aFont];
+	CFRelease(aFont);
+	return self;
+}
+
+- (void)setAdvance:(CGFloat)width {
+	@synchronized(self) {
+		advance = width;
+		if (tabStyle) {
+			CFRelease(tabStyle);
+			tabStyle = NULL;
+		}
+	}
+}
+
+- (void)setTabWidth:(NSUInteger)columns {
+	@synchronized(self) {
+		tabWidth = columns;
+		if (tabStyle) {
+			CFRelease(tabStyle);
+			tabStyle = NULL;
+		}
+	}
+}
+
+/*! Tabs are drawn at the same (column) stops at which they were laid out. */
+- (CTParagraphStyleRef)tabStyle {
+	@synchronized(self) {
+		if (!tabStyle) {
+			CGFloat interval = MAX(tabWidth, 1) * advance;
+			CFArrayRef tabStops = CFArrayCreate(NULL, NULL, 0, &kCFTypeArrayCallBacks);
+			CTParagraphStyleSetting settings[] = {
+				{ kCTParagraphStyleSpecifierDefaultTabInterval, sizeof(CGFloat), &interval },
+				{ kCTParagraphStyleSpecifierTabStops, sizeof(CFArrayRef), &tabStops }
+			};
+			tabStyle = CTParagraphStyleCreate(settings, sizeof(settings) / sizeof(CTParagraphStyleSetting));
+			CFRelease(tabStops);
+		}
+	}
+	return tabStyle;
+}
+
+- (void)drawLine:(CFTypeRef)line ofAttributedString:(NSAttributedString *)string atPoint:(CGPoint)point inContext:(CGContextRef)context {
+	CFRange range = [self stringRangeOfLine:line];
+	NSMutableAttributedString *lineString = [[string attributedSubstringFromRange:NSMakeRange(range.location, range.length)] mutableCopy];
+	[lineString addAttribute:(NSString *)kCTParagraphStyleAttributeName value:(id)[self tabStyle] range:NSMakeRange(0, [lineString length])];
+	CTLineRef textLine = CTLineCreateWithAttributedString((CFAttributedStringRef)lineString);
+	[lineString release];
+	if (textLine) {
+		CGContextSetTextPosition(context, point.x, point.y);
+		CTLineDraw(textLine, context);
+		CFRelease(textLine);
+	}
+}
+
+- (void)dealloc {
+	if (tabStyle) {
+		CFRelease(tabStyle);
+		tabStyle = NULL;
+	}
+	if (font) {
+		CFRelease(font);
+		font = NULL;
+	}
+	[super dealloc];
+}
+
+@end
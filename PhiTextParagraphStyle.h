@@ -20,6 +20,22 @@
 #import <Foundation/Foundation.h>
 #import <CoreText/CoreText.h>
 
+/*! Number of CTParagraphStyles held by the paragraph style cache before it is emptied. */
+#ifndef PHI_PARAGRAPH_STYLE_CACHE_LIMIT
+#define PHI_PARAGRAPH_STYLE_CACHE_LIMIT 256
+#endif
+
+typedef struct {
+	NSUInteger hits;
+	NSUInteger misses;
+	NSUInteger count;
+} PhiTextParagraphStyleCacheStatistics;
+
+/*!
+ A mutable description of a CTParagraphStyle. The CTParagraphStyles made from it are
+ shared process-wide, keyed by the values of their settings, through a thread-safe
+ cache which is emptied on memory warnings.
+ */
 @interface PhiTextParagraphStyle : NSObject {
 	CTParagraphStyleRef _CTParagraphStyle;
 	
@@ -60,6 +76,10 @@
 
 + (id)paragraphStyleWithCTParagraphStyle:(CTParagraphStyleRef)paragraphStyle;
 
++ (PhiTextParagraphStyleCacheStatistics)cacheStatistics;
++ (void)resetCacheStatistics;
++ (void)removeAllCachedParagraphStyles;
+
 
 
 @property (nonatomic, readonly) CTParagraphStyleRef CTParagraphStyle;
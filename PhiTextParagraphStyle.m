@@ -18,6 +18,7 @@
 //
 
 #import "PhiTextParagraphStyle.h"
+#import <UIKit/UIApplication.h>
 
 const CFStringRef kPhiTextTabIgnoreAlignmentAttributeName = CFSTR("PhiTextTabIgnoreAlignmentAttributeName");
 
@@ -30,8 +31,99 @@ Boolean PhiTextTabEqualCallBack (CTTextTabRef tab1, CTTextTabRef tab2, BOOL igno
 	return NO;
 }
 
+typedef struct {
+	struct _PhiTextParagraphStyleBitFields flags;
+	CTTextAlignment alignment;
+	CGFloat firstLineHeadIndent;
+	CGFloat headIndent;
+	CGFloat tailIndent;
+	CGFloat defaultTabInterval;
+	CTLineBreakMode lineBreakMode;
+	CGFloat lineHeightMultiple;
+	CGFloat maximumLineHeight;
+	CGFloat minimumLineHeight;
+	CGFloat lineSpacing;
+	CGFloat paragraphSpacing;
+	CGFloat paragraphSpacingBefore;
+	CTWritingDirection baseWritingDirection;
+	/*! Must be last, the members before it are compared bytewise. */
+	CFArrayRef tabStops;
+} PhiTextParagraphStyleCacheKey;
+
+static const void *PhiParagraphStyleCacheKeyRetain(CFAllocatorRef allocator, const void *value) {
+	PhiTextParagraphStyleCacheKey *rv = CFAllocatorAllocate(allocator, sizeof(PhiTextParagraphStyleCacheKey), 0);
+	memcpy(rv, value, sizeof(PhiTextParagraphStyleCacheKey));
+	if (rv->tabStops)
+		rv->tabStops = CFArrayCreateCopy(allocator, rv->tabStops);
+	return rv;
+}
+static void PhiParagraphStyleCacheKeyRelease(CFAllocatorRef allocator, const void *value) {
+	PhiTextParagraphStyleCacheKey *key = (PhiTextParagraphStyleCacheKey *)value;
+	if (key->tabStops)
+		CFRelease(key->tabStops);
+	CFAllocatorDeallocate(allocator, key);
+}
+static Boolean PhiParagraphStyleCacheKeyEqual(const void *value1, const void *value2) {
+	const PhiTextParagraphStyleCacheKey *key1 = value1, *key2 = value2;
+	if (memcmp(key1, key2, offsetof(PhiTextParagraphStyleCacheKey, tabStops)))
+		return NO;
+	if (key1->tabStops == key2->tabStops)
+		return YES;
+	return key1->tabStops && key2->tabStops && CFEqual(key1->tabStops, key2->tabStops);
+}
+static CFHashCode PhiParagraphStyleCacheKeyHash(const void *value) {
+	const PhiTextParagraphStyleCacheKey *key = value;
+	const unsigned char *bytes = value;
+	CFHashCode hash = 2166136261U;
+	size_t i;
+	for (i = 0; i < offsetof(PhiTextParagraphStyleCacheKey, tabStops); i++)
+		hash = (hash ^ bytes[i]) * 16777619U;
+	if (key->tabStops)
+		hash = hash * 31 + CFHash(key->tabStops);
+	return hash;
+}
+static const CFDictionaryKeyCallBacks PhiParagraphStyleCacheKeyCallBacks = {
+	0, PhiParagraphStyleCacheKeyRetain, PhiParagraphStyleCacheKeyRelease, NULL, PhiParagraphStyleCacheKeyEqual, PhiParagraphStyleCacheKeyHash
+};
+
+static CFMutableDictionaryRef cachedParagraphStyles = NULL;
+static PhiTextParagraphStyleCacheStatistics cacheStatistics;
+
+@interface PhiTextParagraphStyle ()
+
+- (void)getCacheKey:(PhiTextParagraphStyleCacheKey *)key;
+
+@end
+
 @implementation PhiTextParagraphStyle
 
++ (void)initialize {
+	if (self == [PhiTextParagraphStyle class]) {
+		cachedParagraphStyles = CFDictionaryCreateMutable(NULL, 0, &PhiParagraphStyleCacheKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		memset(&cacheStatistics, 0, sizeof(cacheStatistics));
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(removeAllCachedParagraphStyles) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	}
+}
+
++ (PhiTextParagraphStyleCacheStatistics)cacheStatistics {
+	PhiTextParagraphStyleCacheStatistics rv;
+	@synchronized([PhiTextParagraphStyle class]) {
+		rv = cacheStatistics;
+		rv.count = CFDictionaryGetCount(cachedParagraphStyles);
+	}
+	return rv;
+}
++ (void)resetCacheStatistics {
+	@synchronized([PhiTextParagraphStyle class]) {
+		memset(&cacheStatistics, 0, sizeof(cacheStatistics));
+	}
+}
++ (void)removeAllCachedParagraphStyles {
+	@synchronized([PhiTextParagraphStyle class]) {
+		CFDictionaryRemoveAllValues(cachedParagraphStyles);
+	}
+}
+
 + (id)paragraphStyleWithCTParagraphStyle:(CTParagraphStyleRef)paragraphStyle {
 	PhiTextParagraphStyle *rv = [[[PhiTextParagraphStyle alloc] init] autorelease];
 	size_t valueBufferSize = MAX(sizeof(CTTextAlignment), MAX(sizeof(CGFloat), MAX(sizeof(CFArrayRef), MAX(sizeof(CTLineBreakMode), sizeof(CTWritingDirection)))));
@@ -229,7 +321,21 @@ Boolean PhiTextTabEqualCallBack (CTTextTabRef tab1, CTTextTabRef tab2, BOOL igno
 			 buffer[count].value = &count;
 			 count++;
 			 */
-			_CTParagraphStyle = CTParagraphStyleCreate(buffer, count);
+			PhiTextParagraphStyleCacheKey key;
+			[self getCacheKey:&key];
+			@synchronized([PhiTextParagraphStyle class]) {
+				_CTParagraphStyle = CFDictionaryGetValue(cachedParagraphStyles, &key);
+				if (_CTParagraphStyle) {
+					cacheStatistics.hits++;
+					CFRetain(_CTParagraphStyle);
+				} else {
+					cacheStatistics.misses++;
+					_CTParagraphStyle = CTParagraphStyleCreate(buffer, count);
+					if (CFDictionaryGetCount(cachedParagraphStyles) >= PHI_PARAGRAPH_STYLE_CACHE_LIMIT)
+						CFDictionaryRemoveAllValues(cachedParagraphStyles);
+					CFDictionarySetValue(cachedParagraphStyles, &key, _CTParagraphStyle);
+				}
+			}
 		} else {
 			_CTParagraphStyle = NULL;
 		}
@@ -238,6 +344,41 @@ Boolean PhiTextTabEqualCallBack (CTTextTabRef tab1, CTTextTabRef tab2, BOOL igno
 	return _CTParagraphStyle;
 }
 
+/*! Only the values of the settings that have been set are part of the key. */
+- (void)getCacheKey:(PhiTextParagraphStyleCacheKey *)key {
+	memset(key, 0, sizeof(PhiTextParagraphStyleCacheKey));
+	key->flags = flags;
+	key->flags.reserved = 0;
+	if (flags.alignment)
+		key->alignment = alignment;
+	if (flags.firstLineHeadIndent)
+		key->firstLineHeadIndent = firstLineHeadIndent;
+	if (flags.headIndent)
+		key->headIndent = headIndent;
+	if (flags.tailIndent)
+		key->tailIndent = tailIndent;
+	if (flags.defaultTabInterval)
+		key->defaultTabInterval = defaultTabInterval;
+	if (flags.lineBreakMode)
+		key->lineBreakMode = lineBreakMode;
+	if (flags.lineHeightMultiple)
+		key->lineHeightMultiple = lineHeightMultiple;
+	if (flags.maximumLineHeight)
+		key->maximumLineHeight = maximumLineHeight;
+	if (flags.minimumLineHeight)
+		key->minimumLineHeight = minimumLineHeight;
+	if (flags.lineSpacing)
+		key->lineSpacing = lineSpacing;
+	if (flags.paragraphSpacing)
+		key->paragraphSpacing = paragraphSpacing;
+	if (flags.paragraphSpacingBefore)
+		key->paragraphSpacingBefore = paragraphSpacingBefore;
+	if (flags.baseWritingDirection)
+		key->baseWritingDirection = baseWritingDirection;
+	if (flags.tabStops)
+		key->tabStops = tabStops;
+}
+
 - (void)invalidate {
 	if (_CTParagraphStyle)
 		CFRelease(_CTParagraphStyle);
@@ -21,18 +21,33 @@
 #import <UIKit/UIKit.h>
 
 @class PhiTextLine;
+@class PhiTextFrame;
 
 #ifndef PhiPositionOffset
 #define PhiPositionOffset(__POSITION__) [(PhiTextPosition *)(__POSITION__) position]
 #endif
 
+/*! Positions before this offset (that are not in a line) are shared, immutable instances. */
+#ifndef PHI_POSITION_CACHE_LIMIT
+#define PHI_POSITION_CACHE_LIMIT 1024
+#endif
+
+/*!
+ An immutable offset into a document, optionally with the line that contains it. The line is only
+ a hint: it is returned for as long as the frame that typeset it has not discarded its content
+ (see -[PhiTextFrame contentGeneration]), and nil thereafter. Only the frame and the index of the
+ line are kept, so a position doesn't keep the line (nor its CTLine) once the frame discards it.
+ A copy has no line.
+ */
 @interface PhiTextPosition : UITextPosition <NSCopying> {
 	NSUInteger position;
-	PhiTextLine *line;
+	PhiTextFrame *lineFrame;
+	CFIndex lineIndex;
+	NSUInteger lineGeneration;
 }
 
 @property (assign, nonatomic, readonly) NSUInteger position;
-@property (retain, nonatomic, readonly) PhiTextLine *line;
+@property (nonatomic, readonly) PhiTextLine *line;
 
 + (PhiTextPosition *)textPositionWithPosition:(NSUInteger)position;
 + (PhiTextPosition *)textPositionWithPosition:(NSUInteger)position inLine:(PhiTextLine *)line;
@@ -17,41 +17,45 @@
 // limitations under the License.
 //
 
+#import <libkern/OSAtomic.h>
 #import "PhiTextPosition.h"
 #import "PhiTextLine.h"
 #import "PhiTextFrame.h"
 
-@interface PhiTextPosition ()
-@property (retain, nonatomic, readwrite) PhiTextLine *line;
-@end
+static PhiTextPosition *PhiCachedTextPositions[PHI_POSITION_CACHE_LIMIT];
 
 @implementation PhiTextPosition
 
-@synthesize position, line;
+@synthesize position;
 
 + (PhiTextPosition *)textPositionWithPosition:(NSUInteger)aPosition {
-	static PhiTextPosition *zeroTextPosition = nil;
-	if (!zeroTextPosition) {
-		zeroTextPosition = [[PhiTextPosition alloc] initWithPosition:0];
-	}
-	//TODO: caching
-	if (aPosition == 0) {
-		return zeroTextPosition;
+	PhiTextPosition *textPosition;
+	if (aPosition < PHI_POSITION_CACHE_LIMIT) {
+		textPosition = PhiCachedTextPositions[aPosition];
+		if (!textPosition) {
+			textPosition = [[PhiTextPosition alloc] initWithPosition:aPosition];
+			// Another thread may have cached the position first
+			if (!OSAtomicCompareAndSwapPtrBarrier(nil, textPosition, (void * volatile *)&PhiCachedTextPositions[aPosition])) {
+				[textPosition release];
+				textPosition = PhiCachedTextPositions[aPosition];
+			}
+		}
+		return textPosition;
 	}
 	return [[[PhiTextPosition alloc] initWithPosition:aPosition] autorelease];
 }
 
 + (PhiTextPosition *)textPositionWithPosition:(NSUInteger)aPosition inLine:(PhiTextLine *)aLine {
+	if (!aLine)
+		return [PhiTextPosition textPositionWithPosition:aPosition];
 	return [[[PhiTextPosition alloc] initWithPosition:aPosition inLine:aLine] autorelease];
 }
 
 + (PhiTextPosition *)textPositionWithPosition:(NSUInteger)aPosition offset:(NSInteger)offset {
-	//TODO: caching
 	return [PhiTextPosition textPositionWithPosition:aPosition + offset];
 }
 
 + (PhiTextPosition *)textPositionWithTextPosition:(PhiTextPosition *)textPosition offset:(NSInteger)offset {
-	//TODO: caching
 	return [PhiTextPosition textPositionWithPosition:textPosition.position + offset];
 }
 
@@ -72,46 +76,33 @@
 #endif
 	if (self = [self init]) {
 		position = aPosition;
-		self.line = aLine;
+		lineFrame = [[aLine frame] retain];
+		lineIndex = [aLine index];
+		lineGeneration = [lineFrame contentGeneration];
 	}
 	return self;
 }
 
-- (void)unsetLine {
-	self.line = nil;
-}
-- (void)setLine:(PhiTextLine *)aLine {
-	if (line != aLine) {
-		if (line) {
-			[[NSNotificationCenter defaultCenter] removeObserver:self
-															name:PhiTextFrameWillDiscardContentNotification
-														  object:line.frame];
-			[line release];
-		}
-		line = aLine;
-		if (line) {
-			[line retain];
-			[[NSNotificationCenter defaultCenter] addObserver:self
-													 selector:@selector(unsetLine)
-														 name:PhiTextFrameWillDiscardContentNotification
-													   object:line.frame];			
-		}
-	}
+/*! The line is validated, and made again from its frame, when it is asked for, rather than dropped (by every position) when its frame discards its content. */
+- (PhiTextLine *)line {
+	if (lineFrame && [lineFrame contentGeneration] == lineGeneration)
+		return [lineFrame lineAtIndex:lineIndex];
+	return nil;
 }
 
 - (id)textPositionWithOffset:(NSInteger)offset {
-	PhiTextPosition *rv = [PhiTextPosition textPositionWithPosition:MAX(0, (NSInteger)(position + offset))];
-	if (self.line && PhiPositionOffset(rv) <= PhiPositionOffset([self.line.textRange end])) {
-		rv.line = self.line;
-	}
-	return rv;
+	NSUInteger rv = MAX(0, (NSInteger)(position + offset));
+	PhiTextLine *aLine = self.line;
+	if (aLine && rv <= PhiPositionOffset([aLine.textRange end]))
+		return [PhiTextPosition textPositionWithPosition:rv inLine:aLine];
+	return [PhiTextPosition textPositionWithPosition:rv];
 }
 
+/*! A copy is kept (e.g. by the text input system) beyond the life of its line, so it doesn't hold the line's frame. */
 - (id)copyWithZone:(NSZone *)zone {
-	if (line)
-		return [[PhiTextPosition allocWithZone:zone] initWithPosition:position];
-	else
+	if (!lineFrame)
 		return [self retain];
+	return [[PhiTextPosition textPositionWithPosition:position] retain];
 }
 
 - (NSComparisonResult)compare:(PhiTextPosition *)other {
@@ -130,7 +121,7 @@
 }
 
 - (void) dealloc {
-	self.line = nil;
+	[lineFrame release];
 	[super dealloc];
 }
 @end
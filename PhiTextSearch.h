@@ -0,0 +1,135 @@
+//
+//  PhiTextSearch.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class PhiTextSearch;
+@class PhiTextStorage;
+
+/*! Number of UTF-16 code units copied out of the text and scanned as a unit (between which a search may be cancelled). */
+#ifndef PHI_SEARCH_BLOCK_LENGTH
+#define PHI_SEARCH_BLOCK_LENGTH 65536
+#endif
+/*! Number of matches delivered to the delegate at a time. */
+#ifndef PHI_SEARCH_BATCH_SIZE
+#define PHI_SEARCH_BATCH_SIZE 512
+#endif
+/*! Longest time (in seconds) that matches are held back from the delegate while a batch fills. */
+#ifndef PHI_SEARCH_BATCH_INTERVAL
+#define PHI_SEARCH_BATCH_INTERVAL 0.1
+#endif
+/*! Number of UTF-16 code units read out of the store and matched against a regular expression as a unit. */
+#ifndef PHI_REGEX_CHUNK_LENGTH
+#define PHI_REGEX_CHUNK_LENGTH (1 << 20)
+#endif
+/*! Number of code units read past the end of a chunk, so that matches that start in the chunk may end in the next; longer matches are truncated. */
+#ifndef PHI_REGEX_OVERLAP_LENGTH
+#define PHI_REGEX_OVERLAP_LENGTH 4096
+#endif
+/*! Number of code units read before the start of a chunk, for anchors and look-behind. */
+#ifndef PHI_REGEX_CONTEXT_LENGTH
+#define PHI_REGEX_CONTEXT_LENGTH 256
+#endif
+
+enum {
+	/*! Matches characters that differ only in case (by simple, one code unit to one, case folding). */
+	PhiTextSearchCaseInsensitive = 1 << 0,
+};
+typedef NSUInteger PhiTextSearchOptions;
+
+typedef struct {
+	/*! Number of searches (literal or regular expression) begun in the background. */
+	NSUInteger searches;
+	/*! Number of background searches cancelled before they finished. */
+	NSUInteger cancelled;
+	/*! Number of batches delivered to delegates. */
+	NSUInteger batches;
+	/*! Number of matches found (in the background, or by copyRangesOfString:options:count:). */
+	NSUInteger matches;
+	/*! Number of UTF-16 code units scanned. */
+	unsigned long long unitsScanned;
+	/*! Total time spent scanning (in seconds). */
+	double scanTime;
+	/*! Number of UTF-16 code units matched against regular expressions (excluding the overlap and context read with each chunk). */
+	unsigned long long regexUnitsScanned;
+	/*! Total time spent matching regular expressions, including reading chunks out of the store (in seconds). */
+	double regexScanTime;
+	/*! Number of calls to replaceAllOccurrencesOfString:withString:options:. */
+	NSUInteger replaceAlls;
+	/*! Number of matches replaced. */
+	NSUInteger replacements;
+	/*! Total time spent applying replacements to the store, excluding the scan (in seconds). */
+	double replaceTime;
+} PhiTextSearchStatistics;
+
+@protocol PhiTextSearchDelegate <NSObject>
+
+/*! Called on the main thread with the next batch of matches, in ascending order; ranges is only valid for the duration of the call. */
+- (void)textSearch:(PhiTextSearch *)search didFindRanges:(const NSRange *)ranges count:(NSUInteger)count;
+
+@optional
+/*! Called on the main thread after the last batch, unless the search was cancelled. */
+- (void)textSearchDidFinish:(PhiTextSearch *)search;
+
+@end
+
+/*!
+ Finds the (non-overlapping) occurrences of a string in the text of a store. The scan looks for the first
+ code unit of the string four at a time, packed into a 64-bit word, and compares the rest only where
+ it may start. A search may run in the background, delivering its matches to a delegate in batches on
+ the main thread, and is cancelled by the next search, by cancel or when the text changes (because
+ its matches are in the coordinates of the text as it was when the search began).
+ */
+@interface PhiTextSearch : NSObject {
+@private
+	PhiTextStorage *store;
+	NSOperationQueue *searchQueue;
+	NSUInteger generation;
+	BOOL searching;
+	PhiTextSearchStatistics statistics;
+}
+
+/*! The text that is searched. */
+@property (assign) PhiTextStorage *store;
+/*! Whether a background search has begun and has neither finished nor been cancelled. */
+@property (readonly, getter=isSearching) BOOL searching;
+
+- (id)initWithStore:(PhiTextStorage *)store;
+
+/*! Cancels any search and begins searching for pattern in the background, delivering the matches to delegate (which is not retained). */
+- (void)searchForString:(NSString *)pattern options:(PhiTextSearchOptions)options delegate:(id <PhiTextSearchDelegate>)delegate;
+/*!
+ Cancels any search and begins matching regex against the text in the background, delivering the matches
+ to delegate (as ranges of the document, e.g. for +[PhiTextRange textRangeWithRange:]). The text is read
+ out of the store a chunk at a time, rather than copied whole; since any edit cancels the search, every
+ chunk is of the same text.
+ */
+- (void)searchForRegularExpression:(NSRegularExpression *)regex delegate:(id <PhiTextSearchDelegate>)delegate;
+/*! Cancels the background search, if any; its delegate receives no further messages. */
+- (void)cancel;
+
+/*! Returns a malloc'd array of the ranges of every occurrence of pattern in string (the caller must free it), or NULL if there are none; count is set to the number of ranges. */
+- (NSRange *)copyRangesOfString:(NSString *)pattern inString:(NSString *)string options:(PhiTextSearchOptions)options count:(NSUInteger *)count;
+/*! Replaces every occurrence of pattern in the store with replacement as a single edit (one undo action, one invalidation of the document); returns the number of occurrences replaced. */
+- (NSUInteger)replaceAllOccurrencesOfString:(NSString *)pattern withString:(NSString *)replacement options:(PhiTextSearchOptions)options;
+
+- (PhiTextSearchStatistics)statistics;
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,573 @@
+//
+//  PhiTextSearch.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <libkern/OSAtomic.h>
+#import "PhiTextSearch.h"
+#import "PhiTextStorage.h"
+
+/*! The code unit in each of the four 16-bit lanes of a word. */
+#define PHI_LANES(unit) ((uint64_t)(unit) * 0x0001000100010001ULL)
+
+typedef struct {
+	/*! The code units of the string (folded, if caseless). */
+	UniChar *units;
+	NSUInteger length;
+	BOOL caseless;
+	/*! Whether the first code unit (in either case) can be looked for four at a time. */
+	BOOL filtered;
+	uint64_t first, firstAlternate;
+} PhiTextSearchPattern;
+
+/*! Called with each match, and with a range whose location is NSNotFound after each block; the scan stops when it returns NO. */
+typedef BOOL (*PhiTextSearchCallback)(NSRange range, void *context);
+
+typedef struct {
+	NSRange *ranges;
+	NSUInteger count;
+	NSUInteger capacity;
+} PhiTextSearchResults;
+
+static UniChar *PhiFoldPages[256];
+
+static UniChar *PhiCreateFoldPage(NSUInteger page) {
+	UniChar *folds = malloc(256 * sizeof(UniChar));
+	CFMutableStringRef string = CFStringCreateMutable(NULL, 0);
+	UniChar c;
+	NSUInteger i;
+
+	for (i = 0; i < 256; i++) {
+		c = (UniChar)(page << 8 | i);
+		folds[i] = c;
+		if (CFStringIsSurrogateHighCharacter(c) || CFStringIsSurrogateLowCharacter(c))
+			continue;
+		CFStringReplaceAll(string, CFSTR(""));
+		CFStringAppendCharacters(string, &c, 1);
+		CFStringFold(string, kCFCompareCaseInsensitive, NULL);
+		// Folds that expand (such as sharp s to ss) are left as they are
+		if (CFStringGetLength(string) == 1)
+			folds[i] = CFStringGetCharacterAtIndex(string, 0);
+	}
+	CFRelease(string);
+	return folds;
+}
+static UniChar *PhiLoadFoldPage(NSUInteger page) {
+	UniChar *folds;
+	@synchronized([PhiTextSearch class]) {
+		folds = PhiFoldPages[page];
+		if (!folds) {
+			folds = PhiCreateFoldPage(page);
+			OSMemoryBarrier();
+			PhiFoldPages[page] = folds;
+		}
+	}
+	return folds;
+}
+static inline UniChar PhiFold(UniChar c) {
+	UniChar *folds;
+	if (c < 0x80)
+		return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	folds = PhiFoldPages[c >> 8];
+	if (!folds)
+		folds = PhiLoadFoldPage(c >> 8);
+	return folds[c & 0xFF];
+}
+
+/*! Returns a word with the top bit set in (at least) each lane that is zero (and maybe in a lane above a zero lane). */
+static inline uint64_t PhiZeroLanes(uint64_t word) {
+	return (word - PHI_LANES(1)) & ~word & PHI_LANES(0x8000);
+}
+
+static BOOL PhiTextSearchPatternInit(PhiTextSearchPattern *pattern, NSString *string, PhiTextSearchOptions options) {
+	NSUInteger i;
+	UniChar first, alternate;
+
+	memset(pattern, 0, sizeof(PhiTextSearchPattern));
+	pattern->length = [string length];
+	if (!pattern->length)
+		return NO;
+	pattern->units = malloc(pattern->length * sizeof(UniChar));
+	[string getCharacters:pattern->units range:NSMakeRange(0, pattern->length)];
+	pattern->caseless = (options & PhiTextSearchCaseInsensitive) != 0;
+	first = alternate = pattern->units[0];
+	pattern->filtered = YES;
+	if (pattern->caseless) {
+		for (i = 0; i < pattern->length; i++)
+			pattern->units[i] = PhiFold(pattern->units[i]);
+		first = alternate = pattern->units[0];
+		if (first >= 'a' && first <= 'z')
+			alternate = first - ('a' - 'A');
+		// Any number of code units may fold to a non-ASCII one, as may the Kelvin sign to k and long s to s
+		pattern->filtered = first < 0x80 && first != 'k' && first != 's';
+	}
+	pattern->first = PHI_LANES(first);
+	pattern->firstAlternate = PHI_LANES(alternate);
+	return YES;
+}
+static void PhiTextSearchPatternFree(PhiTextSearchPattern *pattern) {
+	if (pattern->units)
+		free(pattern->units);
+	pattern->units = NULL;
+}
+
+static inline BOOL PhiTextSearchMatchesAt(const PhiTextSearchPattern *pattern, const UniChar *chars) {
+	NSUInteger i;
+	if (!pattern->caseless)
+		return memcmp(chars, pattern->units, pattern->length * sizeof(UniChar)) == 0;
+	for (i = 0; i < pattern->length; i++) {
+		if (PhiFold(chars[i]) != pattern->units[i])
+			return NO;
+	}
+	return YES;
+}
+
+/*! Returns the index of the first match in chars (count code units) that starts at or after from and before end, or NSNotFound. */
+static NSUInteger PhiTextSearchNext(const PhiTextSearchPattern *pattern, const UniChar *chars, NSUInteger count, NSUInteger from, NSUInteger end) {
+	NSUInteger i = from, k;
+	uint64_t word, lanes;
+
+	if (count < pattern->length)
+		return NSNotFound;
+	end = MIN(end, count - pattern->length + 1);
+	if (pattern->filtered) {
+		for (; i + 4 <= end; i += 4) {
+			memcpy(&word, chars + i, sizeof(word));
+			lanes = PhiZeroLanes(word ^ pattern->first);
+			if (pattern->caseless)
+				lanes |= PhiZeroLanes(word ^ pattern->firstAlternate);
+			if (lanes) {
+				for (k = 0; k < 4; k++) {
+					if (PhiTextSearchMatchesAt(pattern, chars + i + k))
+						return i + k;
+				}
+			}
+		}
+	}
+	for (; i < end; i++) {
+		if (PhiTextSearchMatchesAt(pattern, chars + i))
+			return i;
+	}
+	return NSNotFound;
+}
+
+/*! Scans string a block at a time, calling found with each match; returns the number of code units scanned. */
+static NSUInteger PhiTextSearchScan(const PhiTextSearchPattern *pattern, CFStringRef string, PhiTextSearchCallback found, void *context) {
+	NSUInteger length = (NSUInteger)CFStringGetLength(string);
+	NSUInteger overlap = pattern->length - 1, location, count, from = 0, i, scanned = 0;
+	const UniChar *direct = CFStringGetCharactersPtr(string), *chars;
+	UniChar *buffer = NULL;
+
+	for (location = 0; location + pattern->length <= length; location += PHI_SEARCH_BLOCK_LENGTH) {
+		// Each block overlaps the next so that matches that start in it may end in the next
+		count = MIN(PHI_SEARCH_BLOCK_LENGTH + overlap, length - location);
+		if (direct) {
+			chars = direct + location;
+		} else {
+			if (!buffer)
+				buffer = malloc((PHI_SEARCH_BLOCK_LENGTH + overlap) * sizeof(UniChar));
+			CFStringGetCharacters(string, CFRangeMake(location, count), buffer);
+			chars = buffer;
+		}
+		scanned = location + MIN(count, PHI_SEARCH_BLOCK_LENGTH);
+		i = from > location ? from - location : 0;
+		while ((i = PhiTextSearchNext(pattern, chars, count, i, PHI_SEARCH_BLOCK_LENGTH)) != NSNotFound) {
+			if (!found(NSMakeRange(location + i, pattern->length), context))
+				goto done;
+			i += pattern->length;
+			from = location + i;
+		}
+		if (!found(NSMakeRange(NSNotFound, 0), context))
+			break;
+	}
+done:
+	if (buffer)
+		free(buffer);
+	return scanned;
+}
+
+static BOOL PhiTextSearchResultsAdd(NSRange range, void *context) {
+	PhiTextSearchResults *results = (PhiTextSearchResults *)context;
+	if (range.location == NSNotFound)
+		return YES;
+	if (results->count == results->capacity) {
+		results->capacity = results->capacity ? results->capacity * 2 : 64;
+		results->ranges = realloc(results->ranges, results->capacity * sizeof(NSRange));
+	}
+	results->ranges[results->count++] = range;
+	return YES;
+}
+
+@interface PhiTextSearchRequest : NSObject {
+@public
+	PhiTextSearch *search;
+	PhiTextSearchPattern pattern;
+	NSRegularExpression *regex;
+	NSUInteger generation;
+	id <PhiTextSearchDelegate> delegate;
+	NSRange batch[PHI_SEARCH_BATCH_SIZE];
+	NSUInteger batchCount;
+	CFAbsoluteTime batchTime;
+	NSUInteger matches;
+}
+@end
+
+@implementation PhiTextSearchRequest
+- (void)dealloc {
+	PhiTextSearchPatternFree(&pattern);
+	[regex release];
+	[super dealloc];
+}
+@end
+
+@interface PhiTextSearchBatch : NSObject {
+@public
+	PhiTextSearchRequest *request;
+	NSData *ranges;
+	BOOL last;
+}
+@end
+
+@implementation PhiTextSearchBatch
+- (void)dealloc {
+	[request release];
+	[ranges release];
+	[super dealloc];
+}
+@end
+
+@interface PhiTextSearch ()
+
+- (void)beginSearchRequest:(PhiTextSearchRequest *)request withSelector:(SEL)selector;
+- (BOOL)isCurrentRequest:(PhiTextSearchRequest *)request;
+- (NSString *)copySubstringWithRange:(NSRange)range ofRequest:(PhiTextSearchRequest *)request;
+- (void)postBatchOfRequest:(PhiTextSearchRequest *)request last:(BOOL)last;
+
+@end
+
+static BOOL PhiTextSearchRequestFound(NSRange range, void *context) {
+	PhiTextSearchRequest *request = (PhiTextSearchRequest *)context;
+
+	if (range.location == NSNotFound) {
+		if (![request->search isCurrentRequest:request])
+			return NO;
+		if (request->batchCount && CFAbsoluteTimeGetCurrent() - request->batchTime >= PHI_SEARCH_BATCH_INTERVAL)
+			[request->search postBatchOfRequest:request last:NO];
+		return YES;
+	}
+	request->batch[request->batchCount++] = range;
+	request->matches++;
+	if (request->batchCount == PHI_SEARCH_BATCH_SIZE)
+		[request->search postBatchOfRequest:request last:NO];
+	return YES;
+}
+
+@implementation PhiTextSearch
+
+@synthesize store;
+
+- (id)initWithStore:(PhiTextStorage *)aStore {
+	if (self = [super init]) {
+		store = aStore;
+		searchQueue = [[NSOperationQueue alloc] init];
+		[searchQueue setMaxConcurrentOperationCount:1];
+		generation = 0;
+		searching = NO;
+		memset(&statistics, 0, sizeof(statistics));
+	}
+	return self;
+}
+
+- (void)setStore:(PhiTextStorage *)aStore {
+	[self cancel];
+	@synchronized(self) {
+		store = aStore;
+	}
+}
+
+- (BOOL)isSearching {
+	BOOL rv;
+	@synchronized(self) {
+		rv = searching;
+	}
+	return rv;
+}
+
+#pragma mark Background Searches
+
+- (void)searchForString:(NSString *)pattern options:(PhiTextSearchOptions)options delegate:(id <PhiTextSearchDelegate>)delegate {
+	PhiTextSearchRequest *request;
+
+	[self cancel];
+	request = [[PhiTextSearchRequest alloc] init];
+	if (!PhiTextSearchPatternInit(&request->pattern, pattern, options)) {
+		[request release];
+		return;
+	}
+	request->delegate = delegate;
+	[self beginSearchRequest:request withSelector:@selector(runSearchRequest:)];
+	[request release];
+}
+
+- (void)searchForRegularExpression:(NSRegularExpression *)regex delegate:(id <PhiTextSearchDelegate>)delegate {
+	PhiTextSearchRequest *request;
+
+	[self cancel];
+	if (!regex)
+		return;
+	request = [[PhiTextSearchRequest alloc] init];
+	request->regex = [regex retain];
+	request->delegate = delegate;
+	[self beginSearchRequest:request withSelector:@selector(runRegularExpressionRequest:)];
+	[request release];
+}
+
+- (void)beginSearchRequest:(PhiTextSearchRequest *)request withSelector:(SEL)selector {
+	NSInvocationOperation *operation;
+
+	request->search = self;
+	@synchronized(self) {
+		request->generation = generation;
+		searching = YES;
+		statistics.searches++;
+	}
+	operation = [[NSInvocationOperation alloc] initWithTarget:self selector:selector object:request];
+	[searchQueue addOperation:operation];
+	[operation release];
+}
+
+- (void)cancel {
+	@synchronized(self) {
+		if (searching)
+			statistics.cancelled++;
+		searching = NO;
+		generation++;
+	}
+	[searchQueue cancelAllOperations];
+}
+
+- (BOOL)isCurrentRequest:(PhiTextSearchRequest *)request {
+	BOOL current;
+	@synchronized(self) {
+		current = request->generation == generation;
+	}
+	return current;
+}
+
+- (void)runSearchRequest:(PhiTextSearchRequest *)request {
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	PhiTextStorage *aStore = self.store;
+	NSString *text = nil;
+	CFAbsoluteTime start;
+	NSUInteger scanned;
+
+	if (aStore && [self isCurrentRequest:request]) {
+		@synchronized(aStore) {
+			text = [[aStore string] copy];
+		}
+		start = request->batchTime = CFAbsoluteTimeGetCurrent();
+		scanned = PhiTextSearchScan(&request->pattern, (CFStringRef)text, PhiTextSearchRequestFound, request);
+		[text release];
+		@synchronized(self) {
+			statistics.matches += request->matches;
+			statistics.unitsScanned += scanned;
+			statistics.scanTime += CFAbsoluteTimeGetCurrent() - start;
+		}
+#ifdef DEVELOPER
+		NSLog(@"Scanned %u code units for %u matches in %.3f seconds.", scanned, request->matches, CFAbsoluteTimeGetCurrent() - start);
+#endif
+	}
+	if ([self isCurrentRequest:request])
+		[self postBatchOfRequest:request last:YES];
+	[pool release];
+}
+
+- (NSString *)copySubstringWithRange:(NSRange)range ofRequest:(PhiTextSearchRequest *)request {
+	PhiTextStorage *aStore = self.store;
+	NSString *rv = nil;
+	// An edit cancels the request before it takes the store's lock, so a current request reads the text it began with
+	@synchronized(aStore) {
+		if ([self isCurrentRequest:request] && NSMaxRange(range) <= [aStore length])
+			rv = [[[aStore string] substringWithRange:range] copy];
+	}
+	return rv;
+}
+
+- (void)runRegularExpressionRequest:(PhiTextSearchRequest *)request {
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init], *chunkPool;
+	PhiTextStorage *aStore = self.store;
+	NSString *chunk;
+	NSRange range;
+	NSUInteger length = 0, location = 0, from = 0, offset, end, next;
+	unsigned long long scanned = 0;
+	CFAbsoluteTime start;
+	BOOL last;
+
+	@synchronized(aStore) {
+		if ([self isCurrentRequest:request])
+			length = [aStore length];
+	}
+	start = request->batchTime = CFAbsoluteTimeGetCurrent();
+	while (location < length) {
+		chunkPool = [[NSAutoreleasePool alloc] init];
+		offset = location - MIN(location, PHI_REGEX_CONTEXT_LENGTH);
+		end = MIN(location + PHI_REGEX_CHUNK_LENGTH + PHI_REGEX_OVERLAP_LENGTH, length);
+		last = end == length;
+		next = last ? length : location + PHI_REGEX_CHUNK_LENGTH;
+		chunk = [self copySubstringWithRange:NSMakeRange(offset, end - offset) ofRequest:request];
+		if (!chunk) {
+			[chunkPool release];
+			break;
+		}
+		for (NSTextCheckingResult *match in [request->regex matchesInString:chunk
+																	options:NSMatchingWithTransparentBounds | NSMatchingWithoutAnchoringBounds
+																	  range:NSMakeRange(MAX(from, location) - offset, end - MAX(from, location))]) {
+			range = [match range];
+			range.location += offset;
+			if (!last) {
+				if (range.location >= next)
+					break;
+				// A match that reaches the end of the chunk may continue past it, so the next chunk begins with it
+				if (NSMaxRange(range) == end && range.location > location) {
+					next = range.location;
+					break;
+				}
+			}
+			PhiTextSearchRequestFound(range, request);
+			from = NSMaxRange(range);
+		}
+		scanned += next - location;
+		[chunk release];
+		[chunkPool release];
+		if (!PhiTextSearchRequestFound(NSMakeRange(NSNotFound, 0), request))
+			break;
+		location = next;
+	}
+	@synchronized(self) {
+		statistics.matches += request->matches;
+		statistics.regexUnitsScanned += scanned;
+		statistics.regexScanTime += CFAbsoluteTimeGetCurrent() - start;
+	}
+#ifdef DEVELOPER
+	NSLog(@"Matched %llu code units for %u matches in %.3f seconds.", scanned, request->matches, CFAbsoluteTimeGetCurrent() - start);
+#endif
+	if ([self isCurrentRequest:request])
+		[self postBatchOfRequest:request last:YES];
+	[pool release];
+}
+
+- (void)postBatchOfRequest:(PhiTextSearchRequest *)request last:(BOOL)last {
+	PhiTextSearchBatch *batch = [[PhiTextSearchBatch alloc] init];
+	batch->request = [request retain];
+	batch->ranges = [[NSData alloc] initWithBytes:request->batch length:request->batchCount * sizeof(NSRange)];
+	batch->last = last;
+	request->batchCount = 0;
+	request->batchTime = CFAbsoluteTimeGetCurrent();
+	[self performSelectorOnMainThread:@selector(deliverBatch:) withObject:batch waitUntilDone:NO];
+	[batch release];
+}
+
+- (void)deliverBatch:(PhiTextSearchBatch *)batch {
+	PhiTextSearchRequest *request = batch->request;
+	NSUInteger count = [batch->ranges length] / sizeof(NSRange);
+
+	@synchronized(self) {
+		if (request->generation != generation)
+			return;
+		if (count)
+			statistics.batches++;
+		if (batch->last)
+			searching = NO;
+	}
+	if (count)
+		[request->delegate textSearch:self didFindRanges:(const NSRange *)[batch->ranges bytes] count:count];
+	if (batch->last && [self isCurrentRequest:request] && [request->delegate respondsToSelector:@selector(textSearchDidFinish:)])
+		[request->delegate textSearchDidFinish:self];
+}
+
+#pragma mark Immediate Searches
+
+- (NSRange *)copyRangesOfString:(NSString *)pattern inString:(NSString *)string options:(PhiTextSearchOptions)options count:(NSUInteger *)count {
+	PhiTextSearchPattern searchPattern;
+	PhiTextSearchResults results = {NULL, 0, 0};
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	NSUInteger scanned = 0;
+
+	if (string && PhiTextSearchPatternInit(&searchPattern, pattern, options)) {
+		scanned = PhiTextSearchScan(&searchPattern, (CFStringRef)string, PhiTextSearchResultsAdd, &results);
+		PhiTextSearchPatternFree(&searchPattern);
+	}
+	@synchronized(self) {
+		statistics.matches += results.count;
+		statistics.unitsScanned += scanned;
+		statistics.scanTime += CFAbsoluteTimeGetCurrent() - start;
+	}
+	if (count)
+		*count = results.count;
+	return results.ranges;
+}
+
+- (NSUInteger)replaceAllOccurrencesOfString:(NSString *)pattern withString:(NSString *)replacement options:(PhiTextSearchOptions)options {
+	PhiTextStorage *aStore = self.store;
+	NSRange *ranges = NULL;
+	NSUInteger count = 0;
+	CFAbsoluteTime start = 0.0, finish = 0.0;
+
+	if (!aStore || ![pattern length])
+		return 0;
+	@synchronized(aStore) {
+		ranges = [self copyRangesOfString:pattern inString:[aStore string] options:options count:&count];
+		if (ranges) {
+			start = CFAbsoluteTimeGetCurrent();
+			[aStore replaceCharactersInRanges:ranges count:count withString:replacement ? replacement : @""];
+			finish = CFAbsoluteTimeGetCurrent();
+			free(ranges);
+		}
+	}
+	@synchronized(self) {
+		statistics.replaceAlls++;
+		statistics.replacements += count;
+		statistics.replaceTime += finish - start;
+	}
+#ifdef DEVELOPER
+	NSLog(@"Replaced %u matches in %.3f seconds.", count, finish - start);
+#endif
+	return count;
+}
+
+#pragma mark Statistics
+
+- (PhiTextSearchStatistics)statistics {
+	PhiTextSearchStatistics rv;
+	@synchronized(self) {
+		rv = statistics;
+	}
+	return rv;
+}
+- (void)resetStatistics {
+	@synchronized(self) {
+		memset(&statistics, 0, sizeof(statistics));
+	}
+}
+
+- (void)dealloc {
+	[searchQueue cancelAllOperations];
+	[searchQueue release];
+	[super dealloc];
+}
+
+@end
@@ -26,6 +26,30 @@
 @class PhiTextSelectionHandle;
 @class PhiTextSelectionView;
 
+/*! Fraction of the viewport's height by which the selection path extends beyond it, above and below, when an end of the selection is outside it (so that the path is not built again until the viewport scrolls that far). */
+#ifndef PHI_SELECTION_CLIP_MARGIN
+#define PHI_SELECTION_CLIP_MARGIN 1.0
+#endif
+
+typedef struct {
+	/*! Number of times the view was laid out (e.g. for each move of a selection handle). */
+	NSUInteger layouts;
+	/*! Total time spent laying out the view, including building the selection path (in seconds). */
+	double layoutTime;
+	/*! Longest time spent laying out the view (in seconds). */
+	double maxLayoutTime;
+	/*! Number of caret rects computed for the ends of the selection. */
+	NSUInteger endsComputed;
+	/*! Number of caret rects reused, because neither the end nor the layout had changed. */
+	NSUInteger endsReused;
+	/*! Number of selection paths built. */
+	NSUInteger paths;
+	/*! Number of selection paths built only for the viewport, because an end was outside it. */
+	NSUInteger clippedPaths;
+	/*! Total time spent building selection paths (in seconds). */
+	double pathTime;
+} PhiTextSelectionStatistics;
+
 @protocol PhiTextSelectionViewDelegate
 
 - (PhiTextRange *)textSelectionViewSelectedTextRange:(PhiTextSelectionView *)view;
@@ -62,10 +86,18 @@
 		
 		unsigned int pixelAligned :1;
 		
-		unsigned int reserved :26;
+		unsigned int selectionPathClipped :1;
+		
+		unsigned int reserved :25;
 	} flags;
 	//CGPathRef selectionPath;
 	PhiTextRange *lastSelectedTextRange;
+	/*! The caret rects of the ends of lastSelectedTextRange, valid while the document's layoutGeneration is geometryGeneration. */
+	CGRect startCaretRect, endCaretRect;
+	NSUInteger geometryGeneration;
+	/*! The rect that a clipped selection path was built for. */
+	CGRect selectionPathRect;
+	PhiTextSelectionStatistics selectionStatistics;
 #ifdef PHI_DIRTY_FRAMES_IN_SELECTION
 	NSMutableSet *dirtyTextFrames;
 #endif
@@ -84,6 +116,11 @@
 @property (nonatomic, assign, getter=isPixelAligned) BOOL pixelAligned;
 
 - (void)update;
+/*! Discards the cached caret rects, for when the geometry of the selection changed without the layout of the document changing. */
+- (void)invalidateCaretGeometry;
+
+- (PhiTextSelectionStatistics)selectionStatistics;
+- (void)resetSelectionStatistics;
 
 - (BOOL)isBlinking;
 - (void)stopBlinking;
@@ -28,6 +28,7 @@
 
 - (void)setupLayer;
 - (void)setupSubviews;
+- (CGRect)caretRectForPosition:(UITextPosition *)position cachedRect:(CGRect *)cachedRect reuse:(BOOL)reuse;
 
 @end
 
@@ -179,8 +180,17 @@
 }
 
 - (void)layoutSubviews {
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent(), time;
 	[self update];
+	// A path built for the viewport is built again once the viewport scrolls beyond its margin
+	if (flags.selectionPathClipped && !CGRectContainsRect(selectionPathRect, [self convertRect:[[self owner] bounds] fromView:[self owner]]))
+		[self setNeedsDisplay];
 	[self.owner bringSubviewToFront:self];
+	time = CFAbsoluteTimeGetCurrent() - start;
+	selectionStatistics.layouts++;
+	selectionStatistics.layoutTime += time;
+	if (time > selectionStatistics.maxLayoutTime)
+		selectionStatistics.maxLayoutTime = time;
 #ifdef PHI_DIRTY_FRAMES_IN_SELECTION
 	// End access to text frame that were used in update
 	for (PhiAATreeRange *nodes in dirtyTextFrames)
@@ -200,13 +210,16 @@
 	@synchronized(self) {
 		if ([self needsUpdate]) {
 			selectedRange = (PhiTextRange *)[self selectedTextRange];
-			BOOL startChanged, endChanged;
-			endChanged   = CGSizeEqualToSize(CGSizeZero,   endCaret.bounds.size) || !lastSelectedTextRange || [[self owner] comparePosition:[selectedRange end] toPosition:[lastSelectedTextRange end]] != NSOrderedSame;
-			startChanged = CGSizeEqualToSize(CGSizeZero, startCaret.bounds.size) || !lastSelectedTextRange || [[self owner] comparePosition:[selectedRange start] toPosition:[lastSelectedTextRange start]] != NSOrderedSame;
+			BOOL startChanged, endChanged, startMoved, endMoved, geometryValid;
+			endMoved   = !lastSelectedTextRange || !selectedRange || [[self owner] comparePosition:[selectedRange end] toPosition:[lastSelectedTextRange end]] != NSOrderedSame;
+			startMoved = !lastSelectedTextRange || !selectedRange || [[self owner] comparePosition:[selectedRange start] toPosition:[lastSelectedTextRange start]] != NSOrderedSame;
+			endChanged   = CGSizeEqualToSize(CGSizeZero,   endCaret.bounds.size) || endMoved;
+			startChanged = CGSizeEqualToSize(CGSizeZero, startCaret.bounds.size) || startMoved;
 			rangeChanged = endChanged || startChanged;
+			geometryValid = geometryGeneration == [[[self owner] textDocument] layoutGeneration];
 			if (selectedRange && ![self isHidden]) {
 				CGRect startRect;
-				CGRect endRect = [self convertRect:[[self owner] visibleCaretRectForPosition:[selectedRange end] alignPixels:YES toView:self] fromView:[self owner]];
+				CGRect endRect = [self caretRectForPosition:[selectedRange end] cachedRect:&endCaretRect reuse:geometryValid && !endMoved];
 				if (!endChanged && !CGSizeEqualToSize(CGSizeZero, endRect.size)) {// Maybe the rect has...
 					endChanged = !CGRectEqualToRect(endRect, [endCaret frame]);
 				}
@@ -214,7 +227,7 @@
 #ifdef DEVELOPER
 					NSLog(@"Selected range is not empty.");
 #endif
-					startRect = [self convertRect:[[self owner] visibleCaretRectForPosition:[selectedRange start] alignPixels:YES toView:self] fromView:[self owner]];
+					startRect = [self caretRectForPosition:[selectedRange start] cachedRect:&startCaretRect reuse:geometryValid && !startMoved];
 					if (!startChanged && !CGSizeEqualToSize(CGSizeZero, startRect.size)) {// Maybe the rect has...
 						startChanged = !CGRectEqualToRect(startRect, [startCaret frame]);
 					}
@@ -313,6 +326,7 @@
 			rangeChanged = endChanged || startChanged;
 			[lastSelectedTextRange release];
 			lastSelectedTextRange = [selectedRange copy];
+			geometryGeneration = [[[self owner] textDocument] layoutGeneration];
 		}
 	}
 
@@ -325,6 +339,24 @@
 #endif
 }
 
+/*! Returns the visible caret rect of position (in the receiver's coordinates), reusing the cached rect if
+ reuse is set (i.e. neither the position nor the layout has changed) and it is still in the viewport. */
+- (CGRect)caretRectForPosition:(UITextPosition *)position cachedRect:(CGRect *)cachedRect reuse:(BOOL)reuse {
+	if (reuse && !CGSizeEqualToSize(CGSizeZero, cachedRect->size)
+		&& CGRectIntersectsRect(*cachedRect, [self convertRect:[[self owner] bounds] fromView:[self owner]])) {
+		selectionStatistics.endsReused++;
+		return *cachedRect;
+	}
+	*cachedRect = [self convertRect:[[self owner] visibleCaretRectForPosition:position alignPixels:YES toView:self] fromView:[self owner]];
+	selectionStatistics.endsComputed++;
+	return *cachedRect;
+}
+
+- (void)invalidateCaretGeometry {
+	startCaretRect = endCaretRect = CGRectZero;
+	[self setNeedsLayout];
+}
+
 - (void)setNeedsDisplay {
 	flags.selectionPathValid = NO;
 	[self selectionPath];
@@ -345,29 +377,49 @@
 - (CGPathRef)selectionPath {
 	BOOL allHandlesShown = ![startCaret isHidden] && ![endCaret isHidden];
 	CAShapeLayer *shape = (CAShapeLayer *)self.layer;
+	CFAbsoluteTime start;
 	[self update];
+	start = CFAbsoluteTimeGetCurrent();
 	if (allHandlesShown) {
 		CGMutablePathRef path = CGPathCreateMutable();
 		[[self.owner textDocument] buildPath:path withFirstRect:[self convertRect:[startCaret frame] toView:[self owner]] toLastRect:[self convertRect:[endCaret frame] toView:[self owner]] alignPixels:flags.pixelAligned toView:self];
 		flags.selectionPathValid = YES;
+		flags.selectionPathClipped = NO;
 		shape.path = path;
 		CGPathRelease(path);
+		selectionStatistics.paths++;
 	} else if (!flags.selectionPathValid) {
 		PhiTextRange *selectedRange = (PhiTextRange *) [self selectedTextRange];
+		flags.selectionPathClipped = NO;
 		if ([selectedRange length]) {
+			// Only the part of the selection near the viewport is built, so that its far end needn't be laid out
+			CGRect viewport = [[self owner] bounds];
+			CGRect clip = CGRectInset(viewport, 0.0, -viewport.size.height * PHI_SELECTION_CLIP_MARGIN);
 			CGMutablePathRef path = CGPathCreateMutable();
-			[[self.owner textDocument] buildPath:path forRange:selectedRange alignPixels:flags.pixelAligned toView:self];
+			[[self.owner textDocument] buildPath:path forRange:selectedRange inRect:clip alignPixels:flags.pixelAligned toView:self];
 			flags.selectionPathValid = YES;
+			flags.selectionPathClipped = YES;
+			selectionPathRect = [self convertRect:clip fromView:[self owner]];
 			shape.path = path;
 			CGPathRelease(path);
+			selectionStatistics.paths++;
+			selectionStatistics.clippedPaths++;
 		} else {
 			shape.path = NULL;
 		}
 	}
+	selectionStatistics.pathTime += CFAbsoluteTimeGetCurrent() - start;
 
 	return shape.path;
 }
 
+- (PhiTextSelectionStatistics)selectionStatistics {
+	return selectionStatistics;
+}
+- (void)resetSelectionStatistics {
+	memset(&selectionStatistics, 0, sizeof(selectionStatistics));
+}
+
 - (void)setSelectionColor:(UIColor *)color {
 	CAShapeLayer *shape = (CAShapeLayer *)self.layer;
 	if (color) {
@@ -462,6 +514,7 @@
 }
 - (void)setOwner:(PhiTextEditorView *)view {
 	owner = view;
+	startCaretRect = endCaretRect = CGRectZero;
 	[startHandle setOwner:owner];
 	[endHandle setOwner:owner];
 	[startCaret setOwner:owner];
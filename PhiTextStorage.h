@@ -56,6 +56,8 @@
 
 - (void)deleteCharactersInRange:(NSRange)range;
 - (void)replaceCharactersInRange:(NSRange)range withString:(NSString *)string;
+/*! Replaces the characters in each of ranges (count of them, in ascending order and disjoint) with string, as a single edit: one undo action and one invalidation of the owner. Each replacement takes the attributes of the first character it replaces. */
+- (void)replaceCharactersInRanges:(const NSRange *)ranges count:(NSUInteger)count withString:(NSString *)string;
 
 #pragma mark Changing Attributes
 
@@ -20,13 +20,45 @@
 #import "PhiTextStorage.h"
 #import "PhiTextDocument.h"
 #import "PhiTextUndoManager.h"
+#import "PhiTextStyle.h"
 
 @interface PhiTextDocument (PhiTextStorage)
 
 - (CGRect)invalidateDocumentNSRange:(NSRange)range;
+- (CGRect)invalidateDocumentPaintNSRange:(NSRange)range;
 
 @end
 
+@interface PhiTextStorage ()
+
+- (BOOL)isPaintOnlyChangeToAttributes:(NSDictionary *)attributes range:(NSRange)aRange;
+- (void)replaceCharactersInRanges:(const NSRange *)ranges count:(NSUInteger)count withAttributedStrings:(NSArray *)strings;
+- (void)replaceCharactersInRangesOfData:(NSData *)ranges withAttributedStrings:(NSArray *)strings;
+
+@end
+
+static BOOL PhiAttributesArePaintOnly(NSDictionary *attributes) {
+	for (NSString *name in attributes) {
+		if (![PhiTextStyle isPaintOnlyAttribute:name])
+			return NO;
+	}
+	return YES;
+}
+
+static BOOL PhiLayoutAttributesEqual(NSDictionary *attributes, NSDictionary *otherAttributes) {
+	for (NSString *name in attributes) {
+		if (![PhiTextStyle isPaintOnlyAttribute:name]
+			&& ![[attributes objectForKey:name] isEqual:[otherAttributes objectForKey:name]])
+			return NO;
+	}
+	for (NSString *name in otherAttributes) {
+		if (![PhiTextStyle isPaintOnlyAttribute:name]
+			&& ![attributes objectForKey:name])
+			return NO;
+	}
+	return YES;
+}
+
 @implementation PhiTextStorage
 
 @synthesize owner;
@@ -65,9 +97,11 @@
 	return rv;
 }
 - (void)setAttributedString:(NSAttributedString *)attributedString {
+	[owner textWillChange];
 	@synchronized(self) {
 		if (text != attributedString) {
 			[[owner undoManager] registerUndoWithTarget:self selector:@selector(setAttributedString:) object:text];
+			[owner textDidReplaceCharactersInRange:NSMakeRange(0, [text length]) withLength:[attributedString length]];
 			if (text) {
 				[text release];
 				text = nil;
@@ -78,6 +112,7 @@
 			[owner invalidateDocument];
 		}
 	}
+	[owner textDidChange];
 }
 
 - (NSAttributedString *)attributedSubstringFromRange:(NSRange)range {
@@ -140,10 +175,11 @@
 			 replaceCharactersInRange:NSMakeRange(range.location, 0)
 						   withString:[[text attributedSubstringFromRange:range] string]];
 		[text deleteCharactersInRange:range];
+		[owner textDidReplaceCharactersInRange:range withLength:0];
 		invalidRect = [owner invalidateDocumentNSRange:range];
 	}
 	[owner textDidChange];
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
 }
 - (void)replaceCharactersInRange:(NSRange)range withString:(NSString *)string {
 	CGRect invalidRect = CGRectNull;
@@ -158,10 +194,89 @@
 			 replaceCharactersInRange:NSMakeRange(range.location, [string length])
 						   withString:[[text attributedSubstringFromRange:range] string]];
 		[text replaceCharactersInRange:range withString:string];
+		[owner textDidReplaceCharactersInRange:range withLength:[string length]];
 		invalidRect = [owner invalidateDocumentNSRange:NSMakeRange(range.location, MAX([string length], range.length))];
 	}
 	[owner textDidChange];
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
+}
+
+- (void)replaceCharactersInRanges:(const NSRange *)ranges count:(NSUInteger)count withString:(NSString *)string {
+	NSMutableArray *strings;
+	NSAttributedString *replacement;
+	NSUInteger i, length;
+	if (!count)
+		return;
+	strings = [NSMutableArray arrayWithCapacity:count];
+	@synchronized(self) {
+		length = [text length];
+		for (i = 0; i < count; i++) {
+			replacement = [[NSAttributedString alloc] initWithString:string
+														  attributes:length ? [text attributesAtIndex:MIN(ranges[i].location, length - 1) effectiveRange:NULL] : nil];
+			[strings addObject:replacement];
+			[replacement release];
+		}
+	}
+	[self replaceCharactersInRanges:ranges count:count withAttributedStrings:strings];
+}
+/*!
+ Replaces the characters in each of ranges (count of them, in ascending order and disjoint) with the string
+ at the same index of strings, as a single edit. Its undo action is another such edit, of the replacements
+ (where they are in the result) with the text they replaced, so that the owner is told of each range that
+ changes, as it is of any other edit, whether the edit is done, undone or redone.
+ */
+- (void)replaceCharactersInRanges:(const NSRange *)ranges count:(NSUInteger)count withAttributedStrings:(NSArray *)strings {
+	CGRect invalidRect = CGRectNull;
+	NSMutableAttributedString *result;
+	NSAttributedString *replacement;
+	NSMutableArray *replaced;
+	NSMutableData *inverse;
+	NSRange *inverseRanges;
+	NSAutoreleasePool *pool = nil;
+	NSUInteger i, location = 0, length;
+	NSInteger diff = 0;
+	if (!count)
+		return;
+	[owner textWillChange];
+	@synchronized(self) {
+		length = [text length];
+		inverse = [NSMutableData dataWithLength:count * sizeof(NSRange)];
+		inverseRanges = [inverse mutableBytes];
+		replaced = [NSMutableArray arrayWithCapacity:count];
+		// Rebuild the text in one pass, rather than shifting its tail once per range
+		result = [[NSMutableAttributedString alloc] init];
+		[result beginEditing];
+		for (i = 0; i < count; i++) {
+			if (i % 256 == 0) {
+				[pool release];
+				pool = [[NSAutoreleasePool alloc] init];
+			}
+			if (ranges[i].location > location)
+				[result appendAttributedString:[text attributedSubstringFromRange:NSMakeRange(location, ranges[i].location - location)]];
+			replacement = [strings objectAtIndex:i];
+			[result appendAttributedString:replacement];
+			[replaced addObject:[text attributedSubstringFromRange:ranges[i]]];
+			inverseRanges[i] = NSMakeRange(ranges[i].location + diff, [replacement length]);
+			diff += (NSInteger)[replacement length] - (NSInteger)ranges[i].length;
+			location = NSMaxRange(ranges[i]);
+		}
+		if (location < length)
+			[result appendAttributedString:[text attributedSubstringFromRange:NSMakeRange(location, length - location)]];
+		[pool release];
+		[result endEditing];
+		[[[owner undoManager] prepareWithInvocationTarget:self] replaceCharactersInRangesOfData:inverse withAttributedStrings:replaced];
+		[text release];
+		text = result;
+		// From the last range, so that the locations of the others are unchanged
+		for (i = count; i > 0; i--)
+			[owner textDidReplaceCharactersInRange:ranges[i - 1] withLength:[[strings objectAtIndex:i - 1] length]];
+		invalidRect = [owner invalidateDocumentNSRange:NSMakeRange(ranges[0].location, [text length] - ranges[0].location)];
+	}
+	[owner textDidChange];
+	[owner addDamageRect:invalidRect];
+}
+- (void)replaceCharactersInRangesOfData:(NSData *)ranges withAttributedStrings:(NSArray *)strings {
+	[self replaceCharactersInRanges:[ranges bytes] count:[ranges length] / sizeof(NSRange) withAttributedStrings:strings];
 }
 
 - (void)replaceCharactersInRange:(NSRange)aRange withAttributedString:(NSAttributedString *)attributedString {
@@ -177,10 +292,11 @@
 			 replaceCharactersInRange:NSMakeRange(aRange.location, [attributedString length])
 						   withString:[[text attributedSubstringFromRange:aRange] string]];
 		[text replaceCharactersInRange:aRange withAttributedString:attributedString];
+		[owner textDidReplaceCharactersInRange:aRange withLength:[attributedString length]];
 		invalidRect = [owner invalidateDocumentNSRange:NSMakeRange(aRange.location, [attributedString length])];
 	}
 	[owner textDidChange];
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
 }
 
 - (void)appendAttributedString:(NSAttributedString *)attributedString {
@@ -197,10 +313,11 @@
 			 replaceCharactersInRange:NSMakeRange(length, [attributedString length])
 						   withString:[[text attributedSubstringFromRange:NSMakeRange(length, 0)] string]];
 		[text appendAttributedString:attributedString];
+		[owner textDidReplaceCharactersInRange:NSMakeRange(length, 0) withLength:[attributedString length]];
 		invalidRect = [owner invalidateDocumentNSRange:NSMakeRange(length, [attributedString length])];
 	}
 	[owner textDidChange];
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
 }
 
 - (void)insertAttributedString:(NSAttributedString *)attributedString atIndex:(NSUInteger)index {
@@ -216,10 +333,11 @@
 			 replaceCharactersInRange:NSMakeRange(index, [attributedString length])
 						   withString:[[text attributedSubstringFromRange:NSMakeRange(index, 0)] string]];
 		[text insertAttributedString:attributedString atIndex:index];
+		[owner textDidReplaceCharactersInRange:NSMakeRange(index, 0) withLength:[attributedString length]];
 		invalidRect = [owner invalidateDocumentNSRange:NSMakeRange(index, [attributedString length])];
 	}
 	[owner textDidChange];
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
 }
 
 - (NSDictionary *)attributesAtIndex:(NSUInteger)index effectiveRange:(NSRangePointer)aRange {
@@ -255,54 +373,83 @@
 
 - (void)setAttributes:(NSDictionary *)attributes range:(NSRange)aRange {
 	CGRect invalidRect = CGRectNull;
+	BOOL paintOnly;
 	@synchronized(self) {
 		if (![[owner undoManager] shouldIgnoreUndoAnyGroupings:PhiTextUndoManagerStylingGroupingType])
 			[[[owner undoManager] prepareWithInvocationTarget:self]
 			 replaceCharactersInRange:aRange
 			     withAttributedString:[self attributedSubstringFromRange:aRange]];
+		paintOnly = [self isPaintOnlyChangeToAttributes:attributes range:aRange];
 		[text setAttributes:attributes range:aRange];
-		invalidRect = [owner invalidateDocumentNSRange:aRange];
+		if (paintOnly)
+			invalidRect = [owner invalidateDocumentPaintNSRange:aRange];
+		else
+			invalidRect = [owner invalidateDocumentNSRange:aRange];
 	}
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
 }
 
 - (void)addAttribute:(NSString *)name value:(id)value range:(NSRange)aRange {
 	CGRect invalidRect = CGRectNull;
+	BOOL paintOnly = [PhiTextStyle isPaintOnlyAttribute:name];
 	@synchronized(self) {
 		if (![[owner undoManager] shouldIgnoreUndoAnyGroupings:PhiTextUndoManagerStylingGroupingType])
 			[[[owner undoManager] prepareWithInvocationTarget:self]
 			 replaceCharactersInRange:aRange
 				 withAttributedString:[self attributedSubstringFromRange:aRange]];
 		[text addAttribute:name value:value range:aRange];
-		invalidRect = [owner invalidateDocumentNSRange:aRange];
+		if (paintOnly)
+			invalidRect = [owner invalidateDocumentPaintNSRange:aRange];
+		else
+			invalidRect = [owner invalidateDocumentNSRange:aRange];
 	}
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
 }
 
 - (void)addAttributes:(NSDictionary *)attributes range:(NSRange)aRange {
 	CGRect invalidRect = CGRectNull;
+	BOOL paintOnly = PhiAttributesArePaintOnly(attributes);
 	@synchronized(self) {
 		if (![[owner undoManager] shouldIgnoreUndoAnyGroupings:PhiTextUndoManagerStylingGroupingType])
 			[[[owner undoManager] prepareWithInvocationTarget:self]
 			 replaceCharactersInRange:aRange
 				 withAttributedString:[self attributedSubstringFromRange:aRange]];
 		[text addAttributes:attributes range:aRange];
-		invalidRect = [owner invalidateDocumentNSRange:aRange];
+		if (paintOnly)
+			invalidRect = [owner invalidateDocumentPaintNSRange:aRange];
+		else
+			invalidRect = [owner invalidateDocumentNSRange:aRange];
 	}
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	[owner addDamageRect:invalidRect];
 }
 
 - (void)removeAttribute:(NSString *)name range:(NSRange)aRange {
 	CGRect invalidRect = CGRectNull;
+	BOOL paintOnly = [PhiTextStyle isPaintOnlyAttribute:name];
 	@synchronized(self) {
 		if (![[owner undoManager] shouldIgnoreUndoAnyGroupings:PhiTextUndoManagerStylingGroupingType])
 			[[[owner undoManager] prepareWithInvocationTarget:self]
 			 replaceCharactersInRange:aRange
 				 withAttributedString:[self attributedSubstringFromRange:aRange]];
 		[text removeAttribute:name range:aRange];
-		invalidRect = [owner invalidateDocumentNSRange:aRange];
+		if (paintOnly)
+			invalidRect = [owner invalidateDocumentPaintNSRange:aRange];
+		else
+			invalidRect = [owner invalidateDocumentNSRange:aRange];
+	}
+	[owner addDamageRect:invalidRect];
+}
+
+/*! Returns YES if setting attributes over the specified range would only change how its text is painted. */
+- (BOOL)isPaintOnlyChangeToAttributes:(NSDictionary *)attributes range:(NSRange)aRange {
+	NSUInteger index = aRange.location;
+	NSRange effectiveRange;
+	while (index < NSMaxRange(aRange)) {
+		if (!PhiLayoutAttributesEqual([text attributesAtIndex:index effectiveRange:&effectiveRange], attributes))
+			return NO;
+		index = NSMaxRange(effectiveRange);
 	}
-	[[owner owner] performSelectorOnMainThread:@selector(setNeedsDisplayInValueRect:) withObject:[NSValue valueWithCGRect:invalidRect] waitUntilDone:YES];
+	return YES;
 }
 
 - (void)dealloc {
@@ -67,9 +67,38 @@ typedef enum {
 	kPhiUnderlineScaleXXSmall
 } PhiUnderlineScaleType;
 
-/*! Encapsulates the string attributes to which Core Text responds. !*/
+/*! Number of styles held by the intern table before the least recently used are evicted. */
+#ifndef PHI_STYLE_INTERN_LIMIT
+#define PHI_STYLE_INTERN_LIMIT 512
+#endif
+/*! Number of the least recently used styles evicted at once when the intern table is full. */
+#ifndef PHI_STYLE_INTERN_EVICTION_COUNT
+#define PHI_STYLE_INTERN_EVICTION_COUNT (PHI_STYLE_INTERN_LIMIT / 4)
+#endif
+
+typedef struct {
+	NSUInteger lookups;
+	NSUInteger hits;
+	/*! Styles allocated by internedStyleWithDictionary: (i.e. misses). */
+	NSUInteger allocations;
+	/*! Styles evicted from the intern table because it was full. */
+	NSUInteger evictions;
+	NSUInteger count;
+} PhiTextStyleInternStatistics;
+
+/*!
+ Encapsulates the string attributes to which Core Text responds.
+ Styles returned by internedStyleWithDictionary: (and internedStyleWithAddedStyle:) are
+ interned: equal attributes share one immutable instance, whose font and paragraph style
+ are created once. Mutating an interned style raises an NSInternalInconsistencyException;
+ copy returns a mutable style. Interned styles are for reading the attributes of text (as
+ the frames and lines do); styles handed to clients are mutable.
+ !*/
 @interface PhiTextStyle : NSObject <NSCopying> {
 	CFMutableDictionaryRef attributes;
+	BOOL interned;
+	/*! When the style was last returned from the intern table (a tick of the table's clock). */
+	NSUInteger internedUse;
 	PhiTextFont *font;
 	PhiTextParagraphStyle *paragraphStyle;
 	PhiStrokeStyleType strokeStyle;
@@ -77,8 +106,23 @@ typedef enum {
 	PhiUnderlineScaleType underlineScale;
 }
 
+/*! Returns a new mutable style with the specified attributes. */
 + (PhiTextStyle *)styleWithDictionary:(NSDictionary *)attributes;
+/*! Returns the shared, immutable style with the specified attributes. */
++ (PhiTextStyle *)internedStyleWithDictionary:(NSDictionary *)attributes;
 - (PhiTextStyle *)styleWithAddedStyle:(PhiTextStyle *)style;
+- (PhiTextStyle *)internedStyleWithAddedStyle:(PhiTextStyle *)style;
+
+/*! The names of the attributes that affect only how glyphs are painted, not their layout (i.e. the colours). */
++ (NSSet *)paintOnlyAttributeNames;
++ (BOOL)isPaintOnlyAttribute:(NSString *)attributeName;
+
++ (PhiTextStyleInternStatistics)internStatistics;
++ (void)resetInternStatistics;
+/*! Empties the intern table, which also happens on a memory warning. */
++ (void)removeAllInternedStyles;
+
+@property(nonatomic, readonly, getter=isInterned) BOOL interned;
 
 // Access the underlying CFDictionary
 @property(nonatomic, readonly) CFDictionaryRef attributes;
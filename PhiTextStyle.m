@@ -17,12 +17,16 @@
 // limitations under the License.
 //
 
+#import <UIKit/UIKit.h>
 #import "PhiTextStyle.h"
 #import "PhiTextFont.h"
 #import "PhiTextParagraphStyle.h"
 
+#define PhiCheckMutable() if (interned) [NSException raise:NSInternalInconsistencyException format:@"Attempt to mutate an interned %@, copy it first.", [self class]]
+
 @interface PhiTextStyle()
 
+- (id)initWithInternedAttributes:(CFDictionaryRef)attr;
 - (void)setAttributes:(CFDictionaryRef)attr;
 
 @end
@@ -31,13 +35,133 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	CFDictionarySetValue(dictionary, key, value);
 }
 
+/*! Independent of the order of the entries, so that equal dictionaries hash equally. */
+static CFHashCode PhiStyleAttributesHash(const void *attr) {
+	const void *stackKeys[16], *stackValues[16];
+	const void **keys = stackKeys, **values = stackValues;
+	CFIndex i, count = CFDictionaryGetCount((CFDictionaryRef)attr);
+	CFHashCode hash = count;
+
+	if (count > 16) {
+		keys = malloc(count * sizeof(void *));
+		values = malloc(count * sizeof(void *));
+	}
+	CFDictionaryGetKeysAndValues((CFDictionaryRef)attr, keys, values);
+	for (i = 0; i < count; i++)
+		hash += CFHash(keys[i]) * 31 + CFHash(values[i]);
+	if (keys != stackKeys) {
+		free(keys);
+		free(values);
+	}
+	return hash;
+}
+static Boolean PhiStyleAttributesEqual(const void *attr1, const void *attr2) {
+	return CFEqual(attr1, attr2);
+}
+/*! Keys are the attributes of the interned styles (the values), which own them. */
+static const CFDictionaryKeyCallBacks PhiStyleAttributesKeyCallBacks = {
+	0, NULL, NULL, NULL, PhiStyleAttributesEqual, PhiStyleAttributesHash
+};
+
+static CFMutableDictionaryRef internedStyles = NULL;
+static NSUInteger internClock = 0;
+static PhiTextStyleInternStatistics internStatistics;
+static NSSet *paintOnlyAttributeNames = nil;
+
 @implementation PhiTextStyle
 
+@synthesize interned;
+
++ (void)initialize {
+	if (self == [PhiTextStyle class]) {
+		internedStyles = CFDictionaryCreateMutable(NULL, 0, &PhiStyleAttributesKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		memset(&internStatistics, 0, sizeof(internStatistics));
+		paintOnlyAttributeNames = [[NSSet alloc] initWithObjects:
+								   (id)kCTForegroundColorAttributeName,
+								   (id)kCTForegroundColorFromContextAttributeName,
+								   (id)kCTStrokeColorAttributeName,
+								   (id)kCTUnderlineColorAttributeName,
+								   nil];
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(removeAllInternedStyles) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	}
+}
+
 +(PhiTextStyle *)styleWithDictionary:(NSDictionary *)attr {
 	PhiTextStyle *rv = [[PhiTextStyle alloc] init];
 	[rv setAttributes:(CFDictionaryRef)attr];
 	return [rv autorelease];
 }
+static int PhiCompareUses(const void *use1, const void *use2) {
+	NSUInteger a = *(const NSUInteger *)use1, b = *(const NSUInteger *)use2;
+	return a < b ? -1 : a > b;
+}
+/*! Removes the PHI_STYLE_INTERN_EVICTION_COUNT least recently used styles from the intern table (whose lock is held). */
+static void PhiEvictInternedStyles(void) {
+	CFIndex i, count = CFDictionaryGetCount(internedStyles);
+	PhiTextStyle **styles = malloc(count * sizeof(PhiTextStyle *));
+	NSUInteger *uses = malloc(count * sizeof(NSUInteger)), threshold;
+	CFDictionaryGetKeysAndValues(internedStyles, NULL, (const void **)styles);
+	for (i = 0; i < count; i++)
+		uses[i] = styles[i]->internedUse;
+	qsort(uses, count, sizeof(NSUInteger), PhiCompareUses);
+	threshold = uses[MIN(PHI_STYLE_INTERN_EVICTION_COUNT, count) - 1];
+	for (i = 0; i < count; i++) {
+		if (styles[i]->internedUse <= threshold) {
+			CFDictionaryRemoveValue(internedStyles, styles[i]->attributes);
+			internStatistics.evictions++;
+		}
+	}
+	free(uses);
+	free(styles);
+}
+
++(PhiTextStyle *)internedStyleWithDictionary:(NSDictionary *)attr {
+	PhiTextStyle *rv;
+	if (!attr)
+		attr = [NSDictionary dictionary];
+	@synchronized([PhiTextStyle class]) {
+		internStatistics.lookups++;
+		rv = (PhiTextStyle *)CFDictionaryGetValue(internedStyles, (CFDictionaryRef)attr);
+		if (rv) {
+			internStatistics.hits++;
+			[rv retain];
+		} else {
+			if (CFDictionaryGetCount(internedStyles) >= PHI_STYLE_INTERN_LIMIT)
+				PhiEvictInternedStyles();
+			rv = [[PhiTextStyle alloc] initWithInternedAttributes:(CFDictionaryRef)attr];
+			CFDictionarySetValue(internedStyles, rv->attributes, rv);
+			internStatistics.allocations++;
+		}
+		rv->internedUse = ++internClock;
+	}
+	return [rv autorelease];
+}
+
++ (NSSet *)paintOnlyAttributeNames {
+	return paintOnlyAttributeNames;
+}
++ (BOOL)isPaintOnlyAttribute:(NSString *)attributeName {
+	return [paintOnlyAttributeNames containsObject:attributeName];
+}
+
++ (PhiTextStyleInternStatistics)internStatistics {
+	PhiTextStyleInternStatistics rv;
+	@synchronized([PhiTextStyle class]) {
+		rv = internStatistics;
+		rv.count = CFDictionaryGetCount(internedStyles);
+	}
+	return rv;
+}
++ (void)resetInternStatistics {
+	@synchronized([PhiTextStyle class]) {
+		memset(&internStatistics, 0, sizeof(internStatistics));
+	}
+}
++ (void)removeAllInternedStyles {
+	@synchronized([PhiTextStyle class]) {
+		CFDictionaryRemoveAllValues(internedStyles);
+	}
+}
 
 - (PhiTextStyle *)styleWithAddedStyle:(PhiTextStyle *)style {
 	CFDictionaryRef addAttr = [style attributes];
@@ -49,6 +173,16 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	CFRelease(newAttr);
 	return rv;
 }
+- (PhiTextStyle *)internedStyleWithAddedStyle:(PhiTextStyle *)style {
+	CFDictionaryRef addAttr = [style attributes];
+	CFMutableDictionaryRef newAttr = CFDictionaryCreateMutableCopy(NULL, 12, [self attributes]);
+	
+	CFDictionaryApplyFunction(addAttr, (CFDictionaryApplierFunction)PhiAddToStyleDictionaryCallBack, newAttr);
+	
+	PhiTextStyle *rv = [PhiTextStyle internedStyleWithDictionary:(NSDictionary *)newAttr];
+	CFRelease(newAttr);
+	return rv;
+}
 
 - (id)init {
 	if (self = [super init]) {
@@ -58,6 +192,21 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return self;
 }
 
+/*! Derived objects are made up front since an interned style may be shared between threads. */
+- (id)initWithInternedAttributes:(CFDictionaryRef)attr {
+	if (self = [super init]) {
+		attributes = CFDictionaryCreateMutableCopy(NULL, 12, attr);
+		strokeStyle = kPhiStrokeOnly;
+		[self font];
+		[self paragraphStyle];
+		[self strokeStyle];
+		[self underlinePattern];
+		[self underlineScale];
+		interned = YES;
+	}
+	return self;
+}
+
 - (id)copyWithZone:(NSZone *)zone {
 	PhiTextStyle *rv = [[PhiTextStyle allocWithZone:zone] init];
 	rv.attributes = self.attributes;
@@ -65,6 +214,8 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 }
 
 - (CFDictionaryRef)attributes {
+	if (interned)
+		return attributes;
 	if (paragraphStyle) {
 		CTParagraphStyleRef value = paragraphStyle.CTParagraphStyle;
 		if (value) {
@@ -79,6 +230,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return attributes;
 }
 - (void)setAttributes:(CFDictionaryRef)attr {
+	PhiCheckMutable();
 	if (paragraphStyle)
 		[paragraphStyle release];
 	paragraphStyle = nil;
@@ -104,12 +256,14 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return type;
 }
 - (void)setCharacterShape:(PhiCharacterShapeType)type {
+	PhiCheckMutable();
 	CFNumberRef value;
 	value = CFNumberCreate(NULL, kCFNumberIntType, &type);
 	CFDictionarySetValue(attributes, kCTCharacterShapeAttributeName, value);
 	CFRelease(value);
 }
 - (void)unsetCharacterShape {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTCharacterShapeAttributeName);
 }
 
@@ -122,6 +276,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return font;
 }
 - (void)setFont:(PhiTextFont *)aFont {
+	PhiCheckMutable();
 	if (font != aFont) {
 		[self unsetFont];
 		if (aFont)
@@ -129,6 +284,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetFont {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTFontAttributeName);
 	if (font)
 		[font release];
@@ -144,12 +300,14 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return kern;
 }
 - (void)setKern:(float)kern {
+	PhiCheckMutable();
 	CFNumberRef value;
 	value = CFNumberCreate(NULL, kCFNumberFloatType, &kern);
 	CFDictionarySetValue(attributes, kCTKernAttributeName, value);
 	CFRelease(value);
 }
 - (void)unsetKern {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTKernAttributeName);
 }
 
@@ -162,12 +320,14 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return type;
 }
 - (void)setLigature:(PhiLigaturesType)type {
+	PhiCheckMutable();
 	CFNumberRef value;
 	value = CFNumberCreate(NULL, kCFNumberIntType, &type);
 	CFDictionarySetValue(attributes, kCTLigatureAttributeName, value);
 	CFRelease(value);
 }
 - (void)unsetLigature {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTLigatureAttributeName);
 }
 
@@ -180,10 +340,12 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return flag;
 }
 - (void)setShouldUseCurrentColor:(BOOL)flag {
+	PhiCheckMutable();
 	CFBooleanRef value = flag ? kCFBooleanTrue : kCFBooleanFalse;
 	CFDictionarySetValue(attributes, kCTForegroundColorFromContextAttributeName, value);
 }
 - (void)unsetShouldUseCurrentColor {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTForegroundColorFromContextAttributeName);
 }
 
@@ -195,6 +357,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return color;
 }
 - (void)setColor:(CGColorRef)color {
+	PhiCheckMutable();
 	if (color) {
 		CFDictionarySetValue(attributes, kCTForegroundColorAttributeName, color);
 	} else {
@@ -202,6 +365,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetColor {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTForegroundColorAttributeName);
 }
 
@@ -216,6 +380,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return paragraphStyle;
 }
 - (void)setParagraphStyle:(PhiTextParagraphStyle *)aParagraphStyle {
+	PhiCheckMutable();
 	if (paragraphStyle != aParagraphStyle) {
 		[self unsetParagraphStyle];
 		if (aParagraphStyle)
@@ -223,6 +388,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetParagraphStyle {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTParagraphStyleAttributeName);
 	if (paragraphStyle)
 		[paragraphStyle release];
@@ -238,6 +404,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return strokeStyle;
 }
 - (void)setStrokeStyle:(PhiStrokeStyleType)type {
+	PhiCheckMutable();
 	strokeStyle = type;
 	
 	float strokeWidth = [self strokeWidth] * -1.0;
@@ -259,6 +426,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return ABS(strokeWidth);
 }
 - (void)setStrokeWidth:(float)strokeWidth {
+	PhiCheckMutable();
 	strokeWidth = ABS(strokeWidth) * strokeStyle;
 	CFNumberRef value;
 	value = CFNumberCreate(NULL, kCFNumberFloatType, &strokeWidth);
@@ -266,6 +434,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	CFRelease(value);
 }
 - (void)unsetStrokeWidth{
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTStrokeWidthAttributeName);
 }
 
@@ -277,6 +446,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return strokeColor;
 }
 - (void)setStrokeColor:(CGColorRef)strokeColor {
+	PhiCheckMutable();
 	if (strokeColor) {
 		CFDictionarySetValue(attributes, kCTStrokeColorAttributeName, strokeColor);
 	} else {
@@ -284,6 +454,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetStrokeColor {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTStrokeColorAttributeName);
 }
 
@@ -296,6 +467,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return type == 1;
 }
 - (void)setSuperscript:(BOOL)flag {
+	PhiCheckMutable();
 	int type = 1;
 	CFNumberRef value;
 	if (flag && ![self isSuperscript]) {
@@ -311,6 +483,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetSuperscript {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTSuperscriptAttributeName);
 }
 
@@ -323,6 +496,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return type == -1;
 }
 - (void)setSubscript:(BOOL)flag {
+	PhiCheckMutable();
 	int type = -1;
 	CFNumberRef value;
 	if (flag && ![self isSubscript]) {
@@ -338,6 +512,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetSubscript {
+	PhiCheckMutable();
 	[self unsetSuperscript];
 }
 
@@ -350,6 +525,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return underlineScale = (style & 0x07);
 }
 - (void)setUnderlineScale:(PhiUnderlineScaleType)oneToSeven {
+	PhiCheckMutable();
 	underlineScale = oneToSeven &= 0x07;
 	[self setUnderlined:oneToSeven > 0];
 }
@@ -363,6 +539,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return (BOOL)(style & 0x07);
 }
 - (void)setUnderlined:(BOOL)flag {
+	PhiCheckMutable();
 	CTUnderlineStyle style = 0;
 	CFNumberRef value;
 	if (CFDictionaryGetValueIfPresent(attributes, kCTUnderlineStyleAttributeName, (const void **)&value)) {
@@ -394,6 +571,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return underlinePattern = type & 0xFF00;
 }
 - (void)setUnderlinePattern:(PhiUnderlinePatternType)type {
+	PhiCheckMutable();
 	CTUnderlineStyle style = 0;
 	CFNumberRef value;
 	if (CFDictionaryGetValueIfPresent(attributes, kCTUnderlineStyleAttributeName, (const void **)&value)) {
@@ -413,6 +591,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return (BOOL)(style & 0x08);
 }
 - (void)setUnderlineDouble:(BOOL)flag {
+	PhiCheckMutable();
 	CTUnderlineStyle style = 0;
 	CFNumberRef value;
 	if (CFDictionaryGetValueIfPresent(attributes, kCTUnderlineStyleAttributeName, (const void **)&value)) {
@@ -432,6 +611,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetUnderline {
+	PhiCheckMutable();
 	underlinePattern = underlineScale = 0;
 	CFDictionaryRemoveValue(attributes, kCTUnderlineStyleAttributeName);
 }
@@ -444,6 +624,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return underlineColor;
 }
 - (void)setUnderlineColor:(CGColorRef)underlineColor {
+	PhiCheckMutable();
 	if (underlineColor) {
 		CFDictionarySetValue(attributes, kCTUnderlineColorAttributeName, underlineColor);
 	} else {
@@ -451,6 +632,7 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	}
 }
 - (void)unsetUnderlineColor {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, kCTUnderlineColorAttributeName);
 }
 
@@ -463,10 +645,12 @@ void PhiAddToStyleDictionaryCallBack (const void *key, const void *value, CFMuta
 	return flag;
 }
 - (void)setShouldUseVerticalForms:(BOOL)flag {
+	PhiCheckMutable();
 	CFBooleanRef value = flag ? kCFBooleanTrue : kCFBooleanFalse;
 	CFDictionarySetValue(attributes, @"CTVerticalFormsAttributeName", value);
 }
 - (void)unsetShouldUseVerticalForms {
+	PhiCheckMutable();
 	CFDictionaryRemoveValue(attributes, @"CTVerticalFormsAttributeName");
 }
 
@@ -0,0 +1,108 @@
+//
+//  PhiTextTileCache.h
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+
+@class PhiTextDocument;
+@class PhiTextLayoutSnapshot;
+
+/*! Number of least recently used tiles considered for eviction, of which the tile farthest from the viewport is evicted first. */
+#ifndef PHI_TILE_CACHE_EVICTION_WINDOW
+#define PHI_TILE_CACHE_EVICTION_WINDOW 4
+#endif
+/*! Maximum number of tiles rendered concurrently in the background. */
+#ifndef PHI_TILE_CACHE_MAX_CONCURRENT_RENDERS
+#define PHI_TILE_CACHE_MAX_CONCURRENT_RENDERS 1
+#endif
+
+@protocol PhiTextTileRenderer <NSObject>
+
+/*!
+ Draws the portion of document in rect (in the coordinates of the document's owner, i.e. with
+ padding) into context, whose CTM maps those coordinates with y increasing downwards, from
+ snapshot (which covers rect, and whose frames are all typeset). Called on a background thread.
+ */
+- (void)drawTileRect:(CGRect)rect withSnapshot:(PhiTextLayoutSnapshot *)snapshot ofDocument:(PhiTextDocument *)document inContext:(CGContextRef)context;
+
+@end
+
+typedef struct {
+	NSUInteger hits;
+	NSUInteger misses;
+	NSUInteger renders;
+	/*! Background renders discarded because their tile was invalidated while rendering. */
+	NSUInteger staleRenders;
+	/*! Background renders skipped because the frames of their tile weren't typeset (typesetting is left to the main thread). */
+	NSUInteger untypesetRenders;
+	NSUInteger evictions;
+	/*! Total time spent rendering tiles in the background (in seconds). */
+	double renderTime;
+	NSUInteger count;
+	NSUInteger totalBytes;
+	NSUInteger budget;
+} PhiTextTileCacheStatistics;
+
+/*!
+ Holds rasterised images of PhiTextView tiles, keyed by tile rect and pixel scale, for as
+ long as the total cost (of the bitmaps) remains within a budget (tileCacheBudget).
+ Tiles are rendered on a background queue, from frames that are already typeset, and
+ composited when the tile is next displayed, so that scrolling back over content already
+ seen does not typeset or draw it again.
+ Any change to the content of a rect invalidates the tiles that intersect it (and cancels
+ their pending renders); a change to the style of the whole document bumps the generation,
+ invalidating every tile.
+ */
+@interface PhiTextTileCache : NSObject {
+@private
+	NSMutableArray *tiles;
+	NSMutableArray *requests;
+	NSOperationQueue *renderQueue;
+	NSUInteger budget;
+	NSUInteger totalBytes;
+	NSUInteger generation;
+	CGRect viewport;
+	PhiTextTileCacheStatistics statistics;
+}
+
+@property (nonatomic, assign) NSUInteger budget;
+@property (nonatomic, readonly) NSUInteger totalBytes;
+@property (readonly) NSUInteger generation;
+/*! The visible portion of the document's owner (i.e. with padding). */
+@property (assign) CGRect viewport;
+
+/*! Returns the (retained) image of the tile at rect and scale, or NULL if there is no valid image. */
+- (CGImageRef)copyImageForTileRect:(CGRect)rect scale:(CGFloat)scale;
+/*! Adds image to the receiver, unless generation is no longer current. */
+- (void)setImage:(CGImageRef)image forTileRect:(CGRect)rect scale:(CGFloat)scale generation:(NSUInteger)generation;
+/*! Schedules the tile at rect and scale to be drawn by renderer, on a background thread, unless it is already valid or pending. */
+- (void)renderTileRect:(CGRect)rect scale:(CGFloat)scale ofDocument:(PhiTextDocument *)document withRenderer:(id <PhiTextTileRenderer>)renderer;
+
+/*! Removes (and cancels the pending renders of) every tile that intersects rect. */
+- (void)invalidateTilesInRect:(CGRect)rect;
+/*! Removes every tile, cancels every pending render and bumps the generation. */
+- (void)invalidateAllTiles;
+
+/*! Evicts tiles until the total cost is no more than the specified number of bytes. */
+- (void)evictToCost:(NSUInteger)bytes;
+
+- (PhiTextTileCacheStatistics)statistics;
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,364 @@
+//
+//  PhiTextTileCache.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <UIKit/UIKit.h>
+#import "PhiTextTileCache.h"
+#import "PhiTextDocument.h"
+
+static CGFloat PhiDistanceFromRectToRect(CGRect rect, CGRect otherRect) {
+	if (CGRectIsNull(rect) || CGRectIsNull(otherRect) || CGRectIntersectsRect(rect, otherRect))
+		return 0.0;
+	if (CGRectGetMaxY(rect) < CGRectGetMinY(otherRect))
+		return CGRectGetMinY(otherRect) - CGRectGetMaxY(rect);
+	if (CGRectGetMinY(rect) > CGRectGetMaxY(otherRect))
+		return CGRectGetMinY(rect) - CGRectGetMaxY(otherRect);
+	return 0.0;
+}
+
+static NSUInteger PhiTileCost(CGRect rect, CGFloat scale) {
+	return (NSUInteger)ceil(rect.size.width * scale) * 4 * (NSUInteger)ceil(rect.size.height * scale);
+}
+
+@interface PhiTextTile : NSObject {
+@public
+	CGRect rect;
+	CGFloat scale;
+	CGImageRef image;
+	NSUInteger cost;
+}
+@end
+
+@implementation PhiTextTile
+- (void)dealloc {
+	CGImageRelease(image);
+	[super dealloc];
+}
+@end
+
+@interface PhiTextTileRequest : NSObject {
+@public
+	CGRect rect;
+	CGFloat scale;
+	NSUInteger generation;
+	PhiTextDocument *document;
+	id <PhiTextTileRenderer> renderer;
+	NSOperation *operation;
+	BOOL cancelled;
+}
+@end
+
+@implementation PhiTextTileRequest
+- (void)dealloc {
+	[document release];
+	[renderer release];
+	[super dealloc];
+}
+@end
+
+@interface PhiTextTileCache ()
+
+- (PhiTextTile *)tileForRect:(CGRect)rect scale:(CGFloat)scale;
+- (void)renderTileRequest:(PhiTextTileRequest *)request;
+- (void)removeAllTiles;
+
+@end
+
+@implementation PhiTextTileCache
+
++ (void)initialize {
+	CFStringRef suiteName = CFSTR("com.phitext");
+	NSInteger aNSInt;
+	CFNumberRef aNumberValue;
+
+	CFPropertyListRef last = CFPreferencesCopyAppValue(CFSTR("tileCacheBudget"), suiteName);
+	if (last) {
+		CFRelease(last);
+	} else {
+		aNSInt = 1 << 23;
+		aNumberValue = CFNumberCreate(NULL, kCFNumberNSIntegerType, &aNSInt);
+		CFPreferencesSetAppValue(CFSTR("tileCacheBudget"), aNumberValue, suiteName);
+		CFRelease(aNumberValue);
+
+#ifdef PHI_SYNC_DEFAULTS
+		CFPreferencesAppSynchronize(suiteName);
+#endif
+	}
+}
+
+@synthesize budget, totalBytes, generation, viewport;
+
+- (id)init {
+	if (self = [super init]) {
+		NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+		[defaults addSuiteNamed:@"com.phitext"];
+
+		tiles = [[NSMutableArray alloc] init];
+		requests = [[NSMutableArray alloc] init];
+		renderQueue = [[NSOperationQueue alloc] init];
+		[renderQueue setMaxConcurrentOperationCount:PHI_TILE_CACHE_MAX_CONCURRENT_RENDERS];
+		budget = [defaults integerForKey:@"tileCacheBudget"];
+		totalBytes = 0;
+		generation = 0;
+		viewport = CGRectNull;
+		memset(&statistics, 0, sizeof(statistics));
+
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(removeAllTiles) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	}
+	return self;
+}
+
+- (void)setBudget:(NSUInteger)bytes {
+	@synchronized(self) {
+		budget = bytes;
+	}
+	[self evictToCost:bytes];
+}
+
+- (PhiTextTile *)tileForRect:(CGRect)rect scale:(CGFloat)scale {
+	for (PhiTextTile *tile in tiles) {
+		if (tile->scale == scale && CGRectEqualToRect(tile->rect, rect))
+			return tile;
+	}
+	return nil;
+}
+
+- (CGImageRef)copyImageForTileRect:(CGRect)rect scale:(CGFloat)scale {
+	CGImageRef image = NULL;
+	@synchronized(self) {
+		PhiTextTile *tile = [self tileForRect:rect scale:scale];
+		if (tile) {
+			statistics.hits++;
+			image = CGImageRetain(tile->image);
+			if (tile != [tiles lastObject]) {
+				[tile retain];
+				[tiles removeObjectIdenticalTo:tile];
+				[tiles addObject:tile];
+				[tile release];
+			}
+		} else {
+			statistics.misses++;
+		}
+	}
+	return image;
+}
+
+- (void)setImage:(CGImageRef)image forTileRect:(CGRect)rect scale:(CGFloat)scale generation:(NSUInteger)imageGeneration {
+	@synchronized(self) {
+		if (!image || imageGeneration != generation)
+			return;
+		NSUInteger cost = CGImageGetBytesPerRow(image) * CGImageGetHeight(image);
+		if (cost > budget)
+			return;
+
+		PhiTextTile *tile = [self tileForRect:rect scale:scale];
+		if (tile) {
+			totalBytes -= tile->cost;
+			[tiles removeObjectIdenticalTo:tile];
+		}
+		tile = [[PhiTextTile alloc] init];
+		tile->rect = rect;
+		tile->scale = scale;
+		tile->image = CGImageRetain(image);
+		tile->cost = cost;
+		[tiles addObject:tile];
+		[tile release];
+		totalBytes += cost;
+	}
+	[self evictToCost:budget];
+}
+
+- (void)renderTileRect:(CGRect)rect scale:(CGFloat)scale ofDocument:(PhiTextDocument *)document withRenderer:(id <PhiTextTileRenderer>)renderer {
+	if (CGRectIsEmpty(rect) || scale <= 0.0)
+		return;
+	@synchronized(self) {
+		if (PhiTileCost(rect, scale) > budget || [self tileForRect:rect scale:scale])
+			return;
+		for (PhiTextTileRequest *request in requests) {
+			if (!request->cancelled && request->scale == scale && CGRectEqualToRect(request->rect, rect))
+				return;
+		}
+
+		PhiTextTileRequest *request = [[PhiTextTileRequest alloc] init];
+		request->rect = rect;
+		request->scale = scale;
+		request->generation = generation;
+		request->document = [document retain];
+		request->renderer = [renderer retain];
+		request->cancelled = NO;
+		NSInvocationOperation *operation = [[NSInvocationOperation alloc] initWithTarget:self selector:@selector(renderTileRequest:) object:request];
+		request->operation = operation;
+		[requests addObject:request];
+		[renderQueue addOperation:operation];
+		[operation release];
+		[request release];
+	}
+}
+
+/*! Draws the requested tile into a bitmap (with the same orientation as a layer's context) and adds its image to the receiver. */
+- (void)renderTileRequest:(PhiTextTileRequest *)request {
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	BOOL cancelled;
+	@synchronized(self) {
+		cancelled = request->cancelled;
+	}
+	// Only draw what the main thread has typeset; a tile of frames still to be typeset is drawn (and requested again) when it is displayed
+	PhiTextLayoutSnapshot *snapshot = nil;
+	if (!cancelled) {
+		snapshot = [request->document typesetLayoutSnapshotForRect:CGRectOffset(request->rect, -[request->document paddingLeft], -[request->document paddingTop])];
+		if (!snapshot) {
+			@synchronized(self) {
+				statistics.untypesetRenders++;
+			}
+		}
+	}
+	if (snapshot) {
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		size_t width = (size_t)ceil(request->rect.size.width * request->scale);
+		size_t height = (size_t)ceil(request->rect.size.height * request->scale);
+		CGImageRef image = NULL;
+		CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+		CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, width * 4, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+		CGColorSpaceRelease(colorSpace);
+		if (context) {
+			CGContextTranslateCTM(context, 0.0, height);
+			CGContextScaleCTM(context, request->scale, -request->scale);
+			CGContextTranslateCTM(context, -request->rect.origin.x, -request->rect.origin.y);
+			CGContextClipToRect(context, request->rect);
+			[request->renderer drawTileRect:request->rect withSnapshot:snapshot ofDocument:request->document inContext:context];
+			image = CGBitmapContextCreateImage(context);
+			CGContextRelease(context);
+		}
+		@synchronized(self) {
+			statistics.renders++;
+			statistics.renderTime += CFAbsoluteTimeGetCurrent() - start;
+			if (request->cancelled || request->generation != generation)
+				statistics.staleRenders++;
+			else
+				[self setImage:image forTileRect:request->rect scale:request->scale generation:request->generation];
+		}
+		CGImageRelease(image);
+	}
+	@synchronized(self) {
+		[requests removeObjectIdenticalTo:request];
+	}
+	[pool release];
+}
+
+- (void)invalidateTilesInRect:(CGRect)rect {
+	@synchronized(self) {
+		NSUInteger i = [tiles count];
+		PhiTextTile *tile;
+		while (i--) {
+			tile = [tiles objectAtIndex:i];
+			if (CGRectIntersectsRect(tile->rect, rect)) {
+				totalBytes -= tile->cost;
+				[tiles removeObjectAtIndex:i];
+			}
+		}
+		for (PhiTextTileRequest *request in requests) {
+			if (CGRectIntersectsRect(request->rect, rect)) {
+				request->cancelled = YES;
+				[request->operation cancel];
+			}
+		}
+	}
+}
+
+- (void)invalidateAllTiles {
+	@synchronized(self) {
+		generation++;
+		[tiles removeAllObjects];
+		totalBytes = 0;
+		for (PhiTextTileRequest *request in requests) {
+			request->cancelled = YES;
+			[request->operation cancel];
+		}
+	}
+}
+
+- (void)evictToCost:(NSUInteger)bytes {
+	@synchronized(self) {
+		PhiTextTile *tile, *victim;
+		CGFloat distance, farthest;
+		NSUInteger i, count = [tiles count];
+
+		while (totalBytes > bytes && count) {
+			victim = nil;
+			farthest = -1.0;
+			for (i = 0; i < count && i < PHI_TILE_CACHE_EVICTION_WINDOW; i++) {
+				tile = [tiles objectAtIndex:i];
+				distance = PhiDistanceFromRectToRect(tile->rect, viewport);
+				if (distance > farthest) {
+					victim = tile;
+					farthest = distance;
+				}
+			}
+#ifdef DEVELOPER
+			NSLog(@"Evicting tile %@ (%u bytes, %.f points from viewport).", NSStringFromCGRect(victim->rect), victim->cost, farthest);
+#endif
+			totalBytes -= victim->cost;
+			[tiles removeObjectIdenticalTo:victim];
+			statistics.evictions++;
+			count = [tiles count];
+		}
+	}
+}
+
+- (void)removeAllTiles {
+	[self evictToCost:0];
+#ifdef DEVELOPER
+	NSLog(@"Memory warning: tile cache emptied.");
+#endif
+}
+
+- (PhiTextTileCacheStatistics)statistics {
+	PhiTextTileCacheStatistics rv;
+	@synchronized(self) {
+		rv = statistics;
+		rv.count = [tiles count];
+		rv.totalBytes = totalBytes;
+		rv.budget = budget;
+	}
+	return rv;
+}
+
+- (void)resetStatistics {
+	@synchronized(self) {
+		memset(&statistics, 0, sizeof(statistics));
+	}
+}
+
+- (NSString *)description {
+	PhiTextTileCacheStatistics stats = [self statistics];
+	return [NSString stringWithFormat:@"<%@: 0x%x; %u tiles; %u/%u bytes; %u hits; %u misses; %u renders (%u stale, %.3fs); %u evictions>",
+			NSStringFromClass([self class]), self, stats.count, stats.totalBytes, stats.budget,
+			stats.hits, stats.misses, stats.renders, stats.staleRenders, stats.renderTime, stats.evictions];
+}
+
+- (void)dealloc {
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+
+	[renderQueue cancelAllOperations];
+	[renderQueue release];
+	[requests release];
+	[tiles release];
+	[super dealloc];
+}
+
+@end
@@ -27,6 +27,18 @@
 #endif
 
 @class PhiTextDocument;
+@protocol PhiTextTileRenderer;
+
+typedef struct {
+	/*! Number of tiles drawn (by every PhiTextView). */
+	NSUInteger tilesDrawn;
+	/*! Number of lines ruled on the lined background. */
+	NSUInteger linesRuled;
+	/*! Total time spent drawing tiles (in seconds). */
+	double drawTime;
+	/*! The part of drawTime spent building and stroking the ruled lines. */
+	double guidelineTime;
+} PhiTextDrawStatistics;
 //@class PhiTextSelectionView;
 
 @interface PhiTextView : UIView {
@@ -44,7 +56,16 @@
 @property (nonatomic, assign) PhiTextDocument *document;
 //@property (nonatomic, assign) PhiTextSelectionView *selectionView;
 
+/*! The draw-time statistics of every PhiTextView, so that the cost of the lined background can be measured. */
++ (PhiTextDrawStatistics)drawStatistics;
++ (void)resetDrawStatistics;
+
 /*! Called before adding the reciever to a container view. */
 - (void)prepareForReuse;
 
+/*! The delegate of the text layer, if it can render tiles for the document's tileCache; otherwise nil. */
+- (id <PhiTextTileRenderer>)tileRenderer;
+/*! The pixel scale at which the text layer is drawn. */
+- (CGFloat)tileScale;
+
 @end
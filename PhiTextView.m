@@ -20,8 +20,11 @@
 #import "PhiTextView.h"
 #import "PhiTextDocument.h"
 #import "PhiTextFrame.h"
+#import "PhiTextTileCache.h"
+#import "PhiTextLayoutSnapshot.h"
 //#import "PhiTextSelectionView.h"
 #import "PhiTextLine.h"
+#import "PhiTextLayoutEngine.h"
 #import "PhiAATree.h"
 
 #ifndef PHI_PIXEL_PERFECT_MAG
@@ -43,6 +46,8 @@
 NSString * const kPhiTextViewLayerOwner = @"PhiTextViewLayerOwner";
 NSString * const kPhiTextViewLayerNeedsClear = @"PhiTextViewLayerNeedsClear";
 
+static PhiTextDrawStatistics PhiTextViewDrawStatistics = {0, 0, 0.0, 0.0};
+
 @interface PhiTextView ()
 
 @property (nonatomic, readonly) CALayer *textLayer;
@@ -55,7 +60,7 @@ NSString * const kPhiTextViewLayerNeedsClear = @"PhiTextViewLayerNeedsClear";
 
 #pragma mark -
 
-@interface PhiTextViewLayerDelegate : NSObject {
+@interface PhiTextViewLayerDelegate : NSObject <PhiTextTileRenderer> {
 	UIColor *lineColor;
 	CGFloat lineWidth;
 	BOOL displayDottedThirds;
@@ -95,6 +100,153 @@ static void PhiTextViewBackgroundPattern (void *info, CGContextRef context) {
     CGContextFillPath(context);
 }
 
+/*! Draws the text of document that lies in rect from the layout snapshot of rect, typesetting its frames if need be. */
+- (void)drawTileRect:(CGRect)rect ofDocument:(PhiTextDocument *)document inContext:(CGContextRef)context {
+	CGRect documentBounds = CGRectOffset(rect, -[document paddingLeft], -[document paddingTop]);
+	[self drawTileRect:rect withSnapshot:[document layoutSnapshotForRect:documentBounds] ofDocument:document inContext:context];
+}
+/*!
+ Draws the text of document (and its ruled lines) that lies in rect, in the coordinates of the document's owner.
+ The text is drawn from a snapshot of the layout, so the store isn't locked.
+ The ruled lines of every frame in the tile are stroked as one path (and the dotted thirds as another), from
+ the guidelines each frame cached when it was typeset.
+ */
+- (void)drawTileRect:(CGRect)rect withSnapshot:(PhiTextLayoutSnapshot *)snapshot ofDocument:(PhiTextDocument *)document inContext:(CGContextRef)context {
+	CFAbsoluteTime drawStart = CFAbsoluteTimeGetCurrent();
+	CFAbsoluteTime guidelineTime;
+	NSUInteger linesRuled = 0;
+	CGRect documentBounds = CGRectOffset(rect, -[document paddingLeft], -[document paddingTop]);
+	id <PhiTextLayoutEngine> engine = [snapshot layoutEngine];
+
+#ifdef DRAW_HOLDING_PATTERN
+	CGContextClearRect(context, rect);
+#endif
+	
+	//Draw Text
+	CGContextSaveGState(context); {
+		CGContextTranslateCTM(context, [document paddingLeft], [document paddingTop]);
+		CGContextScaleCTM(context, 1.0, -1.0);
+		CGContextSetFillColorWithColor(context, document.currentColor.CGColor);
+		CGContextSetStrokeColorWithColor(context, document.currentColor.CGColor);
+		CGContextSetTextMatrix(context, CGAffineTransformIdentity);
+		CGRect textFrameRect;
+		//Draw ruled lines
+		if (self.lineWidth != 0.0f && self.lineColor
+			&& ![self.lineColor isEqual:[UIColor clearColor]]) {
+			CGMutablePathRef ruledPath = CGPathCreateMutable();
+			CGMutablePathRef thirdsPath = self.displayDottedThirds ? CGPathCreateMutable() : NULL;
+			CGFloat xMin = CGRectGetMinX(rect) - [document paddingLeft];
+			CGFloat xMax = CGRectGetMaxX(rect);
+			CGFloat frameY, y;
+			const PhiTextFrameGuideline *guidelines;
+			CFIndex i, count;
+			for (PhiTextFrameSnapshot *textFrame in [snapshot textFrames]) {
+				textFrameRect = [textFrame rect];
+				if (!CGRectIntersectsRect(documentBounds, textFrameRect))
+					continue;
+				frameY = -1.0 * (textFrameRect.size.height + textFrameRect.origin.y + textFrame.tileOffset.y);
+				guidelines = [textFrame guidelines];
+				count = textFrame.lineCount;
+				for (i = 0; i < count; i++) {
+					y = frameY + guidelines[i].baseline - self.lineWidth / 2.0;
+					CGPathMoveToPoint(ruledPath, NULL, xMin, y);
+					CGPathAddLineToPoint(ruledPath, NULL, xMax, y);
+					if (thirdsPath) {
+						if (guidelines[i].xHeight) {
+							y = frameY + guidelines[i].baseline + guidelines[i].xHeight;
+							CGPathMoveToPoint(thirdsPath, NULL, xMin, y);
+							CGPathAddLineToPoint(thirdsPath, NULL, xMax, y);
+						}
+						y = frameY + guidelines[i].baseline - guidelines[i].descent;
+						CGPathMoveToPoint(thirdsPath, NULL, xMin, y);
+						CGPathAddLineToPoint(thirdsPath, NULL, xMax, y);
+					}
+				}
+				linesRuled += count;
+			}
+			CGContextSaveGState(context); {
+				CGContextSetStrokeColorWithColor(context, self.lineColor.CGColor);
+				CGContextSetLineWidth(context, self.lineWidth);
+				if (!CGPathIsEmpty(ruledPath)) {
+					CGContextAddPath(context, ruledPath);
+					CGContextStrokePath(context);
+				}
+				if (thirdsPath && !CGPathIsEmpty(thirdsPath)) {
+					CGFloat lengths[] = {3, PHI * 3};
+					CGContextSetLineDash(context, 10, lengths, 2);
+					CGContextAddPath(context, thirdsPath);
+					CGContextStrokePath(context);
+				}
+			} CGContextRestoreGState(context);
+			CGPathRelease(ruledPath);
+			if (thirdsPath)
+				CGPathRelease(thirdsPath);
+		}
+		guidelineTime = CFAbsoluteTimeGetCurrent() - drawStart;
+		for (PhiTextFrameSnapshot *textFrame in [snapshot textFrames]) {
+			textFrameRect = [textFrame rect];
+			if (CGRectIntersectsRect(documentBounds, textFrameRect)) {
+#ifdef DRAW_OUTLINE
+				//Draw text frame outlines
+				CGContextSaveGState(context); {
+					CGContextScaleCTM(context, 1.0, -1.0);
+					CGContextSetBlendMode(context, kCGBlendModeNormal);
+					if ([textFrame isLastEmptyFrame]) {
+						CGContextSetFillColorWithColor(context, [[[UIColor brownColor] colorWithAlphaComponent:0.5] CGColor]);
+					} else {
+						CGRect top, bottom;
+						CGRectDivide(textFrameRect, &top, &bottom, ((CGFloat)[document tileHeightHint]) - 12.0, CGRectMinYEdge);
+						if ([textFrame isLeftChild])
+							CGContextSetFillColorWithColor(context, [[[UIColor redColor] colorWithAlphaComponent:(CGFloat)[textFrame treeLevel]/6.0] CGColor]);
+						else
+							CGContextSetFillColorWithColor(context, [[[UIColor magentaColor] colorWithAlphaComponent:(CGFloat)[textFrame treeLevel]/6.0] CGColor]);
+						CGContextFillRect(context, textFrameRect);
+						textFrameRect = bottom;
+					}
+					CGContextFillRect(context, textFrameRect);
+				} CGContextRestoreGState(context);
+				textFrameRect = [textFrame rect];
+#endif
+				CGContextSaveGState(context); {
+					CGContextTranslateCTM(context, 0.0, -1.0 * (textFrameRect.size.height + textFrameRect.origin.y + textFrame.tileOffset.y));
+#if DEBUG_LINE_NUMBERS
+					CGContextSaveGState(context); {
+						CGFontRef font = CGFontCreateWithFontName((CFStringRef)@"Helvetica");
+						const PhiTextFrameGuideline *guidelines = [textFrame guidelines];
+						CGContextSetFont(context, font);
+						CGContextSetFontSize(context, 10.0);
+						CGFontRelease(font);
+						for (int i = 0; i < [textFrame lineCount]; i++) {
+							NSString *numberText = [NSString stringWithFormat:@"%i", [textFrame firstLineNumber] + i];
+							CGGlyph glyphStr[[numberText length]];
+							const char *charStr = [numberText UTF8String];
+							for (int j = 0; j < [numberText length]; j++)
+								glyphStr[j] = charStr[j] - 29;
+							CGContextShowGlyphsAtPoint(context, 2.0 - [document paddingLeft], guidelines[i].baseline, glyphStr, [numberText length]);
+						}
+					} CGContextRestoreGState(context);
+#endif
+					CFTypeRef _frame = [textFrame layoutFrame];
+					NSAttributedString *paintString = [textFrame paintString];
+					if (_frame) {
+						if (paintString && [engine respondsToSelector:@selector(drawFrame:withPaintFromAttributedString:inContext:)])
+							[engine drawFrame:_frame withPaintFromAttributedString:paintString inContext:context];
+						else
+							[engine drawFrame:_frame inContext:context];
+					}
+				} CGContextRestoreGState(context);
+			}
+		}
+	} CGContextRestoreGState(context);
+
+	@synchronized([PhiTextView class]) {
+		PhiTextViewDrawStatistics.tilesDrawn++;
+		PhiTextViewDrawStatistics.linesRuled += linesRuled;
+		PhiTextViewDrawStatistics.guidelineTime += guidelineTime;
+		PhiTextViewDrawStatistics.drawTime += CFAbsoluteTimeGetCurrent() - drawStart;
+	}
+}
+
 - (void)drawLayer:(CALayer *)layer
         inContext:(CGContextRef)context {
 	CGContextSaveGState(context);
@@ -104,15 +256,12 @@ static void PhiTextViewBackgroundPattern (void *info, CGContextRef context) {
 #ifdef DEVELOPER
 	NSLog(@"%@Entering -[PhiTextView drawLayer:%@ inRect:(%.1f, %.1f) (%.1f, %.1f)] layer.bounds:(%.1f, %.1f) (%.1f, %.1f)...", traceIndent, layer, CGRectComp(CGContextGetClipBoundingBox(context)), CGRectComp(layer.bounds));
 #endif
-	PhiAATreeRange *textFrameRange;
-	PhiTextFrame *textFrame;
 	CGFloat magnification = 1.0;
 #if PHI_PIXEL_PERFECT_MAG
 	magnification = [defaults floatForKey:@"magnification"];
 	CGContextScaleCTM(context, magnification, magnification);
 #endif
 	CGRect rect = CGContextGetClipBoundingBox(context);
-	CGRect documentBounds = CGRectOffset(rect, -[view.document paddingLeft], -[view.document paddingTop]);
 #ifdef DEVELOPER
 	NSLog(@"%@Drawing rect:(%.1f, %.1f) (%.1f, %.1f) view.frame:(%.1f, %.1f) (%.1f, %.1f)...", traceIndent, CGRectComp(rect), CGRectComp(view.frame));
 #endif
@@ -151,130 +300,27 @@ static void PhiTextViewBackgroundPattern (void *info, CGContextRef context) {
 	} else
 		CGContextClearRect(context, rect);
 #endif
-	@synchronized(view.document.store) {//Thanks Philippe
-		textFrameRange = [view.document beginContentAccessInRect:documentBounds updateDisplay:NO];
-#ifdef DRAW_HOLDING_PATTERN
-		CGContextClearRect(context, rect);
-#endif
-		
-		//Draw Text
-		CGContextSaveGState(context); {
-			CGContextTranslateCTM(context, [view.document paddingLeft], [view.document paddingTop]);
-			CGContextScaleCTM(context, 1.0, -1.0);
-			CGContextSetFillColorWithColor(context, view.document.currentColor.CGColor);
-			CGContextSetStrokeColorWithColor(context, view.document.currentColor.CGColor);
-			CGContextSetTextMatrix(context, CGAffineTransformIdentity);
-			if (textFrameRange) {
-#ifdef DRAW_OUTLINE
-				PhiAATreeNode *currentNode = textFrameRange.start;
-#endif
-				CGRect textFrameRect;
-				for (textFrame in textFrameRange) {
-					textFrameRect = [textFrame rect];
-					if (CGRectIntersectsRect(documentBounds, textFrameRect)) {
-#ifdef DRAW_OUTLINE
-						//Draw text frame outlines
-						CGContextSaveGState(context); {
-							CGContextScaleCTM(context, 1.0, -1.0);
-							CGContextSetBlendMode(context, kCGBlendModeNormal);
-							if (textFrame == [view.document lastEmptyFrame]) {
-								CGContextSetFillColorWithColor(context, [[[UIColor brownColor] colorWithAlphaComponent:0.5] CGColor]);
-							} else {
-								CGRect top, bottom;
-								CGRectDivide(textFrameRect, &top, &bottom, ((CGFloat)[view.document tileHeightHint]) - 12.0, CGRectMinYEdge);
-								if (![currentNode up] || currentNode == [[currentNode up] left])
-									CGContextSetFillColorWithColor(context, [[[UIColor redColor] colorWithAlphaComponent:(CGFloat)((int)[currentNode level])/6.0] CGColor]);
-								else
-									CGContextSetFillColorWithColor(context, [[[UIColor magentaColor] colorWithAlphaComponent:(CGFloat)((int)[currentNode level])/6.0] CGColor]);
-								CGContextFillRect(context, textFrameRect);
-								textFrameRect = bottom;
-							}
-							CGContextFillRect(context, textFrameRect);
-							currentNode = currentNode.next;
-						} CGContextRestoreGState(context);
-#endif
-						CGContextSaveGState(context); {
-							CGContextTranslateCTM(context, 0.0, -1.0 * (textFrameRect.size.height + textFrameRect.origin.y + textFrame.tileOffset.y));
-							if (self.lineWidth != 0.0f && self.lineColor
-								&& ![self.lineColor isEqual:[UIColor clearColor]]) {
-								CGContextSaveGState(context); {
-									CGContextSetStrokeColorWithColor(context, self.lineColor.CGColor);
-									CGContextSetLineWidth(context, self.lineWidth);
-									CGContextSaveGState(context); {
-										CGContextBeginPath(context);
-										CGPoint lineOrigin;
-										CFIndex count = textFrame.lineCount;
-										CFRange lineRange = CFRangeMake(0, 1);
-										for (; lineRange.location < count; lineRange.location++) {
-											CTFrameRef _frame = [textFrame copyCTFrame];
-											//line = [textFrame lineAtIndex:lineRange.location];
-											CTFrameGetLineOrigins(_frame, lineRange, &lineOrigin);
-											CGContextMoveToPoint(context, CGRectGetMinX(view.frame) - [view.document paddingLeft], lineOrigin.y - self.lineWidth / 2.0);
-											CGContextAddLineToPoint(context, CGRectGetMaxX(view.frame), lineOrigin.y - self.lineWidth / 2.0);
-											CFRelease(_frame);
-										}
-										CGContextStrokePath(context);
-									} CGContextRestoreGState(context);
-									if (self.displayDottedThirds) {
-										CGContextSaveGState(context); {
-											CGFloat lengths[] = {3, PHI * 3};
-											CGFloat xheight;
-											CGContextSetLineDash(context, 10, lengths, 2);
-											CGContextBeginPath(context);
-											PhiTextLine *line;
-											CFIndex count = textFrame.lineCount;
-											CFRange lineRange = CFRangeMake(0, 1);
-											for (; lineRange.location < count; lineRange.location++) {
-												line = [textFrame lineAtIndex:lineRange.location];
-												//CFIndex attrCount = CFDictionaryGetCount((CFDictionaryRef) CTRunGetAttributes((CTRunRef)CFArrayGetValueAtIndex((CFArrayRef)CTLineGetGlyphRuns([line textLine]), 0)));
-												//CFStringRef keys[attrCount], values[attrCount];
-												//CFDictionaryGetKeysAndValues((CFDictionaryRef)CTRunGetAttributes((CFTypeRef)CFArrayGetValueAtIndex((CFArrayRef)CTLineGetGlyphRuns([line textLine]), 0)), &keys, &values);
-												xheight = CTFontGetXHeight((CTFontRef)CFDictionaryGetValue(CTRunGetAttributes((CTRunRef)CFArrayGetValueAtIndex(CTLineGetGlyphRuns([line textLine]), 0)), kCTFontAttributeName));
-												CGFloat xMin = CGRectGetMinX(view.frame) - [view.document paddingLeft];
-												CGFloat xMax = CGRectGetMaxX(view.frame);
-												CGFloat yXheight = line.originInFrame.y + xheight; //- self.lineWidth / 2.0;
-												CGFloat yDescent = line.originInFrame.y - line.descent; //- self.lineWidth / 2.0;
-												if (xheight) {
-													CGContextMoveToPoint(context, xMin, yXheight);
-													CGContextAddLineToPoint(context, xMax, yXheight);
-												}
-												CGContextMoveToPoint(context, xMin, yDescent);
-												CGContextAddLineToPoint(context, xMax, yDescent);
-											}
-											CGContextStrokePath(context);
-										} CGContextRestoreGState(context);
-									}
-								} CGContextRestoreGState(context);
-							}
-#if DEBUG_LINE_NUMBERS
-							CGContextSaveGState(context); {
-								CGFontRef font = CGFontCreateWithFontName((CFStringRef)@"Helvetica");
-								CGContextSetFont(context, font);
-								CGContextSetFontSize(context, 10.0);
-								CGFontRelease(font);
-								for (int i = 0; i < [textFrame lineCount]; i++) {
-									PhiTextLine *line = [textFrame lineAtIndex:i];
-									NSString *numberText = [NSString stringWithFormat:@"%i", [line number]];
-									CGGlyph glyphStr[[numberText length]];
-									const char *charStr = [numberText UTF8String];
-									for (int j = 0; j < [numberText length]; j++)
-										glyphStr[j] = charStr[j] - 29;
-									CGContextShowGlyphsAtPoint(context, 2.0 - [view.document paddingLeft], line.originInFrame.y, glyphStr, [numberText length]);
-								}
-							} CGContextRestoreGState(context);
-#endif
-							CTFrameRef _frame = [textFrame copyCTFrame];
-							CTFrameDraw(_frame, context);
-							CFRelease(_frame);
-						} CGContextRestoreGState(context);
-					}
-				}
-			}
-		} CGContextRestoreGState(context);
-		[view.textLayer setValue:[NSNumber numberWithBool:NO] forKey:kPhiTextViewLayerNeedsClear];
-		for (textFrame in textFrameRange)
-            [textFrame endContentAccess];
+	PhiTextTileCache *tileCache = [view.document tileCache];
+	if (tileCache) {
+		// Composite the tile from the cache, if possible, otherwise draw it and have it cached in the background
+		CGRect tileRect = view.frame;
+		CGFloat scale = magnification * [layer contentsScale];
+		CGImageRef image = [tileCache copyImageForTileRect:tileRect scale:scale];
+		if (image) {
+			CGContextSaveGState(context); {
+				CGContextTranslateCTM(context, CGRectGetMinX(tileRect), CGRectGetMaxY(tileRect));
+				CGContextScaleCTM(context, 1.0, -1.0);
+				CGContextDrawImage(context, CGRectMake(0.0, 0.0, tileRect.size.width, tileRect.size.height), image);
+			} CGContextRestoreGState(context);
+			CGImageRelease(image);
+		} else {
+			[self drawTileRect:rect ofDocument:view.document inContext:context];
+			[tileCache renderTileRect:tileRect scale:scale ofDocument:view.document withRenderer:self];
+		}
+	} else {
+		[self drawTileRect:rect ofDocument:view.document inContext:context];
 	}
+	[view.textLayer setValue:[NSNumber numberWithBool:NO] forKey:kPhiTextViewLayerNeedsClear];
 	
 	CGContextRestoreGState(context);
 	
@@ -486,6 +532,20 @@ static PhiTextViewSelectionLayerDelegate *sharedSelectionLayerDelegate = nil;
 	}
 }
 
++ (PhiTextDrawStatistics)drawStatistics {
+	PhiTextDrawStatistics rv;
+	@synchronized([PhiTextView class]) {
+		rv = PhiTextViewDrawStatistics;
+	}
+	return rv;
+}
+
++ (void)resetDrawStatistics {
+	@synchronized([PhiTextView class]) {
+		memset(&PhiTextViewDrawStatistics, 0, sizeof(PhiTextViewDrawStatistics));
+	}
+}
+
 @synthesize document;//, selectionView;
 
 #pragma mark View Methods
@@ -606,6 +666,22 @@ static PhiTextViewSelectionLayerDelegate *sharedSelectionLayerDelegate = nil;
 	[self setFrame:CGRectZero];
 }
 
+- (id <PhiTextTileRenderer>)tileRenderer {
+	id layerDelegate = [textLayer delegate];
+	if ([layerDelegate conformsToProtocol:@protocol(PhiTextTileRenderer)])
+		return layerDelegate;
+	return nil;
+}
+- (CGFloat)tileScale {
+	CGFloat magnification = 1.0;
+#if PHI_PIXEL_PERFECT_MAG
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	[defaults addSuiteNamed:@"com.phitext"];
+	magnification = [defaults floatForKey:@"magnification"];
+#endif
+	return magnification * [textLayer contentsScale];
+}
+
 - (void)layoutSubviews {
 	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
 	[defaults addSuiteNamed:@"com.phitext"];
@@ -0,0 +1,196 @@
+//
+//  PhiTextAnchorSetTests.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "PhiTextAnchorSet.h"
+
+/*! Number of anchors in the typing benchmark. */
+#ifndef PHI_ANCHOR_TEST_COUNT
+#define PHI_ANCHOR_TEST_COUNT 100000
+#endif
+/*! Number of keystrokes typed in the benchmark. */
+#ifndef PHI_ANCHOR_TEST_KEYSTROKES
+#define PHI_ANCHOR_TEST_KEYSTROKES 10000
+#endif
+
+/*! Where an anchor at location should be after the edit, by the rules of the set, computed naively. */
+static NSUInteger PhiReferenceLocation(NSUInteger location, PhiTextAnchorStickiness stickiness, NSRange range, NSUInteger length) {
+	if (location < range.location)
+		return location;
+	if (location > NSMaxRange(range))
+		return location + length - range.length;
+	if (range.length && location == range.location)
+		return range.location;
+	if (range.length && location == NSMaxRange(range))
+		return range.location + length;
+	return stickiness == PhiTextAnchorStickyForward ? range.location + length : range.location;
+}
+
+@interface PhiTextAnchorSetTests : SenTestCase {
+	PhiTextAnchorSet *anchors;
+	uint32_t seed;
+}
+
+@end
+
+@implementation PhiTextAnchorSetTests
+
+- (uint32_t)nextRandom {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+- (void)setUp {
+	[super setUp];
+	seed = 20130901;
+	anchors = [[PhiTextAnchorSet alloc] init];
+}
+
+- (void)tearDown {
+	[anchors release];
+	anchors = nil;
+	[super tearDown];
+}
+
+- (void)testInsertionMovesLaterAnchors {
+	PhiTextAnchor *before = [anchors newAnchorAtLocation:3 stickiness:PhiTextAnchorStickyForward];
+	PhiTextAnchor *after = [anchors newAnchorAtLocation:10 stickiness:PhiTextAnchorStickyBackward];
+	[anchors textDidReplaceCharactersInRange:NSMakeRange(5, 0) withLength:4];
+	STAssertEquals(before.location, (NSUInteger)3, nil);
+	STAssertEquals(after.location, (NSUInteger)14, nil);
+	[anchors textDidReplaceCharactersInRange:NSMakeRange(0, 2) withLength:0];
+	STAssertEquals(before.location, (NSUInteger)1, nil);
+	STAssertEquals(after.location, (NSUInteger)12, nil);
+	STAssertEquals([anchors count], (NSUInteger)2, nil);
+	[before release];
+	[after release];
+	STAssertEquals([anchors count], (NSUInteger)0, nil);
+}
+
+- (void)testStickinessAtAnInsertion {
+	PhiTextAnchor *forward = [anchors newAnchorAtLocation:5 stickiness:PhiTextAnchorStickyForward];
+	PhiTextAnchor *backward = [anchors newAnchorAtLocation:5 stickiness:PhiTextAnchorStickyBackward];
+	[anchors textDidReplaceCharactersInRange:NSMakeRange(5, 0) withLength:3];
+	STAssertEquals(forward.location, (NSUInteger)8, nil);
+	STAssertEquals(backward.location, (NSUInteger)5, nil);
+	[forward release];
+	[backward release];
+}
+
+- (void)testReplacementCollapsesAnchors {
+	PhiTextAnchor *atStart = [anchors newAnchorAtLocation:10 stickiness:PhiTextAnchorStickyForward];
+	PhiTextAnchor *forward = [anchors newAnchorAtLocation:12 stickiness:PhiTextAnchorStickyForward];
+	PhiTextAnchor *backward = [anchors newAnchorAtLocation:15 stickiness:PhiTextAnchorStickyBackward];
+	PhiTextAnchor *atEnd = [anchors newAnchorAtLocation:20 stickiness:PhiTextAnchorStickyBackward];
+	[anchors textDidReplaceCharactersInRange:NSMakeRange(10, 10) withLength:2];
+	STAssertEquals(atStart.location, (NSUInteger)10, @"An anchor at the start of a replacement stays there.");
+	STAssertEquals(forward.location, (NSUInteger)12, nil);
+	STAssertEquals(backward.location, (NSUInteger)10, nil);
+	STAssertEquals(atEnd.location, (NSUInteger)12, @"An anchor at the end of a replacement stays there.");
+	STAssertEquals([anchors statistics].anchorsCollapsed, (NSUInteger)4, nil);
+	[atStart release];
+	[forward release];
+	[backward release];
+	[atEnd release];
+}
+
+- (void)testSetLocation {
+	PhiTextAnchor *anchor = [anchors newAnchorAtLocation:5 stickiness:PhiTextAnchorStickyForward];
+	PhiTextAnchor *other = [anchors newAnchorAtLocation:7 stickiness:PhiTextAnchorStickyForward];
+	anchor.location = 9;
+	[anchors textDidReplaceCharactersInRange:NSMakeRange(8, 0) withLength:1];
+	STAssertEquals(anchor.location, (NSUInteger)10, nil);
+	STAssertEquals(other.location, (NSUInteger)7, nil);
+	STAssertEquals([anchors count], (NSUInteger)2, nil);
+	[anchor release];
+	[other release];
+}
+
+- (void)testAnchorOutlivesItsSet {
+	PhiTextAnchor *anchor = [anchors newAnchorAtLocation:5 stickiness:PhiTextAnchorStickyForward];
+	[anchors release];
+	anchors = nil;
+	STAssertNil(anchor.anchorSet, nil);
+	STAssertEquals(anchor.location, (NSUInteger)NSNotFound, nil);
+	[anchor release];
+}
+
+- (void)testRandomEditsMatchReference {
+	NSMutableArray *made = [NSMutableArray array];
+	NSUInteger *expected = malloc(1000 * sizeof(NSUInteger));
+	NSUInteger i, j, textLength = 10000, length;
+	PhiTextAnchor *anchor;
+	NSRange range;
+	for (i = 0; i < 1000; i++) {
+		expected[i] = [self nextRandom] % (textLength + 1);
+		anchor = [anchors newAnchorAtLocation:expected[i] stickiness:i % 2 ? PhiTextAnchorStickyForward : PhiTextAnchorStickyBackward];
+		[made addObject:anchor];
+		[anchor release];
+	}
+	for (j = 0; j < 500; j++) {
+		range.location = [self nextRandom] % (textLength + 1);
+		range.length = MIN([self nextRandom] % 50, textLength - range.location);
+		length = [self nextRandom] % 50;
+		[anchors textDidReplaceCharactersInRange:range withLength:length];
+		textLength = textLength - range.length + length;
+		for (i = 0; i < 1000; i++)
+			expected[i] = PhiReferenceLocation(expected[i], [[made objectAtIndex:i] stickiness], range, length);
+	}
+	for (i = 0; i < 1000; i++)
+		STAssertEquals([[made objectAtIndex:i] location], expected[i], @"Anchor %u", i);
+	free(expected);
+}
+
+- (void)testTypingAmongManyAnchors {
+	NSMutableArray *made = [NSMutableArray arrayWithCapacity:PHI_ANCHOR_TEST_COUNT];
+	NSUInteger i, caret = 500000, first, last;
+	PhiTextAnchor *anchor;
+	PhiTextAnchorStatistics statistics;
+	CFAbsoluteTime start, time;
+	// An anchor every ten characters of a million character text
+	for (i = 0; i < PHI_ANCHOR_TEST_COUNT; i++) {
+		anchor = [anchors newAnchorAtLocation:i * 10 stickiness:PhiTextAnchorStickyForward];
+		[made addObject:anchor];
+		[anchor release];
+	}
+	[anchors resetStatistics];
+	start = CFAbsoluteTimeGetCurrent();
+	for (i = 0; i < PHI_ANCHOR_TEST_KEYSTROKES; i++) {
+		// Type a character, and delete one every fourth keystroke
+		if (i % 4 == 3) {
+			[anchors textDidReplaceCharactersInRange:NSMakeRange(caret - 1, 1) withLength:0];
+			caret--;
+		} else {
+			[anchors textDidReplaceCharactersInRange:NSMakeRange(caret, 0) withLength:1];
+			caret++;
+		}
+	}
+	time = CFAbsoluteTimeGetCurrent() - start;
+	statistics = [anchors statistics];
+	first = [[made objectAtIndex:0] location];
+	last = [[made lastObject] location];
+	STAssertEquals(statistics.edits, (NSUInteger)PHI_ANCHOR_TEST_KEYSTROKES, nil);
+	STAssertEquals(first, (NSUInteger)0, nil);
+	STAssertEquals(last, (NSUInteger)(PHI_ANCHOR_TEST_COUNT - 1) * 10 + caret - 500000, nil);
+	NSLog(@"Typed %u keystrokes among %u anchors in %.3f seconds (%.3f ms per keystroke, slowest %.3f ms).",
+		  PHI_ANCHOR_TEST_KEYSTROKES, PHI_ANCHOR_TEST_COUNT, time,
+		  1000.0 * time / PHI_ANCHOR_TEST_KEYSTROKES, 1000.0 * statistics.maxUpdateTime);
+}
+
+@end
@@ -0,0 +1,133 @@
+//
+//  PhiTextBoundaryCacheTests.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "PhiTextBoundaryCache.h"
+
+@interface PhiTextBoundaryCacheTests : SenTestCase {
+	NSMutableString *text;
+	PhiTextBoundaryCache *cache;
+}
+
+@end
+
+@implementation PhiTextBoundaryCacheTests
+
+- (void)setUp {
+	[super setUp];
+	text = [[NSMutableString alloc] init];
+	cache = [[PhiTextBoundaryCache alloc] initWithSource:text];
+}
+
+- (void)tearDown {
+	[cache release];
+	[text release];
+	[super tearDown];
+}
+
+- (void)setText:(NSString *)string {
+	[text setString:string];
+	[cache invalidate];
+}
+
+/*! Returns every index of the text that is any of the specified boundaries. */
+- (NSIndexSet *)indexesOfBoundary:(PhiTextBoundary)boundary {
+	NSMutableIndexSet *rv = [NSMutableIndexSet indexSet];
+	NSUInteger i;
+	for (i = 0; i <= [text length]; i++)
+		if ([cache boundariesAtIndex:i] & boundary)
+			[rv addIndex:i];
+	return rv;
+}
+
+- (void)testWords {
+	NSMutableIndexSet *starts = [NSMutableIndexSet indexSet], *ends = [NSMutableIndexSet indexSet];
+	[self setText:@"Don't stop, 3.14 my_var."];
+	[starts addIndex:0]; [ends addIndex:5];
+	[starts addIndex:6]; [ends addIndex:10];
+	[starts addIndex:12]; [ends addIndex:16];
+	[starts addIndex:17]; [ends addIndex:23];
+	STAssertEqualObjects([self indexesOfBoundary:PhiTextWordStartBoundary], starts, nil);
+	STAssertEqualObjects([self indexesOfBoundary:PhiTextWordEndBoundary], ends, nil);
+}
+
+- (void)testSurrogatePairsAreNotSplit {
+	NSUInteger i;
+	// A mathematical script A (a letter outside the BMP) between words, and an emoji (not a word)
+	[self setText:@"a \U0001D49C\U0001D49C b \U0001F600 c"];
+	STAssertEquals([cache boundariesAtIndex:2] & PhiTextWordStartBoundary, (PhiTextBoundary)PhiTextWordStartBoundary, nil);
+	STAssertEquals([cache boundariesAtIndex:6] & PhiTextWordEndBoundary, (PhiTextBoundary)PhiTextWordEndBoundary, nil);
+	for (i = 0; i < [text length]; i++) {
+		if (CFStringIsSurrogateLowCharacter([text characterAtIndex:i]))
+			STAssertEquals([cache boundariesAtIndex:i], (PhiTextBoundary)0, @"Boundary within the surrogate pair at %u.", i);
+	}
+	STAssertEquals([cache boundariesAtIndex:9] & PhiTextWordStartBoundary, (PhiTextBoundary)0, @"An emoji isn't a word.");
+}
+
+- (void)testCJKIsSplitByDictionary {
+	// There are no spaces in the text, yet it has several words
+	[self setText:@"我们今天去北京"];
+	NSUInteger end = [cache indexOfBoundary:PhiTextWordEndBoundary afterIndex:0];
+	STAssertTrue(end != NSNotFound && end < [text length], @"The run of ideographs wasn't split.");
+	STAssertTrue([[self indexesOfBoundary:PhiTextWordStartBoundary] count] > 1, nil);
+}
+
+- (void)testParagraphs {
+	NSMutableIndexSet *starts = [NSMutableIndexSet indexSet], *ends = [NSMutableIndexSet indexSet];
+	// \n, \r\n, \r and U+2029 each end a paragraph; the \r and \n of a \r\n don't make an empty one
+	[self setText:@"ab\ncd\r\nef\rgh\u2029ij"];
+	[starts addIndex:0]; [ends addIndex:2];
+	[starts addIndex:3]; [ends addIndex:5];
+	[starts addIndex:7]; [ends addIndex:9];
+	[starts addIndex:10]; [ends addIndex:12];
+	[starts addIndex:13]; [ends addIndex:15];
+	STAssertEqualObjects([self indexesOfBoundary:PhiTextParagraphStartBoundary], starts, nil);
+	STAssertEqualObjects([self indexesOfBoundary:PhiTextParagraphEndBoundary], ends, nil);
+}
+
+- (void)testSentences {
+	[self setText:@"One. \"Two?\" Three\r\nFour"];
+	STAssertEquals([cache indexOfBoundary:PhiTextSentenceEndBoundary afterIndex:0], (NSUInteger)4, nil);
+	STAssertEquals([cache indexOfBoundary:PhiTextSentenceStartBoundary afterIndex:0], (NSUInteger)5, nil);
+	STAssertEquals([cache indexOfBoundary:PhiTextSentenceEndBoundary afterIndex:4], (NSUInteger)11, nil);
+	STAssertEquals([cache indexOfBoundary:PhiTextSentenceEndBoundary afterIndex:11], (NSUInteger)17, nil);
+	STAssertEquals([cache indexOfBoundary:PhiTextSentenceStartBoundary afterIndex:12], (NSUInteger)19, nil);
+}
+
+- (void)testEditsAreFollowed {
+	NSString *paragraph = @"The quick brown fox jumps over the lazy dog.\n";
+	NSUInteger i, index, reference;
+	for (i = 0; i < 100; i++)
+		[text appendString:paragraph];
+	[cache invalidate];
+	// Fill the cache, then insert a word near the start and check the boundaries far after it
+	[cache indexOfBoundary:PhiTextParagraphEndBoundary beforeIndex:[text length]];
+	[text replaceCharactersInRange:NSMakeRange(4, 0) withString:@"very "];
+	[cache textDidChangeInRange:NSMakeRange(4, 5) changeInLength:5];
+	index = [cache indexOfBoundary:PhiTextParagraphEndBoundary beforeIndex:[text length]];
+	STAssertEquals(index, [text length] - 1, nil);
+	STAssertEquals([cache boundariesAtIndex:4] & PhiTextWordStartBoundary, (PhiTextBoundary)PhiTextWordStartBoundary, nil);
+	STAssertEquals([cache indexOfBoundary:PhiTextWordEndBoundary afterIndex:4], (NSUInteger)8, nil);
+	// The boundaries of the cache that followed the edit are those of a cache that didn't
+	reference = [[self indexesOfBoundary:PhiTextWordStartBoundary | PhiTextSentenceEndBoundary] count];
+	[cache invalidate];
+	STAssertEquals([[self indexesOfBoundary:PhiTextWordStartBoundary | PhiTextSentenceEndBoundary] count], reference, nil);
+}
+
+@end
@@ -0,0 +1,169 @@
+//
+//  PhiTextDecorationsTests.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <CoreText/CoreText.h>
+#import "PhiTextDecorations.h"
+
+/*! Number of decorations, and of keystrokes typed among them, in the timed test. */
+#ifndef PHI_DECORATION_TEST_COUNT
+#define PHI_DECORATION_TEST_COUNT 10000
+#endif
+
+@interface PhiTextDecorationsTests : SenTestCase {
+	PhiTextDecorations *decorations;
+}
+
+@end
+
+@implementation PhiTextDecorationsTests
+
+- (void)setUp {
+	[super setUp];
+	decorations = [[PhiTextDecorations alloc] initWithDocument:nil];
+}
+
+- (void)tearDown {
+	[decorations release];
+	[super tearDown];
+}
+
+/*! Publishes a decoration of each name (the foreground colour, which is paint-only) over ranges, against the current version. */
+- (BOOL)publishNames:(NSArray *)names ranges:(const NSRange *)ranges inRange:(NSRange)region version:(NSUInteger)version {
+	NSMutableArray *attributes = [NSMutableArray arrayWithCapacity:[names count]];
+	for (NSString *name in names)
+		[attributes addObject:[NSDictionary dictionaryWithObject:name forKey:(NSString *)kCTForegroundColorAttributeName]];
+	return [decorations setAttributes:attributes ranges:ranges count:[names count] inRange:region forKey:@"test" version:version];
+}
+
+/*! Returns the decorated runs of the first length characters, as "location,length=name". */
+- (NSArray *)runsOfLength:(NSUInteger)length {
+	NSMutableAttributedString *string = [[[NSMutableAttributedString alloc] initWithString:[@"" stringByPaddingToLength:length withString:@" " startingAtIndex:0]] autorelease];
+	NSMutableArray *rv = [NSMutableArray array];
+	NSRange range = NSMakeRange(0, 0);
+	id value;
+	[decorations addAttributesToString:string atLocation:0];
+	while (NSMaxRange(range) < length) {
+		value = [string attribute:(NSString *)kCTForegroundColorAttributeName atIndex:NSMaxRange(range) longestEffectiveRange:&range inRange:NSMakeRange(0, length)];
+		if (value)
+			[rv addObject:[NSString stringWithFormat:@"%u,%u=%@", range.location, range.length, value]];
+	}
+	return rv;
+}
+
+- (void)testPublishSplitsDecorationsAtTheRegionEdges {
+	NSRange ranges[] = {NSMakeRange(0, 10), NSMakeRange(20, 10)};
+	NSRange replacement = NSMakeRange(8, 14);
+	STAssertTrue([self publishNames:[NSArray arrayWithObjects:@"a", @"b", nil] ranges:ranges inRange:NSMakeRange(0, 40) version:[decorations version]], nil);
+	// The region cuts both decorations; their parts outside it are kept
+	STAssertTrue([self publishNames:[NSArray arrayWithObject:@"c"] ranges:&replacement inRange:NSMakeRange(5, 20) version:[decorations version]], nil);
+	STAssertEqualObjects([self runsOfLength:40], ([NSArray arrayWithObjects:@"0,5=a", @"8,14=c", @"25,5=b", nil]), nil);
+}
+
+- (void)testPublishWithinADecorationKeepsBothEnds {
+	NSRange range = NSMakeRange(0, 20);
+	STAssertTrue([self publishNames:[NSArray arrayWithObject:@"a"] ranges:&range inRange:NSMakeRange(0, 20) version:[decorations version]], nil);
+	range = NSMakeRange(9, 2);
+	STAssertTrue([self publishNames:[NSArray arrayWithObject:@"b"] ranges:&range inRange:NSMakeRange(5, 10) version:[decorations version]], nil);
+	STAssertEqualObjects([self runsOfLength:20], ([NSArray arrayWithObjects:@"0,5=a", @"9,2=b", @"15,5=a", nil]), nil);
+	// An empty publish clears the region alone, and the head and tail still follow edits
+	STAssertTrue([self publishNames:[NSArray array] ranges:NULL inRange:NSMakeRange(5, 10) version:[decorations version]], nil);
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(0, 0) withLength:3];
+	STAssertEqualObjects([self runsOfLength:23], ([NSArray arrayWithObjects:@"3,5=a", @"18,5=a", nil]), nil);
+}
+
+- (void)testEditsMoveDecorations {
+	NSRange ranges[] = {NSMakeRange(2, 3), NSMakeRange(10, 4)};
+	STAssertTrue([self publishNames:[NSArray arrayWithObjects:@"a", @"b", nil] ranges:ranges inRange:NSMakeRange(0, 20) version:[decorations version]], nil);
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(0, 0) withLength:2];
+	STAssertEqualObjects([self runsOfLength:30], ([NSArray arrayWithObjects:@"4,3=a", @"12,4=b", nil]), nil);
+	// Text inserted at either end of a decoration isn't decorated
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(4, 0) withLength:2];
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(9, 0) withLength:1];
+	STAssertEqualObjects([self runsOfLength:30], ([NSArray arrayWithObjects:@"6,3=a", @"15,4=b", nil]), nil);
+	// Text inserted inside a decoration is
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(7, 0) withLength:1];
+	STAssertEqualObjects([self runsOfLength:30], ([NSArray arrayWithObjects:@"6,4=a", @"16,4=b", nil]), nil);
+	// A replacement across the end of a decoration keeps the part before it
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(18, 4) withLength:1];
+	STAssertEqualObjects([self runsOfLength:30], ([NSArray arrayWithObjects:@"6,4=a", @"16,2=b", nil]), nil);
+}
+
+- (void)testDeletionCollapsesDecoration {
+	NSRange ranges[] = {NSMakeRange(2, 3), NSMakeRange(10, 4)};
+	STAssertTrue([self publishNames:[NSArray arrayWithObjects:@"a", @"b", nil] ranges:ranges inRange:NSMakeRange(0, 20) version:[decorations version]], nil);
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(1, 5) withLength:0];
+	STAssertFalse([decorations hasDecorationsInRange:NSMakeRange(0, 4)], nil);
+	STAssertTrue([decorations hasDecorationsInRange:NSMakeRange(4, 2)], nil);
+	STAssertEqualObjects([self runsOfLength:20], ([NSArray arrayWithObject:@"5,4=b"]), nil);
+	// Text typed where the decoration was isn't decorated, and a publish over it drops it
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(1, 0) withLength:1];
+	STAssertEqualObjects([self runsOfLength:20], ([NSArray arrayWithObject:@"6,4=b"]), nil);
+	STAssertTrue([self publishNames:[NSArray array] ranges:NULL inRange:NSMakeRange(0, 3) version:[decorations version]], nil);
+	STAssertEquals([decorations statistics].decorationsCollapsed, (NSUInteger)1, nil);
+	STAssertEqualObjects([self runsOfLength:20], ([NSArray arrayWithObject:@"6,4=b"]), nil);
+}
+
+- (void)testPublishOfAnOlderVersionIsMapped {
+	NSUInteger version = [decorations version];
+	NSRange ranges[] = {NSMakeRange(2, 3), NSMakeRange(10, 4)};
+	// The analyser read the text, then the user typed before the first decoration and deleted the second
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(0, 0) withLength:5];
+	[decorations textDidReplaceCharactersInRange:NSMakeRange(15, 4) withLength:0];
+	STAssertTrue([self publishNames:[NSArray arrayWithObjects:@"a", @"b", nil] ranges:ranges inRange:NSMakeRange(0, 20) version:version], nil);
+	STAssertEqualObjects([self runsOfLength:30], ([NSArray arrayWithObject:@"7,3=a"]), nil);
+	STAssertEquals([decorations statistics].decorationsMapped, (NSUInteger)1, nil);
+}
+
+- (void)testStalePublishIsDropped {
+	NSUInteger version = [decorations version], i;
+	NSRange range = NSMakeRange(0, 1);
+	for (i = 0; i <= PHI_DECORATION_EDIT_LIMIT; i++)
+		[decorations textDidReplaceCharactersInRange:NSMakeRange(0, 0) withLength:1];
+	STAssertFalse([self publishNames:[NSArray arrayWithObject:@"a"] ranges:&range inRange:NSMakeRange(0, 1) version:version], nil);
+	STAssertFalse([self publishNames:[NSArray arrayWithObject:@"a"] ranges:&range inRange:NSMakeRange(0, 1) version:[decorations version] + 1], nil);
+	STAssertEquals([decorations statistics].stalePublishes, (NSUInteger)2, nil);
+	STAssertFalse([decorations hasDecorationsInRange:NSMakeRange(0, 100)], nil);
+}
+
+- (void)testTypingAmongManyDecorations {
+	NSRange *ranges = malloc(PHI_DECORATION_TEST_COUNT * sizeof(NSRange));
+	NSMutableArray *names = [NSMutableArray arrayWithCapacity:PHI_DECORATION_TEST_COUNT];
+	NSUInteger i;
+	CFAbsoluteTime time;
+	for (i = 0; i < PHI_DECORATION_TEST_COUNT; i++) {
+		ranges[i] = NSMakeRange(4 * i, 2);
+		[names addObject:@"a"];
+	}
+	STAssertTrue([self publishNames:names ranges:ranges inRange:NSMakeRange(0, 4 * PHI_DECORATION_TEST_COUNT) version:[decorations version]], nil);
+	free(ranges);
+	// Type at the start of the text, so that every decoration moves with every keystroke
+	time = CFAbsoluteTimeGetCurrent();
+	for (i = 0; i < PHI_DECORATION_TEST_COUNT; i++)
+		[decorations textDidReplaceCharactersInRange:NSMakeRange(0, 0) withLength:1];
+	time = CFAbsoluteTimeGetCurrent() - time;
+	STAssertFalse([decorations hasDecorationsInRange:NSMakeRange(0, PHI_DECORATION_TEST_COUNT)], nil);
+	STAssertTrue([decorations hasDecorationsInRange:NSMakeRange(PHI_DECORATION_TEST_COUNT, 1)], nil);
+	STAssertFalse([decorations hasDecorationsInRange:NSMakeRange(5 * PHI_DECORATION_TEST_COUNT - 2, 2)], nil);
+	STAssertTrue([decorations hasDecorationsInRange:NSMakeRange(5 * PHI_DECORATION_TEST_COUNT - 4, 1)], nil);
+	NSLog(@"Typed %u keystrokes before %u decorations in %.3f seconds (%.3f ms per keystroke).",
+		  PHI_DECORATION_TEST_COUNT, PHI_DECORATION_TEST_COUNT, time, 1000.0 * time / PHI_DECORATION_TEST_COUNT);
+}
+
+@end
@@ -0,0 +1,253 @@
+//
+//  PhiTextLayoutHarnessTests.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "PhiTextDocument.h"
+#import "PhiTextStorage.h"
+#import "PhiTextFrame.h"
+#import "PhiTextRange.h"
+#import "PhiTextFixedAdvanceLayoutEngine.h"
+#import "PhiTextCoreTextLayoutEngine.h"
+#import "PhiTextMonospaceLayoutEngine.h"
+#import "PhiAATree.h"
+
+/*! Number of characters of the text laid out by the harness. */
+#ifndef PHI_HARNESS_TEXT_LENGTH
+#define PHI_HARNESS_TEXT_LENGTH 1000000
+#endif
+/*! Number of scroll steps (each a viewport further down) and of edits in a scripted run. */
+#ifndef PHI_HARNESS_STEPS
+#define PHI_HARNESS_STEPS 200
+#endif
+/*! Number of characters of the text under the selection of the handle-drag run. */
+#ifndef PHI_HARNESS_SELECTION_TEXT_LENGTH
+#define PHI_HARNESS_SELECTION_TEXT_LENGTH 10000000
+#endif
+#define PHI_HARNESS_VIEWPORT_WIDTH 320.0
+#define PHI_HARNESS_VIEWPORT_HEIGHT 480.0
+
+/*!
+ Drives the frame management of PhiTextDocument (beginContentAccessInRect: and the invalidation
+ of edits) headless, i.e. without an editor view, with a scripted run of scrolls and edits over
+ a text generated from a fixed seed, so that both the layout and the timings are reproducible.
+ It is a logic test of the PhitextTests target, run on the iOS simulator: PhiTextDocument and
+ PhiTextFrame depend on UIKit (and the engines on Core Graphics), so there is no Foundation-only
+ (e.g. GNUstep) build of the harness.
+ */
+@interface PhiTextLayoutHarnessTests : SenTestCase {
+	PhiTextDocument *document;
+	uint32_t seed;
+}
+
+@end
+
+@implementation PhiTextLayoutHarnessTests
+
+/*! A linear congruential generator, rather than arc4random, so that every run is the same. */
+- (uint32_t)nextRandom {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+- (NSString *)textOfLength:(NSUInteger)length {
+	static NSString *words[] = {@"the", @"quick", @"brown", @"fox", @"jumps", @"over", @"a", @"lazy", @"dog", @"\tindented", @"line\n", @"paragraph.\n\n"};
+	NSMutableString *text = [NSMutableString stringWithCapacity:length + 16];
+	while ([text length] < length) {
+		[text appendString:words[[self nextRandom] % (sizeof(words) / sizeof(NSString *))]];
+		[text appendString:@" "];
+	}
+	return [text substringToIndex:length];
+}
+
+- (void)setUp {
+	[super setUp];
+	seed = 20130826;
+	document = [[PhiTextDocument alloc] init];
+	document.layoutEngine = [[[PhiTextFixedAdvanceLayoutEngine alloc] init] autorelease];
+	document.store = [[[PhiTextStorage alloc] initWithString:[self textOfLength:PHI_HARNESS_TEXT_LENGTH]] autorelease];
+}
+
+- (void)tearDown {
+	[document release];
+	document = nil;
+	[super tearDown];
+}
+
+/*! Accesses (and so typesets) the frames in rect, returning the time taken; checks that the frames are contiguous. */
+- (CFAbsoluteTime)accessRect:(CGRect)rect {
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent(), time;
+	PhiAATreeRange *range = [document beginContentAccessInRect:rect];
+	NSUInteger next = NSNotFound;
+	NSRange frameRange;
+	time = CFAbsoluteTimeGetCurrent() - start;
+	STAssertNotNil(range, @"No frames in %@.", NSStringFromCGRect(rect));
+	for (PhiTextFrame *textFrame in range) {
+		frameRange = [textFrame rangeValue];
+		if (next != NSNotFound)
+			STAssertEquals(frameRange.location, next, @"Frames in %@ aren't contiguous.", NSStringFromCGRect(rect));
+		next = NSMaxRange(frameRange);
+		[textFrame endContentAccess];
+	}
+	return time;
+}
+
+/*! Checks that the frames of the document, from its start, are contiguous and that their rects are stacked. */
+- (NSUInteger)checkFrames {
+	NSUInteger next = 0, count = 0;
+	CGFloat y = 0.0;
+	NSRange frameRange;
+	CGRect rect;
+	for (PhiAATreeNode *node = [[document textFrames] firstNode]; node; node = node.next) {
+		if (node.object == [document lastEmptyFrame])
+			break;
+		frameRange = [node.object rangeValue];
+		rect = [node.object CGRectValue];
+		if (frameRange.location != next)
+			break;
+		STAssertEqualsWithAccuracy(rect.origin.y, y, 0.5, @"Frame %u isn't stacked on the previous frame.", count);
+		next = NSMaxRange(frameRange);
+		y = CGRectGetMaxY(rect);
+		count++;
+	}
+	return next;
+}
+
+- (void)testScroll {
+	CFAbsoluteTime time = 0.0, slowest = 0.0, step;
+	NSUInteger i;
+	for (i = 0; i < PHI_HARNESS_STEPS; i++) {
+		step = [self accessRect:CGRectMake(0.0, i * PHI_HARNESS_VIEWPORT_HEIGHT, PHI_HARNESS_VIEWPORT_WIDTH, PHI_HARNESS_VIEWPORT_HEIGHT)];
+		time += step;
+		slowest = MAX(slowest, step);
+	}
+	STAssertTrue([self checkFrames] > 0, @"Nothing was laid out.");
+	NSLog(@"Scrolled %u viewports in %.3f seconds (%.3f ms per step, slowest %.3f ms); %u frames cover %u characters.",
+		  PHI_HARNESS_STEPS, time, 1000.0 * time / PHI_HARNESS_STEPS, 1000.0 * slowest, [[document textFrames] count], [self checkFrames]);
+}
+
+- (void)testTypingWhileScrolled {
+	CGRect viewport = CGRectMake(0.0, 20.0 * PHI_HARNESS_VIEWPORT_HEIGHT, PHI_HARNESS_VIEWPORT_WIDTH, PHI_HARNESS_VIEWPORT_HEIGHT);
+	PhiAATreeRange *range;
+	NSString *expected;
+	NSUInteger i, location;
+	CFAbsoluteTime time = 0.0;
+
+	[self accessRect:viewport];
+	range = [document beginContentAccessInRect:viewport];
+	location = [range.start.object rangeValue].location + 10;
+	for (PhiTextFrame *textFrame in range)
+		[textFrame endContentAccess];
+	expected = [document.store string];
+	for (i = 0; i < PHI_HARNESS_STEPS; i++) {
+		// Type a character, and delete one every fourth step
+		if (i % 4 == 3) {
+			[document.store deleteCharactersInRange:NSMakeRange(location - 1, 1)];
+			expected = [expected stringByReplacingCharactersInRange:NSMakeRange(location - 1, 1) withString:@""];
+			location--;
+		} else {
+			[document.store replaceCharactersInRange:NSMakeRange(location, 0) withString:@"x"];
+			expected = [expected stringByReplacingCharactersInRange:NSMakeRange(location, 0) withString:@"x"];
+			location++;
+		}
+		time += [self accessRect:viewport];
+	}
+	STAssertEqualObjects([document.store string], expected, nil);
+	STAssertTrue([self checkFrames] > location, @"The frames before the edit were lost.");
+	NSLog(@"Typed %u edits in a viewport %u characters into the text in %.3f seconds (%.3f ms per edit).",
+		  PHI_HARNESS_STEPS, location, time, 1000.0 * time / PHI_HARNESS_STEPS);
+}
+
+- (void)testLayoutIsDeterministic {
+	CGRect rect = CGRectMake(0.0, 0.0, PHI_HARNESS_VIEWPORT_WIDTH, 10.0 * PHI_HARNESS_VIEWPORT_HEIGHT);
+	NSMutableArray *first = [NSMutableArray array], *second = [NSMutableArray array];
+	PhiAATreeRange *range;
+
+	[self accessRect:rect];
+	for (PhiAATreeNode *node = [[document textFrames] firstNode]; node; node = node.next)
+		[first addObject:[NSValue valueWithRange:[node.object rangeValue]]];
+	[document invalidateDocument];
+	range = [document beginContentAccessInRect:rect];
+	for (PhiTextFrame *textFrame in range)
+		[textFrame endContentAccess];
+	for (PhiAATreeNode *node = [[document textFrames] firstNode]; node; node = node.next)
+		[second addObject:[NSValue valueWithRange:[node.object rangeValue]]];
+	STAssertEqualObjects(first, second, nil);
+}
+
+- (void)testColumnsAreCountedPerCluster {
+	PhiTextFixedAdvanceLayoutEngine *engine = [[[PhiTextFixedAdvanceLayoutEngine alloc] init] autorelease];
+	// e + combining acute, a wide ideograph, a fullwidth A, an emoji (a surrogate pair) and a tab
+	NSString *string = @"e\u0301\u6f22\uff21\U0001F600\t";
+	STAssertEquals([engine columnsOfString:string range:NSMakeRange(0, 2) fromColumn:0], (NSUInteger)1, nil);
+	STAssertEquals([engine columnsOfString:string range:NSMakeRange(2, 2) fromColumn:0], (NSUInteger)4, nil);
+	STAssertEquals([engine columnsOfString:string range:NSMakeRange(4, 2) fromColumn:0], (NSUInteger)2, nil);
+	STAssertEquals([engine columnsOfString:string range:NSMakeRange(0, [string length]) fromColumn:0], (NSUInteger)8, nil);
+	STAssertFalse([PhiTextMonospaceLayoutEngine canLayoutString:string range:NSMakeRange(0, [string length])], nil);
+	STAssertTrue([PhiTextMonospaceLayoutEngine canLayoutString:@"plain\tASCII\n" range:NSMakeRange(0, 12)], nil);
+}
+
+- (void)testCoreTextEngineGrowsFrames {
+	CFAbsoluteTime time;
+	document.layoutEngine = [[[PhiTextCoreTextLayoutEngine alloc] init] autorelease];
+	time = [self accessRect:CGRectMake(0.0, 0.0, PHI_HARNESS_VIEWPORT_WIDTH, 10.0 * PHI_HARNESS_VIEWPORT_HEIGHT)];
+	STAssertTrue([self checkFrames] > 0, @"Nothing was laid out.");
+	NSLog(@"Core Text laid out %u characters in %.3f seconds.", [self checkFrames], time);
+}
+
+/*!
+ Drags the start handle of a selection through the viewport while its end stays at the end of the text,
+ building the selection path clipped to the viewport for each step, as PhiTextSelectionView does.
+ */
+- (void)testSelectionPathOfAHandleDrag {
+	CGRect viewport = CGRectMake(0.0, 0.0, PHI_HARNESS_VIEWPORT_WIDTH, PHI_HARNESS_VIEWPORT_HEIGHT);
+	PhiAATreeRange *frames;
+	CGMutablePathRef path;
+	NSRange visible = NSMakeRange(NSNotFound, 0), frameRange;
+	NSUInteger i, length, start;
+	CFAbsoluteTime time = 0.0, slowest = 0.0, step;
+
+	document.store = [[[PhiTextStorage alloc] initWithString:[self textOfLength:PHI_HARNESS_SELECTION_TEXT_LENGTH]] autorelease];
+	length = [document.store length];
+	frames = [document beginContentAccessInRect:viewport];
+	for (PhiTextFrame *textFrame in frames) {
+		frameRange = [textFrame rangeValue];
+		visible = visible.location == NSNotFound ? frameRange : NSUnionRange(visible, frameRange);
+		[textFrame endContentAccess];
+	}
+	STAssertTrue(visible.length > 0, @"Nothing was laid out.");
+	for (i = 0; i < PHI_HARNESS_STEPS; i++) {
+		start = visible.location + i * visible.length / PHI_HARNESS_STEPS;
+		path = CGPathCreateMutable();
+		step = CFAbsoluteTimeGetCurrent();
+		[document buildPath:path forRange:[PhiTextRange textRangeWithRange:NSMakeRange(start, length - start)]
+					 inRect:viewport alignPixels:NO toView:nil];
+		step = CFAbsoluteTimeGetCurrent() - step;
+		STAssertFalse(CGPathIsEmpty(path), @"No path for the selection from %u.", start);
+		STAssertTrue(CGRectGetMaxY(CGPathGetBoundingBox(path)) <= CGRectGetMaxY(viewport) + 1.0, @"The path isn't clipped to the viewport.");
+		CGPathRelease(path);
+		time += step;
+		slowest = MAX(slowest, step);
+	}
+	// The end of the selection, at the end of the text, was never laid out
+	STAssertTrue([self checkFrames] < length / 2, @"The text beyond the viewport was laid out.");
+	NSLog(@"Dragged a handle %u steps over a selection to the end of %u characters in %.3f seconds (%.3f ms per frame, slowest %.3f ms).",
+		  PHI_HARNESS_STEPS, length, time, 1000.0 * time / PHI_HARNESS_STEPS, 1000.0 * slowest);
+}
+
+@end
@@ -0,0 +1,129 @@
+//
+//  PhiTextPositionTests.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "PhiTextDocument.h"
+#import "PhiTextStorage.h"
+#import "PhiTextFrame.h"
+#import "PhiTextLine.h"
+#import "PhiTextPosition.h"
+#import "PhiTextFixedAdvanceLayoutEngine.h"
+#import "PhiAATree.h"
+
+/*! Number of positions (each in a line) that are invalidated by the benchmark. */
+#ifndef PHI_POSITION_TEST_COUNT
+#define PHI_POSITION_TEST_COUNT 10000
+#endif
+
+@interface PhiTextPositionTests : SenTestCase {
+	PhiTextDocument *document;
+	NSMutableArray *textFrames;
+}
+
+@end
+
+@implementation PhiTextPositionTests
+
+- (void)setUp {
+	NSMutableString *text = [NSMutableString stringWithCapacity:100000];
+	PhiAATreeRange *range;
+	[super setUp];
+	while ([text length] < 100000)
+		[text appendString:@"The quick brown fox jumps over the lazy dog.\n"];
+	document = [[PhiTextDocument alloc] init];
+	document.layoutEngine = [[[PhiTextFixedAdvanceLayoutEngine alloc] init] autorelease];
+	document.store = [[[PhiTextStorage alloc] initWithString:text] autorelease];
+	textFrames = [[NSMutableArray alloc] init];
+	range = [document beginContentAccessInRect:CGRectMake(0.0, 0.0, 320.0, 4800.0)];
+	for (PhiTextFrame *textFrame in range)
+		[textFrames addObject:textFrame];
+}
+
+- (void)tearDown {
+	for (PhiTextFrame *textFrame in textFrames)
+		[textFrame endContentAccess];
+	[textFrames release];
+	[document release];
+	document = nil;
+	[super tearDown];
+}
+
+/*! Returns every line of the accessed frames. */
+- (NSArray *)lines {
+	NSMutableArray *rv = [NSMutableArray array];
+	NSUInteger i;
+	for (PhiTextFrame *textFrame in textFrames)
+		for (i = 0; i < [textFrame lineCount]; i++)
+			[rv addObject:[textFrame lineAtIndex:i]];
+	return rv;
+}
+
+- (void)testCopyHasNoLine {
+	PhiTextLine *line = [[self lines] objectAtIndex:0];
+	NSUInteger retainCount = [line retainCount];
+	PhiTextPosition *position = [PhiTextPosition textPositionWithPosition:PhiPositionOffset([line.textRange start]) inLine:line];
+	PhiTextPosition *copy = [[position copy] autorelease];
+	// The position keeps the frame and index of its line, not the line
+	STAssertEquals([line retainCount], retainCount, nil);
+	STAssertEquals([position.line frame], [line frame], nil);
+	STAssertEquals([position.line index], [line index], nil);
+	STAssertEqualObjects([position.line textRange], [line textRange], nil);
+	STAssertNil(copy.line, nil);
+	STAssertEqualObjects(copy, position, nil);
+	copy = [[[PhiTextPosition textPositionWithPosition:5] copy] autorelease];
+	STAssertEquals(copy.position, (NSUInteger)5, nil);
+}
+
+- (void)testLineIsDroppedWithContent {
+	PhiTextLine *line = [[self lines] objectAtIndex:0];
+	PhiTextPosition *position = [PhiTextPosition textPositionWithPosition:PhiPositionOffset([line.textRange start]) inLine:line];
+	STAssertNotNil(position.line, nil);
+	[[line frame] invalidateFrame];
+	STAssertNil(position.line, nil);
+	STAssertNil([[position textPositionWithOffset:1] line], nil);
+}
+
+- (void)testInvalidationOfManyPositions {
+	NSArray *lines = [self lines];
+	NSMutableArray *positions = [NSMutableArray arrayWithCapacity:PHI_POSITION_TEST_COUNT];
+	CFAbsoluteTime start, invalidationTime, validationTime;
+	PhiTextLine *line;
+	NSUInteger i, remaining = 0;
+
+	STAssertTrue([lines count] > 0, @"Nothing was laid out.");
+	for (i = 0; i < PHI_POSITION_TEST_COUNT; i++) {
+		line = [lines objectAtIndex:i % [lines count]];
+		[positions addObject:[PhiTextPosition textPositionWithPosition:PhiPositionOffset([line.textRange start]) + i % 10 inLine:line]];
+	}
+	// Invalidation costs the same however many positions are in the lines; they notice when asked for a line
+	start = CFAbsoluteTimeGetCurrent();
+	for (PhiTextFrame *textFrame in textFrames)
+		[textFrame invalidateFrame];
+	invalidationTime = CFAbsoluteTimeGetCurrent() - start;
+	start = CFAbsoluteTimeGetCurrent();
+	for (PhiTextPosition *position in positions)
+		if (position.line)
+			remaining++;
+	validationTime = CFAbsoluteTimeGetCurrent() - start;
+	STAssertEquals(remaining, (NSUInteger)0, @"Positions kept lines of invalidated frames.");
+	NSLog(@"Invalidated %u frames under %u positions in %.3f ms; validated the positions in %.3f ms.",
+		  [textFrames count], PHI_POSITION_TEST_COUNT, 1000.0 * invalidationTime, 1000.0 * validationTime);
+}
+
+@end
@@ -0,0 +1,230 @@
+//
+//  PhiTextSearchTests.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "PhiTextSearch.h"
+#import "PhiTextStorage.h"
+
+/*! Longest time (in seconds) that a test waits for a background search to finish. */
+#define PHI_SEARCH_TEST_TIMEOUT 30.0
+/*! Seed of the random text; define it as a logged seed to repeat a failing run. */
+#ifndef PHI_SEARCH_TEST_SEED
+#define PHI_SEARCH_TEST_SEED ((uint32_t)time(NULL))
+#endif
+
+@interface PhiTextSearchTests : SenTestCase <PhiTextSearchDelegate> {
+	PhiTextStorage *store;
+	PhiTextSearch *search;
+	NSMutableArray *found;
+	BOOL finished;
+	uint32_t seed;
+}
+
+@end
+
+/*! Returns the ranges of the non-overlapping occurrences of pattern in string, as found by Foundation. */
+static NSArray *PhiReferenceRanges(NSString *string, NSString *pattern, NSStringCompareOptions options) {
+	NSMutableArray *rv = [NSMutableArray array];
+	NSRange range = NSMakeRange(0, [string length]), match;
+	while (range.length) {
+		match = [string rangeOfString:pattern options:options | NSLiteralSearch range:range];
+		if (match.location == NSNotFound)
+			break;
+		[rv addObject:[NSValue valueWithRange:match]];
+		range = NSMakeRange(NSMaxRange(match), [string length] - NSMaxRange(match));
+	}
+	return rv;
+}
+
+static NSArray *PhiRangesArray(const NSRange *ranges, NSUInteger count) {
+	NSMutableArray *rv = [NSMutableArray arrayWithCapacity:count];
+	NSUInteger i;
+	for (i = 0; i < count; i++)
+		[rv addObject:[NSValue valueWithRange:ranges[i]]];
+	return rv;
+}
+
+@implementation PhiTextSearchTests
+
+/*! A linear congruential generator, rather than arc4random, so that a failing run can be repeated from its seed. */
+- (uint32_t)nextRandom {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/*! Returns a string of length characters drawn at random from alphabet. */
+- (NSString *)randomStringFromAlphabet:(NSString *)alphabet length:(NSUInteger)length {
+	NSMutableString *rv = [NSMutableString stringWithCapacity:length];
+	unichar c;
+	while (length--) {
+		c = [alphabet characterAtIndex:[self nextRandom] % [alphabet length]];
+		CFStringAppendCharacters((CFMutableStringRef)rv, &c, 1);
+	}
+	return rv;
+}
+
+- (void)setUp {
+	[super setUp];
+	seed = PHI_SEARCH_TEST_SEED;
+	NSLog(@"%@ uses the seed %u (define PHI_SEARCH_TEST_SEED as it to repeat the run).", [self name], seed);
+	store = [[PhiTextStorage alloc] initWithString:@""];
+	search = [[PhiTextSearch alloc] initWithStore:store];
+	found = [[NSMutableArray alloc] init];
+	finished = NO;
+}
+
+- (void)tearDown {
+	[search cancel];
+	[search release];
+	[store release];
+	[found release];
+	[super tearDown];
+}
+
+- (NSArray *)rangesOfString:(NSString *)pattern inString:(NSString *)string options:(PhiTextSearchOptions)options {
+	NSUInteger count = 0;
+	NSRange *ranges = [search copyRangesOfString:pattern inString:string options:options count:&count];
+	NSArray *rv = PhiRangesArray(ranges, count);
+	free(ranges);
+	return rv;
+}
+
+- (void)waitForSearch {
+	NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:PHI_SEARCH_TEST_TIMEOUT];
+	while (!finished && [timeout timeIntervalSinceNow] > 0.0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+	STAssertTrue(finished, @"Search didn't finish within %.0f seconds.", PHI_SEARCH_TEST_TIMEOUT);
+}
+
+- (void)textSearch:(PhiTextSearch *)aSearch didFindRanges:(const NSRange *)ranges count:(NSUInteger)count {
+	if ([found count] && count)
+		STAssertTrue(ranges[0].location >= NSMaxRange([[found lastObject] rangeValue]), @"Batches must be delivered in ascending order.");
+	[found addObjectsFromArray:PhiRangesArray(ranges, count)];
+}
+
+- (void)textSearchDidFinish:(PhiTextSearch *)aSearch {
+	finished = YES;
+}
+
+#pragma mark Literal Searches
+
+- (void)testMatchesDoNotOverlap {
+	NSArray *ranges = [self rangesOfString:@"aa" inString:@"aaaaa" options:0];
+	STAssertEquals([ranges count], (NSUInteger)2, nil);
+	STAssertEquals([[ranges objectAtIndex:0] rangeValue], NSMakeRange(0, 2), nil);
+	STAssertEquals([[ranges objectAtIndex:1] rangeValue], NSMakeRange(2, 2), nil);
+}
+
+- (void)testMatchesAtEveryLaneOfAWord {
+	NSString *string;
+	NSArray *ranges;
+	NSUInteger offset;
+	// The first code unit is looked for four at a time, so a match may start in any lane (or in the tail)
+	for (offset = 0; offset < 11; offset++) {
+		string = [[@"" stringByPaddingToLength:offset withString:@"-" startingAtIndex:0] stringByAppendingString:@"xyz--"];
+		ranges = [self rangesOfString:@"xyz" inString:string options:0];
+		STAssertEquals([ranges count], (NSUInteger)1, @"offset %u", offset);
+		STAssertEquals([[ranges lastObject] rangeValue], NSMakeRange(offset, 3), @"offset %u", offset);
+	}
+}
+
+- (void)testNoMatch {
+	STAssertEquals([[self rangesOfString:@"abd" inString:@"abcabcab" options:0] count], (NSUInteger)0, nil);
+	STAssertEquals([[self rangesOfString:@"abc" inString:@"" options:0] count], (NSUInteger)0, nil);
+	STAssertEquals([[self rangesOfString:@"" inString:@"abc" options:0] count], (NSUInteger)0, nil);
+}
+
+- (void)testCaseInsensitive {
+	NSArray *ranges = [self rangesOfString:@"ÄbC" inString:@"äbc ÄBC abc äBc" options:PhiTextSearchCaseInsensitive];
+	STAssertEquals([ranges count], (NSUInteger)3, nil);
+	STAssertEquals([[ranges objectAtIndex:2] rangeValue], NSMakeRange(12, 3), nil);
+	// The Kelvin sign folds to k, so k can't be looked for with the ASCII filter
+	ranges = [self rangesOfString:@"kg" inString:@"5 Kg, 6 KG" options:PhiTextSearchCaseInsensitive];
+	STAssertEquals([ranges count], (NSUInteger)2, nil);
+	STAssertEquals([[self rangesOfString:@"ÄbC" inString:@"äbc" options:0] count], (NSUInteger)0, nil);
+}
+
+- (void)testMatchesFoundationOnRandomText {
+	NSString *string = [self randomStringFromAlphabet:@"abABäÄ \n" length:100000];
+	NSString *pattern;
+	NSUInteger i;
+	for (i = 0; i < 20; i++) {
+		pattern = [self randomStringFromAlphabet:@"abABä" length:1 + i % 4];
+		STAssertEqualObjects([self rangesOfString:pattern inString:string options:0],
+							 PhiReferenceRanges(string, pattern, 0), @"pattern %@", pattern);
+		STAssertEqualObjects([self rangesOfString:pattern inString:string options:PhiTextSearchCaseInsensitive],
+							 PhiReferenceRanges(string, pattern, NSCaseInsensitiveSearch), @"caseless pattern %@", pattern);
+	}
+}
+
+- (void)testBackgroundSearch {
+	NSString *string = [self randomStringFromAlphabet:@"ab c\n" length:3 * PHI_SEARCH_BLOCK_LENGTH + 17];
+	[store setAttributedString:[[[NSAttributedString alloc] initWithString:string] autorelease]];
+	[search searchForString:@"ab" options:0 delegate:self];
+	[self waitForSearch];
+	STAssertEqualObjects(found, PhiReferenceRanges(string, @"ab", 0), nil);
+	STAssertFalse([search isSearching], nil);
+}
+
+- (void)testCancelledSearchDeliversNothing {
+	[store setAttributedString:[[[NSAttributedString alloc] initWithString:[self randomStringFromAlphabet:@"ab" length:100000]] autorelease]];
+	[search searchForString:@"ab" options:0 delegate:self];
+	[search cancel];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	STAssertEquals([found count], (NSUInteger)0, nil);
+	STAssertFalse(finished, nil);
+}
+
+#pragma mark Replace All
+
+- (void)testReplaceAll {
+	NSString *string = [self randomStringFromAlphabet:@"abc " length:10000];
+	NSUInteger expected = [PhiReferenceRanges(string, @"ab", 0) count];
+	[store setAttributedString:[[[NSAttributedString alloc] initWithString:string] autorelease]];
+	STAssertEquals([search replaceAllOccurrencesOfString:@"ab" withString:@"xyz" options:0], expected, nil);
+	STAssertEqualObjects([store string], [string stringByReplacingOccurrencesOfString:@"ab" withString:@"xyz"], nil);
+	STAssertEquals([search replaceAllOccurrencesOfString:@"xyz" withString:nil options:0], expected, nil);
+	STAssertEqualObjects([store string], [string stringByReplacingOccurrencesOfString:@"ab" withString:@""], nil);
+}
+
+#pragma mark Regular Expressions
+
+- (void)testRegularExpressionAcrossChunks {
+	// Long enough to be read in several chunks, with matches of every length straddling their ends
+	NSString *string = [self randomStringFromAlphabet:@"aab \n" length:2 * PHI_REGEX_CHUNK_LENGTH + 1000];
+	NSRegularExpression *regex = [NSRegularExpression regularExpressionWithPattern:@"a+b|^b" options:NSRegularExpressionAnchorsMatchLines error:NULL];
+	NSMutableArray *expected = [NSMutableArray array];
+	for (NSTextCheckingResult *match in [regex matchesInString:string options:0 range:NSMakeRange(0, [string length])])
+		[expected addObject:[NSValue valueWithRange:[match range]]];
+	[store setAttributedString:[[[NSAttributedString alloc] initWithString:string] autorelease]];
+	[search searchForRegularExpression:regex delegate:self];
+	[self waitForSearch];
+	STAssertEqualObjects(found, expected, nil);
+}
+
+- (void)testCancelledRegularExpressionDeliversNothing {
+	[store setAttributedString:[[[NSAttributedString alloc] initWithString:[self randomStringFromAlphabet:@"ab" length:3 * PHI_REGEX_CHUNK_LENGTH]] autorelease]];
+	[search searchForRegularExpression:[NSRegularExpression regularExpressionWithPattern:@"ab" options:0 error:NULL] delegate:self];
+	[search cancel];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	STAssertEquals([found count], (NSUInteger)0, nil);
+	STAssertFalse(finished, nil);
+}
+
+@end
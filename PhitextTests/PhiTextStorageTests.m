@@ -0,0 +1,139 @@
+//
+//  PhiTextStorageTests.m
+//  Phitext
+//
+// Copyright 2013 Corin Lawson
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "PhiTextStorage.h"
+
+/*! Stands in for the document: records the edits that the store reports, and keeps its undo actions. */
+@interface PhiTextStorageTestOwner : NSObject {
+@public
+	NSUndoManager *undoManager;
+	NSMutableArray *edits;
+	NSUInteger changes, pendingChanges;
+}
+
+@end
+
+@implementation PhiTextStorageTestOwner
+
+- (id)init {
+	if (self = [super init]) {
+		undoManager = [[NSUndoManager alloc] init];
+		[undoManager setGroupsByEvent:NO];
+		edits = [[NSMutableArray alloc] init];
+	}
+	return self;
+}
+- (NSUndoManager *)undoManager {
+	return undoManager;
+}
+- (void)textWillChange {
+	pendingChanges++;
+}
+- (void)textDidReplaceCharactersInRange:(NSRange)range withLength:(NSUInteger)length {
+	[edits addObject:[NSString stringWithFormat:@"%u,%u=%u", range.location, range.length, length]];
+}
+- (void)textDidChange {
+	pendingChanges--;
+	changes++;
+}
+- (CGRect)invalidateDocumentNSRange:(NSRange)range {
+	return CGRectNull;
+}
+- (void)invalidateDocument {
+}
+- (void)addDamageRect:(CGRect)rect {
+}
+- (void)dealloc {
+	[undoManager release];
+	[edits release];
+	[super dealloc];
+}
+
+@end
+
+@interface PhiTextStorageTests : SenTestCase {
+	PhiTextStorage *store;
+	PhiTextStorageTestOwner *owner;
+}
+
+@end
+
+@implementation PhiTextStorageTests
+
+- (void)setUp {
+	[super setUp];
+	owner = [[PhiTextStorageTestOwner alloc] init];
+	store = [[PhiTextStorage alloc] initWithString:@"ab-ab-ab"];
+	[store setOwner:owner];
+}
+
+- (void)tearDown {
+	[store release];
+	[owner release];
+	[super tearDown];
+}
+
+/*! Replaces ab with xyz throughout the text, as one undo group. */
+- (void)replaceAll {
+	NSRange ranges[] = {NSMakeRange(0, 2), NSMakeRange(3, 2), NSMakeRange(6, 2)};
+	[owner->undoManager beginUndoGrouping];
+	[store replaceCharactersInRanges:ranges count:3 withString:@"xyz"];
+	[owner->undoManager endUndoGrouping];
+}
+
+- (void)testReplaceAllReportsEachRange {
+	[self replaceAll];
+	STAssertEqualObjects([store string], @"xyz-xyz-xyz", nil);
+	STAssertEqualObjects(owner->edits, ([NSArray arrayWithObjects:@"6,2=3", @"3,2=3", @"0,2=3", nil]), nil);
+	STAssertEquals(owner->changes, (NSUInteger)1, nil);
+	STAssertEquals(owner->pendingChanges, (NSUInteger)0, nil);
+}
+
+- (void)testUndoOfReplaceAllReportsEachRange {
+	[self replaceAll];
+	[owner->edits removeAllObjects];
+	[owner->undoManager undo];
+	STAssertEqualObjects([store string], @"ab-ab-ab", nil);
+	// The replacements, where they were in the result, from the last
+	STAssertEqualObjects(owner->edits, ([NSArray arrayWithObjects:@"8,3=2", @"4,3=2", @"0,3=2", nil]), nil);
+	STAssertEquals(owner->changes, (NSUInteger)2, nil);
+	STAssertEquals(owner->pendingChanges, (NSUInteger)0, nil);
+
+	[owner->edits removeAllObjects];
+	[owner->undoManager redo];
+	STAssertEqualObjects([store string], @"xyz-xyz-xyz", nil);
+	STAssertEqualObjects(owner->edits, ([NSArray arrayWithObjects:@"6,2=3", @"3,2=3", @"0,2=3", nil]), nil);
+}
+
+- (void)testReplaceAllKeepsAttributesOfReplacedText {
+	NSMutableAttributedString *string = [[[NSMutableAttributedString alloc] initWithString:@"ab-ab-ab"] autorelease];
+	[string addAttribute:@"test" value:@"bold" range:NSMakeRange(3, 2)];
+	[store setOwner:nil];
+	[store setAttributedString:string];
+	[store setOwner:owner];
+	[self replaceAll];
+	STAssertEqualObjects([store attribute:@"test" atIndex:4 effectiveRange:NULL], @"bold", nil);
+	STAssertNil([store attribute:@"test" atIndex:0 effectiveRange:NULL], nil);
+	[owner->undoManager undo];
+	STAssertEqualObjects([store attributedString], string, nil);
+}
+
+@end